@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "arena.h"
+#include "hugemem.h"
+
+struct ArenaSlab {
+
+    ArenaSlab* next;
+    size_t size;
+    size_t used;
+    // Size of the mapping when the slab has a huge page to itself, 0 when malloc'd
+    size_t mapped;
+    char data[];
+
+};
+
+// Header in front of every block too big for a size class
+struct ArenaLargeBlock {
+
+    ArenaLargeBlock* prev;
+    ArenaLargeBlock* next;
+    size_t size;
+    size_t pad;
+
+};
+
+struct ArenaFreeBlock {
+
+    ArenaFreeBlock* next;
+
+};
+
+Arena* createArena() {
+
+    Arena* arena = calloc(1, sizeof(Arena));
+
+    if (!arena) {
+        fprintf(stderr, "calloc returned NULL pointer for Arena object\n");
+        exit(1);
+    }
+
+    arena->nextSlabSize = ARENA_FIRST_SLAB;
+
+    return arena;
+}
+
+// Frees every slab and large block at once
+void destroyArena(Arena* arena) {
+
+    if (!arena)
+        return;
+
+    ArenaSlab* slab = arena->slabs;
+
+    while (slab) {
+        ArenaSlab* next = slab->next;
+        largeFree(slab, slab->mapped);
+        slab = next;
+    }
+
+    ArenaLargeBlock* block = arena->large;
+
+    while (block) {
+        ArenaLargeBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+// Size class for a request, or -1 if it's a large block
+static int sizeClass(size_t bytes) {
+
+    size_t blockSize = ARENA_MIN_BLOCK;
+
+    for (int c = 0; c < ARENA_NUM_CLASSES; c++, blockSize <<= 1) {
+        if (bytes <= blockSize)
+            return c;
+    }
+
+    return -1;
+}
+
+// Bytes actually reserved for a request of this size
+size_t arenaBlockSize(size_t bytes) {
+
+    int c = sizeClass(bytes);
+
+    return c < 0 ? bytes : (size_t)ARENA_MIN_BLOCK << c;
+}
+
+// Bump allocate from the current slab, starting a bigger slab when it's full
+static void* slabAlloc(Arena* arena, size_t blockSize) {
+
+    ArenaSlab* slab = arena->slabs;
+
+    if (!slab || slab->used + blockSize > slab->size) {
+
+        size_t size = arena->nextSlabSize;
+
+        while (size < blockSize)
+            size <<= 1;
+
+        // Full size slabs fill a huge page of their own when large buffers are placed
+        size_t hugeSlab = largeSlabSize();
+        size_t mapped = 0;
+
+        if (hugeSlab && size >= ARENA_MAX_SLAB) {
+            if (sizeof(ArenaSlab) + size < hugeSlab)
+                size = hugeSlab - sizeof(ArenaSlab);
+
+            slab = largeAlloc(sizeof(ArenaSlab) + size, &mapped);
+        } else {
+            slab = malloc(sizeof(ArenaSlab) + size);
+        }
+
+        if (!slab) {
+            fprintf(stderr, "malloc returned NULL pointer for arena slab\n");
+            exit(1);
+        }
+
+        slab->size = size;
+        slab->mapped = mapped;
+        slab->used = 0;
+        slab->next = arena->slabs;
+        arena->slabs = slab;
+        arena->bytesReserved += sizeof(ArenaSlab) + size;
+
+        if (arena->nextSlabSize < ARENA_MAX_SLAB)
+            arena->nextSlabSize <<= 1;
+    }
+
+    void* ptr = slab->data + slab->used;
+    slab->used += blockSize;
+
+    return ptr;
+}
+
+// Returns an uninitialized block of at least bytes, NULL for a 0 byte request
+void* arenaAlloc(Arena* arena, size_t bytes) {
+
+    if (!bytes)
+        return NULL;
+
+    int c = sizeClass(bytes);
+
+    if (c < 0) {
+        ArenaLargeBlock* block = malloc(sizeof(ArenaLargeBlock) + bytes);
+
+        if (!block) {
+            fprintf(stderr, "malloc returned NULL pointer for arena block\n");
+            exit(1);
+        }
+
+        block->size = bytes;
+        block->prev = NULL;
+        block->next = arena->large;
+        if (arena->large)
+            arena->large->prev = block;
+        arena->large = block;
+
+        arena->bytesReserved += sizeof(ArenaLargeBlock) + bytes;
+        arena->bytesInUse += bytes;
+        arena->liveBlocks++;
+
+        return block + 1;
+    }
+
+    size_t blockSize = (size_t)ARENA_MIN_BLOCK << c;
+    void* ptr;
+
+    if (arena->freeLists[c]) {
+        ptr = arena->freeLists[c];
+        arena->freeLists[c] = arena->freeLists[c]->next;
+    } else {
+        ptr = slabAlloc(arena, blockSize);
+    }
+
+    arena->bytesInUse += blockSize;
+    arena->liveBlocks++;
+
+    return ptr;
+}
+
+// bytes must be the size the block was allocated (or last reallocated) with
+void arenaFree(Arena* arena, void* ptr, size_t bytes) {
+
+    if (!ptr)
+        return;
+
+    int c = sizeClass(bytes);
+
+    arena->liveBlocks--;
+
+    if (c < 0) {
+        ArenaLargeBlock* block = (ArenaLargeBlock*)ptr - 1;
+
+        if (block->prev)
+            block->prev->next = block->next;
+        else
+            arena->large = block->next;
+
+        if (block->next)
+            block->next->prev = block->prev;
+
+        arena->bytesReserved -= sizeof(ArenaLargeBlock) + block->size;
+        arena->bytesInUse -= block->size;
+        free(block);
+        return;
+    }
+
+    // Small blocks go back on their class's free list for reuse
+    ArenaFreeBlock* freeBlock = ptr;
+    freeBlock->next = arena->freeLists[c];
+    arena->freeLists[c] = freeBlock;
+
+    arena->bytesInUse -= (size_t)ARENA_MIN_BLOCK << c;
+}
+
+// Resize a block, blocks that stay in the same size class are returned as is
+void* arenaRealloc(Arena* arena, void* ptr, size_t oldBytes, size_t newBytes) {
+
+    if (!ptr)
+        return arenaAlloc(arena, newBytes);
+
+    if (!newBytes) {
+        arenaFree(arena, ptr, oldBytes);
+        return NULL;
+    }
+
+    int oldClass = sizeClass(oldBytes);
+
+    if (oldClass >= 0 && oldClass == sizeClass(newBytes))
+        return ptr;
+
+    void* newPtr = arenaAlloc(arena, newBytes);
+
+    memcpy(newPtr, ptr, oldBytes < newBytes ? oldBytes : newBytes);
+    arenaFree(arena, ptr, oldBytes);
+
+    return newPtr;
+}
+
+// Migrates the slabs that have a huge page to themselves to the calling thread's NUMA node
+void arenaMoveHere(Arena* arena) {
+
+    for (ArenaSlab* slab = arena->slabs; slab; slab = slab->next)
+        largeMoveHere(slab, slab->mapped);
+}
@@ -0,0 +1,43 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Per-table allocator for cell blocks. Small blocks come from size-classed
+   free lists carved out of slabs, larger ones are malloc'd and tracked so the
+   whole arena can be released in one call when the table is deleted. */
+
+#define ARENA_MIN_BLOCK 8
+#define ARENA_NUM_CLASSES 12
+#define ARENA_FIRST_SLAB 4096
+#define ARENA_MAX_SLAB (1 << 20)
+
+typedef struct ArenaSlab ArenaSlab;
+typedef struct ArenaLargeBlock ArenaLargeBlock;
+typedef struct ArenaFreeBlock ArenaFreeBlock;
+
+typedef struct {
+
+    ArenaSlab* slabs;
+    ArenaLargeBlock* large;
+    ArenaFreeBlock* freeLists[ARENA_NUM_CLASSES];
+    size_t nextSlabSize;
+
+    // Bytes taken from malloc (slabs + large blocks) and bytes currently handed out
+    size_t bytesReserved;
+    size_t bytesInUse;
+    size_t liveBlocks;
+
+} Arena;
+
+Arena* createArena();
+void destroyArena(Arena* arena);
+
+void* arenaAlloc(Arena* arena, size_t bytes);
+void* arenaRealloc(Arena* arena, void* ptr, size_t oldBytes, size_t newBytes);
+void arenaFree(Arena* arena, void* ptr, size_t bytes);
+
+size_t arenaBlockSize(size_t bytes);
+void arenaMoveHere(Arena* arena);
+
+#endif
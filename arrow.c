@@ -0,0 +1,927 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "arrow.h"
+#include "stats.h"
+#include "fileio.h"
+
+// Arrow buffers and flatbuffers are little endian, ours are written from memory as they are
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Arrow import and export expect a little endian host"
+#endif
+
+// Values from Arrow's Schema.fbs and Message.fbs
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOAT 3
+#define ARROW_PRECISION_SINGLE 1
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_BIG_ENDIAN 1
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+
+// Field numbers of the tables we write and read
+enum { MESSAGE_VERSION, MESSAGE_HEADER_TYPE, MESSAGE_HEADER, MESSAGE_BODY_LENGTH, MESSAGE_FIELDS };
+enum { SCHEMA_ENDIANNESS, SCHEMA_FIELDS, SCHEMA_FIELD_COUNT };
+enum { FIELD_NAME, FIELD_NULLABLE, FIELD_TYPE_TYPE, FIELD_TYPE, FIELD_DICTIONARY, FIELD_CHILDREN, FIELD_FIELDS };
+enum { INT_BIT_WIDTH, INT_IS_SIGNED, INT_FIELDS };
+enum { FLOAT_PRECISION, FLOAT_FIELDS };
+enum { BATCH_LENGTH, BATCH_NODES, BATCH_BUFFERS, BATCH_COMPRESSION, BATCH_FIELDS };
+enum { FOOTER_VERSION, FOOTER_SCHEMA, FOOTER_DICTIONARIES, FOOTER_RECORD_BATCHES, FOOTER_FIELDS };
+
+#define FB_MAX_FIELDS 8
+
+// How each column type is described in a schema, types without an entry can't be exported
+static const struct {
+
+    unsigned char typeId;
+    int bitWidth;
+    int precision;
+
+} arrow_types[DATA_TYPE_COUNT] = {
+    [INT_TYPE] = {ARROW_TYPE_INT, 32, 0},
+    [FLOAT_TYPE] = {ARROW_TYPE_FLOAT, 0, ARROW_PRECISION_SINGLE},
+    [DOUBLE_TYPE] = {ARROW_TYPE_FLOAT, 0, ARROW_PRECISION_DOUBLE},
+};
+
+// Structs that Message.fbs and File.fbs lay out inline in vectors
+typedef struct {
+
+    int64_t length;
+    int64_t nullCount;
+
+} ArrowFieldNode;
+
+typedef struct {
+
+    int64_t offset;
+    int64_t length;
+
+} ArrowBuffer;
+
+typedef struct {
+
+    int64_t offset;
+    int32_t metaDataLength;
+    int32_t pad;
+    int64_t bodyLength;
+
+} ArrowBlock;
+
+static size_t alignUp(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+/* ---- Flatbuffer builder ----
+
+   Builds front to back: a table is written before what it points to, and its
+   offset fields are filled in with fbLink once the target is down. Flatbuffer
+   offsets only have to point forward, and vtables can sit anywhere, so each
+   table's vtable goes right in front of it */
+
+typedef struct {
+
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+
+} FlatBuilder;
+
+// A table field: size 0 leaves it out, offset fields are 4 byte placeholders for fbLink
+typedef struct {
+
+    unsigned char size;
+    uint64_t value;
+
+} FbField;
+
+static size_t fbGrow(FlatBuilder* b, size_t bytes) {
+
+    if (b->size + bytes > b->capacity) {
+
+        size_t capacity = b->capacity ? b->capacity * 2 : 1024;
+
+        while (capacity < b->size + bytes)
+            capacity *= 2;
+
+        unsigned char* data = realloc(b->data, capacity);
+
+        if (!data) {
+            fprintf(stderr, "realloc returned NULL pointer for Arrow metadata\n");
+            exit(1);
+        }
+
+        b->data = data;
+        b->capacity = capacity;
+    }
+
+    size_t pos = b->size;
+
+    memset(b->data + pos, 0, bytes);
+    b->size += bytes;
+
+    return pos;
+}
+
+static void fbPad(FlatBuilder* b, size_t align) {
+
+    if (b->size % align)
+        fbGrow(b, align - b->size % align);
+}
+
+static void fbLink(FlatBuilder* b, size_t at, size_t target) {
+
+    uint32_t offset = target - at;
+
+    memcpy(b->data + at, &offset, sizeof(offset));
+}
+
+/* Writes a table's vtable and then the table, the fields largest first so each one
+   is aligned. pos[i] gets where field i went. Returns where the table starts */
+static size_t fbTable(FlatBuilder* b, const FbField* fields, size_t numFields, size_t* pos) {
+
+    uint16_t offsets[FB_MAX_FIELDS] = {0};
+    size_t inlineSize = 4;
+
+    for (size_t width = 8; width; width >>= 1) {
+        for (size_t i = 0; i < numFields; i++) {
+            if (fields[i].size == width) {
+                inlineSize = alignUp(inlineSize, width);
+                offsets[i] = inlineSize;
+                inlineSize += width;
+            }
+        }
+    }
+
+    fbPad(b, 2);
+
+    size_t vtable = fbGrow(b, 4 + 2 * numFields);
+    uint16_t header[2] = {4 + 2 * numFields, inlineSize};
+
+    memcpy(b->data + vtable, header, sizeof(header));
+    memcpy(b->data + vtable + 4, offsets, 2 * numFields);
+
+    fbPad(b, 8);
+
+    size_t table = fbGrow(b, alignUp(inlineSize, 8));
+    int32_t toVtable = table - vtable;
+
+    memcpy(b->data + table, &toVtable, sizeof(toVtable));
+
+    for (size_t i = 0; i < numFields; i++) {
+        if (fields[i].size) {
+            memcpy(b->data + table + offsets[i], &fields[i].value, fields[i].size);
+            if (pos)
+                pos[i] = table + offsets[i];
+        }
+    }
+
+    return table;
+}
+
+// Starts a vector of count elements, aligned for them. Returns where its length is, the elements follow
+static size_t fbVector(FlatBuilder* b, size_t count, size_t elemSize, size_t align) {
+
+    while ((b->size + 4) % align)
+        fbGrow(b, 1);
+
+    size_t vector = fbGrow(b, 4 + count * elemSize);
+    uint32_t length = count;
+
+    memcpy(b->data + vector, &length, sizeof(length));
+
+    return vector;
+}
+
+static size_t fbString(FlatBuilder* b, const char* text) {
+
+    size_t length = strlen(text);
+    size_t string = fbVector(b, length + 1, 1, 4);
+    uint32_t count = length;
+
+    // The length leaves out the terminating NUL
+    memcpy(b->data + string, &count, sizeof(count));
+    memcpy(b->data + string + 4, text, length);
+
+    return string;
+}
+
+// Starts a flatbuffer, its first 4 bytes are the offset to the root table
+static void fbStart(FlatBuilder* b) {
+
+    b->size = 0;
+    fbGrow(b, 4);
+}
+
+/* ---- Export ---- */
+
+// Writes the schema table with a field per stored column, returns where it starts
+static size_t buildSchema(FlatBuilder* b, const Database* db) {
+
+    size_t pos[FB_MAX_FIELDS];
+    FbField schema[SCHEMA_FIELD_COUNT] = {[SCHEMA_FIELDS] = {4, 0}};
+
+    size_t table = fbTable(b, schema, SCHEMA_FIELD_COUNT, pos);
+    size_t fields = fbVector(b, db->numCols, 4, 4);
+
+    fbLink(b, pos[SCHEMA_FIELDS], fields);
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        const Column* column = &db->cols[col];
+        size_t fieldPos[FB_MAX_FIELDS];
+        FbField field[FIELD_FIELDS] = {
+            [FIELD_NAME] = {4, 0},
+            [FIELD_NULLABLE] = {1, 1},
+            [FIELD_TYPE_TYPE] = {1, arrow_types[column->type].typeId},
+            [FIELD_TYPE] = {4, 0},
+            [FIELD_CHILDREN] = {4, 0}
+        };
+
+        size_t fieldTable = fbTable(b, field, FIELD_FIELDS, fieldPos);
+        fbLink(b, fields + 4 + 4 * col, fieldTable);
+
+        fbLink(b, fieldPos[FIELD_NAME], fbString(b, column->colName));
+
+        size_t typeTable;
+
+        if (arrow_types[column->type].typeId == ARROW_TYPE_INT) {
+            FbField type[INT_FIELDS] = {{4, arrow_types[column->type].bitWidth}, {1, 1}};
+            typeTable = fbTable(b, type, INT_FIELDS, NULL);
+        } else {
+            FbField type[FLOAT_FIELDS] = {{2, arrow_types[column->type].precision}};
+            typeTable = fbTable(b, type, FLOAT_FIELDS, NULL);
+        }
+
+        fbLink(b, fieldPos[FIELD_TYPE], typeTable);
+
+        // Readers expect the children vector even when it's empty
+        fbLink(b, fieldPos[FIELD_CHILDREN], fbVector(b, 0, 4, 4));
+    }
+
+    return table;
+}
+
+// Starts a message flatbuffer, returns where its header offset goes
+static size_t buildMessage(FlatBuilder* b, unsigned char headerType, size_t bodyLength) {
+
+    size_t pos[FB_MAX_FIELDS];
+    FbField message[MESSAGE_FIELDS] = {
+        [MESSAGE_VERSION] = {2, ARROW_METADATA_V5},
+        [MESSAGE_HEADER_TYPE] = {1, headerType},
+        [MESSAGE_HEADER] = {4, 0},
+        [MESSAGE_BODY_LENGTH] = {8, bodyLength}
+    };
+
+    fbStart(b);
+    fbLink(b, 0, fbTable(b, message, MESSAGE_FIELDS, pos));
+
+    return pos[MESSAGE_HEADER];
+}
+
+typedef struct {
+
+    IoFile* file;
+    // Bytes written so far, the footer's blocks point at file offsets
+    size_t offset;
+    int failed;
+
+} ArrowWriter;
+
+static void writeBytes(ArrowWriter* w, const void* data, size_t size) {
+
+    if (!w->failed && ioWrite(w->file, data, size) < 0)
+        w->failed = 1;
+
+    w->offset += size;
+}
+
+// Writes the continuation marker, the metadata length and the metadata padded to 8, returns the bytes written
+static size_t writeMessageMetadata(ArrowWriter* w, FlatBuilder* meta) {
+
+    fbPad(meta, ARROW_ALIGN);
+
+    uint32_t prefix[2] = {ARROW_CONTINUATION, meta->size};
+
+    writeBytes(w, prefix, sizeof(prefix));
+    writeBytes(w, meta->data, meta->size);
+
+    return sizeof(prefix) + meta->size;
+}
+
+/* Writes rows [firstRow, firstRow + count) as a record batch. Each column's validity
+   (when it has NULLs here) and values are gathered into body, 8 byte aligned */
+static ArrowBlock writeRecordBatch(ArrowWriter* w, FlatBuilder* meta, Database* db, size_t firstRow, size_t count,
+    unsigned char* body) {
+
+    ArrowFieldNode nodes[db->numCols];
+    ArrowBuffer buffers[2 * db->numCols];
+    size_t bodyLength = 0;
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        const TypeOps* ops = typeOps(db->cols[col].type);
+        uint64_t* validity = (uint64_t*)(body + bodyLength);
+        size_t nulls = db->cols[col].nullCount ? gatherValidity(db, col, firstRow, count, validity) : 0;
+
+        nodes[col] = (ArrowFieldNode){count, nulls};
+
+        // A column without NULLs in the batch leaves its validity buffer empty
+        buffers[2 * col] = (ArrowBuffer){bodyLength, nulls ? (count + 7) / 8 : 0};
+        if (nulls)
+            bodyLength += VALIDITY_WORDS(count) * sizeof(uint64_t);
+
+        ops->gather(db->rows + firstRow, col, count, body + bodyLength);
+
+        buffers[2 * col + 1] = (ArrowBuffer){bodyLength, count * ops->width};
+        bodyLength += alignUp(count * ops->width, ARROW_ALIGN);
+    }
+
+    size_t pos[FB_MAX_FIELDS];
+    size_t header = buildMessage(meta, ARROW_HEADER_RECORD_BATCH, bodyLength);
+    FbField batch[BATCH_FIELDS] = {[BATCH_LENGTH] = {8, count}, [BATCH_NODES] = {4, 0}, [BATCH_BUFFERS] = {4, 0}};
+
+    size_t table = fbTable(meta, batch, BATCH_FIELDS, pos);
+    fbLink(meta, header, table);
+
+    size_t vector = fbVector(meta, db->numCols, sizeof(ArrowFieldNode), 8);
+    memcpy(meta->data + vector + 4, nodes, sizeof(nodes));
+    fbLink(meta, pos[BATCH_NODES], vector);
+
+    vector = fbVector(meta, 2 * db->numCols, sizeof(ArrowBuffer), 8);
+    memcpy(meta->data + vector + 4, buffers, sizeof(buffers));
+    fbLink(meta, pos[BATCH_BUFFERS], vector);
+
+    ArrowBlock block = {w->offset, 0, 0, bodyLength};
+
+    block.metaDataLength = writeMessageMetadata(w, meta);
+    writeBytes(w, body, bodyLength);
+
+    return block;
+}
+
+/* Saves the stored columns of db as an Arrow file or stream.
+   Returns 0, or -1 if the file can't be written or a column has no Arrow type */
+int saveDatabaseToArrow(Database* db, const char* fileName, ArrowFormat format) {
+
+    if (!db->numCols) {
+        fprintf(stderr, "Error: %s has no columns to save\n", db->dbName);
+        return -1;
+    }
+
+    for (size_t col = 0; col < db->numCols; col++) {
+        if (!arrow_types[db->cols[col].type].typeId) {
+            fprintf(stderr, "Column %s has no Arrow type\n", db->cols[col].colName);
+            return -1;
+        }
+    }
+
+    ArrowWriter w = {ioOpenWrite(fileName), 0, 0};
+
+    if (!w.file) {
+        fprintf(stderr, "Unable to create file: %s\n", fileName);
+        return -1;
+    }
+
+    STATS_BEGIN();
+
+    size_t batchRows = db->numRows < ARROW_BATCH_ROWS ? db->numRows : ARROW_BATCH_ROWS;
+    size_t numBatches = (db->numRows + ARROW_BATCH_ROWS - 1) / ARROW_BATCH_ROWS;
+
+    // Room for every column's validity and values in the biggest batch
+    unsigned char* body = malloc(db->numCols * (VALIDITY_WORDS(batchRows) * sizeof(uint64_t) + batchRows * 8) + 1);
+    ArrowBlock* blocks = malloc((numBatches ? numBatches : 1) * sizeof(ArrowBlock));
+
+    if (!body || !blocks) {
+        fprintf(stderr, "malloc returned NULL pointer for Arrow batch\n");
+        exit(1);
+    }
+
+    FlatBuilder meta = {0};
+
+    if (format == ARROW_FILE) {
+        char magic[8] = ARROW_MAGIC;
+        writeBytes(&w, magic, sizeof(magic));
+    }
+
+    size_t header = buildMessage(&meta, ARROW_HEADER_SCHEMA, 0);
+    fbLink(&meta, header, buildSchema(&meta, db));
+    writeMessageMetadata(&w, &meta);
+
+    for (size_t b = 0; b < numBatches; b++) {
+
+        size_t firstRow = b * ARROW_BATCH_ROWS;
+        size_t count = db->numRows - firstRow < ARROW_BATCH_ROWS ? db->numRows - firstRow : ARROW_BATCH_ROWS;
+
+        blocks[b] = writeRecordBatch(&w, &meta, db, firstRow, count, body);
+        STATS_ADD(STAT_COUNTER_ROWS_SCANNED, count);
+    }
+
+    uint32_t endOfStream[2] = {ARROW_CONTINUATION, 0};
+    writeBytes(&w, endOfStream, sizeof(endOfStream));
+
+    // The footer repeats the schema and says where each batch is
+    if (format == ARROW_FILE) {
+
+        size_t pos[FB_MAX_FIELDS];
+        FbField footer[FOOTER_FIELDS] = {
+            [FOOTER_VERSION] = {2, ARROW_METADATA_V5},
+            [FOOTER_SCHEMA] = {4, 0},
+            [FOOTER_DICTIONARIES] = {4, 0},
+            [FOOTER_RECORD_BATCHES] = {4, 0}
+        };
+
+        fbStart(&meta);
+        fbLink(&meta, 0, fbTable(&meta, footer, FOOTER_FIELDS, pos));
+        fbLink(&meta, pos[FOOTER_SCHEMA], buildSchema(&meta, db));
+        fbLink(&meta, pos[FOOTER_DICTIONARIES], fbVector(&meta, 0, sizeof(ArrowBlock), 8));
+
+        size_t vector = fbVector(&meta, numBatches, sizeof(ArrowBlock), 8);
+        memcpy(meta.data + vector + 4, blocks, numBatches * sizeof(ArrowBlock));
+        fbLink(&meta, pos[FOOTER_RECORD_BATCHES], vector);
+
+        int32_t footerLength = meta.size;
+
+        writeBytes(&w, meta.data, meta.size);
+        writeBytes(&w, &footerLength, sizeof(footerLength));
+        writeBytes(&w, ARROW_MAGIC, strlen(ARROW_MAGIC));
+    }
+
+    free(meta.data);
+    free(blocks);
+    free(body);
+
+    if ((ioClose(w.file) < 0) | w.failed) {
+        fprintf(stderr, "Error writing file: %s\n", fileName);
+        return -1;
+    }
+
+    STATS_END(STAT_SAVE_ARROW);
+
+    return 0;
+}
+
+/* ---- Flatbuffer reader ----
+
+   Every read is checked against the flatbuffer's size, a file that points
+   outside it sets bad and reads as zeros */
+
+typedef struct {
+
+    const unsigned char* data;
+    size_t size;
+    int bad;
+
+} FlatBuffer;
+
+static uint64_t fbRead(FlatBuffer* fb, size_t pos, size_t bytes) {
+
+    uint64_t value = 0;
+
+    if (pos > fb->size || bytes > fb->size - pos) {
+        fb->bad = 1;
+        return 0;
+    }
+
+    memcpy(&value, fb->data + pos, bytes);
+
+    return value;
+}
+
+// Follows the offset stored at pos
+static size_t fbDeref(FlatBuffer* fb, size_t pos) {
+
+    size_t target = pos + (uint32_t)fbRead(fb, pos, 4);
+
+    if (target >= fb->size)
+        fb->bad = 1;
+
+    return fb->bad ? 0 : target;
+}
+
+// Where field index of the table is, 0 when the table leaves it out
+static size_t fbField(FlatBuffer* fb, size_t table, size_t index) {
+
+    size_t vtable = table - (int32_t)fbRead(fb, table, 4);
+    size_t vtableSize = fbRead(fb, vtable, 2);
+
+    if (fb->bad || 4 + 2 * index + 2 > vtableSize)
+        return 0;
+
+    size_t offset = fbRead(fb, vtable + 4 + 2 * index, 2);
+
+    return offset && !fb->bad ? table + offset : 0;
+}
+
+static uint64_t fbScalar(FlatBuffer* fb, size_t table, size_t index, size_t bytes, uint64_t defaultValue) {
+
+    size_t pos = fbField(fb, table, index);
+
+    return pos ? fbRead(fb, pos, bytes) : defaultValue;
+}
+
+// The table or vector an offset field points at, 0 when it's left out
+static size_t fbRef(FlatBuffer* fb, size_t table, size_t index) {
+
+    size_t pos = fbField(fb, table, index);
+
+    return pos ? fbDeref(fb, pos) : 0;
+}
+
+// Elements of a vector field of elemSize bytes each, returns where they start and their count in *count
+static size_t fbVectorField(FlatBuffer* fb, size_t table, size_t index, size_t elemSize, size_t* count) {
+
+    size_t vector = fbRef(fb, table, index);
+
+    *count = vector ? fbRead(fb, vector, 4) : 0;
+
+    if (*count && (*count > fb->size / elemSize || vector + 4 + *count * elemSize > fb->size)) {
+        fb->bad = 1;
+        *count = 0;
+    }
+
+    return vector + 4;
+}
+
+/* ---- Import ---- */
+
+typedef struct {
+
+    const unsigned char* map;
+    size_t size;
+    const char* sourceName;
+
+} ArrowSource;
+
+/* Reads the message at *offset into meta and moves *offset past its metadata to its body.
+   Returns 0, 1 at the end of the stream and -1 if it runs past the file */
+static int readMessage(const ArrowSource* src, size_t* offset, FlatBuffer* meta, size_t* message) {
+
+    uint32_t length;
+
+    if (*offset + 4 > src->size)
+        return -1;
+
+    memcpy(&length, src->map + *offset, 4);
+    *offset += 4;
+
+    // Writers before the continuation marker put the length first
+    if (length == ARROW_CONTINUATION) {
+
+        if (*offset + 4 > src->size)
+            return -1;
+
+        memcpy(&length, src->map + *offset, 4);
+        *offset += 4;
+    }
+
+    if (!length)
+        return 1;
+
+    if (length > src->size - *offset)
+        return -1;
+
+    *meta = (FlatBuffer){src->map + *offset, length, 0};
+    *offset += length;
+    *message = fbDeref(meta, 0);
+
+    return meta->bad ? -1 : 0;
+}
+
+// Creates the table's columns from a schema. Returns NULL after printing why it can't be read
+static Database* createFromSchema(FlatBuffer* fb, size_t schema, const char* dbName, const char* sourceName) {
+
+    size_t numFields;
+    size_t fields = fbVectorField(fb, schema, SCHEMA_FIELDS, 4, &numFields);
+
+    if (fbScalar(fb, schema, SCHEMA_ENDIANNESS, 2, 0) == ARROW_BIG_ENDIAN) {
+        fprintf(stderr, "Error: %s is big endian\n", sourceName);
+        return NULL;
+    }
+
+    if (fb->bad || !numFields) {
+        fprintf(stderr, "Error: bad schema in %s\n", sourceName);
+        return NULL;
+    }
+
+    DataTypes* types = malloc(numFields * sizeof(DataTypes));
+    char (*names)[STRING_LEN] = malloc(numFields * STRING_LEN);
+    Database* db = NULL;
+    size_t i;
+
+    if (!types || !names) {
+        fprintf(stderr, "malloc returned NULL pointer for Arrow schema\n");
+        exit(1);
+    }
+
+    for (i = 0; i < numFields; i++) {
+
+        size_t field = fbDeref(fb, fields + 4 * i);
+        size_t nameLength;
+        size_t name = fbVectorField(fb, field, FIELD_NAME, 1, &nameLength);
+        size_t type = fbRef(fb, field, FIELD_TYPE);
+        size_t typeId = fbScalar(fb, field, FIELD_TYPE_TYPE, 1, 0);
+        int found = 0;
+
+        if (nameLength >= STRING_LEN)
+            nameLength = STRING_LEN - 1;
+
+        if (nameLength)
+            memcpy(names[i], fb->data + name, nameLength);
+        else
+            nameLength = snprintf(names[i], STRING_LEN, "col%zu", i);
+
+        names[i][nameLength] = '\0';
+
+        for (int t = 0; t < DATA_TYPE_COUNT && !fb->bad && type; t++) {
+
+            if (arrow_types[t].typeId != typeId)
+                continue;
+
+            if (typeId == ARROW_TYPE_INT)
+                found = fbScalar(fb, type, INT_BIT_WIDTH, 4, 0) == (uint64_t)arrow_types[t].bitWidth
+                    && fbScalar(fb, type, INT_IS_SIGNED, 1, 0);
+            else
+                found = fbScalar(fb, type, FLOAT_PRECISION, 2, 0) == (uint64_t)arrow_types[t].precision;
+
+            if (found) {
+                types[i] = t;
+                break;
+            }
+        }
+
+        if (fb->bad) {
+            fprintf(stderr, "Error: bad schema in %s\n", sourceName);
+            break;
+        }
+
+        if (!found || fbField(fb, field, FIELD_DICTIONARY)) {
+            fprintf(stderr, "Error: column %s of %s isn't int32, float32 or float64\n", names[i], sourceName);
+            break;
+        }
+    }
+
+    // Every field has a type we store
+    if (i == numFields) {
+
+        db = createDatabase(dbName);
+
+        for (i = 0; i < numFields; i++)
+            createColumn(db, names[i], types[i]);
+    }
+
+    free(types);
+    free(names);
+
+    return db;
+}
+
+/* Appends a record batch whose body is at body in the mapping. Buffers are used where
+   they lie unless they're misaligned or too short to read whole words from, then they're
+   copied. Returns the rows added or -1 if the batch doesn't fit the schema or the body */
+static long appendRecordBatch(Database* db, FlatBuffer* fb, size_t batch, const unsigned char* body,
+    size_t bodyLength) {
+
+    size_t numNodes, numBuffers;
+    size_t nodes = fbVectorField(fb, batch, BATCH_NODES, sizeof(ArrowFieldNode), &numNodes);
+    size_t buffers = fbVectorField(fb, batch, BATCH_BUFFERS, sizeof(ArrowBuffer), &numBuffers);
+    uint64_t length = fbScalar(fb, batch, BATCH_LENGTH, 8, 0);
+
+    if (batch && fbField(fb, batch, BATCH_COMPRESSION)) {
+        fprintf(stderr, "Error: compressed record batches aren't supported\n");
+        return -1;
+    }
+
+    if (!batch || fb->bad || numNodes != db->numCols
+        || numBuffers != 2 * db->numCols || length > bodyLength * 8)
+        return -1;
+
+    const void* columns[db->numCols];
+    const uint64_t* validity[db->numCols];
+    void* copies[2 * db->numCols];
+    int hasNulls = 0;
+    long result = length;
+
+    memset(copies, 0, sizeof(copies));
+
+    for (size_t col = 0; col < db->numCols && result >= 0; col++) {
+
+        ArrowFieldNode node;
+        ArrowBuffer bits, values;
+        size_t width = typeOps(db->cols[col].type)->width;
+
+        memcpy(&node, fb->data + nodes + col * sizeof(node), sizeof(node));
+        memcpy(&bits, fb->data + buffers + 2 * col * sizeof(bits), sizeof(bits));
+        memcpy(&values, fb->data + buffers + (2 * col + 1) * sizeof(values), sizeof(values));
+
+        if ((uint64_t)node.length != length || node.nullCount < 0 || (uint64_t)node.nullCount > length
+            || bits.offset < 0 || bits.length < 0 || (uint64_t)bits.offset > bodyLength
+            || (uint64_t)bits.length > bodyLength - bits.offset || values.offset < 0
+            || (uint64_t)values.offset > bodyLength || (uint64_t)values.length > bodyLength - values.offset
+            || (uint64_t)values.length < length * width || (node.nullCount && (uint64_t)bits.length < (length + 7) / 8)) {
+            result = -1;
+            break;
+        }
+
+        columns[col] = body + values.offset;
+        validity[col] = NULL;
+
+        if ((uintptr_t)columns[col] % width) {
+            copies[2 * col] = malloc(length * width + 1);
+            if (!copies[2 * col]) {
+                fprintf(stderr, "malloc returned NULL pointer for Arrow column\n");
+                exit(1);
+            }
+            memcpy(copies[2 * col], columns[col], length * width);
+            columns[col] = copies[2 * col];
+        }
+
+        if (!node.nullCount)
+            continue;
+
+        hasNulls = 1;
+        validity[col] = (const uint64_t*)(body + bits.offset);
+
+        if ((uintptr_t)validity[col] % sizeof(uint64_t) || (uint64_t)bits.length < VALIDITY_WORDS(length) * 8) {
+            copies[2 * col + 1] = calloc(VALIDITY_WORDS(length) + 1, sizeof(uint64_t));
+            if (!copies[2 * col + 1]) {
+                fprintf(stderr, "calloc returned NULL pointer for Arrow validity\n");
+                exit(1);
+            }
+            memcpy(copies[2 * col + 1], body + bits.offset, (length + 7) / 8);
+            validity[col] = copies[2 * col + 1];
+        }
+    }
+
+    if (result > 0) {
+        BulkBatch bulk = {COLUMN_MAJOR, length, db->numCols, NULL, NULL, columns, hasNulls ? validity : NULL};
+        if (appendRows(db, &bulk) < 0)
+            result = -1;
+    }
+
+    for (size_t i = 0; i < 2 * db->numCols; i++)
+        free(copies[i]);
+
+    return result;
+}
+
+// An Arrow file: the footer has the schema and where each batch is
+static Database* readArrowFile(const ArrowSource* src, const char* dbName) {
+
+    int32_t footerLength;
+    size_t magicLength = strlen(ARROW_MAGIC);
+
+    memcpy(&footerLength, src->map + src->size - magicLength - 4, 4);
+
+    if (footerLength <= 0 || (size_t)footerLength > src->size - magicLength - 4 - 8) {
+        fprintf(stderr, "Error: %s is truncated or corrupt\n", src->sourceName);
+        return NULL;
+    }
+
+    FlatBuffer fb = {src->map + src->size - magicLength - 4 - footerLength, footerLength, 0};
+    size_t footer = fbDeref(&fb, 0);
+    size_t schema = footer ? fbRef(&fb, footer, FOOTER_SCHEMA) : 0;
+
+    if (!schema) {
+        fprintf(stderr, "Error: %s is truncated or corrupt\n", src->sourceName);
+        return NULL;
+    }
+
+    Database* db = createFromSchema(&fb, schema, dbName, src->sourceName);
+
+    if (!db)
+        return NULL;
+
+    size_t numBlocks;
+    size_t blocks = fbVectorField(&fb, footer, FOOTER_RECORD_BATCHES, sizeof(ArrowBlock), &numBlocks);
+
+    for (size_t i = 0; i < numBlocks && !fb.bad; i++) {
+
+        ArrowBlock block;
+        memcpy(&block, fb.data + blocks + i * sizeof(block), sizeof(block));
+
+        size_t offset = block.offset;
+        FlatBuffer meta;
+        size_t message;
+
+        // The body starts metaDataLength after the block, which may be past the end of the metadata
+        if (block.offset < 0 || block.metaDataLength <= 0 || block.bodyLength < 0
+            || (uint64_t)block.offset > src->size || readMessage(src, &offset, &meta, &message) != 0
+            || offset > (size_t)block.offset + block.metaDataLength
+            || (offset = block.offset + block.metaDataLength) > src->size
+            || (uint64_t)block.bodyLength > src->size - offset
+            || fbScalar(&meta, message, MESSAGE_HEADER_TYPE, 1, 0) != ARROW_HEADER_RECORD_BATCH
+            || appendRecordBatch(db, &meta, fbRef(&meta, message, MESSAGE_HEADER), src->map + offset,
+                block.bodyLength) < 0) {
+            fb.bad = 1;
+        }
+    }
+
+    if (fb.bad) {
+        fprintf(stderr, "Error: bad record batch in %s\n", src->sourceName);
+        deleteDatabase(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+// An Arrow stream: a schema message, then record batches up to the end marker or the end of the file
+static Database* readArrowStream(const ArrowSource* src, size_t offset, const char* dbName) {
+
+    FlatBuffer meta;
+    size_t message;
+
+    if (readMessage(src, &offset, &meta, &message) != 0
+        || fbScalar(&meta, message, MESSAGE_HEADER_TYPE, 1, 0) != ARROW_HEADER_SCHEMA || meta.bad) {
+        fprintf(stderr, "Error: %s is not an Arrow file or stream\n", src->sourceName);
+        return NULL;
+    }
+
+    Database* db = createFromSchema(&meta, fbRef(&meta, message, MESSAGE_HEADER), dbName, src->sourceName);
+    int status;
+
+    if (!db)
+        return NULL;
+
+    while (offset < src->size && (status = readMessage(src, &offset, &meta, &message)) != 1) {
+
+        uint64_t bodyLength = fbScalar(&meta, message, MESSAGE_BODY_LENGTH, 8, 0);
+        uint64_t type = fbScalar(&meta, message, MESSAGE_HEADER_TYPE, 1, 0);
+
+        if (status < 0 || meta.bad || bodyLength > src->size - offset || (type == ARROW_HEADER_RECORD_BATCH
+            && appendRecordBatch(db, &meta, fbRef(&meta, message, MESSAGE_HEADER), src->map + offset,
+                bodyLength) < 0)) {
+            fprintf(stderr, "Error: bad record batch in %s\n", src->sourceName);
+            deleteDatabase(db);
+            return NULL;
+        }
+
+        // Anything but a record batch (e.g. a dictionary for a column we'd have refused) is skipped
+        offset += bodyLength;
+    }
+
+    return db;
+}
+
+/* Loads an Arrow file or stream into a new table named dbName.
+   Returns NULL after printing why if it can't be read */
+Database* loadDatabaseFromArrow(const char* fileName, const char* dbName) {
+
+    int fd = open(fileName, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Unable to open file: %s\n", fileName);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    if (st.st_size < 8) {
+        fprintf(stderr, "Error: %s is not an Arrow file or stream\n", fileName);
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map file: %s\n", fileName);
+        return NULL;
+    }
+
+    STATS_BEGIN();
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    ArrowSource src = {map, st.st_size, fileName};
+    size_t magicLength = strlen(ARROW_MAGIC);
+    int fileMagic = memcmp(src.map, ARROW_MAGIC, magicLength) == 0;
+    Database* db;
+
+    // A file cut off before its footer still holds a stream after the 8 byte header
+    if (fileMagic && src.size >= 2 * magicLength + 8 + 4
+        && memcmp(src.map + src.size - magicLength, ARROW_MAGIC, magicLength) == 0)
+        db = readArrowFile(&src, dbName);
+    else
+        db = readArrowStream(&src, fileMagic ? 8 : 0, dbName);
+
+    munmap(map, st.st_size);
+
+    if (!db)
+        return NULL;
+
+    STATS_ADD(STAT_COUNTER_BYTES_READ, st.st_size);
+    STATS_ADD(STAT_COUNTER_ROWS_LOADED, db->numRows);
+    STATS_END(STAT_LOAD_ARROW);
+
+    return db;
+}
@@ -0,0 +1,36 @@
+#ifndef ARROW_H
+#define ARROW_H
+
+#include "database.h"
+
+/* Apache Arrow IPC import and export with nothing but this file: the flatbuffer
+   metadata is built and read by hand.
+
+   Export writes the stored columns as record batches of ARROW_BATCH_ROWS rows,
+   either as an Arrow file ("ARROW1", schema, batches, footer indexing them,
+   "ARROW1") that readers can map and seek in, or as a stream (schema, batches,
+   end marker) for pipes. INT, FLOAT and DOUBLE are int32, float32 and float64.
+   NULLs go in the validity bitmap, a set bit means the value is there (the same
+   convention and bit order as Column.validity); batches of a column without NULLs
+   leave it out. Buffers are little endian and 8 byte aligned.
+
+   Import maps the file and hands each batch's buffers to appendRows where they
+   lie in the mapping, so a load is one copy into the rows with no parsing. Both
+   formats are read. Dictionaries, compressed bodies, big endian data and any
+   other type are refused. */
+
+#define ARROW_MAGIC "ARROW1"
+#define ARROW_BATCH_ROWS (16 * BLOCK_ROWS)
+#define ARROW_ALIGN 8
+
+typedef enum {
+
+    ARROW_FILE,
+    ARROW_STREAM
+
+} ArrowFormat;
+
+int saveDatabaseToArrow(Database* db, const char* fileName, ArrowFormat format);
+Database* loadDatabaseFromArrow(const char* fileName, const char* dbName);
+
+#endif
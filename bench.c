@@ -0,0 +1,616 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "database.h"
+#include "database_list.h"
+#include "shard.h"
+#include "expr.h"
+#include "query.h"
+#include "bloom.h"
+
+/* Benchmarks for the core database operations. Results are written to stdout
+   as JSON so runs can be diffed, progress goes to stderr.
+
+   Usage: ./scdb_bench [--sizes 10000,1000000] [--full] [--seed N] */
+
+#define MAX_SIZES 8
+#define MAX_RESULTS 256
+#define MAX_SAMPLES 1000000
+#define BENCH_COLS 3
+#define LOOKUP_TABLES 1000
+#define SHARD_BENCH_BATCH 65536
+
+typedef struct {
+
+    char name[64];
+    size_t rows;
+    size_t ops;
+    uint64_t totalNs;
+
+    // Percentiles only exist for benchmarks that time each op, others only have the mean
+    int sampled;
+    uint64_t p50Ns;
+    uint64_t p90Ns;
+    uint64_t p99Ns;
+    uint64_t maxNs;
+
+} BenchResult;
+
+// Latencies for one benchmark, every op is timed until the buffer is full,
+// after that every stride-th op is recorded
+typedef struct {
+
+    uint64_t* samples;
+    size_t count;
+    size_t stride;
+    size_t seen;
+
+} Samples;
+
+static BenchResult results[MAX_RESULTS];
+static size_t resultCount = 0;
+static uint64_t rngState = 88172645463325252ull;
+
+// xorshift64, fast and good enough for synthetic data
+static uint64_t nextRandom() {
+
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+
+    return rngState;
+}
+
+static uint64_t nowNs() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void initSamples(Samples* s, size_t expectedOps) {
+
+    s->count = 0;
+    s->seen = 0;
+    s->stride = expectedOps / MAX_SAMPLES + 1;
+    s->samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+
+    if (!s->samples) {
+        fprintf(stderr, "malloc returned NULL pointer for benchmark samples\n");
+        exit(1);
+    }
+}
+
+static void addSample(Samples* s, uint64_t ns) {
+
+    if (s->seen++ % s->stride == 0 && s->count < MAX_SAMPLES)
+        s->samples[s->count++] = ns;
+}
+
+static int compareU64(const void* a, const void* b) {
+
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(Samples* s, double p) {
+
+    if (!s->count)
+        return 0;
+
+    size_t index = (size_t)(p * (s->count - 1) + 0.5);
+
+    return s->samples[index];
+}
+
+// Records a benchmark result, the samples are sorted and freed
+static void report(const char* name, size_t rows, size_t ops, uint64_t totalNs, Samples* s) {
+
+    if (resultCount == MAX_RESULTS)
+        return;
+
+    BenchResult* r = &results[resultCount++];
+
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->rows = rows;
+    r->ops = ops;
+    r->totalNs = totalNs;
+    r->sampled = s != NULL;
+
+    if (s) {
+        qsort(s->samples, s->count, sizeof(uint64_t), compareU64);
+        r->p50Ns = percentile(s, 0.50);
+        r->p90Ns = percentile(s, 0.90);
+        r->p99Ns = percentile(s, 0.99);
+        r->maxNs = s->count ? s->samples[s->count - 1] : 0;
+        free(s->samples);
+        s->samples = NULL;
+    }
+
+    fprintf(stderr, "%-24s rows=%-10zu ops=%-10zu %12.0f ops/s  ", name, rows, ops,
+        totalNs ? ops * 1e9 / totalNs : 0.0);
+
+    if (r->sampled)
+        fprintf(stderr, "p50=%lluns p99=%lluns\n", (unsigned long long)r->p50Ns, (unsigned long long)r->p99Ns);
+    else
+        fprintf(stderr, "mean=%.0fns\n", (double)totalNs / (ops ? ops : 1));
+}
+
+// Some operations print on every call, send stdout to /dev/null while they run
+static int savedStdout = -1;
+
+static void silenceStdout() {
+
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+}
+
+static void restoreStdout() {
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    savedStdout = -1;
+}
+
+// Synthetic table with an INT, a FLOAT and a DOUBLE column filled with random values
+static Database* generateTable(const char* name, size_t rows) {
+
+    Database* db = createDatabase(name);
+
+    createColumn(db, "id", INT_TYPE);
+    createColumn(db, "price", FLOAT_TYPE);
+    createColumn(db, "amount", DOUBLE_TYPE);
+
+    int* ids = malloc(rows * sizeof(int));
+    float* prices = malloc(rows * sizeof(float));
+    double* amounts = malloc(rows * sizeof(double));
+
+    if (!ids || !prices || !amounts) {
+        fprintf(stderr, "malloc returned NULL pointer for benchmark data\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < rows; i++) {
+        ids[i] = (int)i;
+        prices[i] = (float)(nextRandom() % 100000) / 100.0f;
+        amounts[i] = (double)(nextRandom() % 10000000) / 1000.0;
+    }
+
+    const void* columns[BENCH_COLS] = {ids, prices, amounts};
+    BulkBatch batch = {COLUMN_MAJOR, rows, BENCH_COLS, NULL, NULL, columns};
+
+    appendRows(db, &batch);
+
+    free(ids);
+    free(prices);
+    free(amounts);
+
+    return db;
+}
+
+static void benchCreateRow(size_t rows) {
+
+    Database* db = createDatabase("bench");
+    Samples s;
+
+    for (size_t c = 0; c < BENCH_COLS; c++)
+        createColumn(db, "c", INT_TYPE);
+
+    initSamples(&s, rows);
+
+    uint64_t start = nowNs();
+
+    for (size_t i = 0; i < rows; i++) {
+        uint64_t t = nowNs();
+        createRow(db);
+        addSample(&s, nowNs() - t);
+    }
+
+    report("createRow", rows, rows, nowNs() - start, &s);
+    deleteDatabase(db);
+}
+
+static void benchAppendRows(size_t rows) {
+
+    uint64_t start = nowNs();
+    Database* db = generateTable("bench", rows);
+
+    report("appendRows (bulk)", rows, rows, nowNs() - start, NULL);
+    deleteDatabase(db);
+}
+
+// Ingest through a sharded table in batches, then a fanned out aggregate over it
+static void benchSharded(size_t rows, size_t numShards) {
+
+    Database* empty = generateTable("bench", 0);
+    ShardedTable* table = shardDatabase(empty, 0, numShards);
+    Database* source = generateTable("source", rows);
+    DataValues* values = malloc(SHARD_BENCH_BATCH * BENCH_COLS * sizeof(DataValues));
+    char name[64];
+
+    if (!values) {
+        fprintf(stderr, "malloc returned NULL pointer for benchmark data\n");
+        exit(1);
+    }
+
+    deleteDatabase(empty);
+
+    uint64_t start = nowNs();
+
+    for (size_t from = 0; from < rows; from += SHARD_BENCH_BATCH) {
+
+        size_t n = rows - from < SHARD_BENCH_BATCH ? rows - from : SHARD_BENCH_BATCH;
+
+        for (size_t r = 0; r < n; r++) {
+            for (size_t c = 0; c < BENCH_COLS; c++)
+                values[r * BENCH_COLS + c] = source->rows[from + r].cells[c].value;
+        }
+
+        BulkBatch batch = {ROW_MAJOR, n, BENCH_COLS, NULL, values, NULL};
+        shardAppendRows(table, &batch);
+    }
+
+    // Waits for the workers to finish the queued batches
+    shardNumRows(table);
+
+    snprintf(name, sizeof(name), "shardAppendRows (%zu shards)", numShards);
+    report(name, rows, rows, nowNs() - start, NULL);
+
+    AggregateResult result;
+
+    start = nowNs();
+    shardAggregate(table, AGG_SUM, 2, NULL, 0, &result);
+
+    snprintf(name, sizeof(name), "shardAggregate sum (%zu shards)", numShards);
+    report(name, rows, 1, nowNs() - start, NULL);
+
+    free(values);
+    deleteDatabase(source);
+    deleteShardedTable(table);
+}
+
+// Adding a column touches every row, so this measures growth of existing rows
+static void benchCreateColumn(size_t rows) {
+
+    Database* db = generateTable("bench", rows);
+    size_t ops = 8;
+    Samples s;
+
+    initSamples(&s, ops);
+
+    uint64_t start = nowNs();
+
+    for (size_t i = 0; i < ops; i++) {
+        uint64_t t = nowNs();
+        createColumn(db, "extra", DOUBLE_TYPE);
+        addSample(&s, nowNs() - t);
+    }
+
+    report("createColumn", rows, ops, nowNs() - start, &s);
+    deleteDatabase(db);
+}
+
+static void benchDeleteRow(size_t rows) {
+
+    Database* db = generateTable("bench", rows);
+    size_t ops = rows < 1000 ? rows : 1000;
+    Samples s;
+
+    if (rows > 1000000)
+        ops = 100;
+
+    initSamples(&s, ops);
+    silenceStdout();
+
+    uint64_t start = nowNs();
+
+    for (size_t i = 0; i < ops; i++) {
+        size_t index = nextRandom() % db->numRows;
+        uint64_t t = nowNs();
+        deleteRow(db, index);
+        addSample(&s, nowNs() - t);
+    }
+
+    uint64_t total = nowNs() - start;
+
+    restoreStdout();
+    report("deleteRow", rows, ops, total, &s);
+    deleteDatabase(db);
+}
+
+static void benchDeleteColumn(size_t rows) {
+
+    Database* db = generateTable("bench", rows);
+    Samples s;
+
+    initSamples(&s, BENCH_COLS);
+
+    uint64_t start = nowNs();
+
+    for (size_t i = 0; i < BENCH_COLS; i++) {
+        uint64_t t = nowNs();
+        deleteColumn(db, 0);
+        addSample(&s, nowNs() - t);
+    }
+
+    report("deleteColumn", rows, BENCH_COLS, nowNs() - start, &s);
+    deleteDatabase(db);
+}
+
+// Random cell writes through addInt/addFloat/addDouble
+static void benchAddValues(size_t rows) {
+
+    Database* db = generateTable("bench", rows);
+    const char* names[BENCH_COLS] = {"addInt", "addFloat", "addDouble"};
+
+    for (size_t col = 0; col < BENCH_COLS; col++) {
+
+        Samples s;
+        initSamples(&s, rows);
+
+        uint64_t start = nowNs();
+
+        for (size_t i = 0; i < rows; i++) {
+            size_t row = nextRandom() % rows;
+            uint64_t t = nowNs();
+
+            if (col == 0)
+                addInt(db, row, col, (int)i);
+            else if (col == 1)
+                addFloat(db, row, col, (float)i);
+            else
+                addDouble(db, row, col, (double)i);
+
+            addSample(&s, nowNs() - t);
+        }
+
+        report(names[col], rows, rows, nowNs() - start, &s);
+    }
+
+    deleteDatabase(db);
+}
+
+// Set-based update of a whole column from an expression, on one thread and on one per CPU
+static void benchUpdateExpr(size_t rows) {
+
+    Database* db = generateTable("bench", rows);
+    ExprProgram prog;
+    char name[64];
+
+    if (compileExpr(db, "price * 1.1 + amount / 2 - id", &prog) < 0) {
+        fprintf(stderr, "Unable to compile the benchmark expression\n");
+        exit(1);
+    }
+
+    size_t threadCounts[] = {1, 0};
+
+    for (size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); i++) {
+
+        uint64_t start = nowNs();
+        updateColumnExpr(db, 2, &prog, NULL, 0, threadCounts[i]);
+
+        snprintf(name, sizeof(name), "updateColumnExpr (%s)", threadCounts[i] ? "1 thread" : "all CPUs");
+        report(name, rows, rows, nowNs() - start, NULL);
+    }
+
+    deleteDatabase(db);
+}
+
+// Needle lookups (amount = a value one row has) by full scan, then with a Bloom filter on amount
+static void benchEqualityLookup(size_t rows) {
+
+    Database* db = generateTable("bench", rows);
+    size_t lookups = rows >= 1000000 ? 20 : 100;
+
+    for (int bloom = 0; bloom <= 1; bloom++) {
+
+        if (bloom)
+            addBloomFilter(db, 2);
+
+        uint64_t start = nowNs();
+
+        for (size_t i = 0; i < lookups; i++) {
+
+            Predicate pred = {2, PRED_EQ, db->rows[nextRandom() % rows].cells[2].value};
+            AggregateResult result;
+
+            aggregateColumn(db, AGG_COUNT, 0, &pred, 1, &result);
+        }
+
+        report(bloom ? "lookup = (bloom)" : "lookup = (scan)", rows, lookups, nowNs() - start, NULL);
+    }
+
+    deleteDatabase(db);
+}
+
+static void benchCSV(size_t rows) {
+
+    Database* db = generateTable("bench", rows);
+    size_t reps = rows >= 1000000 ? 3 : 10;
+    char fileName[FILE_NAME_LEN];
+    const char* dir = getenv("TMPDIR");
+
+    snprintf(fileName, sizeof(fileName), "%s/scdb-bench-%d.csv", dir ? dir : "/tmp", (int)getpid());
+
+    Samples save;
+    Samples load;
+
+    initSamples(&save, reps);
+    initSamples(&load, reps);
+
+    uint64_t saveTotal = 0;
+    uint64_t loadTotal = 0;
+
+    for (size_t i = 0; i < reps; i++) {
+
+        uint64_t t = nowNs();
+        saveDatabaseToCSV(db, fileName);
+        uint64_t elapsed = nowNs() - t;
+
+        saveTotal += elapsed;
+        addSample(&save, elapsed);
+
+        t = nowNs();
+        Database* loaded = loadDatabaseFromCSV(fileName);
+        elapsed = nowNs() - t;
+
+        loadTotal += elapsed;
+        addSample(&load, elapsed);
+        deleteDatabase(loaded);
+    }
+
+    unlink(fileName);
+
+    report("saveDatabaseToCSV", rows, reps, saveTotal, &save);
+    report("loadDatabaseFromCSV", rows, reps, loadTotal, &load);
+    deleteDatabase(db);
+}
+
+static void benchPrint(size_t rows) {
+
+    Database* db = generateTable("bench", rows);
+    size_t reps = rows >= 1000000 ? 1 : 5;
+    Samples s;
+
+    initSamples(&s, reps);
+    silenceStdout();
+
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < reps; i++) {
+        uint64_t t = nowNs();
+        printDatabase(db);
+        fflush(stdout);
+        uint64_t elapsed = nowNs() - t;
+
+        total += elapsed;
+        addSample(&s, elapsed);
+    }
+
+    restoreStdout();
+    report("printDatabase", rows, reps, total, &s);
+    deleteDatabase(db);
+}
+
+static void benchFindDatabase() {
+
+    DatabaseList* dbl = createDatabaseList(0);
+    char name[STRING_LEN];
+    size_t ops = 1000000;
+    Samples s;
+
+    silenceStdout();
+
+    for (size_t i = 0; i < LOOKUP_TABLES; i++) {
+        snprintf(name, sizeof(name), "table_%zu", i);
+        addDatabaseToList(createDatabase(name), dbl);
+    }
+
+    restoreStdout();
+    initSamples(&s, ops);
+
+    uint64_t start = nowNs();
+
+    for (size_t i = 0; i < ops; i++) {
+        snprintf(name, sizeof(name), "table_%zu", (size_t)(nextRandom() % LOOKUP_TABLES));
+        uint64_t t = nowNs();
+        findDatabaseInList(dbl, name);
+        addSample(&s, nowNs() - t);
+    }
+
+    report("findDatabaseInList", LOOKUP_TABLES, ops, nowNs() - start, &s);
+    deleteDatabaseList(dbl);
+}
+
+static void printResults(size_t* sizes, size_t numSizes) {
+
+    printf("{\n  \"benchmark\": \"scdb\",\n  \"timestamp\": %lld,\n  \"sizes\": [", (long long)time(NULL));
+
+    for (size_t i = 0; i < numSizes; i++)
+        printf("%s%zu", i ? ", " : "", sizes[i]);
+
+    printf("],\n  \"results\": [\n");
+
+    for (size_t i = 0; i < resultCount; i++) {
+        BenchResult* r = &results[i];
+
+        printf("    {\"name\": \"%s\", \"rows\": %zu, \"ops\": %zu, \"total_ns\": %llu, \"ops_per_sec\": %.1f, "
+            "\"mean_ns\": %.1f, ", r->name, r->rows, r->ops, (unsigned long long)r->totalNs,
+            r->totalNs ? r->ops * 1e9 / r->totalNs : 0.0, (double)r->totalNs / (r->ops ? r->ops : 1));
+
+        // Benchmarks timed as a whole have no latency distribution, null rather than the mean again
+        if (r->sampled)
+            printf("\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}",
+                (unsigned long long)r->p50Ns, (unsigned long long)r->p90Ns, (unsigned long long)r->p99Ns,
+                (unsigned long long)r->maxNs);
+        else
+            printf("\"p50_ns\": null, \"p90_ns\": null, \"p99_ns\": null, \"max_ns\": null}");
+
+        printf("%s\n", i + 1 < resultCount ? "," : "");
+    }
+
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+
+    size_t sizes[MAX_SIZES] = {10000, 1000000};
+    size_t numSizes = 2;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--full") == 0) {
+            sizes[0] = 10000;
+            sizes[1] = 1000000;
+            sizes[2] = 10000000;
+            numSizes = 3;
+        } else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            numSizes = 0;
+            for (char* tok = strtok(argv[++i], ","); tok && numSizes < MAX_SIZES; tok = strtok(NULL, ","))
+                sizes[numSizes++] = strtoull(tok, NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            rngState = strtoull(argv[++i], NULL, 10) | 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--sizes 10000,1000000] [--full] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < numSizes; i++) {
+
+        size_t rows = sizes[i];
+
+        if (!rows)
+            continue;
+
+        benchCreateRow(rows);
+        benchAppendRows(rows);
+        benchSharded(rows, 1);
+        benchSharded(rows, 4);
+        benchCreateColumn(rows);
+        benchDeleteRow(rows);
+        benchDeleteColumn(rows);
+        benchAddValues(rows);
+        benchUpdateExpr(rows);
+        benchEqualityLookup(rows);
+        benchCSV(rows);
+        benchPrint(rows);
+    }
+
+    benchFindDatabase();
+
+    printResults(sizes, numSizes);
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "bgsave.h"
+#include "database.h"
+
+/* Background saves work like Redis BGSAVE: we fork, and the child writes the
+   copy-on-write image of the Database it inherited while the parent keeps
+   serving commands. Only one background save runs at a time. */
+
+typedef struct {
+
+    size_t rowsWritten;
+    size_t totalRows;
+
+} SaveProgress;
+
+typedef struct {
+
+    int active;
+    pid_t pid;
+    int progressFd;
+    SaveProgress progress;
+    time_t startTime;
+    char dbName[STRING_LEN];
+    char fileName[STRING_LEN + 8];
+    char tmpName[STRING_LEN + 16];
+
+} BackgroundSave;
+
+static BackgroundSave bgSave = {0};
+
+// Runs in the child, sends the latest progress to the parent
+// The pipe is non-blocking, if the parent is not reading we just drop the update
+static void sendProgress(size_t rowsWritten, size_t totalRows, void* ctx) {
+
+    int fd = *(int*)ctx;
+    SaveProgress update = {rowsWritten, totalRows};
+
+    ssize_t written = write(fd, &update, sizeof(update));
+    (void)written;
+}
+
+// Forks a child that saves db to fileName, returns 0 if the save was started
+int startBackgroundSave(Database* db, const char* fileName) {
+
+    if (bgSave.active) {
+        printf("Background save of %s already in progress.\n", bgSave.dbName);
+        return -1;
+    }
+
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+        fprintf(stderr, "Unable to create progress pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    strncpy(bgSave.dbName, db->dbName, STRING_LEN);
+    bgSave.dbName[STRING_LEN - 1] = '\0';
+    snprintf(bgSave.fileName, sizeof(bgSave.fileName), "%s", fileName);
+    snprintf(bgSave.tmpName, sizeof(bgSave.tmpName), "%s.tmp", fileName);
+
+    // Anything still buffered would otherwise be printed twice
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        fprintf(stderr, "fork failed for background save: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Child: write to a temp file and rename it so a crash never leaves a half written file behind
+        close(fds[0]);
+
+        int status = saveDatabaseToCSVWithProgress(db, bgSave.tmpName, sendProgress, &fds[1]);
+
+        if (status == 0 && rename(bgSave.tmpName, bgSave.fileName) != 0)
+            status = -1;
+
+        if (status != 0)
+            unlink(bgSave.tmpName);
+
+        close(fds[1]);
+        _exit(status == 0 ? 0 : 1);
+    }
+
+    close(fds[1]);
+
+    bgSave.active = 1;
+    bgSave.pid = pid;
+    bgSave.progressFd = fds[0];
+    bgSave.progress.rowsWritten = 0;
+    bgSave.progress.totalRows = db->numRows;
+    bgSave.startTime = time(NULL);
+
+    printf("Background saving %s to %s started (pid %d).\n", bgSave.dbName, bgSave.fileName, (int)pid);
+
+    return 0;
+}
+
+int backgroundSaveActive() {
+    return bgSave.active;
+}
+
+// Drain the pipe, we only care about the most recent update
+static void readProgress() {
+
+    SaveProgress update;
+
+    while (read(bgSave.progressFd, &update, sizeof(update)) == sizeof(update)) {
+        bgSave.progress = update;
+    }
+}
+
+static void finishBackgroundSave(int status) {
+
+    readProgress();
+    close(bgSave.progressFd);
+    bgSave.active = 0;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("Background save of %s to %s completed (%zu rows, %lds).\n", bgSave.dbName, bgSave.fileName,
+            bgSave.progress.totalRows, (long)(time(NULL) - bgSave.startTime));
+    } else {
+        printf("Background save of %s to %s failed.\n", bgSave.dbName, bgSave.fileName);
+    }
+}
+
+// Non-blocking check on the child, reports once it has finished
+void pollBackgroundSave() {
+
+    if (!bgSave.active)
+        return;
+
+    int status;
+    pid_t result = waitpid(bgSave.pid, &status, WNOHANG);
+
+    if (result == 0) {
+        readProgress();
+        return;
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "Lost track of background save: %s\n", strerror(errno));
+        close(bgSave.progressFd);
+        bgSave.active = 0;
+        return;
+    }
+
+    finishBackgroundSave(status);
+}
+
+// Blocks until the running background save is done (used before exiting)
+void waitBackgroundSave() {
+
+    if (!bgSave.active)
+        return;
+
+    printf("Waiting for background save of %s to finish...\n", bgSave.dbName);
+
+    int status;
+
+    while (waitpid(bgSave.pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            close(bgSave.progressFd);
+            bgSave.active = 0;
+            return;
+        }
+    }
+
+    finishBackgroundSave(status);
+}
+
+void printBackgroundSaveStatus() {
+
+    pollBackgroundSave();
+
+    if (!bgSave.active) {
+        printf("No background save in progress.\n");
+        return;
+    }
+
+    double percent = 100.0;
+
+    if (bgSave.progress.totalRows)
+        percent = 100.0 * bgSave.progress.rowsWritten / bgSave.progress.totalRows;
+
+    printf("Background save of %s to %s: %zu/%zu rows (%.1f%%), running for %lds.\n", bgSave.dbName,
+        bgSave.fileName, bgSave.progress.rowsWritten, bgSave.progress.totalRows, percent,
+        (long)(time(NULL) - bgSave.startTime));
+}
@@ -0,0 +1,14 @@
+#ifndef BGSAVE_H
+#define BGSAVE_H
+
+#include <stdio.h>
+#include "database.h"
+
+int startBackgroundSave(Database* db, const char* fileName);
+int backgroundSaveActive();
+
+void pollBackgroundSave();
+void waitBackgroundSave();
+void printBackgroundSaveStatus();
+
+#endif
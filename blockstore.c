@@ -0,0 +1,423 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "blockstore.h"
+#include "database.h"
+#include "compress.h"
+#include "stats.h"
+
+#define STORE_IO_BUFFER (1 << 20)
+
+typedef struct {
+
+    uint64_t generation;
+    uint64_t dataId;
+    uint64_t numCols;
+    uint64_t numRows;
+    uint32_t blockRows;
+    uint64_t dataSize;
+    uint64_t garbage;
+    uint32_t* types;
+    char (*names)[STRING_LEN];
+    BlockRef* refs;
+
+} StoreManifest;
+
+static size_t numBlocks(uint64_t numRows) {
+    return (numRows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+}
+
+static void dataFileName(char* out, size_t size, const char* fileName, uint64_t dataId) {
+    snprintf(out, size, "%s.%llx.data", fileName, (unsigned long long)dataId);
+}
+
+// Unique enough id for a manifest or data file, time and pid mixed with a counter
+static uint64_t newId() {
+
+    static uint64_t counter = 0;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec) ^ ((uint64_t)getpid() << 40) ^ ++counter;
+}
+
+static void freeManifest(StoreManifest* m) {
+
+    free(m->types);
+    free(m->names);
+    free(m->refs);
+    memset(m, 0, sizeof(*m));
+}
+
+static void* allocOrDie(size_t size, const char* what) {
+
+    void* ptr = malloc(size ? size : 1);
+
+    if (!ptr) {
+        fprintf(stderr, "malloc returned NULL pointer for %s\n", what);
+        exit(1);
+    }
+
+    return ptr;
+}
+
+// Returns 0 and fills m if fileName holds a valid manifest, -1 otherwise
+static int readManifest(const char* fileName, StoreManifest* m) {
+
+    memset(m, 0, sizeof(*m));
+
+    FILE* file = fopen(fileName, "rb");
+
+    if (!file)
+        return -1;
+
+    char magic[4];
+    uint32_t version;
+    uint32_t reserved;
+
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, STORE_MAGIC, 4) != 0
+        || fread(&version, sizeof(version), 1, file) != 1 || version < 1 || version > STORE_VERSION
+        || fread(&m->generation, sizeof(uint64_t), 1, file) != 1
+        || fread(&m->dataId, sizeof(uint64_t), 1, file) != 1
+        || fread(&m->numCols, sizeof(uint64_t), 1, file) != 1
+        || fread(&m->numRows, sizeof(uint64_t), 1, file) != 1
+        || fread(&m->blockRows, sizeof(uint32_t), 1, file) != 1 || m->blockRows != BLOCK_ROWS
+        || fread(&reserved, sizeof(uint32_t), 1, file) != 1
+        || fread(&m->dataSize, sizeof(uint64_t), 1, file) != 1
+        || fread(&m->garbage, sizeof(uint64_t), 1, file) != 1) {
+        fclose(file);
+        return -1;
+    }
+
+    size_t refs = numBlocks(m->numRows) * m->numCols;
+
+    m->types = allocOrDie(m->numCols * sizeof(uint32_t), "manifest types");
+    m->names = allocOrDie(m->numCols * STRING_LEN, "manifest names");
+    m->refs = allocOrDie(refs * sizeof(BlockRef), "manifest blocks");
+
+    for (uint64_t col = 0; col < m->numCols; col++) {
+        if (fread(&m->types[col], sizeof(uint32_t), 1, file) != 1 || m->types[col] >= DATA_TYPE_COUNT
+            || fread(m->names[col], 1, STRING_LEN, file) != STRING_LEN) {
+            freeManifest(m);
+            fclose(file);
+            return -1;
+        }
+        m->names[col][STRING_LEN - 1] = '\0';
+    }
+
+    if (fread(m->refs, sizeof(BlockRef), refs, file) != refs) {
+        freeManifest(m);
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+// Write the manifest next to fileName, sync it and rename it into place
+static int commitManifest(Database* db, const char* fileName, const StoreManifest* m) {
+
+    char tmpName[FILENAME_MAX];
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName);
+
+    FILE* file = fopen(tmpName, "wb");
+
+    if (!file) {
+        fprintf(stderr, "Unable to create file: %s\n", tmpName);
+        return -1;
+    }
+
+    uint32_t version = STORE_VERSION;
+    uint32_t blockRows = BLOCK_ROWS;
+    uint32_t reserved = 0;
+
+    fwrite(STORE_MAGIC, 1, 4, file);
+    fwrite(&version, sizeof(version), 1, file);
+    fwrite(&m->generation, sizeof(uint64_t), 1, file);
+    fwrite(&m->dataId, sizeof(uint64_t), 1, file);
+    fwrite(&m->numCols, sizeof(uint64_t), 1, file);
+    fwrite(&m->numRows, sizeof(uint64_t), 1, file);
+    fwrite(&blockRows, sizeof(blockRows), 1, file);
+    fwrite(&reserved, sizeof(reserved), 1, file);
+    fwrite(&m->dataSize, sizeof(uint64_t), 1, file);
+    fwrite(&m->garbage, sizeof(uint64_t), 1, file);
+
+    for (size_t col = 0; col < db->numCols; col++) {
+        uint32_t type = db->cols[col].type;
+        fwrite(&type, sizeof(type), 1, file);
+        fwrite(db->cols[col].colName, 1, STRING_LEN, file);
+    }
+
+    fwrite(m->refs, sizeof(BlockRef), numBlocks(m->numRows) * m->numCols, file);
+
+    if (ferror(file) | (fflush(file) != 0) | (fsync(fileno(file)) != 0) | (fclose(file) != 0)) {
+        fprintf(stderr, "Error writing file: %s\n", tmpName);
+        unlink(tmpName);
+        return -1;
+    }
+
+    if (rename(tmpName, fileName) != 0) {
+        fprintf(stderr, "Unable to replace %s\n", fileName);
+        unlink(tmpName);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* One save attempt. old is the manifest on disk when its generation matches the
+   table's, then clean blocks are reused and dirty ones appended to its data file.
+   Returns 1 if an incremental save would leave too much garbage and a full rewrite
+   should be done instead, 0 on success and -1 on failure */
+static int writeStore(Database* db, const char* fileName, const StoreManifest* old, StoreSaveInfo* info) {
+
+    size_t blocks = numBlocks(db->numRows);
+    size_t oldBlocks = old ? numBlocks(old->numRows) : 0;
+    char dataName[FILENAME_MAX];
+
+    StoreManifest m = {0};
+    m.generation = newId();
+    m.dataId = old ? old->dataId : newId();
+    m.numCols = db->numCols;
+    m.numRows = db->numRows;
+    m.dataSize = old ? old->dataSize : 0;
+    m.garbage = old ? old->garbage : 0;
+    m.refs = allocOrDie(blocks * db->numCols * sizeof(BlockRef), "manifest blocks");
+
+    // Blocks past the new end are dead
+    for (size_t block = blocks; block < oldBlocks; block++) {
+        for (size_t col = 0; col < db->numCols; col++)
+            m.garbage += old->refs[block * db->numCols + col].size;
+    }
+
+    dataFileName(dataName, sizeof(dataName), fileName, m.dataId);
+
+    // Appends start at the end of the committed data, anything after it is from a save that never committed
+    FILE* data = fopen(dataName, old ? "r+b" : "wb");
+
+    if (!data || (old && fseeko(data, old->dataSize, SEEK_SET) != 0)) {
+        fprintf(stderr, "Unable to open file: %s\n", dataName);
+        if (data)
+            fclose(data);
+        free(m.refs);
+        return -1;
+    }
+
+    setvbuf(data, NULL, _IOFBF, STORE_IO_BUFFER);
+
+    void* column = allocOrDie(BLOCK_ROWS * sizeof(double), "store column");
+    uint64_t* validity = allocOrDie(VALIDITY_WORDS(BLOCK_ROWS) * sizeof(uint64_t), "store validity");
+    ByteBuffer buf;
+    initByteBuffer(&buf);
+
+    info->blocksWritten = 0;
+    info->blocksTotal = blocks * db->numCols;
+    info->bytesWritten = 0;
+    info->fullRewrite = !old;
+
+    for (size_t block = 0; block < blocks; block++) {
+
+        size_t first = block * BLOCK_ROWS;
+        size_t count = db->numRows - first < BLOCK_ROWS ? db->numRows - first : BLOCK_ROWS;
+
+        for (size_t col = 0; col < db->numCols; col++) {
+
+            BlockRef* ref = &m.refs[block * db->numCols + col];
+
+            if (old && block < oldBlocks && !isBlockDirty(db, block, col)) {
+                *ref = old->refs[block * db->numCols + col];
+                continue;
+            }
+
+            if (old && block < oldBlocks)
+                m.garbage += old->refs[block * db->numCols + col].size;
+
+            gatherColumn(db, col, first, count, column);
+
+            buf.size = 0;
+            compressBlock(db->cols[col].type, column, count, &buf);
+            ref->flags = 0;
+
+            if (gatherValidity(db, col, first, count, validity)) {
+                appendBytes(&buf, validity, VALIDITY_WORDS(count) * sizeof(uint64_t));
+                ref->flags = STORE_BLOCK_NULLS;
+            }
+
+            fwrite(buf.data, 1, buf.size, data);
+
+            ref->offset = m.dataSize;
+            ref->size = buf.size;
+
+            m.dataSize += buf.size;
+            info->blocksWritten++;
+            info->bytesWritten += buf.size;
+        }
+    }
+
+    freeByteBuffer(&buf);
+    free(validity);
+    free(column);
+
+    int result = 0;
+
+    if (old && m.garbage * 2 > m.dataSize) {
+        // Not committed, the appended bytes are ignored and the full rewrite starts a new data file
+        fclose(data);
+        result = 1;
+    } else if (ferror(data) | (fflush(data) != 0) | (fsync(fileno(data)) != 0) | (fclose(data) != 0)) {
+        fprintf(stderr, "Error writing file: %s\n", dataName);
+        result = -1;
+    } else if (commitManifest(db, fileName, &m) < 0) {
+        result = -1;
+    } else {
+        db->storeGeneration = m.generation;
+        clearDirty(db);
+    }
+
+    free(m.refs);
+
+    return result;
+}
+
+// Saves the table to a block store, rewriting only what changed since it was last saved there.
+// Returns 0 on success, -1 on failure
+int saveDatabaseToStore(Database* db, const char* fileName, StoreSaveInfo* info) {
+
+    STATS_BEGIN();
+
+    StoreManifest old;
+    int haveOld = readManifest(fileName, &old) == 0;
+
+    // Incremental only if the file still holds exactly what this table last saved
+    int incremental = haveOld && !db->allDirty && db->storeGeneration == old.generation
+        && old.numCols == db->numCols;
+
+    int result = writeStore(db, fileName, incremental ? &old : NULL, info);
+
+    if (result == 1)
+        result = writeStore(db, fileName, NULL, info);
+
+    // A full rewrite went to a new data file, the old one is no longer referenced
+    if (result == 0 && haveOld && info->fullRewrite) {
+        char dataName[FILENAME_MAX];
+        dataFileName(dataName, sizeof(dataName), fileName, old.dataId);
+        unlink(dataName);
+    }
+
+    if (haveOld)
+        freeManifest(&old);
+
+    STATS_END(STAT_SAVE_STORE);
+
+    return result;
+}
+
+Database* loadDatabaseFromStore(const char* fileName, const char* dbName) {
+
+    StoreManifest m;
+
+    if (readManifest(fileName, &m) < 0) {
+        fprintf(stderr, "Error: %s is not an SCDB block store\n", fileName);
+        return NULL;
+    }
+
+    char dataName[FILENAME_MAX];
+    dataFileName(dataName, sizeof(dataName), fileName, m.dataId);
+
+    FILE* data = fopen(dataName, "rb");
+
+    if (!data) {
+        fprintf(stderr, "Unable to open file: %s\n", dataName);
+        freeManifest(&m);
+        return NULL;
+    }
+
+    STATS_BEGIN();
+
+    setvbuf(data, NULL, _IOFBF, STORE_IO_BUFFER);
+
+    Database* db = createDatabase(dbName);
+
+    for (size_t col = 0; col < m.numCols; col++)
+        createColumn(db, m.names[col], m.types[col]);
+
+    reserveRows(db, m.numRows);
+
+    void** columns = allocOrDie(m.numCols * sizeof(void*), "store columns");
+
+    for (size_t col = 0; col < m.numCols; col++)
+        columns[col] = allocOrDie(BLOCK_ROWS * sizeof(double), "store column");
+
+    uint64_t* validity = allocOrDie(m.numCols * VALIDITY_WORDS(BLOCK_ROWS) * sizeof(uint64_t), "store validity");
+    const uint64_t** nullableCols = allocOrDie(m.numCols * sizeof(uint64_t*), "store validity");
+    uint8_t* scratch = NULL;
+    size_t scratchSize = 0;
+    BulkBatch batch = {COLUMN_MAJOR, 0, m.numCols, NULL, NULL, (const void* const*)columns, nullableCols};
+    int bad = 0;
+
+    for (size_t block = 0; block < numBlocks(m.numRows) && m.numCols && !bad; block++) {
+
+        batch.numRows = m.numRows - block * BLOCK_ROWS < BLOCK_ROWS ? m.numRows - block * BLOCK_ROWS : BLOCK_ROWS;
+
+        for (size_t col = 0; col < m.numCols && !bad; col++) {
+
+            BlockRef* ref = &m.refs[block * m.numCols + col];
+
+            if (ref->size > scratchSize) {
+                free(scratch);
+                scratch = allocOrDie(ref->size, "store block");
+                scratchSize = ref->size;
+            }
+
+            size_t validityBytes = ref->flags & STORE_BLOCK_NULLS ? VALIDITY_WORDS(batch.numRows) * sizeof(uint64_t) : 0;
+            uint64_t* bits = validity + col * VALIDITY_WORDS(BLOCK_ROWS);
+
+            bad = ref->offset + ref->size > m.dataSize || ref->size < validityBytes
+                || fseeko(data, ref->offset, SEEK_SET) != 0
+                || fread(scratch, 1, ref->size, data) != ref->size
+                || decompressBlock(scratch, ref->size - validityBytes, m.types[col], columns[col], BLOCK_ROWS)
+                    != (int)batch.numRows;
+
+            if (!bad && validityBytes)
+                memcpy(bits, scratch + ref->size - validityBytes, validityBytes);
+
+            nullableCols[col] = validityBytes ? bits : NULL;
+        }
+
+        if (!bad)
+            appendRows(db, &batch);
+    }
+
+    for (size_t col = 0; col < m.numCols; col++)
+        free(columns[col]);
+
+    free(columns);
+    free(validity);
+    free(nullableCols);
+    free(scratch);
+    fclose(data);
+
+    if (bad) {
+        fprintf(stderr, "Error: %s is truncated or corrupt\n", dataName);
+        deleteDatabase(db);
+        freeManifest(&m);
+        return NULL;
+    }
+
+    // The table matches the store, the next save only writes what changes from here
+    db->storeGeneration = m.generation;
+    clearDirty(db);
+
+    STATS_ADD(STAT_COUNTER_ROWS_LOADED, m.numRows);
+    STATS_END(STAT_LOAD_STORE);
+
+    freeManifest(&m);
+
+    return db;
+}
@@ -0,0 +1,53 @@
+#ifndef BLOCKSTORE_H
+#define BLOCKSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "database.h"
+
+/* Block store: a table saved as compressed (block, column) pieces in a data
+   file, plus a small manifest that says where each piece lives.
+
+   Saves are incremental. Only blocks the table has marked dirty since its last
+   save are compressed and appended to the data file, the rest keep pointing
+   at their old copies. The new manifest is written to "<file>.tmp", synced and
+   renamed over the old one, so a crash at any point leaves either the old or
+   the new table on disk, never a mix. Once more than half of the data file is
+   dead blocks the next save writes a fresh data file instead.
+
+   Manifest layout (native byte order):
+   "SCDM", uint32 version, uint64 generation, uint64 dataId, uint64 numCols,
+   uint64 numRows, uint32 blockRows, uint32 reserved, uint64 dataSize, uint64 garbageBytes,
+   numCols x (uint32 type, char name[STRING_LEN]),
+   numBlocks x numCols x BlockRef
+   The data file is "<file>.<dataId>.data". A piece is the compressed column block,
+   followed by the block's validity bitmap (VALIDITY_WORDS(rows) x uint64) when its
+   flags have STORE_BLOCK_NULLS. Version 1 stores have no NULLs */
+
+#define STORE_MAGIC "SCDM"
+#define STORE_VERSION 2
+
+#define STORE_BLOCK_NULLS 1
+
+typedef struct {
+
+    uint64_t offset;
+    uint32_t size;
+    uint32_t flags;
+
+} BlockRef;
+
+// What a save did, for reporting
+typedef struct {
+
+    size_t blocksWritten;
+    size_t blocksTotal;
+    size_t bytesWritten;
+    int fullRewrite;
+
+} StoreSaveInfo;
+
+int saveDatabaseToStore(Database* db, const char* fileName, StoreSaveInfo* info);
+Database* loadDatabaseFromStore(const char* fileName, const char* dbName);
+
+#endif
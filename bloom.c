@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bloom.h"
+
+#define BLOOM_LINES (BLOOM_BLOCK_WORDS / BLOOM_LINE_WORDS)
+
+// Picking the line and then 9 bits per hash in a 512 bit line has to fit in one 64 bit hash
+_Static_assert(BLOOM_LINE_WORDS * 64 == 512 && BLOOM_LINES <= 64 && 6 + 9 * BLOOM_HASHES <= 64,
+    "bloom hash bits don't fit");
+
+// NaN compares equal to every value, so it can't be looked up by its bits
+static int isNaN(const TypeOps* ops, DataValues value) {
+
+    double d = ops->toDouble(value);
+
+    return d != d;
+}
+
+static void growBloom(BloomFilter* bloom, size_t block) {
+
+    if (block < bloom->numBlocks)
+        return;
+
+    size_t blocks = bloom->numBlocks ? bloom->numBlocks : 16;
+
+    while (blocks <= block)
+        blocks *= 2;
+
+    uint64_t* words = realloc(bloom->words, blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+
+    if (!words) {
+        fprintf(stderr, "realloc returned NULL pointer for bloom filter\n");
+        exit(1);
+    }
+
+    memset(words + bloom->numBlocks * BLOOM_BLOCK_WORDS, 0,
+        (blocks - bloom->numBlocks) * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+
+    bloom->words = words;
+    bloom->numBlocks = blocks;
+}
+
+static void addToBlock(BloomFilter* bloom, const TypeOps* ops, size_t rowIndex, DataValues value) {
+
+    size_t block = rowIndex / BLOCK_ROWS;
+
+    growBloom(bloom, block);
+
+    uint64_t* words = bloom->words + block * BLOOM_BLOCK_WORDS;
+
+    // A block holding a NaN can match any value
+    if (isNaN(ops, value)) {
+        memset(words, 0xff, BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+        return;
+    }
+
+    uint64_t hash = mixBits(ops->hashBits(value));
+    uint64_t* line = words + (hash % BLOOM_LINES) * BLOOM_LINE_WORDS;
+
+    hash /= BLOOM_LINES;
+
+    for (int k = 0; k < BLOOM_HASHES; k++, hash >>= 9)
+        line[(hash & 511) / 64] |= 1ull << (hash & 63);
+}
+
+// Adds rows [builtRows, numRows) of the column
+static void buildBloom(Database* db, size_t col) {
+
+    BloomFilter* bloom = db->cols[col].bloom;
+    const TypeOps* ops = typeOps(db->cols[col].type);
+
+    if (db->numRows)
+        growBloom(bloom, (db->numRows - 1) / BLOCK_ROWS);
+
+    for (size_t r = bloom->builtRows; r < db->numRows; r++) {
+        if (!isCellNull(db, r, col))
+            addToBlock(bloom, ops, r, db->rows[r].cells[col].value);
+    }
+
+    bloom->builtRows = db->numRows;
+}
+
+/* Starts keeping a Bloom filter on a column, built from the rows already there.
+   Returns 0, 1 if the column already has one and -1 if it doesn't exist */
+int addBloomFilter(Database* db, size_t col) {
+
+    if (col >= db->numCols)
+        return -1;
+
+    if (db->cols[col].bloom)
+        return 1;
+
+    BloomFilter* bloom = calloc(1, sizeof(BloomFilter));
+
+    if (!bloom) {
+        fprintf(stderr, "calloc returned NULL pointer for BloomFilter\n");
+        exit(1);
+    }
+
+    db->cols[col].bloom = bloom;
+    buildBloom(db, col);
+
+    return 0;
+}
+
+/* Puts back a filter saved with the table: words holds numBlocks blocks covering every
+   row and is taken over. A filter that doesn't cover the table is built again instead.
+   Returns the same as addBloomFilter */
+int restoreBloomFilter(Database* db, size_t col, uint64_t* words, size_t numBlocks) {
+
+    if (col >= db->numCols || db->cols[col].bloom || !words || numBlocks * BLOCK_ROWS < db->numRows) {
+        free(words);
+        return addBloomFilter(db, col);
+    }
+
+    BloomFilter* bloom = calloc(1, sizeof(BloomFilter));
+
+    if (!bloom) {
+        fprintf(stderr, "calloc returned NULL pointer for BloomFilter\n");
+        exit(1);
+    }
+
+    bloom->words = words;
+    bloom->numBlocks = numBlocks;
+    bloom->builtRows = db->numRows;
+    db->cols[col].bloom = bloom;
+
+    return 0;
+}
+
+// Returns 0, or -1 if the column has no filter
+int dropBloomFilter(Database* db, size_t col) {
+
+    if (col >= db->numCols || !db->cols[col].bloom)
+        return -1;
+
+    freeBloomFilter(db->cols[col].bloom);
+    db->cols[col].bloom = NULL;
+
+    return 0;
+}
+
+void freeBloomFilter(BloomFilter* bloom) {
+
+    if (!bloom)
+        return;
+
+    free(bloom->words);
+    free(bloom);
+}
+
+size_t bloomFilterBytes(const Database* db) {
+
+    size_t bytes = 0;
+
+    for (size_t col = 0; col < db->numCols; col++) {
+        if (db->cols[col].bloom)
+            bytes += sizeof(BloomFilter) + db->cols[col].bloom->numBlocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    }
+
+    return bytes;
+}
+
+// A write to a row already in the filter, rows past builtRows are added when they're built
+void bloomAddValue(Database* db, size_t col, size_t rowIndex, DataValues value) {
+
+    BloomFilter* bloom = db->cols[col].bloom;
+
+    if (bloom && rowIndex < bloom->builtRows)
+        addToBlock(bloom, typeOps(db->cols[col].type), rowIndex, value);
+}
+
+// Rows from fromRow on moved or went away, their blocks are emptied and built again on the next sync
+void truncateBloomFilters(Database* db, size_t fromRow) {
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        BloomFilter* bloom = db->cols[col].bloom;
+
+        if (!bloom || bloom->builtRows <= fromRow)
+            continue;
+
+        size_t block = fromRow / BLOCK_ROWS;
+
+        memset(bloom->words + block * BLOOM_BLOCK_WORDS, 0,
+            (bloom->numBlocks - block) * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+        bloom->builtRows = block * BLOCK_ROWS;
+    }
+}
+
+// Adds every row that isn't in the filters yet: new rows, and rows moved by a delete
+void syncBloomFilters(Database* db) {
+
+    for (size_t col = 0; col < db->numCols; col++) {
+        if (db->cols[col].bloom && db->cols[col].bloom->builtRows != db->numRows)
+            buildBloom(db, col);
+    }
+}
+
+/* 0 if no row of block holds value in column col, 1 if one may. Blocks that
+   aren't built yet, and columns without a filter, may hold anything */
+int bloomMayContain(const Database* db, size_t col, size_t block, DataValues value) {
+
+    const BloomFilter* bloom = col < db->numCols ? db->cols[col].bloom : NULL;
+
+    if (!bloom || block >= bloom->numBlocks
+        || ((block + 1) * BLOCK_ROWS > bloom->builtRows && bloom->builtRows < db->numRows))
+        return 1;
+
+    const TypeOps* ops = typeOps(db->cols[col].type);
+
+    if (isNaN(ops, value))
+        return 1;
+
+    uint64_t hash = mixBits(ops->hashBits(value));
+    const uint64_t* line = bloom->words + block * BLOOM_BLOCK_WORDS + (hash % BLOOM_LINES) * BLOOM_LINE_WORDS;
+
+    hash /= BLOOM_LINES;
+
+    for (int k = 0; k < BLOOM_HASHES; k++, hash >>= 9) {
+        if (!((line[(hash & 511) / 64] >> (hash & 63)) & 1))
+            return 0;
+    }
+
+    return 1;
+}
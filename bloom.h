@@ -0,0 +1,50 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "database.h"
+
+/* Optional Bloom filters on chosen columns, one per BLOCK_ROWS block, so an
+   equality (or in) filter can skip the blocks that can't hold the value
+   without a full index.
+
+   The filters are blocked: a value hashes to one 64 byte line of its block's
+   filter and sets BLOOM_HASHES bits in it, so a probe touches one cache line.
+   At BLOOM_BITS_PER_ROW bits per row that's about 2-3% false positives.
+
+   Appends and writes add their values as they happen. Bloom filters can't
+   forget values, so a value that was overwritten only costs a false positive.
+   Removing rows moves the ones after it, so the blocks from there on are
+   rebuilt by syncBloomFilters before the next scan. NULLs are never added,
+   they don't match = or in */
+
+#define BLOOM_BITS_PER_ROW 8
+#define BLOOM_BLOCK_WORDS (BLOCK_ROWS * BLOOM_BITS_PER_ROW / 64)
+#define BLOOM_LINE_WORDS 8
+#define BLOOM_HASHES 6
+
+typedef struct BloomFilter {
+
+    // BLOOM_BLOCK_WORDS per block, for numBlocks blocks
+    uint64_t* words;
+    size_t numBlocks;
+
+    // Rows [0, builtRows) are in the filter
+    size_t builtRows;
+
+} BloomFilter;
+
+int addBloomFilter(Database* db, size_t col);
+int restoreBloomFilter(Database* db, size_t col, uint64_t* words, size_t numBlocks);
+int dropBloomFilter(Database* db, size_t col);
+void freeBloomFilter(BloomFilter* bloom);
+size_t bloomFilterBytes(const Database* db);
+
+void bloomAddValue(Database* db, size_t col, size_t rowIndex, DataValues value);
+void truncateBloomFilters(Database* db, size_t fromRow);
+void syncBloomFilters(Database* db);
+
+int bloomMayContain(const Database* db, size_t col, size_t block, DataValues value);
+
+#endif
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "cache.h"
+#include "stats.h"
+
+typedef struct CacheEntry {
+
+    char* key;
+    uint64_t hash;
+    CacheStamp stamp;
+    void* value;
+    size_t size;
+    size_t bytes;
+
+    struct CacheEntry* nextInBucket;
+
+    // Recency list, newest first
+    struct CacheEntry* prev;
+    struct CacheEntry* next;
+
+} CacheEntry;
+
+typedef struct {
+
+    CacheEntry** buckets;
+    size_t numBuckets;
+    size_t count;
+    CacheEntry* newest;
+    CacheEntry* oldest;
+
+    size_t bytes;
+    size_t budget;
+
+    size_t hits;
+    size_t misses;
+    size_t stale;
+    size_t evictions;
+
+} ResultCache;
+
+static ResultCache cache = {NULL, 0, 0, NULL, NULL, 0, CACHE_DEFAULT_BUDGET, 0, 0, 0, 0};
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a
+static uint64_t hashKey(const char* key) {
+
+    uint64_t hash = 1469598103934665603ull;
+
+    for (; *key; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static void growBuckets() {
+
+    size_t numBuckets = cache.numBuckets ? cache.numBuckets * 2 : CACHE_INITIAL_BUCKETS;
+    CacheEntry** buckets = calloc(numBuckets, sizeof(CacheEntry*));
+
+    if (!buckets) {
+        fprintf(stderr, "calloc returned NULL pointer for cache buckets\n");
+        exit(1);
+    }
+
+    for (CacheEntry* entry = cache.newest; entry; entry = entry->next) {
+        size_t b = entry->hash & (numBuckets - 1);
+        entry->nextInBucket = buckets[b];
+        buckets[b] = entry;
+    }
+
+    free(cache.buckets);
+    cache.buckets = buckets;
+    cache.numBuckets = numBuckets;
+}
+
+static void unlinkRecency(CacheEntry* entry) {
+
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache.newest = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache.oldest = entry->prev;
+}
+
+static void pushNewest(CacheEntry* entry) {
+
+    entry->prev = NULL;
+    entry->next = cache.newest;
+
+    if (cache.newest)
+        cache.newest->prev = entry;
+    else
+        cache.oldest = entry;
+
+    cache.newest = entry;
+}
+
+static void removeEntry(CacheEntry* entry) {
+
+    CacheEntry** link = &cache.buckets[entry->hash & (cache.numBuckets - 1)];
+
+    while (*link != entry)
+        link = &(*link)->nextInBucket;
+
+    *link = entry->nextInBucket;
+
+    unlinkRecency(entry);
+
+    cache.bytes -= entry->bytes;
+    cache.count--;
+
+    free(entry->key);
+    free(entry->value);
+    free(entry);
+}
+
+static CacheEntry* findEntry(const char* key, uint64_t hash) {
+
+    if (!cache.numBuckets)
+        return NULL;
+
+    for (CacheEntry* entry = cache.buckets[hash & (cache.numBuckets - 1)]; entry; entry = entry->nextInBucket) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static int stampsMatch(const CacheStamp* a, const CacheStamp* b) {
+    return a->numDeps == b->numDeps && memcmp(a->versions, b->versions, a->numDeps * sizeof(a->versions[0])) == 0;
+}
+
+static void evictToBudget() {
+
+    while (cache.bytes > cache.budget && cache.oldest) {
+        removeEntry(cache.oldest);
+        cache.evictions++;
+    }
+}
+
+// Copies the cached result for key into value and returns 1, or returns 0 if there's no up to date one
+int cacheLookup(const char* key, const CacheStamp* stamp, void* value, size_t size) {
+
+    uint64_t hash = hashKey(key);
+    int hit = 0;
+
+    pthread_mutex_lock(&cacheLock);
+
+    CacheEntry* entry = findEntry(key, hash);
+
+    if (entry && !stampsMatch(&entry->stamp, stamp)) {
+        // Something the result depends on changed since it was stored
+        removeEntry(entry);
+        cache.stale++;
+        entry = NULL;
+    }
+
+    if (entry && entry->size == size) {
+        memcpy(value, entry->value, size);
+        unlinkRecency(entry);
+        pushNewest(entry);
+        cache.hits++;
+        hit = 1;
+    } else {
+        cache.misses++;
+    }
+
+    pthread_mutex_unlock(&cacheLock);
+
+    STATS_ADD(hit ? STAT_COUNTER_CACHE_HITS : STAT_COUNTER_CACHE_MISSES, 1);
+
+    return hit;
+}
+
+void cacheStore(const char* key, const CacheStamp* stamp, const void* value, size_t size) {
+
+    size_t keyLen = strlen(key) + 1;
+    size_t bytes = sizeof(CacheEntry) + keyLen + size;
+    uint64_t hash = hashKey(key);
+
+    pthread_mutex_lock(&cacheLock);
+
+    if (bytes > cache.budget) {
+        pthread_mutex_unlock(&cacheLock);
+        return;
+    }
+
+    CacheEntry* old = findEntry(key, hash);
+
+    if (old)
+        removeEntry(old);
+
+    CacheEntry* entry = malloc(sizeof(CacheEntry));
+    char* keyCopy = malloc(keyLen);
+    void* valueCopy = malloc(size ? size : 1);
+
+    if (!entry || !keyCopy || !valueCopy) {
+        fprintf(stderr, "malloc returned NULL pointer for CacheEntry\n");
+        exit(1);
+    }
+
+    memcpy(keyCopy, key, keyLen);
+    memcpy(valueCopy, value, size);
+
+    entry->key = keyCopy;
+    entry->hash = hash;
+    entry->stamp = *stamp;
+    entry->value = valueCopy;
+    entry->size = size;
+    entry->bytes = bytes;
+
+    if (cache.count >= cache.numBuckets)
+        growBuckets();
+
+    size_t b = hash & (cache.numBuckets - 1);
+    entry->nextInBucket = cache.buckets[b];
+    cache.buckets[b] = entry;
+
+    pushNewest(entry);
+    cache.count++;
+    cache.bytes += bytes;
+
+    evictToBudget();
+
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void setCacheBudget(size_t bytes) {
+
+    pthread_mutex_lock(&cacheLock);
+    cache.budget = bytes;
+    evictToBudget();
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void cacheClear() {
+
+    pthread_mutex_lock(&cacheLock);
+
+    while (cache.newest)
+        removeEntry(cache.newest);
+
+    cache.hits = cache.misses = cache.stale = cache.evictions = 0;
+
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void printCacheStats() {
+
+    pthread_mutex_lock(&cacheLock);
+
+    size_t lookups = cache.hits + cache.misses;
+
+    printf("Cached results: %zu, %zu of %zu bytes\n", cache.count, cache.bytes, cache.budget);
+    printf("Hits: %zu, misses: %zu (%.1f%% hit rate), invalidated: %zu, evicted: %zu\n", cache.hits, cache.misses,
+        lookups ? 100.0 * cache.hits / lookups : 0.0, cache.stale, cache.evictions);
+
+    pthread_mutex_unlock(&cacheLock);
+}
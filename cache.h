@@ -0,0 +1,31 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+/* Query result cache. Results are stored under a normalized query string
+   together with a stamp: the versions of the table's rows and of every column
+   the query read. Any mutation gives those a new version, so a lookup whose
+   stamp no longer matches is a miss and the stale entry is dropped. Writes to
+   other columns leave the entry alone. Entries are evicted least recently used
+   first once the cache is over its byte budget. */
+
+#define CACHE_DEFAULT_BUDGET (16 * 1024 * 1024)
+#define CACHE_MAX_DEPS 16
+#define CACHE_INITIAL_BUCKETS 64
+
+typedef struct {
+
+    size_t numDeps;
+    unsigned long long versions[CACHE_MAX_DEPS];
+
+} CacheStamp;
+
+int cacheLookup(const char* key, const CacheStamp* stamp, void* value, size_t size);
+void cacheStore(const char* key, const CacheStamp* stamp, const void* value, size_t size);
+
+void setCacheBudget(size_t bytes);
+void cacheClear();
+void printCacheStats();
+
+#endif
@@ -0,0 +1,771 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "compress.h"
+#include "database.h"
+
+const char* encoding_names[] = {"PLAIN", "RLE", "FOR", "DELTA", "XOR"};
+
+// Every encoded block starts with this header
+typedef struct {
+
+    uint8_t encoding;
+    uint8_t bitWidth;
+    uint16_t reserved;
+    uint32_t count;
+
+} BlockHeader;
+
+void initByteBuffer(ByteBuffer* buf) {
+
+    buf->data = NULL;
+    buf->size = 0;
+    buf->capacity = 0;
+}
+
+void freeByteBuffer(ByteBuffer* buf) {
+
+    free(buf->data);
+    initByteBuffer(buf);
+}
+
+void appendBytes(ByteBuffer* buf, const void* data, size_t size) {
+
+    if (buf->size + size > buf->capacity) {
+
+        size_t capacity = buf->capacity ? buf->capacity : 256;
+
+        while (capacity < buf->size + size)
+            capacity *= 2;
+
+        uint8_t* newData = realloc(buf->data, capacity);
+
+        if (!newData) {
+            fprintf(stderr, "realloc returned NULL pointer for ByteBuffer\n");
+            exit(1);
+        }
+
+        buf->data = newData;
+        buf->capacity = capacity;
+    }
+
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+size_t typeWidth(DataTypes type) {
+    return typeOps(type)->width;
+}
+
+/* ---- Bit packing, bits are written LSB first into 64 bit words ---- */
+
+typedef struct {
+
+    ByteBuffer* buf;
+    uint64_t acc;
+    int bits;
+
+} BitWriter;
+
+typedef struct {
+
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    int bits;
+
+} BitReader;
+
+static uint64_t lowMask(int n) {
+    return n >= 64 ? ~0ull : (1ull << n) - 1;
+}
+
+static void putBits(BitWriter* w, uint64_t value, int n) {
+
+    if (!n)
+        return;
+
+    value &= lowMask(n);
+    w->acc |= value << w->bits;
+
+    int space = 64 - w->bits;
+
+    if (n >= space) {
+        appendBytes(w->buf, &w->acc, sizeof(w->acc));
+        w->acc = space < 64 ? value >> space : 0;
+        w->bits = n - space;
+    } else {
+        w->bits += n;
+    }
+}
+
+static void flushBits(BitWriter* w) {
+
+    if (w->bits)
+        appendBytes(w->buf, &w->acc, sizeof(w->acc));
+
+    w->acc = 0;
+    w->bits = 0;
+}
+
+static void initBitReader(BitReader* r, const uint8_t* data, size_t size) {
+
+    r->data = data;
+    r->size = size;
+    r->pos = 0;
+    r->acc = 0;
+    r->bits = 0;
+}
+
+static uint64_t getBits(BitReader* r, int n) {
+
+    if (!n)
+        return 0;
+
+    if (n <= r->bits) {
+        uint64_t result = r->acc & lowMask(n);
+        r->acc = n < 64 ? r->acc >> n : 0;
+        r->bits -= n;
+        return result;
+    }
+
+    uint64_t result = r->acc;
+    int have = r->bits;
+
+    // Past the end of the block reads as zeros
+    r->acc = 0;
+    if (r->pos + sizeof(uint64_t) <= r->size)
+        memcpy(&r->acc, r->data + r->pos, sizeof(uint64_t));
+    r->pos += sizeof(uint64_t);
+    r->bits = 64;
+
+    int need = n - have;
+
+    result |= (r->acc & lowMask(need)) << have;
+    r->acc = need < 64 ? r->acc >> need : 0;
+    r->bits -= need;
+
+    return result;
+}
+
+static int bitsNeeded(uint64_t range) {
+    return range ? 64 - __builtin_clzll(range) : 0;
+}
+
+/* ---- Reading values out of the typed arrays ---- */
+
+static int64_t intAt(const void* values, size_t i) {
+    return ((const int*)values)[i];
+}
+
+// Raw bit pattern of a value, used by RLE and XOR
+static uint64_t bitsAt(DataTypes type, const void* values, size_t i) {
+
+    size_t width = typeWidth(type);
+    uint64_t bits = 0;
+
+    memcpy(&bits, (const uint8_t*)values + i * width, width);
+    return bits;
+}
+
+static void storeBits(DataTypes type, void* values, size_t i, uint64_t bits) {
+
+    size_t width = typeWidth(type);
+
+    memcpy((uint8_t*)values + i * width, &bits, width);
+}
+
+/* ---- Encoders ---- */
+
+static void writeHeader(ByteBuffer* out, BlockEncoding encoding, int bitWidth, size_t count) {
+
+    BlockHeader header = {encoding, bitWidth, 0, count};
+    appendBytes(out, &header, sizeof(header));
+}
+
+static void encodePlain(DataTypes type, const void* values, size_t count, ByteBuffer* out) {
+
+    writeHeader(out, ENC_PLAIN, 0, count);
+    appendBytes(out, values, count * typeWidth(type));
+}
+
+static void encodeRLE(DataTypes type, const void* values, size_t count, ByteBuffer* out, uint32_t runs) {
+
+    size_t width = typeWidth(type);
+
+    writeHeader(out, ENC_RLE, 0, count);
+    appendBytes(out, &runs, sizeof(runs));
+
+    for (size_t i = 0; i < count; ) {
+
+        uint64_t bits = bitsAt(type, values, i);
+        uint32_t length = 1;
+
+        while (i + length < count && bitsAt(type, values, i + length) == bits)
+            length++;
+
+        appendBytes(out, (const uint8_t*)values + i * width, width);
+        appendBytes(out, &length, sizeof(length));
+        i += length;
+    }
+}
+
+// Frame of reference: store min once, then every value as a bitWidth-bit offset from it
+static void encodeFOR(const void* values, size_t count, ByteBuffer* out, int64_t min, int bitWidth) {
+
+    BitWriter w = {out, 0, 0};
+
+    writeHeader(out, ENC_FOR, bitWidth, count);
+    appendBytes(out, &min, sizeof(min));
+
+    for (size_t i = 0; i < count; i++)
+        putBits(&w, (uint64_t)(intAt(values, i) - min), bitWidth);
+
+    flushBits(&w);
+}
+
+// Delta: store the first value and the smallest delta, then each delta as an offset from it
+static void encodeDelta(const void* values, size_t count, ByteBuffer* out, int64_t minDelta, int bitWidth) {
+
+    BitWriter w = {out, 0, 0};
+    int64_t first = intAt(values, 0);
+
+    writeHeader(out, ENC_DELTA, bitWidth, count);
+    appendBytes(out, &first, sizeof(first));
+    appendBytes(out, &minDelta, sizeof(minDelta));
+
+    for (size_t i = 1; i < count; i++)
+        putBits(&w, (uint64_t)(intAt(values, i) - intAt(values, i - 1) - minDelta), bitWidth);
+
+    flushBits(&w);
+}
+
+/* Gorilla style XOR: each value is XORed with the previous one. A zero XOR costs
+   one bit, otherwise we store the meaningful bits, reusing the previous
+   leading/trailing zero window when the new bits fit inside it */
+static void encodeXOR(DataTypes type, const void* values, size_t count, ByteBuffer* out) {
+
+    BitWriter w = {out, 0, 0};
+    int valueBits = (int)typeWidth(type) * 8;
+    uint64_t prev = bitsAt(type, values, 0);
+    int prevLeading = -1;
+    int prevTrailing = 0;
+
+    writeHeader(out, ENC_XOR, 0, count);
+    putBits(&w, prev, valueBits);
+
+    for (size_t i = 1; i < count; i++) {
+
+        uint64_t cur = bitsAt(type, values, i);
+        uint64_t x = cur ^ prev;
+
+        prev = cur;
+
+        if (!x) {
+            putBits(&w, 0, 1);
+            continue;
+        }
+
+        int leading = __builtin_clzll(x) - (64 - valueBits);
+        int trailing = __builtin_ctzll(x);
+
+        putBits(&w, 1, 1);
+
+        if (prevLeading >= 0 && leading >= prevLeading && trailing >= prevTrailing) {
+            putBits(&w, 0, 1);
+            putBits(&w, x >> prevTrailing, valueBits - prevLeading - prevTrailing);
+        } else {
+            int length = valueBits - leading - trailing;
+
+            putBits(&w, 1, 1);
+            putBits(&w, leading, 6);
+            putBits(&w, length - 1, 6);
+            putBits(&w, x >> trailing, length);
+
+            prevLeading = leading;
+            prevTrailing = trailing;
+        }
+    }
+
+    flushBits(&w);
+}
+
+// Appends the smallest encoding of the block to out, returns the number of bytes added
+size_t compressBlock(DataTypes type, const void* values, size_t count, ByteBuffer* out) {
+
+    size_t start = out->size;
+    size_t width = typeWidth(type);
+
+    if (!count) {
+        writeHeader(out, ENC_PLAIN, 0, 0);
+        return out->size - start;
+    }
+
+    // Block statistics: number of runs, and for ints the value and delta ranges
+    uint32_t runs = 1;
+
+    for (size_t i = 1; i < count; i++) {
+        if (bitsAt(type, values, i) != bitsAt(type, values, i - 1))
+            runs++;
+    }
+
+    size_t bestSize = count * width;
+    BlockEncoding best = ENC_PLAIN;
+    size_t rleSize = sizeof(uint32_t) + runs * (width + sizeof(uint32_t));
+
+    if (rleSize < bestSize) {
+        bestSize = rleSize;
+        best = ENC_RLE;
+    }
+
+    int64_t min = 0;
+    int forBits = 0;
+    int64_t minDelta = 0;
+    int deltaBits = 0;
+
+    if (type == INT_TYPE) {
+
+        int64_t max = min = intAt(values, 0);
+        int64_t maxDelta = 0;
+
+        for (size_t i = 0; i < count; i++) {
+
+            int64_t v = intAt(values, i);
+
+            if (v < min) min = v;
+            if (v > max) max = v;
+
+            if (i > 0) {
+                int64_t delta = v - intAt(values, i - 1);
+
+                if (i == 1 || delta < minDelta) minDelta = delta;
+                if (i == 1 || delta > maxDelta) maxDelta = delta;
+            }
+        }
+
+        forBits = bitsNeeded((uint64_t)(max - min));
+        deltaBits = bitsNeeded((uint64_t)(maxDelta - minDelta));
+
+        size_t forSize = sizeof(int64_t) + (count * forBits + 63) / 64 * 8;
+        size_t deltaSize = 2 * sizeof(int64_t) + ((count - 1) * deltaBits + 63) / 64 * 8;
+
+        if (forSize < bestSize) {
+            bestSize = forSize;
+            best = ENC_FOR;
+        }
+
+        if (deltaSize < bestSize) {
+            bestSize = deltaSize;
+            best = ENC_DELTA;
+        }
+    } else {
+        // XOR's size depends on the data, so encode it and keep it if it wins
+        encodeXOR(type, values, count, out);
+
+        if (out->size - start - sizeof(BlockHeader) < bestSize)
+            return out->size - start;
+
+        out->size = start;
+    }
+
+    switch (best) {
+        case ENC_RLE :
+            encodeRLE(type, values, count, out, runs);
+            break;
+        case ENC_FOR :
+            encodeFOR(values, count, out, min, forBits);
+            break;
+        case ENC_DELTA :
+            encodeDelta(values, count, out, minDelta, deltaBits);
+            break;
+        default :
+            encodePlain(type, values, count, out);
+    }
+
+    return out->size - start;
+}
+
+/* ---- Decoders ---- */
+
+BlockEncoding blockEncoding(const uint8_t* block) {
+    return ((const BlockHeader*)block)->encoding;
+}
+
+size_t blockCount(const uint8_t* block) {
+    return ((const BlockHeader*)block)->count;
+}
+
+// Decodes a block into a typed array of up to maxCount values, returns the count or -1 if the block is bad
+int decompressBlock(const uint8_t* block, size_t size, DataTypes type, void* values, size_t maxCount) {
+
+    if (size < sizeof(BlockHeader))
+        return -1;
+
+    BlockHeader header;
+    memcpy(&header, block, sizeof(header));
+
+    const uint8_t* payload = block + sizeof(header);
+    size_t payloadSize = size - sizeof(header);
+    size_t count = header.count;
+    size_t width = typeWidth(type);
+
+    // Packed widths past 64 bits can't come from the encoder
+    if (count > maxCount || header.bitWidth > 64)
+        return -1;
+
+    switch (header.encoding) {
+
+        case ENC_PLAIN :
+            if (payloadSize < count * width)
+                return -1;
+            memcpy(values, payload, count * width);
+            break;
+
+        case ENC_RLE : {
+            uint32_t runs;
+            size_t filled = 0;
+
+            if (payloadSize < sizeof(runs))
+                return -1;
+
+            memcpy(&runs, payload, sizeof(runs));
+            payload += sizeof(runs);
+
+            if (payloadSize < sizeof(runs) + (size_t)runs * (width + sizeof(uint32_t)))
+                return -1;
+
+            for (uint32_t r = 0; r < runs; r++) {
+
+                uint32_t length;
+                memcpy(&length, payload + width, sizeof(length));
+
+                if (filled + length > count)
+                    return -1;
+
+                for (uint32_t i = 0; i < length; i++)
+                    memcpy((uint8_t*)values + (filled + i) * width, payload, width);
+
+                filled += length;
+                payload += width + sizeof(uint32_t);
+            }
+            break;
+        }
+
+        case ENC_FOR : {
+            int64_t min;
+            BitReader r;
+
+            if (payloadSize < sizeof(min))
+                return -1;
+
+            memcpy(&min, payload, sizeof(min));
+            initBitReader(&r, payload + sizeof(min), payloadSize - sizeof(min));
+
+            for (size_t i = 0; i < count; i++)
+                ((int*)values)[i] = (int)(min + (int64_t)getBits(&r, header.bitWidth));
+            break;
+        }
+
+        case ENC_DELTA : {
+            int64_t value;
+            int64_t minDelta;
+            BitReader r;
+
+            if (payloadSize < 2 * sizeof(int64_t))
+                return -1;
+
+            memcpy(&value, payload, sizeof(value));
+            memcpy(&minDelta, payload + sizeof(value), sizeof(minDelta));
+            initBitReader(&r, payload + 2 * sizeof(int64_t), payloadSize - 2 * sizeof(int64_t));
+
+            for (size_t i = 0; i < count; i++) {
+                if (i > 0)
+                    value += minDelta + (int64_t)getBits(&r, header.bitWidth);
+                ((int*)values)[i] = (int)value;
+            }
+            break;
+        }
+
+        case ENC_XOR : {
+            BitReader r;
+            int valueBits = (int)width * 8;
+            int leading = 0;
+            int trailing = 0;
+
+            initBitReader(&r, payload, payloadSize);
+
+            uint64_t prev = count ? getBits(&r, valueBits) : 0;
+
+            for (size_t i = 0; i < count; i++) {
+
+                if (i > 0 && getBits(&r, 1)) {
+
+                    if (getBits(&r, 1)) {
+                        leading = (int)getBits(&r, 6);
+                        int length = (int)getBits(&r, 6) + 1;
+
+                        if (leading + length > valueBits)
+                            return -1;
+
+                        trailing = valueBits - leading - length;
+                    }
+
+                    prev ^= getBits(&r, valueBits - leading - trailing) << trailing;
+                }
+
+                storeBits(type, values, i, prev);
+            }
+            break;
+        }
+
+        default :
+            return -1;
+    }
+
+    return (int)count;
+}
+
+/* ---- Kernels on encoded data ---- */
+
+// Values inside RLE runs aren't aligned, so read them through memcpy
+static double valueAsDouble(DataTypes type, const void* values, size_t i) {
+
+    const TypeOps* ops = typeOps(type);
+
+    return ops->toDouble(ops->load(values, i));
+}
+
+// Decode into a scratch array, for encodings the kernels can't work on directly
+static void* decodeScratch(const uint8_t* block, size_t size, DataTypes type) {
+
+    size_t count = blockCount(block);
+    void* values = malloc((count ? count : 1) * typeWidth(type));
+
+    if (!values) {
+        fprintf(stderr, "malloc returned NULL pointer for decode scratch\n");
+        exit(1);
+    }
+
+    if (decompressBlock(block, size, type, values, count) < 0) {
+        free(values);
+        return NULL;
+    }
+
+    return values;
+}
+
+// Sum of the block's values, returns 0 on success and -1 if the block is bad
+int compressedBlockSum(const uint8_t* block, size_t size, DataTypes type, double* sum) {
+
+    if (size < sizeof(BlockHeader))
+        return -1;
+
+    BlockHeader header;
+    memcpy(&header, block, sizeof(header));
+
+    const uint8_t* payload = block + sizeof(header);
+    size_t width = typeWidth(type);
+
+    *sum = 0.0;
+
+    if (header.encoding == ENC_RLE) {
+
+        uint32_t runs;
+
+        if (size - sizeof(header) < sizeof(runs))
+            return -1;
+
+        memcpy(&runs, payload, sizeof(runs));
+        payload += sizeof(runs);
+
+        if (size - sizeof(header) < sizeof(runs) + (size_t)runs * (width + sizeof(uint32_t)))
+            return -1;
+
+        // value * run length, no need to expand the runs
+        for (uint32_t r = 0; r < runs; r++) {
+            uint32_t length;
+            memcpy(&length, payload + width, sizeof(length));
+            *sum += valueAsDouble(type, payload, 0) * length;
+            payload += width + sizeof(uint32_t);
+        }
+        return 0;
+    }
+
+    if (header.encoding == ENC_FOR) {
+
+        int64_t min;
+        BitReader r;
+        uint64_t offsets = 0;
+
+        if (size - sizeof(header) < sizeof(min) || header.bitWidth > 64)
+            return -1;
+
+        memcpy(&min, payload, sizeof(min));
+        initBitReader(&r, payload + sizeof(min), size - sizeof(header) - sizeof(min));
+
+        // count * min + the sum of the packed offsets
+        for (size_t i = 0; i < header.count; i++)
+            offsets += getBits(&r, header.bitWidth);
+
+        *sum = (double)min * header.count + (double)offsets;
+        return 0;
+    }
+
+    void* values = decodeScratch(block, size, type);
+
+    if (!values)
+        return -1;
+
+    for (size_t i = 0; i < header.count; i++)
+        *sum += valueAsDouble(type, values, i);
+
+    free(values);
+    return 0;
+}
+
+// Number of values equal to *value, or -1 if the block is bad
+long compressedBlockCountEqual(const uint8_t* block, size_t size, DataTypes type, const void* value) {
+
+    if (size < sizeof(BlockHeader))
+        return -1;
+
+    BlockHeader header;
+    memcpy(&header, block, sizeof(header));
+
+    const uint8_t* payload = block + sizeof(header);
+    size_t width = typeWidth(type);
+    uint64_t target = bitsAt(type, value, 0);
+    long matches = 0;
+
+    if (header.encoding == ENC_RLE) {
+
+        uint32_t runs;
+
+        if (size - sizeof(header) < sizeof(runs))
+            return -1;
+
+        memcpy(&runs, payload, sizeof(runs));
+        payload += sizeof(runs);
+
+        if (size - sizeof(header) < sizeof(runs) + (size_t)runs * (width + sizeof(uint32_t)))
+            return -1;
+
+        for (uint32_t r = 0; r < runs; r++) {
+            uint32_t length;
+            memcpy(&length, payload + width, sizeof(length));
+            if (bitsAt(type, payload, 0) == target)
+                matches += length;
+            payload += width + sizeof(uint32_t);
+        }
+        return matches;
+    }
+
+    if (header.encoding == ENC_FOR) {
+
+        int64_t min;
+        BitReader r;
+
+        if (size - sizeof(header) < sizeof(min) || header.bitWidth > 64)
+            return -1;
+
+        memcpy(&min, payload, sizeof(min));
+
+        // Outside the block's frame nothing can match
+        int64_t offset = intAt(value, 0) - min;
+
+        if (offset < 0 || (uint64_t)offset > lowMask(header.bitWidth))
+            return 0;
+
+        initBitReader(&r, payload + sizeof(min), size - sizeof(header) - sizeof(min));
+
+        for (size_t i = 0; i < header.count; i++)
+            matches += getBits(&r, header.bitWidth) == (uint64_t)offset;
+
+        return matches;
+    }
+
+    void* values = decodeScratch(block, size, type);
+
+    if (!values)
+        return -1;
+
+    for (size_t i = 0; i < header.count; i++)
+        matches += bitsAt(type, values, i) == target;
+
+    free(values);
+    return matches;
+}
+
+/* ---- Row-major tables ---- */
+
+// Copies count values of a column into a typed array, starting at firstRow
+void gatherColumn(Database* db, size_t col, size_t firstRow, size_t count, void* out) {
+
+    typeOps(db->cols[col].type)->gather(db->rows + firstRow, col, count, out);
+}
+
+// Same as gatherColumn for a list of rows, e.g. a cursor batch
+void gatherRows(Database* db, size_t col, const size_t* rowIndexes, size_t count, void* out) {
+
+    typeOps(db->cols[col].type)->gatherRows(db->rows, rowIndexes, col, count, out);
+}
+
+// Compresses every column of the table block by block and prints the encodings chosen and the ratio
+void printCompressionInfo(Database* db) {
+
+    void* column = malloc(COMPRESS_BLOCK_ROWS * sizeof(double));
+
+    if (!column) {
+        fprintf(stderr, "malloc returned NULL pointer for compression column\n");
+        exit(1);
+    }
+
+    ByteBuffer block;
+    initByteBuffer(&block);
+
+    size_t totalRaw = 0;
+    size_t totalEncoded = 0;
+
+    printf("%-*s %-8s %12s %12s %8s  %s\n", STRING_LEN, "column", "type", "raw", "encoded", "ratio", "blocks");
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        DataTypes type = db->cols[col].type;
+        size_t blocks[ENC_COUNT] = {0};
+        size_t encoded = 0;
+
+        for (size_t first = 0; first < db->numRows; first += COMPRESS_BLOCK_ROWS) {
+
+            size_t count = db->numRows - first < COMPRESS_BLOCK_ROWS ? db->numRows - first : COMPRESS_BLOCK_ROWS;
+
+            gatherColumn(db, col, first, count, column);
+
+            block.size = 0;
+            encoded += compressBlock(type, column, count, &block);
+            blocks[blockEncoding(block.data)]++;
+        }
+
+        size_t raw = db->numRows * typeWidth(type);
+
+        printf("%-*s %-8s %12zu %12zu %7.2fx ", STRING_LEN, db->cols[col].colName, data_types[type], raw, encoded,
+            encoded ? (double)raw / encoded : 0.0);
+
+        for (int e = 0; e < ENC_COUNT; e++) {
+            if (blocks[e])
+                printf(" %s:%zu", encoding_names[e], blocks[e]);
+        }
+
+        printf("\n");
+
+        totalRaw += raw;
+        totalEncoded += encoded;
+    }
+
+    printf("total %zu bytes raw, %zu bytes encoded (%.2fx)\n", totalRaw, totalEncoded,
+        totalEncoded ? (double)totalRaw / totalEncoded : 0.0);
+
+    freeByteBuffer(&block);
+    free(column);
+}
@@ -0,0 +1,59 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "database.h"
+
+/* Lightweight encodings for blocks of one column's values. The encoder
+   looks at the block's statistics and keeps whichever encoding is smallest:
+   RLE for repeated values, frame-of-reference or delta with bit-packing for
+   narrow or sorted ints, and XOR (Gorilla style) for floats and doubles.
+   Values are passed as typed arrays (int, float or double per the column type). */
+
+#define COMPRESS_BLOCK_ROWS BLOCK_ROWS
+
+typedef enum {
+
+    ENC_PLAIN,
+    ENC_RLE,
+    ENC_FOR,
+    ENC_DELTA,
+    ENC_XOR,
+    ENC_COUNT
+
+} BlockEncoding;
+
+extern const char* encoding_names[];
+
+// Growable byte buffer the encoder appends to
+typedef struct {
+
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+
+} ByteBuffer;
+
+void initByteBuffer(ByteBuffer* buf);
+void freeByteBuffer(ByteBuffer* buf);
+void appendBytes(ByteBuffer* buf, const void* data, size_t size);
+
+size_t typeWidth(DataTypes type);
+
+size_t compressBlock(DataTypes type, const void* values, size_t count, ByteBuffer* out);
+int decompressBlock(const uint8_t* block, size_t size, DataTypes type, void* values, size_t maxCount);
+
+BlockEncoding blockEncoding(const uint8_t* block);
+size_t blockCount(const uint8_t* block);
+
+void gatherColumn(Database* db, size_t col, size_t firstRow, size_t count, void* out);
+void gatherRows(Database* db, size_t col, const size_t* rowIndexes, size_t count, void* out);
+void printCompressionInfo(Database* db);
+
+// Kernels that work on the encoded block, RLE and FOR blocks are never decoded.
+// Aggregates over tables evicted to snapshots use them (aggregateSnapshot)
+int compressedBlockSum(const uint8_t* block, size_t size, DataTypes type, double* sum);
+long compressedBlockCountEqual(const uint8_t* block, size_t size, DataTypes type, const void* value);
+
+#endif
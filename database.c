@@ -1,9 +1,249 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <errno.h>
 #include "database.h"
+#include "stats.h"
+#include "arena.h"
+#include "expr.h"
+#include "bloom.h"
+#include "sketch.h"
+#include "fileio.h"
+#include "hugemem.h"
 
-const char* data_types[] = {"INT", "FLOAT", "DOUBLE", "STRING"};
+static unsigned long long versionClock = 0;
+
+typedef struct {
+
+    MutationObserver observer;
+    void* ctx;
+
+} ObserverSlot;
+
+static ObserverSlot observers[MAX_MUTATION_OBSERVERS];
+static size_t numObservers = 0;
+
+/* Versions come from one clock shared by every table, so a version is never
+   reused, not even by a table or column that is deleted and created again.
+   Cached results remember the versions they were computed from */
+unsigned long long nextVersion() {
+    return __atomic_add_fetch(&versionClock, 1, __ATOMIC_RELAXED);
+}
+
+/* ---- Validity bitmaps ---- */
+
+static void setBit(uint64_t* words, size_t bit) {
+    words[bit / 64] |= 1ull << (bit % 64);
+}
+
+static void clearBit(uint64_t* words, size_t bit) {
+    words[bit / 64] &= ~(1ull << (bit % 64));
+}
+
+static int testBit(const uint64_t* words, size_t bit) {
+    return (words[bit / 64] >> (bit % 64)) & 1;
+}
+
+// Sets bits [from, from + count), whole words at a time where it can
+static void setBitRange(uint64_t* words, size_t from, size_t count) {
+
+    for (; count && from % 64; count--)
+        setBit(words, from++);
+
+    for (; count >= 64; count -= 64, from += 64)
+        words[from / 64] = ~0ull;
+
+    for (; count; count--)
+        setBit(words, from++);
+}
+
+// Number of set bits in [from, from + count)
+static size_t countBits(const uint64_t* words, size_t from, size_t count) {
+
+    size_t total = 0;
+
+    for (; count && from % 64; count--)
+        total += testBit(words, from++);
+
+    for (; count >= 64; count -= 64, from += 64)
+        total += __builtin_popcountll(words[from / 64]);
+
+    if (count)
+        total += __builtin_popcountll(words[from / 64] & ((1ull << count) - 1));
+
+    return total;
+}
+
+// Drops bit index from the first numBits bits, the ones above it move down one
+static void removeBit(uint64_t* words, size_t index, size_t numBits) {
+
+    size_t word = index / 64;
+    size_t last = (numBits - 1) / 64;
+    uint64_t below = (1ull << (index % 64)) - 1;
+
+    words[word] = (words[word] & below) | ((words[word] >> 1) & ~below);
+
+    for (; word < last; word++) {
+        words[word] |= words[word + 1] << 63;
+        words[word + 1] >>= 1;
+    }
+}
+
+static uint64_t* newValidity(Database* db) {
+
+    size_t words = VALIDITY_WORDS(db->rowCapacity);
+    uint64_t* validity = calloc(words ? words : 1, sizeof(uint64_t));
+
+    if (!validity) {
+        fprintf(stderr, "calloc returned NULL pointer for validity bitmap\n");
+        exit(1);
+    }
+
+    return validity;
+}
+
+// Gives a column its bitmap ahead of its first NULL, every row it has so far is valid
+static void allocValidity(Database* db, Column* column) {
+
+    if (column->validity)
+        return;
+
+    column->validity = newValidity(db);
+    setBitRange(column->validity, 0, db->numRows);
+}
+
+// Keeps every bitmap covering rowCapacity rows, called whenever the row array is resized
+static void resizeValidity(Database* db, size_t oldCapacity) {
+
+    size_t oldWords = VALIDITY_WORDS(oldCapacity);
+    size_t newWords = VALIDITY_WORDS(db->rowCapacity);
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        Column* column = &db->cols[col];
+
+        if (!column->validity)
+            continue;
+
+        uint64_t* validity = realloc(column->validity, (newWords ? newWords : 1) * sizeof(uint64_t));
+
+        if (!validity) {
+            fprintf(stderr, "realloc returned NULL pointer for validity bitmap\n");
+            exit(1);
+        }
+
+        if (newWords > oldWords)
+            memset(validity + oldWords, 0, (newWords - oldWords) * sizeof(uint64_t));
+
+        column->validity = validity;
+    }
+}
+
+// Valid (non NULL) cells among count rows of a column from firstRow
+size_t countValid(Database* db, size_t colIndex, size_t firstRow, size_t count) {
+
+    if (!db->cols[colIndex].nullCount)
+        return count;
+
+    return countBits(db->cols[colIndex].validity, firstRow, count);
+}
+
+// Copies the validity of count rows from firstRow into out (VALIDITY_WORDS(count) words)
+// Returns how many of them are NULL
+size_t gatherValidity(Database* db, size_t colIndex, size_t firstRow, size_t count, uint64_t* out) {
+
+    const Column* column = &db->cols[colIndex];
+    size_t nulls = 0;
+
+    memset(out, 0, VALIDITY_WORDS(count) * sizeof(uint64_t));
+
+    if (!column->nullCount) {
+        setBitRange(out, 0, count);
+        return 0;
+    }
+
+    // Blocks start on a word, those are a copy and a popcount
+    if (firstRow % 64 == 0) {
+        memcpy(out, column->validity + firstRow / 64, VALIDITY_WORDS(count) * sizeof(uint64_t));
+        if (count % 64)
+            out[count / 64] &= (1ull << (count % 64)) - 1;
+        return count - countBits(out, 0, count);
+    }
+
+    for (size_t r = 0; r < count; r++) {
+        if (testBit(column->validity, firstRow + r))
+            setBit(out, r);
+        else
+            nulls++;
+    }
+
+    return nulls;
+}
+
+// Same as gatherValidity for a list of rows, e.g. a cursor batch
+size_t gatherValidityRows(Database* db, size_t colIndex, const size_t* rowIndexes, size_t count, uint64_t* out) {
+
+    const Column* column = &db->cols[colIndex];
+    size_t nulls = 0;
+
+    memset(out, 0, VALIDITY_WORDS(count) * sizeof(uint64_t));
+
+    if (!column->nullCount) {
+        setBitRange(out, 0, count);
+        return 0;
+    }
+
+    for (size_t r = 0; r < count; r++) {
+        if (testBit(column->validity, rowIndexes[r]))
+            setBit(out, r);
+        else
+            nulls++;
+    }
+
+    return nulls;
+}
+
+// For callers compacting the row array themselves: row from moves to row to
+void moveRowValidity(Database* db, size_t from, size_t to) {
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        uint64_t* validity = db->cols[col].validity;
+
+        if (!validity)
+            continue;
+
+        if (testBit(validity, from))
+            setBit(validity, to);
+        else
+            clearBit(validity, to);
+    }
+}
+
+// After such a compaction: clears the bits past numRows and recounts the NULLs
+void trimValidity(Database* db) {
+
+    size_t words = VALIDITY_WORDS(db->rowCapacity);
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        Column* column = &db->cols[col];
+
+        if (!column->validity)
+            continue;
+
+        if (db->numRows % 64)
+            column->validity[db->numRows / 64] &= (1ull << (db->numRows % 64)) - 1;
+
+        size_t fullWords = VALIDITY_WORDS(db->numRows);
+
+        if (words > fullWords)
+            memset(column->validity + fullWords, 0, (words - fullWords) * sizeof(uint64_t));
+
+        column->nullCount = db->numRows - countBits(column->validity, 0, db->numRows);
+    }
+}
 
 // Should initialize with zeros 
 Database* createDatabase(const char* name) {
@@ -19,9 +259,27 @@ Database* createDatabase(const char* name) {
     // Initialize Database struct members to 0 and NULL
     db->numRows = 0;
     db->numCols = 0;
+    db->rowCapacity = 0;
     db->rows = NULL;
+    db->rowsMapped = 0;
     db->cols = NULL;
 
+    // Every Cell array of this table lives in its arena
+    db->arena = createArena();
+
+    // Nothing has been saved yet
+    db->dirty = NULL;
+    db->dirtyBlocks = 0;
+    db->allDirty = 1;
+    db->storeGeneration = 0;
+    db->rowsVersion = nextVersion();
+
+    // Not in the catalog yet
+    db->observed = 0;
+
+    db->computed = NULL;
+    db->numComputed = 0;
+
     // Copy the db name and null terminate
     strncpy(db->dbName, name, STRING_LEN);
     db->dbName[STRING_LEN - 1] = '\0';
@@ -32,6 +290,8 @@ Database* createDatabase(const char* name) {
 // Create a column and add it to our Database object
 void createColumn(Database* db, const char* name, DataTypes type) {
 
+    STATS_BEGIN();
+
     // Need to reallocate memory for the new column object
     Column* newCols = realloc(db->cols, (db->numCols + 1)*sizeof(Column));
 
@@ -46,63 +306,219 @@ void createColumn(Database* db, const char* name, DataTypes type) {
     db->cols[db->numCols].type = type;
     strncpy(db->cols[db->numCols].colName, name, STRING_LEN);
     db->cols[db->numCols].colName[STRING_LEN - 1] = '\0';
+    db->cols[db->numCols].version = nextVersion();
+
+    // The column has nothing in the rows that are already there, they're all NULL
+    db->cols[db->numCols].validity = db->numRows ? newValidity(db) : NULL;
+    db->cols[db->numCols].nullCount = db->numRows;
+    db->cols[db->numCols].bloom = NULL;
+    db->cols[db->numCols].sketch = NULL;
 
     db->numCols++;
 
+    // The dirty bits are laid out per column, a schema change means a full rewrite
+    markAllDirty(db);
+
     // If there are rows, we need to allocate memory for the new column cells by adding a cell to each row
     if (db->rows) {
         for (size_t i = 0; i < db->numRows; i++) {
 
-            db->rows[i].cells = realloc(db->rows[i].cells, db->numCols * sizeof(Cell));
-
-            if (!db->rows[i].cells) {
-                fprintf(stderr, "realloc returned NULL pointer for Row object\n");
-                exit(1);
-            }
+            // Rows only move when they outgrow their size class
+            db->rows[i].cells = arenaRealloc(db->arena, db->rows[i].cells, (db->numCols - 1) * sizeof(Cell),
+                db->numCols * sizeof(Cell));
 
-            if (type == INT_TYPE)
-                db->rows[i].cells[db->numCols - 1].value.i = 0;
-            else if (type == FLOAT_TYPE) 
-                db->rows[i].cells[db->numCols - 1].value.f = 0.0f;
-            else if (type == DOUBLE_TYPE) 
-                db->rows[i].cells[db->numCols - 1].value.d = 0.00;
+            // Zero bits are zero for every type, NULL cells hold zero
+            memset(&db->rows[i].cells[db->numCols - 1], 0, sizeof(Cell));
         }
     }
+
+    notifyTableMutation(db, MUTATION_CREATE_COLUMN, 0, 0, db->numCols - 1, (DataValues){0});
+
+    STATS_END(STAT_CREATE_COLUMN);
 }
 
-// Create a row of Cells for our Database
-void createRow(Database* db) {
+// Make room for at least capacity rows so appends don't realloc the row array every time
+void reserveRows(Database* db, size_t capacity) {
 
-    // Allocate memory for a row
-    Row* newRows = realloc(db->rows, (db->numRows + 1) * sizeof(Row));
+    if (capacity <= db->rowCapacity)
+        return;
+
+    Row* newRows = largeResize(db->rows, &db->rowsMapped, db->numRows * sizeof(Row), capacity * sizeof(Row));
 
     if (!newRows) {
         fprintf(stderr, "realloc returned NULL pointer for Row object\n");
         exit(1);
     }
 
+    size_t oldCapacity = db->rowCapacity;
+
     db->rows = newRows;
+    db->rowCapacity = capacity;
+
+    resizeValidity(db, oldCapacity);
+}
+
+// Create a row of Cells for our Database
+void createRow(Database* db) {
+
+    STATS_BEGIN_SAMPLED();
+
+    // Grow the row array geometrically
+    if (db->numRows == db->rowCapacity)
+        reserveRows(db, db->rowCapacity ? db->rowCapacity * 2 : 16);
 
     // Initalize the memory in each cell to '0'
-    db->rows[db->numRows].cells = calloc(db->numCols, sizeof(Cell));
+    db->rows[db->numRows].cells = arenaAlloc(db->arena, db->numCols * sizeof(Cell));
 
-    if ( db->rows[db->numRows].cells == NULL) {
-        fprintf(stderr, "calloc returned NULL pointer for Cell object in Row");
-        exit(1);
+    if (db->numCols)
+        memset(db->rows[db->numRows].cells, 0, db->numCols * sizeof(Cell));
+
+    // Nothing has been written to the new row yet, every cell starts out NULL
+    for (size_t col = 0; col < db->numCols; col++) {
+        allocValidity(db, &db->cols[col]);
+        db->cols[col].nullCount++;
     }
 
     db->numRows++;
+
+    markRowsDirty(db, db->numRows - 1);
+    syncBloomFilters(db);
+
+    notifyTableMutation(db, MUTATION_APPEND_ROWS, db->numRows - 1, 1, 0, (DataValues){0});
+
+    STATS_ADD(STAT_COUNTER_ROWS_APPENDED, 1);
+    STATS_END_SAMPLED(STAT_CREATE_ROW);
+}
+
+// Append a batch of rows in one go. The batch is checked against the schema once,
+// the row array is grown once and the values are copied without per-cell checks
+// Returns 0 on success, -1 if the batch shape doesn't match and -2 on a type mismatch
+int appendRows(Database* db, const BulkBatch* batch) {
+
+    STATS_BEGIN();
+
+    if (!db->numCols || batch->numCols != db->numCols) {
+        fprintf(stderr, "Bulk append expects %zu columns, batch has %zu.\n", db->numCols, batch->numCols);
+        return -1;
+    }
+
+    if (batch->types) {
+        for (size_t col = 0; col < db->numCols; col++) {
+            if (batch->types[col] != db->cols[col].type) {
+                fprintf(stderr, "Type mismatch in column %s. Expected '%s'.\n", db->cols[col].colName,
+                    data_types[db->cols[col].type]);
+                return -2;
+            }
+        }
+    }
+
+    if (!batch->numRows)
+        return 0;
+
+    size_t firstRow = db->numRows;
+    size_t needed = firstRow + batch->numRows;
+
+    if (needed > db->rowCapacity)
+        reserveRows(db, needed > db->rowCapacity * 2 ? needed : db->rowCapacity * 2);
+
+    for (size_t r = 0; r < batch->numRows; r++) {
+        db->rows[firstRow + r].cells = arenaAlloc(db->arena, db->numCols * sizeof(Cell));
+    }
+
+    if (batch->layout == ROW_MAJOR) {
+        // A row of DataValues has the same layout as a row of Cells
+        const DataValues* values = batch->values;
+
+        for (size_t r = 0; r < batch->numRows; r++) {
+            memcpy(db->rows[firstRow + r].cells, values + r * db->numCols, db->numCols * sizeof(Cell));
+        }
+    } else {
+        // One typed array per column, copy each column down the rows
+        for (size_t col = 0; col < db->numCols; col++)
+            typeOps(db->cols[col].type)->scatter(db->rows + firstRow, col, batch->numRows, batch->columns[col]);
+    }
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        Column* column = &db->cols[col];
+        const uint64_t* bits = batch->validity ? batch->validity[col] : NULL;
+        size_t nulls = bits ? batch->numRows - countBits(bits, 0, batch->numRows) : 0;
+
+        if (nulls)
+            allocValidity(db, column);
+
+        if (!column->validity)
+            continue;
+
+        if (!nulls) {
+            setBitRange(column->validity, firstRow, batch->numRows);
+            continue;
+        }
+
+        for (size_t r = 0; r < batch->numRows; r++) {
+            if (testBit(bits, r))
+                setBit(column->validity, firstRow + r);
+            else
+                memset(&db->rows[firstRow + r].cells[col], 0, sizeof(Cell));
+        }
+
+        column->nullCount += nulls;
+    }
+
+    db->numRows = needed;
+
+    markRowsDirty(db, firstRow);
+    syncBloomFilters(db);
+    sketchAddRows(db, firstRow, batch->numRows);
+
+    notifyTableMutation(db, MUTATION_APPEND_ROWS, firstRow, batch->numRows, 0, (DataValues){0});
+
+    STATS_ADD(STAT_COUNTER_ROWS_APPENDED, batch->numRows);
+    STATS_END(STAT_APPEND_ROWS);
+
+    return 0;
 }
 
 // Deletes a row and all its allocated Cells, resizes and reindxes the rows of the Database
 void deleteRow(Database* db, size_t rowIndex) {
 
-    if (rowIndex >= db->numRows) {
+    if (removeRow(db, rowIndex) < 0) {
         fprintf(stderr, "Invalid row index.\n");
         return;
     }
+
+    printf("Row %zu successfully deleted.\n", rowIndex);
+}
+
+// deleteRow without the messages, returns -1 if the row doesn't exist
+int removeRow(Database* db, size_t rowIndex) {
+
+    if (rowIndex >= db->numRows)
+        return -1;
+
+    STATS_BEGIN();
+
+    notifyTableMutation(db, MUTATION_DELETE_ROW, rowIndex, 1, 0, (DataValues){0});
+
+    // Every row after this one moves up, so its block and all later ones change
+    markRowsDirty(db, rowIndex);
+    sketchRemoveRow(db, rowIndex);
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        Column* column = &db->cols[col];
+
+        if (!column->validity)
+            continue;
+
+        if (!testBit(column->validity, rowIndex))
+            column->nullCount--;
+
+        removeBit(column->validity, rowIndex, db->numRows);
+    }
+
     // Free the allocated memory for the cells in this row
-    free(db->rows[rowIndex].cells);
+    arenaFree(db->arena, db->rows[rowIndex].cells, db->numCols * sizeof(Cell));
 
     // Shift the row elements down 
     for (size_t index = rowIndex; index < db->numRows-1; index++) {
@@ -112,23 +528,38 @@ void deleteRow(Database* db, size_t rowIndex) {
     // Decrementing the number of rows in our Database
     db->numRows--;
 
-    // Resize the array of rows
+    size_t oldCapacity = db->rowCapacity;
+
+    // Resize the array of rows once it's mostly empty
     if (db->numRows > 0) {
 
-        Row* newRows = realloc(db->rows, db->numRows * sizeof(Row));
+        if (db->numRows < db->rowCapacity / 4) {
 
-        if (!newRows) {
-            fprintf(stderr, "realloc returned NULL pointer for Row object\n");
-            exit(1);
-        }
+            Row* newRows = largeResize(db->rows, &db->rowsMapped, db->numRows * sizeof(Row),
+                db->rowCapacity / 2 * sizeof(Row));
+
+            if (!newRows) {
+                fprintf(stderr, "realloc returned NULL pointer for Row object\n");
+                exit(1);
+            }
 
-        db->rows = newRows;
+            db->rows = newRows;
+            db->rowCapacity /= 2;
+        }
 
     } else {
-        free(db->rows);
+        largeFree(db->rows, db->rowsMapped);
         db->rows = NULL;
+        db->rowsMapped = 0;
+        db->rowCapacity = 0;
     }
-    printf("Row %zu successfully deleted.\n", rowIndex);
+
+    if (db->rowCapacity != oldCapacity)
+        resizeValidity(db, oldCapacity);
+
+    STATS_END(STAT_DELETE_ROW);
+
+    return 0;
 }
 
 void deleteColumn(Database* db, size_t columnIndex) {
@@ -138,6 +569,10 @@ void deleteColumn(Database* db, size_t columnIndex) {
         return;
     }
 
+    STATS_BEGIN();
+
+    notifyTableMutation(db, MUTATION_DELETE_COLUMN, 0, 0, columnIndex, (DataValues){0});
+
     // Need to remove the column cells from each row and shift
     for (size_t row = 0; row < db->numRows; row++) {
 
@@ -147,21 +582,19 @@ void deleteColumn(Database* db, size_t columnIndex) {
 
         if (db->numCols > 1) {
             // Reallocate memory for the number of cells in our row, since we just deleted a cell from each row
-            Cell* newCells = realloc(db->rows[row].cells, (db->numCols - 1) * sizeof(Cell));
-
-            if (!newCells) {
-                fprintf(stderr, "Realloc failed when removing cell\n");
-                exit(1);
-            }
-
-            db->rows[row].cells = newCells;
+            db->rows[row].cells = arenaRealloc(db->arena, db->rows[row].cells, db->numCols * sizeof(Cell),
+                (db->numCols - 1) * sizeof(Cell));
 
         } else {
-            free(db->rows[row].cells);
+            arenaFree(db->arena, db->rows[row].cells, sizeof(Cell));
             db->rows[row].cells = NULL;
         }
     }
 
+    free(db->cols[columnIndex].validity);
+    freeBloomFilter(db->cols[columnIndex].bloom);
+    freeColumnSketch(db->cols[columnIndex].sketch);
+
     // Shift down the other columns
     for (size_t index = columnIndex; index < db->numCols- 1; index++) {
         db->cols[index] = db->cols[index + 1];
@@ -169,6 +602,8 @@ void deleteColumn(Database* db, size_t columnIndex) {
 
     db->numCols--;
 
+    markAllDirty(db);
+
     // Reallocate the memory for our columns
     if (db->numCols > 0) {
         Column* newCols = realloc(db->cols, (db->numCols) * sizeof(Column));
@@ -185,136 +620,593 @@ void deleteColumn(Database* db, size_t columnIndex) {
         db->cols = NULL;
     }
 
+    // Computed columns were compiled against the old column numbers
+    refreshComputedColumns(db);
+
+    STATS_END(STAT_DELETE_COLUMN);
+}
+
+// Make sure the dirty bitmap covers block, new bits start clean
+static void growDirty(Database* db, size_t block) {
+
+    size_t blocks = db->dirtyBlocks ? db->dirtyBlocks : 16;
+
+    while (blocks <= block)
+        blocks *= 2;
+
+    size_t oldBytes = (db->dirtyBlocks * db->numCols + 7) / 8;
+    size_t newBytes = (blocks * db->numCols + 7) / 8;
+    unsigned char* dirty = realloc(db->dirty, newBytes ? newBytes : 1);
+
+    if (!dirty) {
+        fprintf(stderr, "realloc returned NULL pointer for dirty blocks\n");
+        exit(1);
+    }
+
+    memset(dirty + oldBytes, 0, newBytes - oldBytes);
+
+    db->dirty = dirty;
+    db->dirtyBlocks = blocks;
+}
+
+static void setDirtyBit(Database* db, size_t block, size_t colIndex) {
+
+    if (block >= db->dirtyBlocks)
+        growDirty(db, block);
+
+    size_t bit = block * db->numCols + colIndex;
+
+    db->dirty[bit / 8] |= 1 << (bit % 8);
+}
+
+void markCellDirty(Database* db, size_t rowIndex, size_t colIndex) {
+
+    db->cols[colIndex].version = nextVersion();
+
+    if (!db->allDirty)
+        setDirtyBit(db, rowIndex / BLOCK_ROWS, colIndex);
+}
+
+// Every column of every block from the one holding fromRow to the last row
+void markRowsDirty(Database* db, size_t fromRow) {
+
+    db->rowsVersion = nextVersion();
+
+    // Rows from here on may have moved
+    truncateBloomFilters(db, fromRow);
+
+    if (db->allDirty || !db->numRows)
+        return;
+
+    for (size_t block = fromRow / BLOCK_ROWS; block <= (db->numRows - 1) / BLOCK_ROWS; block++) {
+        for (size_t col = 0; col < db->numCols; col++)
+            setDirtyBit(db, block, col);
+    }
+}
+
+void markAllDirty(Database* db) {
+
+    free(db->dirty);
+    db->dirty = NULL;
+    db->dirtyBlocks = 0;
+    db->allDirty = 1;
+}
+
+// Called once the table has been saved, everything matches the store again
+void clearDirty(Database* db) {
+
+    free(db->dirty);
+    db->dirty = NULL;
+    db->dirtyBlocks = 0;
+    db->allDirty = 0;
+}
+
+int isBlockDirty(Database* db, size_t block, size_t colIndex) {
+
+    if (db->allDirty)
+        return 1;
+
+    if (block >= db->dirtyBlocks)
+        return 0;
+
+    size_t bit = block * db->numCols + colIndex;
+
+    return (db->dirty[bit / 8] >> (bit % 8)) & 1;
+}
+
+// Registers a function called with every change to a table in the catalog, returns -1 if there's no room
+int addMutationObserver(MutationObserver observer, void* ctx) {
+
+    if (numObservers == MAX_MUTATION_OBSERVERS)
+        return -1;
+
+    observers[numObservers].observer = observer;
+    observers[numObservers].ctx = ctx;
+    numObservers++;
+
+    return 0;
+}
+
+void removeMutationObserver(MutationObserver observer, void* ctx) {
+
+    for (size_t i = 0; i < numObservers; i++) {
+        if (observers[i].observer == observer && observers[i].ctx == ctx) {
+            observers[i] = observers[--numObservers];
+            return;
+        }
+    }
+}
+
+void notifyMutation(const Mutation* mutation) {
+
+    for (size_t i = 0; i < numObservers; i++)
+        observers[i].observer(mutation, observers[i].ctx);
+}
+
+// Reports a change to db if it's in the catalog. Tables outside it (shards, loads in progress) stay quiet
+void notifyTableMutation(Database* db, MutationType type, size_t row, size_t numRows, size_t col, DataValues oldValue) {
+
+    if (!db->observed || !numObservers)
+        return;
+
+    Mutation mutation = {type, db, db->dbName, row, numRows, col, oldValue, 0};
+
+    notifyMutation(&mutation);
+}
+
+static void notifyCellWrite(Database* db, size_t rowIndex, size_t colIndex, DataValues oldValue, int oldNull) {
+
+    if (!db->observed || !numObservers)
+        return;
+
+    Mutation mutation = {MUTATION_WRITE_CELL, db, db->dbName, rowIndex, 1, colIndex, oldValue, oldNull};
+
+    notifyMutation(&mutation);
+}
+
+// Bytes held by a table, counting whole arena slabs (ignores malloc's own overhead)
+size_t databaseMemoryUsage(Database* db) {
+
+    if (!db)
+        return 0;
+
+    size_t validityBytes = 0;
+
+    for (size_t col = 0; col < db->numCols; col++) {
+        if (db->cols[col].validity)
+            validityBytes += VALIDITY_WORDS(db->rowCapacity) * sizeof(uint64_t);
+    }
+
+    return sizeof(Database) + sizeof(Arena) + db->numCols * sizeof(Column) + db->rowCapacity * sizeof(Row)
+        + db->arena->bytesReserved + validityBytes + bloomFilterBytes(db)
+        + sketchBytes(db);
 }
 
 void deleteDatabase(Database* db) {
 
     if (!db) return;
 
-    // Free the memory for our Rows and Cells
+    // Free the memory for our Rows, the Cells all go with the arena
+    destroyArena(db->arena);
+    db->arena = NULL;
+
     if (db->rows) {
-        for (size_t i = 0; i < db->numRows; i++) {
-            free(db->rows[i].cells);
-        }
-        free(db->rows);
+        largeFree(db->rows, db->rowsMapped);
         db->rows = NULL;
+        db->rowsMapped = 0;
         db->numRows = 0;
+        db->rowCapacity = 0;
     }
     
     // Free the memory for our Column array
     if (db->cols) {
+        for (size_t col = 0; col < db->numCols; col++) {
+            free(db->cols[col].validity);
+            freeBloomFilter(db->cols[col].bloom);
+            freeColumnSketch(db->cols[col].sketch);
+        }
         free(db->cols);
         db->cols = NULL;
         db->numCols = 0;
     }
 
+    free(db->dirty);
+
+    freeComputedColumns(db);
+
     // Free the memory for our database
     free(db);
 }
 
-int addInt(Database* db, size_t rowIndex, size_t colIndex, int value) {
-    // Checking if the table index passed in is valid
+// Checking if the table index passed in is valid
+static int checkCellIndex(Database* db, size_t rowIndex, size_t colIndex) {
+
     if (rowIndex >= db->numRows || colIndex >= db->numCols) {
         fprintf(stderr, "Index (%zu, %zu) is out of bounds. Valid range: rows 0-%zu, cols 0-%zu\n",
             rowIndex, colIndex, db->numRows - 1, db->numCols - 1);
         return -1;
     }
 
-    if (db->cols[colIndex].type != INT_TYPE) {
-        fprintf(stderr, "Type mismatch. Expected 'INT_TYPE'.\n");
+    return 0;
+}
+
+/* Writes one cell after checking the index and that value holds the column's type
+   Returns 0 on success, -1 if the index is out of bounds and -2 on a type mismatch */
+int writeCell(Database* db, size_t rowIndex, size_t colIndex, DataTypes type, DataValues value) {
+
+    if (checkCellIndex(db, rowIndex, colIndex) < 0)
+        return -1;
+
+    if (db->cols[colIndex].type != type) {
+        fprintf(stderr, "Type mismatch. Expected '%s'.\n", data_types[db->cols[colIndex].type]);
         return -2;
     }
 
-    db->rows[rowIndex].cells[colIndex].value.i = value;
+    Column* column = &db->cols[colIndex];
+    DataValues old = db->rows[rowIndex].cells[colIndex].value;
+    int oldNull = isCellNull(db, rowIndex, colIndex);
+
+    db->rows[rowIndex].cells[colIndex].value = value;
+
+    if (oldNull) {
+        setBit(column->validity, rowIndex);
+        column->nullCount--;
+    }
+
+    if (column->bloom)
+        bloomAddValue(db, colIndex, rowIndex, value);
+
+    if (column->sketch) {
+        if (!oldNull)
+            sketchRemoveValues(db, colIndex, 1);
+        sketchAddValue(db, colIndex, value);
+    }
+
+    markCellDirty(db, rowIndex, colIndex);
+    notifyCellWrite(db, rowIndex, colIndex, old, oldNull);
+
+    STATS_ADD(STAT_COUNTER_CELLS_WRITTEN, 1);
 
     return 0;
 }
 
-int addFloat(Database* db, size_t rowIndex, size_t colIndex, float value) {
-    // Checking if the table index passed in is valid
-     if (rowIndex >= db->numRows || colIndex >= db->numCols) {
-        fprintf(stderr, "Index (%zu, %zu) is out of bounds. Valid range: rows 0-%zu, cols 0-%zu\n",
-            rowIndex, colIndex, db->numRows - 1, db->numCols - 1);
+/* Writes count values to one column. values is a typed array of the column's type and
+   validity (count bits, set for a value) marks the NULLs, NULL if there are none.
+   rowIndexes must be ascending. The bounds and type are checked once for the batch and
+   the column is marked dirty once per block, observers still hear about every cell.
+   Returns -1 for a bad index and -2 for a type mismatch, like writeCell */
+int writeColumnRows(Database* db, size_t colIndex, DataTypes type, const size_t* rowIndexes, size_t count,
+    const void* values, const uint64_t* validity) {
+
+    if (!count)
+        return 0;
+
+    // Ascending, so the last row is the largest
+    if (checkCellIndex(db, rowIndexes[count - 1], colIndex) < 0)
         return -1;
+
+    if (db->cols[colIndex].type != type) {
+        fprintf(stderr, "Type mismatch. Expected '%s'.\n", data_types[db->cols[colIndex].type]);
+        return -2;
     }
 
-    // First check if our passed value is compatible with the type at the index
-    if (db->cols[colIndex].type != FLOAT_TYPE) {
-        fprintf(stderr, "Type mismatch. Expected 'FLOAT_TYPE'.\n");
-        return -1;
+    Column* column = &db->cols[colIndex];
+    const TypeOps* ops = typeOps(type);
+    int observed = db->observed && numObservers;
+    DataValues* old = NULL;
+    unsigned char* oldNull = NULL;
+
+    if (observed) {
+
+        old = malloc(count * sizeof(DataValues));
+        oldNull = malloc(count);
+
+        if (!old || !oldNull) {
+            fprintf(stderr, "malloc returned NULL pointer for overwritten values\n");
+            exit(1);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            old[i] = db->rows[rowIndexes[i]].cells[colIndex].value;
+            oldNull[i] = isCellNull(db, rowIndexes[i], colIndex);
+        }
+    }
+
+    // The values being overwritten leave the sketch
+    if (column->sketch) {
+
+        size_t overwritten = count;
+
+        for (size_t i = 0; column->validity && i < count; i++)
+            overwritten -= !testBit(column->validity, rowIndexes[i]);
+
+        sketchRemoveValues(db, colIndex, overwritten);
+    }
+
+    ops->scatterRows(db->rows, rowIndexes, colIndex, count, values);
+
+    if (validity && countBits(validity, 0, count) != count)
+        allocValidity(db, column);
+
+    if (column->validity) {
+
+        for (size_t i = 0; i < count; i++) {
+
+            size_t row = rowIndexes[i];
+            int wasNull = !testBit(column->validity, row);
+
+            if (!validity || testBit(validity, i)) {
+                if (wasNull) {
+                    setBit(column->validity, row);
+                    column->nullCount--;
+                }
+            } else {
+                if (!wasNull) {
+                    clearBit(column->validity, row);
+                    column->nullCount++;
+                }
+                memset(&db->rows[row].cells[colIndex], 0, sizeof(Cell));
+            }
+        }
+    }
+
+    for (size_t i = 0; column->bloom && i < count; i++) {
+        if (!validity || testBit(validity, i))
+            bloomAddValue(db, colIndex, rowIndexes[i], ops->load(values, i));
+    }
+
+    for (size_t i = 0; column->sketch && i < count; i++) {
+        if (!validity || testBit(validity, i))
+            sketchAddValue(db, colIndex, ops->load(values, i));
+    }
+
+    column->version = nextVersion();
+
+    if (!db->allDirty) {
+        for (size_t i = 0; i < count; i++) {
+            if (i == 0 || rowIndexes[i] / BLOCK_ROWS != rowIndexes[i - 1] / BLOCK_ROWS)
+                setDirtyBit(db, rowIndexes[i] / BLOCK_ROWS, colIndex);
+        }
+    }
+
+    if (observed) {
+        for (size_t i = 0; i < count; i++)
+            notifyCellWrite(db, rowIndexes[i], colIndex, old[i], oldNull[i]);
+        free(old);
+        free(oldNull);
     }
 
-    db->rows[rowIndex].cells[colIndex].value.f = value;
+    STATS_ADD(STAT_COUNTER_CELLS_WRITTEN, count);
+
     return 0;
 }
 
-int addDouble(Database* db, size_t rowIndex, size_t colIndex, double value) {
-    // Checking if the table index passed in is valid
-     if (rowIndex >= db->numRows || colIndex >= db->numCols) {
-        fprintf(stderr, "Index (%zu, %zu) is out of bounds. Valid range: rows 0-%zu, cols 0-%zu\n",
-            rowIndex, colIndex, db->numRows - 1, db->numCols - 1);
+// Clears a cell to NULL, returns 0 on success and -1 if the index is out of bounds
+int setCellNull(Database* db, size_t rowIndex, size_t colIndex) {
+
+    if (checkCellIndex(db, rowIndex, colIndex) < 0)
         return -1;
+
+    if (isCellNull(db, rowIndex, colIndex))
+        return 0;
+
+    Column* column = &db->cols[colIndex];
+    DataValues old = db->rows[rowIndex].cells[colIndex].value;
+
+    allocValidity(db, column);
+    clearBit(column->validity, rowIndex);
+    column->nullCount++;
+
+    sketchRemoveValues(db, colIndex, 1);
+
+    // NULL cells hold zero, so what gets gathered and compressed doesn't depend on what was there
+    memset(&db->rows[rowIndex].cells[colIndex], 0, sizeof(Cell));
+
+    markCellDirty(db, rowIndex, colIndex);
+    notifyCellWrite(db, rowIndex, colIndex, old, 0);
+
+    STATS_ADD(STAT_COUNTER_CELLS_WRITTEN, 1);
+
+    return 0;
+}
+
+int addInt(Database* db, size_t rowIndex, size_t colIndex, int value) {
+    STATS_BEGIN_SAMPLED();
+
+    int result = writeCell(db, rowIndex, colIndex, INT_TYPE, (DataValues){.i = value});
+
+    STATS_END_SAMPLED(STAT_ADD_INT);
+    return result;
+}
+
+int addFloat(Database* db, size_t rowIndex, size_t colIndex, float value) {
+    STATS_BEGIN_SAMPLED();
+
+    int result = writeCell(db, rowIndex, colIndex, FLOAT_TYPE, (DataValues){.f = value});
+
+    STATS_END_SAMPLED(STAT_ADD_FLOAT);
+    return result;
+}
+
+int addDouble(Database* db, size_t rowIndex, size_t colIndex, double value) {
+    STATS_BEGIN_SAMPLED();
+
+    int result = writeCell(db, rowIndex, colIndex, DOUBLE_TYPE, (DataValues){.d = value});
+
+    STATS_END_SAMPLED(STAT_ADD_DOUBLE);
+    return result;
+}
+
+typedef struct {
+
+    char data[PRINT_BUFFER_SIZE];
+    size_t used;
+
+} PrintPage;
+
+static void flushPage(PrintPage* page) {
+
+    fwrite(page->data, 1, page->used, stdout);
+    page->used = 0;
+}
+
+// Append printf style text to the page, writing the page out when it fills up
+static void pagePrintf(PrintPage* page, const char* format, ...) {
+
+    va_list ap;
+
+    va_start(ap, format);
+    int len = vsnprintf(page->data + page->used, PRINT_BUFFER_SIZE - page->used, format, ap);
+    va_end(ap);
+
+    if (len < 0)
+        return;
+
+    if (page->used + len >= PRINT_BUFFER_SIZE) {
+        flushPage(page);
+
+        va_start(ap, format);
+        len = vsnprintf(page->data, PRINT_BUFFER_SIZE, format, ap);
+        va_end(ap);
+
+        if (len >= PRINT_BUFFER_SIZE)
+            len = PRINT_BUFFER_SIZE - 1;
     }
 
-    // First check if our passed value is compatible with the type at the index
-    if (db->cols[colIndex].type != DOUBLE_TYPE) {
-        fprintf(stderr, "Type mismatch. Expected 'DOUBLE_TYPE'.\n");
-        return -1;
+    page->used += len;
+}
+
+static void pageRule(PrintPage* page, const int* widths, size_t numCols) {
+
+    for (size_t col = 0; col < numCols; col++) {
+        pagePrintf(page, "-");
+        for (int i = 0; i < widths[col]; i++)
+            pagePrintf(page, "-");
     }
 
-    db->rows[rowIndex].cells[colIndex].value.d = value;
-    return 0;
+    pagePrintf(page, "-\n");
+}
+
+// Text for one cell as tables show it, returns its length
+static int formatCell(Database* db, size_t rowIndex, size_t colIndex, char* out, size_t size) {
+
+    if (colIndex >= db->numCols) {
+
+        DataValues value;
+
+        if (computedCell(db, colIndex, rowIndex, &value) <= 0)
+            return snprintf(out, size, "NULL");
+
+        return typeOps(columnType(db, colIndex))->format(out, size, value);
+    }
+
+    if (isCellNull(db, rowIndex, colIndex))
+        return snprintf(out, size, "NULL");
+
+    return typeOps(db->cols[colIndex].type)->format(out, size, db->rows[rowIndex].cells[colIndex].value);
 }
 
 void printDatabase(Database* db) {
+    printDatabaseRows(db, 0, db->numRows);
+}
+
+/* Prints limit rows starting at offset. Column widths come from the column
+   names and a sample of the printed rows (values wider than that still print
+   in full), and output goes out a page at a time instead of a printf per cell */
+void printDatabaseRows(Database* db, size_t offset, size_t limit) {
 
     if (!(db->cols)) {
         printf("Database has no rows or columns.\n");
         return;
     }
 
-    size_t width = db->numCols * 15 + db->numCols + 1;
+    STATS_BEGIN();
 
-    for (size_t i = 0; i < width; i++)
-        printf("-");
-    printf("\n");
+    if (offset > db->numRows)
+        offset = db->numRows;
 
-    for (size_t i = 0; i < db->numCols; i++) {
-        printf("|%-15s", db->cols[i].colName);
-    }
-    printf("|\n");
-
-    for (size_t i = 0; i < width; i++)
-        printf("-");
-    printf("\n");
-
-    for (size_t j = 0; j <db->numRows; j++) {
-        for (size_t k = 0; k < db->numCols; k++) {
-            if (db->cols[k].type == INT_TYPE)
-                printf("|%-15d", db->rows[j].cells[k].value.i);
-            else if (db->cols[k].type == FLOAT_TYPE) 
-                printf("|%-15f", db->rows[j].cells[k].value.f);
-            else if (db->cols[k].type == DOUBLE_TYPE) 
-                printf("|%-15lf", db->rows[j].cells[k].value.d);
-            else {
-                printf("| haleem.");
-            }
+    if (limit > db->numRows - offset)
+        limit = db->numRows - offset;
+
+    // Computed columns print after the stored ones
+    size_t numCols = totalColumns(db);
+    int* widths = malloc(numCols * sizeof(int));
+    PrintPage* page = malloc(sizeof(PrintPage));
+
+    if (!widths || !page) {
+        fprintf(stderr, "malloc returned NULL pointer for printDatabase\n");
+        exit(1);
+    }
+
+    page->used = 0;
+
+    size_t step = limit > PRINT_SAMPLE_ROWS ? limit / PRINT_SAMPLE_ROWS : 1;
+    // Room for any value, only the column width is capped
+    char cell[VALUE_TEXT_LEN];
+
+    for (size_t col = 0; col < numCols; col++) {
+
+        widths[col] = strlen(columnName(db, col));
+
+        for (size_t r = offset; r < offset + limit; r += step) {
+            int len = formatCell(db, r, col, cell, sizeof(cell));
+            if (len > widths[col])
+                widths[col] = len;
+        }
+
+        if (widths[col] > PRINT_MAX_COL_WIDTH)
+            widths[col] = PRINT_MAX_COL_WIDTH;
+    }
+
+    pageRule(page, widths, numCols);
+
+    for (size_t col = 0; col < numCols; col++)
+        pagePrintf(page, "|%-*s", widths[col], columnName(db, col));
+    pagePrintf(page, "|\n");
+
+    pageRule(page, widths, numCols);
+
+    for (size_t r = offset; r < offset + limit; r++) {
+
+        for (size_t col = 0; col < numCols; col++) {
+            formatCell(db, r, col, cell, sizeof(cell));
+            pagePrintf(page, "|%-*s", widths[col], cell);
         }
-        printf("|\n");
+
+        pagePrintf(page, "|\n");
     }
+
+    if (limit < db->numRows) {
+        if (limit)
+            pagePrintf(page, "(rows %zu-%zu of %zu)\n", offset, offset + limit - 1, db->numRows);
+        else
+            pagePrintf(page, "(0 of %zu rows)\n", db->numRows);
+    }
+
+    flushPage(page);
+
+    free(page);
+    free(widths);
+
+    STATS_ADD(STAT_COUNTER_ROWS_SCANNED, limit);
+    STATS_END(STAT_PRINT_DB);
 }
 
 // Loads column header and type from a csv
-size_t loadColumnsFromCSV(Database* db, FILE* csvPtr) {
+size_t loadColumnsFromCSV(Database* db, IoFile* csvFile) {
 
     size_t numCols = 0;
 
-    char nameBuffer[1024];
-    char typeBuffer[1024];
+    char nameBuffer[1024] = "";
+    char typeBuffer[1024] = "";
+    char* line;
+    size_t length;
 
     // Read the headers (first line), tokenize the strings, then read the 
-    fgets(nameBuffer, sizeof(nameBuffer), csvPtr);
-    fgets(typeBuffer, sizeof(typeBuffer), csvPtr);
+    if ((line = ioReadLine(csvFile, &length)))
+        snprintf(nameBuffer, sizeof(nameBuffer), "%s", line);
+    if ((line = ioReadLine(csvFile, &length)))
+        snprintf(typeBuffer, sizeof(typeBuffer), "%s", line);
 
     char* nameSave; 
     char* typeSave;
@@ -324,18 +1216,14 @@ size_t loadColumnsFromCSV(Database* db, FILE* csvPtr) {
     // Creating columns based on the name and type
     while (nameTokens && typeTokens) {
 
-        // Trim new line characters
-        nameTokens[strcspn(nameTokens, "\n")] = 0;
-        typeTokens[strcspn(typeTokens, "\n")] = 0;
+        // Trim carriage returns
+        nameTokens[strcspn(nameTokens, "\r\n")] = 0;
+        typeTokens[strcspn(typeTokens, "\r\n")] = 0;
 
-        if (strcmp("INT", typeTokens) == 0) {
-            createColumn(db, nameTokens, INT_TYPE);
-        }
-        else if (strcmp("FLOAT", typeTokens) == 0) {
-            createColumn(db, nameTokens, FLOAT_TYPE);
-        }
-        else if (strcmp("DOUBLE", typeTokens) == 0) {
-            createColumn(db, nameTokens, DOUBLE_TYPE);
+        DataTypes type;
+
+        if (findDataType(typeTokens, &type) == 0) {
+            createColumn(db, nameTokens, type);
         }
         else {
             fprintf(stderr, "Error: unknown type '%s' for column %s\n", typeTokens, nameTokens);
@@ -350,97 +1238,146 @@ size_t loadColumnsFromCSV(Database* db, FILE* csvPtr) {
     return numCols;
 }
 
-// Loads rows from a csv 
-size_t loadRowFromCSV(Database* db, FILE* csvPtr, size_t numCols) {
+// Append the rows parsed so far and start a new batch. validity holds a bitmap of
+// CSV_BATCH_ROWS bits per column, batch->validity points at those of columns that got a NULL
+static void flushCSVBatch(Database* db, BulkBatch* batch, uint64_t* validity, const uint64_t** nullableCols) {
+
+    if (batch->numRows)
+        appendRows(db, batch);
+
+    batch->numRows = 0;
+
+    memset(validity, 0, db->numCols * VALIDITY_WORDS(CSV_BATCH_ROWS) * sizeof(uint64_t));
+    memset(nullableCols, 0, db->numCols * sizeof(uint64_t*));
+}
+
+// Loads rows from a csv, rows are parsed into a batch and appended CSV_BATCH_ROWS at a time
+// An empty field is a NULL
+size_t loadRowFromCSV(Database* db, IoFile* csvFile, size_t numCols) {
 
     size_t numRows = 0;
     size_t numTokens;
+    int failed = 0;
 
-    char rowBuffer[1024];  
+    char* rowBuffer;
+    size_t length;
 
-    char* valueBuffer;
-    char* endPtr;
+    if (!numCols || numCols != db->numCols) {
+        fprintf(stderr, "Error: file columns don't match the table columns\n");
+        return 0;
+    }
 
-    // Parse the individual data values, convert to the required 
-    while ((fgets(rowBuffer, sizeof(rowBuffer), csvPtr))) {
+    DataValues* values = malloc(CSV_BATCH_ROWS * numCols * sizeof(DataValues));
+    uint64_t* validity = calloc(numCols * VALIDITY_WORDS(CSV_BATCH_ROWS), sizeof(uint64_t));
+    const uint64_t** nullableCols = calloc(numCols, sizeof(uint64_t*));
 
-        // Create the row
-        createRow(db);
-    
-        // Tokenize the values, add them to the row
+    if (!values || !validity || !nullableCols) {
+        fprintf(stderr, "malloc returned NULL pointer for CSV row batch\n");
+        exit(1);
+    }
+
+    BulkBatch batch = {ROW_MAJOR, 0, numCols, NULL, values, NULL, nullableCols};
+
+    // Parse the individual data values, convert to the required. The next chunks are
+    // already being read while this one is parsed
+    while (!failed && (rowBuffer = ioReadLine(csvFile, &length))) {
+
+        DataValues* row = values + batch.numRows * numCols;
+
+        // Trim new lines
+        rowBuffer[strcspn(rowBuffer, "\r\n")] = 0;
+
+        // Split on commas by hand, strtok would skip the empty fields
+        char* field = rowBuffer;
         numTokens = 0; 
 
-        valueBuffer = strtok(rowBuffer, ",");
+        while (field) {
+
+            char* comma = strchr(field, ',');
 
-        while (valueBuffer) {
+            if (comma)
+                *comma = '\0';
 
             // Check that the number of tokens does not exceed the number of columns
             if (numTokens >= numCols) {
                 fprintf(stderr, "Error: file has extraneous column values\n");
-                return 0;
+                failed = 1;
+                break;
             }
 
-            // Trim new lines
-            valueBuffer[strcspn(valueBuffer, "\n")] = 0;
-
-            // Check the column type and perform the correct conversion
-            switch(db->cols[numTokens].type) {
-
-                case INT_TYPE:
-                    if (addInt(db, numRows, numTokens, strtol(valueBuffer, &endPtr, 10)) < 0) 
-                        return 0;
-                    break;
-                case FLOAT_TYPE:
-                    if (addFloat(db, numRows, numTokens, strtof(valueBuffer, &endPtr)) < 0)
-                        return 0;
-                    break;
-                case DOUBLE_TYPE:
-                    if (addDouble(db, numRows, numTokens, strtod(valueBuffer, &endPtr)) < 0)
-                        return 0;
-                    break;
-                default:
-                    printf("Unknown type.\n");
+            uint64_t* bits = validity + numTokens * VALIDITY_WORDS(CSV_BATCH_ROWS);
+
+            if (*field == '\0') {
+                row[numTokens] = (DataValues){0};
+                nullableCols[numTokens] = bits;
+            } else {
+                // Like before a value with trailing junk keeps what parsed
+                typeOps(db->cols[numTokens].type)->parse(field, &row[numTokens]);
+                bits[batch.numRows / 64] |= 1ull << (batch.numRows % 64);
             }
+
             // Increase our number of tokens
             numTokens++;
-            valueBuffer = strtok(NULL, ",");
+            field = comma ? comma + 1 : NULL;
         }
+
+        if (failed)
+            break;
+
         if (numTokens != numCols) {
             fprintf(stderr, "Error: too few tokens to assign to columns.\n");
-            return 0;
+            failed = 1;
+            break;
         }
         numRows++;
+
+        if (++batch.numRows == CSV_BATCH_ROWS)
+            flushCSVBatch(db, &batch, validity, nullableCols);
     }
 
-    return numRows;
+    if (!failed && ioFailed(csvFile)) {
+        perror("Error reading CSV rows");
+        failed = 1;
+    }
+
+    flushCSVBatch(db, &batch, validity, nullableCols);
+    free(values);
+    free(validity);
+    free(nullableCols);
+
+    return failed ? 0 : numRows;
 }
 
 // Loads a database from a .csv file
 // Should return a Database struct built with the .csv file
 Database* loadDatabaseFromCSV(const char* fileName) {
 
-    Database* db = createDatabase(fileName);
-
     size_t numCols = 0;
     size_t numRows = 0;
 
-    char nameBuffer[1024];
-    char typeBuffer[1024];
-
-    // Open the .csv file
-    FILE* csvPtr = fopen(fileName, "r");
+    // Open the .csv file, reads of the first chunks start right away
+    IoFile* csvFile = ioOpenRead(fileName);
 
-    if (!csvPtr) {
+    if (!csvFile) {
         fprintf(stderr, "Unable to open file: %s\n", fileName);
         return NULL;
     }
 
-    numCols = loadColumnsFromCSV(db, csvPtr);
-    numRows = loadRowFromCSV(db, csvPtr, numCols);
+    STATS_BEGIN();
+
+    Database* db = createDatabase(fileName);
+
+    numCols = loadColumnsFromCSV(db, csvFile);
+    numRows = loadRowFromCSV(db, csvFile, numCols);
 
     if (!numRows) {
         fprintf(stderr, "Error: could not read CSV rows.\n");
     }
+
+    ioClose(csvFile);
+
+    STATS_ADD(STAT_COUNTER_ROWS_LOADED, numRows);
+    STATS_END(STAT_LOAD_CSV);
     
     return db;
 }
@@ -449,78 +1386,67 @@ Database* loadDatabaseFromCSV(const char* fileName) {
 // This needs to be cleaned up
 void saveDatabaseToCSV(Database* db, const char* fileName) {
 
+    saveDatabaseToCSVWithProgress(db, fileName, NULL, NULL);
+}
+
+// Saves the database to a .csv file, calling progress (if set) after every
+// SAVE_PROGRESS_INTERVAL rows and once more when the last row is written
+// Returns 0 on success and -1 if the file could not be written
+int saveDatabaseToCSVWithProgress(Database* db, const char* fileName, SaveProgressFn progress, void* ctx) {
+
     // Our file to create
-    FILE* csvPtr = fopen(fileName, "w");
+    IoFile* csvFile = ioOpenWrite(fileName);
 
     // Exit if we can't open the file
-    if (!csvPtr) {
+    if (!csvFile) {
         fprintf(stderr, "Unable to create file: %s\n", fileName);
-        fclose(csvPtr);
-        return;
+        return -1;
     }
 
+    STATS_BEGIN();
+
     // Write the column headers to the file
     for (size_t col = 0; col < db->numCols; col++) {
         // TODO: First special case, check if the string contains a comma, if so, enclose the string in double quotes (add when string support added)
 
-        fprintf(csvPtr, "%s", db->cols[col].colName);
-    
-        if (col < db->numCols - 1)
-            // Before the last column, seperate the names by commas
-            fputc(',', csvPtr);
-        else 
-            // Last column, replace the comma with a newline
-            fputc('\n', csvPtr);
+        ioWrite(csvFile, db->cols[col].colName, strlen(db->cols[col].colName));
+
+        // Before the last column, seperate the names by commas, after it a newline
+        ioWrite(csvFile, col < db->numCols - 1 ? "," : "\n", 1);
     }
 
     for (size_t col = 0; col < db->numCols; col++) {
-        fprintf(csvPtr, "%s", data_types[db->cols[col].type]);
-        if (col < db->numCols - 1)
-            // Before the last column, seperate the names by commas
-            fputc(',', csvPtr);
-        else 
-            // Last column, replace the comma with a newline
-            fputc('\n', csvPtr);
+        ioWrite(csvFile, data_types[db->cols[col].type], strlen(data_types[db->cols[col].type]));
+        ioWrite(csvFile, col < db->numCols - 1 ? "," : "\n", 1);
     }
 
+    char cell[VALUE_TEXT_LEN];
+
+    // Full chunks are written out while the next ones are formatted
     for (size_t r = 0; r < db->numRows; r++) {
-        for (size_t c = 0; c < db->numCols - 1; c++) {
-            // Need to check the data type
-            switch(db->cols[c].type) {
-                case INT_TYPE :     
-                    fprintf(csvPtr, "%d,", db->rows[r].cells[c].value.i); 
-                    break;
-                case FLOAT_TYPE :   
-                    fprintf(csvPtr, "%f,", db->rows[r].cells[c].value.f); 
-                    break;
-                case DOUBLE_TYPE :  
-                    fprintf(csvPtr, "%lf,", db->rows[r].cells[c].value.d); 
-                    break;
-                default :   
-                    fprintf(stderr, "Unknown type, cannot write to file.\n");
-                    return;
-            }
-        }
-        // Repetitive, i should change this
-        switch(db->cols[db->numCols-1].type) {
-            case INT_TYPE :     
-                fprintf(csvPtr, "%d\n", db->rows[r].cells[db->numCols-1].value.i); 
-                break;
-            case FLOAT_TYPE :   
-                fprintf(csvPtr, "%f\n", db->rows[r].cells[db->numCols-1].value.f); 
-                break;
-            case DOUBLE_TYPE :  
-                fprintf(csvPtr, "%lf\n", db->rows[r].cells[db->numCols-1].value.d); 
-                break;
-            default :   
-                fprintf(stderr, "Unknown type, cannot write to file.\n");
-                fclose(csvPtr);
-                return;
+        for (size_t c = 0; c < db->numCols; c++) {
+            // NULL is an empty field
+            int len = isCellNull(db, r, c) ? 0
+                : typeOps(db->cols[c].type)->format(cell, sizeof(cell) - 1, db->rows[r].cells[c].value);
+            // Commas between values, a newline after the last one
+            cell[len++] = c < db->numCols - 1 ? ',' : '\n';
+            ioWrite(csvFile, cell, len);
         }
 
+        if (progress && ((r + 1) % SAVE_PROGRESS_INTERVAL == 0 || r + 1 == db->numRows))
+            progress(r + 1, db->numRows, ctx);
+    }
+
+    // ioClose waits for the writes still in flight, so this is where a full disk shows up
+    if (ioClose(csvFile) != 0) {
+        fprintf(stderr, "Error writing file: %s (%s)\n", fileName, strerror(errno));
+        return -1;
     }
 
-    fclose(csvPtr);
+    STATS_ADD(STAT_COUNTER_ROWS_SCANNED, db->numRows);
+    STATS_END(STAT_SAVE_CSV);
+
+    return 0;
 }
 
 void changeColumnName(Database* db, char* newName, char* column) {
@@ -543,19 +1469,76 @@ void changeColumnName(Database* db, char* newName, char* column) {
     }
     // Change the name if the specified column is found
     if (found) {
+        char oldName[STRING_LEN];
+
         printf("Changing column: '%s' to '%s.\n", db->cols[index].colName, newName);
+        memcpy(oldName, db->cols[index].colName, STRING_LEN);
         strncpy(db->cols[index].colName, newName, STRING_LEN);
+        db->cols[index].colName[STRING_LEN - 1] = '\0';
+        renameComputedSource(db, oldName, db->cols[index].colName);
+        notifyTableMutation(db, MUTATION_RENAME_COLUMN, 0, 0, index, (DataValues){0});
     } else {
         printf("Column: '%s' not found.\n", column);
     }
 
 }
 // Calculate the average value of a row
-double calculateRowAverage(Database* db) {
+double calculateRowAverage(Database* db, size_t rowIndex) {
+
+    if (rowIndex >= db->numRows || !db->numCols)
+        return 0.0;
 
+    Cell* cells = db->rows[rowIndex].cells;
+    double sum = 0.0;
+    size_t valid = 0;
+
+    // NULLs are left out of the average
+    for (size_t col = 0; col < db->numCols; col++) {
+        if (!isCellNull(db, rowIndex, col)) {
+            sum += typeOps(db->cols[col].type)->toDouble(cells[col].value);
+            valid++;
+        }
+    }
+
+    return valid ? sum / valid : 0.0;
 }
 
 // Calculate the average value of a column
-double calculateColAverage(Database* db) {
+double calculateColAverage(Database* db, size_t colIndex) {
+
+    if (colIndex >= db->numCols || !db->numRows)
+        return 0.0;
+
+    const TypeOps* ops = typeOps(db->cols[colIndex].type);
+    Column* column = &db->cols[colIndex];
+
+    if (!column->nullCount) {
+        STATS_ADD(STAT_COUNTER_ROWS_SCANNED, db->numRows);
+        return ops->sum(db->rows, colIndex, db->numRows) / db->numRows;
+    }
+
+    double sum = 0.0;
+    size_t valid = 0;
+
+    // A popcount of each block's bitmap says if it has NULLs, blocks without go through the plain kernel
+    for (size_t first = 0; first < db->numRows; first += BLOCK_ROWS) {
+
+        size_t count = db->numRows - first < BLOCK_ROWS ? db->numRows - first : BLOCK_ROWS;
+        size_t blockValid = countBits(column->validity, first, count);
 
-}
\ No newline at end of file
+        if (blockValid == count) {
+            sum += ops->sum(db->rows + first, colIndex, count);
+        } else if (blockValid) {
+            for (size_t r = first; r < first + count; r++) {
+                if (testBit(column->validity, r))
+                    sum += ops->toDouble(db->rows[r].cells[colIndex].value);
+            }
+        }
+
+        valid += blockValid;
+    }
+
+    STATS_ADD(STAT_COUNTER_ROWS_SCANNED, db->numRows);
+
+    return valid ? sum / valid : 0.0;
+}
@@ -2,76 +2,208 @@
 #define DATABASE_H
 
 #define STRING_LEN 30
-#define DB_LIMIT 16
+#define SAVE_PROGRESS_INTERVAL 4096
+#define CSV_BATCH_ROWS 4096
+
+// Rows per block for dirty tracking and compressed storage
+#define BLOCK_ROWS 4096
+
+// Table printing: output is built in PRINT_BUFFER_SIZE pages and column widths
+// are sized from up to PRINT_SAMPLE_ROWS of the rows being printed
+#define PRINT_BUFFER_SIZE (64 * 1024)
+#define PRINT_SAMPLE_ROWS 256
+#define PRINT_MAX_COL_WIDTH 32
+
+// Words in a validity bitmap covering rows rows
+#define VALIDITY_WORDS(rows) (((rows) + 63) / 64)
 
 #include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "types.h"
 
-extern const char* data_types[];
+typedef struct {
 
-typedef enum {
+    DataTypes type;
+    char colName[STRING_LEN];
+
+    // Changes whenever a cell in the column is written, see nextVersion
+    unsigned long long version;
 
-    INT_TYPE,
-    FLOAT_TYPE,
-    DOUBLE_TYPE,
-    STRING_TYPE
+    // NULLs: one bit per row (rowCapacity bits), set when the cell holds a value. Only
+    // allocated once the column gets its first NULL, bits past numRows are always clear
+    uint64_t* validity;
+    size_t nullCount;
 
-} DataTypes;
+    // Optional per block Bloom filter for = and in filters, see bloom.h
+    struct BloomFilter* bloom;
 
-typedef union {
+    // Optional distinct count and percentile sketches, see sketch.h
+    struct ColumnSketch* sketch;
 
-    int i;
-    float f;
-    double d;
-    char* s;
+} Column;
 
-} DataValues;
+// Columns defined by an expression, see expr.h
+struct ComputedColumn;
+
+// Files read and written through the chunked I/O layer, see fileio.h
+struct IoFile;
 
 typedef struct {
 
-    DataValues value;
+    Column* cols;
+    Row* rows;
+    size_t numRows;
+    size_t numCols;
+    size_t rowCapacity;
+    // Size of the mapping rows lives in when it was placed by hugemem.c, 0 when malloc'd
+    size_t rowsMapped;
+    char dbName[STRING_LEN];
+    Arena* arena;
 
-} Cell;
+    // Incremental saves: one dirty bit per (block of BLOCK_ROWS rows, column) changed since
+    // the last save to the block store with storeGeneration. allDirty means rewrite everything
+    unsigned char* dirty;
+    size_t dirtyBlocks;
+    int allDirty;
+    unsigned long long storeGeneration;
 
-typedef struct {
+    // Changes whenever rows are added or removed
+    unsigned long long rowsVersion;
 
-    DataTypes type;
-    char colName[STRING_LEN];
+    // Set while the table is in the catalog, only changes to observed tables are reported
+    int observed;
 
-} Column;
+    // Computed columns, numbered after the stored ones: column numCols + i is computed[i]
+    struct ComputedColumn** computed;
+    size_t numComputed;
 
-typedef struct {
+} Database;
 
-    Cell* cells;
+typedef enum {
+
+    ROW_MAJOR,
+    COLUMN_MAJOR
 
-} Row;
+} BulkLayout;
 
+// A batch of rows for appendRows
+// ROW_MAJOR: values holds numRows * numCols DataValues, one row after another
+// COLUMN_MAJOR: columns holds one int/float/double array of numRows values per column
+// validity is optional, one bitmap of numRows bits per column (NULL for a column with no NULLs)
 typedef struct {
 
-    Column* cols;
-    Row* rows;
+    BulkLayout layout;
     size_t numRows;
     size_t numCols;
-    char dbName[STRING_LEN];
+    const DataTypes* types;
+    const DataValues* values;
+    const void* const* columns;
+    const uint64_t* const* validity;
 
-} Database;
+} BulkBatch;
+
+/* Changes to tables in the catalog are reported to the registered observers,
+   e.g. to stream them to replicas. Deletes are reported while the row or column
+   is still there, everything else right after the change */
+typedef enum {
+
+    MUTATION_ADD_TABLE,
+    MUTATION_DROP_TABLE,
+    MUTATION_CREATE_COLUMN,
+    MUTATION_DELETE_COLUMN,
+    MUTATION_RENAME_COLUMN,
+    MUTATION_APPEND_ROWS,
+    MUTATION_DELETE_ROW,
+    MUTATION_WRITE_CELL
+
+} MutationType;
+
+typedef struct {
+
+    MutationType type;
+    // NULL for MUTATION_DROP_TABLE of a table that isn't loaded
+    Database* db;
+    const char* table;
+
+    // APPEND_ROWS adds rows [row, row + numRows)
+    size_t row;
+    size_t numRows;
+    size_t col;
+
+    // What a MUTATION_WRITE_CELL overwrote, oldNull if the cell was NULL
+    DataValues oldValue;
+    int oldNull;
+
+} Mutation;
+
+#define MAX_MUTATION_OBSERVERS 8
+
+typedef void (*MutationObserver)(const Mutation* mutation, void* ctx);
+
+// Called by saveDatabaseToCSVWithProgress as rows are written out
+typedef void (*SaveProgressFn)(size_t rowsWritten, size_t totalRows, void* ctx);
 
 Database* createDatabase(const char* name);
 Database* loadDatabaseFromCSV(const char* fileName);
 
 void createColumn(Database* db, const char* name, DataTypes type);
 void createRow(Database* db);
+void reserveRows(Database* db, size_t capacity);
 void deleteDatabase(Database* db);
 void deleteRow(Database* db, size_t rowIndex);
+int removeRow(Database* db, size_t rowIndex);
 void deleteColumn(Database* db, size_t columnIndex);
 void printDatabase(Database* db);
+void printDatabaseRows(Database* db, size_t offset, size_t limit);
 void saveDatabaseToCSV(Database* db, const char* fileName);
 void changeColumnName(Database* db, char* newName, char* column);
 
+int saveDatabaseToCSVWithProgress(Database* db, const char* fileName, SaveProgressFn progress, void* ctx);
+int appendRows(Database* db, const BulkBatch* batch);
 int addInt(Database* db, size_t rowIndex, size_t colIndex, int value);
 int addFloat(Database* db, size_t rowIndex, size_t colIndex, float value);
 int addDouble(Database* db, size_t rowIndex, size_t colIndex, double value);
-
-size_t loadColumnsFromCSV(Database* db, FILE* csvPtr);
-size_t loadRowFromCSV(Database* db, FILE* csvPtr, size_t numCols);
+int writeCell(Database* db, size_t rowIndex, size_t colIndex, DataTypes type, DataValues value);
+int setCellNull(Database* db, size_t rowIndex, size_t colIndex);
+int writeColumnRows(Database* db, size_t colIndex, DataTypes type, const size_t* rowIndexes, size_t count,
+    const void* values, const uint64_t* validity);
+
+size_t databaseMemoryUsage(Database* db);
+
+unsigned long long nextVersion();
+double calculateRowAverage(Database* db, size_t rowIndex);
+double calculateColAverage(Database* db, size_t colIndex);
+
+void markCellDirty(Database* db, size_t rowIndex, size_t colIndex);
+void markRowsDirty(Database* db, size_t fromRow);
+void markAllDirty(Database* db);
+void clearDirty(Database* db);
+int isBlockDirty(Database* db, size_t block, size_t colIndex);
+
+size_t countValid(Database* db, size_t colIndex, size_t firstRow, size_t count);
+size_t gatherValidity(Database* db, size_t colIndex, size_t firstRow, size_t count, uint64_t* out);
+size_t gatherValidityRows(Database* db, size_t colIndex, const size_t* rowIndexes, size_t count, uint64_t* out);
+void moveRowValidity(Database* db, size_t from, size_t to);
+void trimValidity(Database* db);
+
+int addMutationObserver(MutationObserver observer, void* ctx);
+void removeMutationObserver(MutationObserver observer, void* ctx);
+void notifyMutation(const Mutation* mutation);
+void notifyTableMutation(Database* db, MutationType type, size_t row, size_t numRows, size_t col, DataValues oldValue);
+size_t loadColumnsFromCSV(Database* db, struct IoFile* csvFile);
+size_t loadRowFromCSV(Database* db, struct IoFile* csvFile, size_t numCols);
+
+// Stored and computed columns, any column index below this is valid for queries
+static inline size_t totalColumns(const Database* db) {
+    return db->numCols + db->numComputed;
+}
+
+static inline int isCellNull(const Database* db, size_t rowIndex, size_t colIndex) {
+
+    const Column* col = &db->cols[colIndex];
+
+    return col->nullCount && !((col->validity[rowIndex / 64] >> (rowIndex % 64)) & 1);
+}
 
 #endif
\ No newline at end of file
@@ -1,10 +1,53 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "database_list.h"
 #include "database.h"
+#include "snapshot.h"
+#include "blockstore.h"
+#include "arrow.h"
+#include "stats.h"
 
-// Instantiate a database list
+static pthread_mutex_t catalogLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Held by the CLI while a command runs and by replication while it applies
+   or snapshots tables, so the two never work on the catalog at the same time */
+void lockCatalog() {
+    pthread_mutex_lock(&catalogLock);
+}
+
+void unlockCatalog() {
+    pthread_mutex_unlock(&catalogLock);
+}
+
+// FNV-1a hash of a table name
+static size_t hashName(const char* name) {
+
+    size_t hash = 2166136261u;
+
+    for (size_t i = 0; i < STRING_LEN && name[i]; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static DatabaseEntry** allocBuckets(size_t numBuckets) {
+
+    DatabaseEntry** buckets = calloc(numBuckets, sizeof(DatabaseEntry*));
+
+    if (!buckets) {
+        fprintf(stderr, "calloc returned NULL ptr for DatabaseList buckets\n");
+        exit(1);
+    }
+
+    return buckets;
+}
+
+// Instantiate a database list, a limit of 0 means there's no limit on the number of tables
 DatabaseList* createDatabaseList(size_t limit) {
 
     DatabaseList* dbl = malloc(sizeof(DatabaseList));
@@ -14,83 +57,466 @@ DatabaseList* createDatabaseList(size_t limit) {
         exit(1);
     }
 
-    dbl->dbList = NULL;
+    dbl->numBuckets = DB_LIST_INITIAL_BUCKETS;
+    dbl->buckets = allocBuckets(dbl->numBuckets);
+    dbl->first = NULL;
+    dbl->last = NULL;
     dbl->dbCount = 0;
     dbl->dbLimit = limit;
+    dbl->memoryBudget = 0;
+    dbl->clock = 0;
+    dbl->hits = 0;
+    dbl->misses = 0;
+    dbl->evictions = 0;
+    dbl->spillCount = 0;
+    dbl->evictToMemory = 0;
 
     return dbl;
 }
 
-// Adds a database to our list of active DBs
-void addDatabaseToList(Database* db, DatabaseList* dbl) {
+int databaseListFull(DatabaseList* dbl) {
+    return dbl->dbLimit && dbl->dbCount >= dbl->dbLimit;
+}
+
+// Double the bucket array once the average chain gets longer than one entry
+static void growBuckets(DatabaseList* dbl) {
+
+    size_t numBuckets = dbl->numBuckets * 2;
+    DatabaseEntry** buckets = allocBuckets(numBuckets);
+
+    for (DatabaseEntry* entry = dbl->first; entry; entry = entry->next) {
+        size_t bucket = hashName(entry->dbName) & (numBuckets - 1);
+        entry->nextInBucket = buckets[bucket];
+        buckets[bucket] = entry;
+    }
+
+    free(dbl->buckets);
+    dbl->buckets = buckets;
+    dbl->numBuckets = numBuckets;
+}
+
+// Links a new entry into its bucket and onto the end of the list
+static DatabaseEntry* insertEntry(DatabaseList* dbl, const char* name) {
 
-    if (dbl->dbCount >= dbl->dbLimit) {
+    if (databaseListFull(dbl)) {
         printf("Database List has reached its maximum size. Delete a Database to continue. \n");
-        return;
+        return NULL;
     }
 
-    Database** newDbList = realloc(dbl->dbList, (dbl->dbCount + 1) * sizeof(Database*));
+    if (findDatabaseInList(dbl, name)) {
+        printf("Database with name %s already exists. Choose a new name.\n", name);
+        return NULL;
+    }
 
-    if (!newDbList) {
-        fprintf(stderr, "Failed to realloc memory for db list\n");
+    if (dbl->dbCount + 1 > dbl->numBuckets)
+        growBuckets(dbl);
+
+    DatabaseEntry* entry = calloc(1, sizeof(DatabaseEntry));
+
+    if (!entry) {
+        fprintf(stderr, "calloc returned NULL ptr for DatabaseEntry object\n");
         exit(1);
     }
 
-    dbl->dbList = newDbList;
-    dbl->dbList[dbl->dbCount] = db;
+    strncpy(entry->dbName, name, STRING_LEN);
+    entry->dbName[STRING_LEN - 1] = '\0';
+
+    size_t bucket = hashName(entry->dbName) & (dbl->numBuckets - 1);
+    entry->nextInBucket = dbl->buckets[bucket];
+    dbl->buckets[bucket] = entry;
+
+    entry->prev = dbl->last;
+    if (dbl->last)
+        dbl->last->next = entry;
+    else
+        dbl->first = entry;
+    dbl->last = entry;
+
     dbl->dbCount++;
 
+    return entry;
+}
+
+// Adds a database to our list of active DBs, returns its handle or NULL if it couldn't be added
+DatabaseEntry* addDatabaseToList(Database* db, DatabaseList* dbl) {
+
+    DatabaseEntry* entry = insertEntry(dbl, db->dbName);
+
+    if (!entry)
+        return NULL;
+
+    entry->db = db;
+    entry->lastUsed = ++dbl->clock;
+
+    db->observed = 1;
+    notifyTableMutation(db, MUTATION_ADD_TABLE, 0, 0, 0, (DataValues){0});
+
     printf("Successfully added Database: %s\n", db->dbName);
+
+    return entry;
 }
 
-// Searches for a Database object by name in a DatabaseList
-int findDatabaseInList(DatabaseList* dbl, const char* name) {
+// Registers a table stored in a .csv file without loading it, it is loaded the first time it's opened
+DatabaseEntry* registerDatabaseFile(DatabaseList* dbl, const char* name, const char* fileName) {
+
+    DatabaseEntry* entry = insertEntry(dbl, name);
+
+    if (!entry)
+        return NULL;
+
+    strncpy(entry->fileName, fileName, FILE_NAME_LEN);
+    entry->fileName[FILE_NAME_LEN - 1] = '\0';
 
-    for (size_t i = 0; i < dbl->dbCount; i++) {
+    printf("Successfully registered Database: %s\n", entry->dbName);
+
+    return entry;
+}
+
+// Searches for a Database entry by name in a DatabaseList
+DatabaseEntry* findDatabaseInList(DatabaseList* dbl, const char* name) {
+
+    STATS_BEGIN_SAMPLED();
+
+    DatabaseEntry* entry = dbl->buckets[hashName(name) & (dbl->numBuckets - 1)];
+
+    for (; entry; entry = entry->nextInBucket) {
         // Found the right db
-        if (strncmp(name, dbl->dbList[i]->dbName, STRING_LEN) == 0) {   
-            return i;
+        if (strncmp(name, entry->dbName, STRING_LEN) == 0) {
+            break;
         }
-    }   
-    return -1;
+    }
+
+    STATS_END_SAMPLED(STAT_FIND_DB);
+
+    return entry;
 }
 
-void removeDatabaseAtIndex(DatabaseList* dbl, size_t index) {
+// Loads an attached file with the reader its first bytes call for, anything unrecognized is read as .csv
+static Database* loadAttachedFile(const char* fileName, const char* dbName) {
 
-     deleteDatabase(dbl->dbList[index]);
+    unsigned char magic[8] = {0};
+    FILE* file = fopen(fileName, "rb");
 
-    // Shift the list to get rid of our garbage values
-    for (size_t i = index; i < dbl->dbCount - 1; i++) {
-        dbl->dbList[i] = dbl->dbList[i+1];
+    if (!file) {
+        fprintf(stderr, "Unable to open file: %s\n", fileName);
+        return NULL;
     }
 
-    dbl->dbCount--;
+    size_t got = fread(magic, 1, sizeof(magic), file);
+
+    fclose(file);
+
+    if (got >= 4 && memcmp(magic, SNAPSHOT_MAGIC, 4) == 0)
+        return loadDatabaseFromBinary(fileName, dbName);
+
+    if (got >= 4 && memcmp(magic, STORE_MAGIC, 4) == 0)
+        return loadDatabaseFromStore(fileName, dbName);
+
+    // Arrow files start with their magic, streams with the 0xFFFFFFFF continuation marker
+    if ((got >= 6 && memcmp(magic, ARROW_MAGIC, 6) == 0)
+        || (got >= 4 && memcmp(magic, "\xff\xff\xff\xff", 4) == 0))
+        return loadDatabaseFromArrow(fileName, dbName);
+
+    return loadDatabaseFromCSV(fileName);
+}
+
+// Returns the table behind an entry, loading it from its file on first use
+// or reading it back in if it was evicted
+Database* openDatabaseEntry(DatabaseList* dbl, DatabaseEntry* entry) {
+
+    entry->lastUsed = ++dbl->clock;
+
+    if (entry->db) {
+        dbl->hits++;
+        return entry->db;
+    }
+
+    dbl->misses++;
+
+    int firstLoad = 0;
 
-    if (dbl->dbCount > 0) {
-        Database** newDbList = realloc(dbl->dbList, (dbl->dbCount) * sizeof(Database*));
+    // The image or spill file is the only copy of an evicted table. readSnapshot gives back
+    // all of the rows or nothing, and the copy is only let go once the whole table is back
+    if (entry->image) {
+        FILE* image = fmemopen(entry->image, entry->imageSize, "rb");
 
-        if (!newDbList) {
-            fprintf(stderr, "Failed to realloc memory for db list\n");
-            exit(1);
+        if (image) {
+            entry->db = readSnapshot(image, entry->dbName, entry->dbName);
+            fclose(image);
         }
-        dbl->dbList = newDbList;
 
-    } else {
-        free(dbl->dbList);
-        dbl->dbList = NULL;
-        dbl->dbCount = 0;
+        if (entry->db) {
+            free(entry->image);
+            entry->image = NULL;
+            entry->imageSize = 0;
+        }
+    } else if (entry->spillFile[0]) {
+        entry->db = loadDatabaseFromBinary(entry->spillFile, entry->dbName);
+
+        if (entry->db) {
+            unlink(entry->spillFile);
+            entry->spillFile[0] = '\0';
+        }
+    } else if (entry->fileName[0]) {
+        entry->db = loadAttachedFile(entry->fileName, entry->dbName);
+        firstLoad = 1;
+    }
+
+    if (!entry->db) {
+        if (entry->image || entry->spillFile[0])
+            fprintf(stderr, "Unable to open Database %s, its evicted copy is kept\n", entry->dbName);
+        else
+            fprintf(stderr, "Unable to open Database %s\n", entry->dbName);
+        return NULL;
     }
+
+    // Keep the name it was registered under
+    strncpy(entry->db->dbName, entry->dbName, STRING_LEN);
+
+    // Observers first hear of an attached table when it's loaded, reloading an evicted one changes nothing
+    entry->db->observed = 1;
+
+    if (firstLoad)
+        notifyTableMutation(entry->db, MUTATION_ADD_TABLE, 0, 0, 0, (DataValues){0});
+
+    // Loading this table may have put us over budget, make room without evicting it again
+    entry->pinned++;
+    enforceMemoryBudget(dbl);
+    entry->pinned--;
+
+    return entry->db;
+}
+
+// The snapshot an evicted table was written to, NULL if it's resident or hasn't been loaded yet
+static FILE* openEvictedSnapshot(DatabaseEntry* entry) {
+
+    if (entry->db)
+        return NULL;
+
+    if (entry->image)
+        return fmemopen(entry->image, entry->imageSize, "rb");
+
+    return entry->spillFile[0] ? fopen(entry->spillFile, "rb") : NULL;
+}
+
+// The stored columns of an evicted table as an empty table, without reading it back in
+Database* readEvictedSchema(DatabaseEntry* entry) {
+
+    FILE* file = openEvictedSnapshot(entry);
+
+    if (!file)
+        return NULL;
+
+    Database* schema = readSnapshotSchema(file, entry->dbName, entry->dbName);
+
+    fclose(file);
+
+    return schema;
+}
+
+// Aggregates a column of an evicted table on its compressed snapshot, leaving it evicted
+// Returns 0 on success, -1 on failure and -2 if the table has to be opened to answer it
+int aggregateEvictedEntry(DatabaseEntry* entry, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out) {
+
+    FILE* file = openEvictedSnapshot(entry);
+
+    if (!file)
+        return -2;
+
+    int result = aggregateSnapshot(file, op, col, preds, numPreds, out, entry->dbName);
+
+    fclose(file);
+
+    return result;
+}
+
+// Pinned tables (e.g. the one selected in the CLI) are never evicted
+void pinDatabaseEntry(DatabaseEntry* entry) {
+    entry->pinned++;
+}
+
+void unpinDatabaseEntry(DatabaseEntry* entry) {
+    if (entry->pinned > 0)
+        entry->pinned--;
+}
+
+// Bytes held by all resident tables and compressed images
+size_t databaseListMemoryUsage(DatabaseList* dbl) {
+
+    size_t total = 0;
+
+    for (DatabaseEntry* entry = dbl->first; entry; entry = entry->next)
+        total += databaseMemoryUsage(entry->db) + entry->imageSize;
+
+    return total;
+}
+
+// Compress a table into a snapshot image held in memory, returns 0 on success
+static int compressEntry(DatabaseEntry* entry) {
+
+    FILE* image = open_memstream(&entry->image, &entry->imageSize);
+
+    if (!image)
+        return -1;
+
+    if (writeSnapshot(entry->db, image) | (fclose(image) != 0)) {
+        free(entry->image);
+        entry->image = NULL;
+        entry->imageSize = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Write a table out to a spill file (or a compressed image if evictToMemory is set)
+// and free it, returns 0 if it was evicted
+static int evictEntry(DatabaseList* dbl, DatabaseEntry* entry) {
+
+    STATS_BEGIN();
+
+    if (dbl->evictToMemory) {
+        if (compressEntry(entry) < 0)
+            return -1;
+
+        deleteDatabase(entry->db);
+        entry->db = NULL;
+        dbl->evictions++;
+
+        STATS_END(STAT_EVICT_DB);
+
+        return 0;
+    }
+
+    const char* dir = getenv("TMPDIR");
+
+    snprintf(entry->spillFile, FILE_NAME_LEN, "%s/scdb-%d-%zu.spill", dir ? dir : "/tmp", (int)getpid(),
+        dbl->spillCount++);
+
+    if (saveDatabaseToBinary(entry->db, entry->spillFile) < 0) {
+        unlink(entry->spillFile);
+        entry->spillFile[0] = '\0';
+        return -1;
+    }
+
+    deleteDatabase(entry->db);
+    entry->db = NULL;
+    dbl->evictions++;
+
+    STATS_END(STAT_EVICT_DB);
+
+    return 0;
+}
+
+// Evict the least recently used unpinned tables until we're back under the memory budget
+void enforceMemoryBudget(DatabaseList* dbl) {
+
+    if (!dbl->memoryBudget)
+        return;
+
+    size_t used = databaseListMemoryUsage(dbl);
+
+    while (used > dbl->memoryBudget) {
+
+        DatabaseEntry* victim = NULL;
+
+        for (DatabaseEntry* entry = dbl->first; entry; entry = entry->next) {
+            if (entry->db && !entry->pinned && (!victim || entry->lastUsed < victim->lastUsed))
+                victim = entry;
+        }
+
+        // Everything left is pinned, nothing more we can do
+        if (!victim)
+            return;
+
+        size_t size = databaseMemoryUsage(victim->db);
+
+        if (evictEntry(dbl, victim) < 0)
+            return;
+
+        used -= size;
+        used += victim->imageSize;
+    }
+}
+
+void setMemoryBudget(DatabaseList* dbl, size_t budget) {
+
+    dbl->memoryBudget = budget;
+    enforceMemoryBudget(dbl);
+}
+
+void printMemoryStats(DatabaseList* dbl) {
+
+    size_t resident = 0;
+
+    for (DatabaseEntry* entry = dbl->first; entry; entry = entry->next) {
+        if (entry->db) {
+            printf("%-30s %12zu bytes, cells %zu/%zu bytes in use%s\n", entry->dbName,
+                databaseMemoryUsage(entry->db), entry->db->arena->bytesInUse, entry->db->arena->bytesReserved,
+                entry->pinned ? " (pinned)" : "");
+            resident++;
+        } else if (entry->image) {
+            printf("%-30s %12zu bytes, compressed in memory\n", entry->dbName, entry->imageSize);
+        } else {
+            printf("%-30s %12s\n", entry->dbName, entry->spillFile[0] ? "evicted" : "not loaded");
+        }
+    }
+
+    size_t lookups = dbl->hits + dbl->misses;
+
+    printf("Resident tables: %zu/%zu\n", resident, dbl->dbCount);
+    printf("Memory used: %zu bytes, budget: ", databaseListMemoryUsage(dbl));
+    if (dbl->memoryBudget)
+        printf("%zu bytes, evicting to %s\n", dbl->memoryBudget, dbl->evictToMemory ? "memory" : "disk");
+    else
+        printf("unlimited\n");
+    printf("Hits: %zu, misses: %zu (%.1f%% hit rate), evictions: %zu\n", dbl->hits, dbl->misses,
+        lookups ? 100.0 * dbl->hits / lookups : 0.0, dbl->evictions);
+}
+
+// Unlinks an entry and frees it along with its table
+void removeDatabaseEntry(DatabaseList* dbl, DatabaseEntry* entry) {
+
+    Mutation drop = {MUTATION_DROP_TABLE, entry->db, entry->dbName, 0, 0, 0, {0}};
+    notifyMutation(&drop);
+
+    DatabaseEntry** link = &dbl->buckets[hashName(entry->dbName) & (dbl->numBuckets - 1)];
+
+    while (*link != entry)
+        link = &(*link)->nextInBucket;
+
+    *link = entry->nextInBucket;
+
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        dbl->first = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        dbl->last = entry->prev;
+
+    dbl->dbCount--;
+
+    if (entry->spillFile[0])
+        unlink(entry->spillFile);
+
+    free(entry->image);
+    deleteDatabase(entry->db);
+    free(entry);
 }
 
 // Delete a DB from our list of active DBs
 void deleteDatabaseFromList(DatabaseList* dbl, const char* name) {
 
     // Search for our DB in the list
-    int index = findDatabaseInList(dbl, name);
+    DatabaseEntry* entry = findDatabaseInList(dbl, name);
 
     // If found, remove it
-    if (index >= 0) {
-        removeDatabaseAtIndex(dbl, index);
+    if (entry) {
+        removeDatabaseEntry(dbl, entry);
     } else {
         printf("Database %s not found. Enter a valid name.\n", name);
         return;
@@ -99,11 +525,32 @@ void deleteDatabaseFromList(DatabaseList* dbl, const char* name) {
     printf("Successfully deleted Database: %s\n", name);
 }
 
+// True if db is one of the loaded tables, without touching db itself
+int databaseListContains(DatabaseList* dbl, const Database* db) {
+
+    for (DatabaseEntry* entry = dbl->first; entry; entry = entry->next) {
+        if (entry->db == db)
+            return 1;
+    }
+
+    return 0;
+}
+
 // Print the list of available DBs
 void printDatabaseList(DatabaseList* dbl) {
 
-    for (size_t i = 0; i < dbl->dbCount; i++)
-        printf("%d) %s\n", i + 1, dbl->dbList[i]->dbName);
+    size_t i = 1;
+
+    for (DatabaseEntry* entry = dbl->first; entry; entry = entry->next, i++) {
+        if (entry->db)
+            printf("%zu) %s\n", i, entry->dbName);
+        else if (entry->image)
+            printf("%zu) %s (compressed)\n", i, entry->dbName);
+        else if (entry->spillFile[0])
+            printf("%zu) %s (evicted)\n", i, entry->dbName);
+        else
+            printf("%zu) %s (not loaded, %s)\n", i, entry->dbName, entry->fileName);
+    }
 }
 
 // Deletes a DatabaseList object
@@ -112,11 +559,19 @@ void deleteDatabaseList(DatabaseList* dbl) {
     if (!dbl)
         return;
 
-    for (size_t i = 0; i < dbl->dbCount; i++) {
-        deleteDatabase(dbl->dbList[i]);
+    DatabaseEntry* entry = dbl->first;
+
+    while (entry) {
+        DatabaseEntry* next = entry->next;
+        if (entry->spillFile[0])
+            unlink(entry->spillFile);
+        free(entry->image);
+        deleteDatabase(entry->db);
+        free(entry);
+        entry = next;
     }
 
-    free(dbl->dbList);
+    free(dbl->buckets);
 
     free(dbl);
-}
\ No newline at end of file
+}
@@ -1,23 +1,82 @@
 #ifndef DATABASE_LIST_H
 #define DATABASE_LIST_H
 #include "database.h"
+#include "query.h"
 
+#define FILE_NAME_LEN 256
+#define DB_LIST_INITIAL_BUCKETS 16
+
+// One table in the catalog. Entries are allocated individually so a pointer
+// to one is a stable handle for as long as the table is in the list.
+// Lazily opened tables have a fileName and a NULL db until they are first used,
+// tables evicted under the memory budget have a spillFile or a compressed
+// in-memory image and a NULL db.
+typedef struct DatabaseEntry {
+
+    char dbName[STRING_LEN];
+    char fileName[FILE_NAME_LEN];
+    char spillFile[FILE_NAME_LEN];
+    char* image;
+    size_t imageSize;
+    Database* db;
+
+    unsigned long long lastUsed;
+    int pinned;
+
+    struct DatabaseEntry* nextInBucket;
+    struct DatabaseEntry* prev;
+    struct DatabaseEntry* next;
+
+} DatabaseEntry;
+
+// Catalog of tables hashed on dbName, entries are also linked in the order they were added
 typedef struct {
 
-    Database** dbList;
+    DatabaseEntry** buckets;
+    size_t numBuckets;
+    DatabaseEntry* first;
+    DatabaseEntry* last;
     size_t dbCount;
     size_t dbLimit;
 
+    // Buffer manager state, a memoryBudget of 0 means tables are never evicted
+    size_t memoryBudget;
+    int evictToMemory;
+    unsigned long long clock;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t spillCount;
+
 }DatabaseList;
 
 DatabaseList* createDatabaseList(size_t limit);
 
+DatabaseEntry* addDatabaseToList(Database* db, DatabaseList* dbl);
+DatabaseEntry* registerDatabaseFile(DatabaseList* dbl, const char* name, const char* fileName);
+DatabaseEntry* findDatabaseInList(DatabaseList* dbl, const char* name);
+
+Database* openDatabaseEntry(DatabaseList* dbl, DatabaseEntry* entry);
+Database* readEvictedSchema(DatabaseEntry* entry);
+int aggregateEvictedEntry(DatabaseEntry* entry, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out);
+
+size_t databaseListMemoryUsage(DatabaseList* dbl);
+void setMemoryBudget(DatabaseList* dbl, size_t budget);
+void enforceMemoryBudget(DatabaseList* dbl);
+void pinDatabaseEntry(DatabaseEntry* entry);
+void unpinDatabaseEntry(DatabaseEntry* entry);
+void printMemoryStats(DatabaseList* dbl);
+
 void deleteDatabaseFromList(DatabaseList* dbl, const char* name);
-void addDatabaseToList(Database* db, DatabaseList* dbl);
-void removeDatabaseAtIndex(DatabaseList* dbl, size_t index);
+void removeDatabaseEntry(DatabaseList* dbl, DatabaseEntry* entry);
 void printDatabaseList(DatabaseList* dbl);
 void deleteDatabaseList(DatabaseList* dbl);
 
-int findDatabaseInList(DatabaseList* dbl, const char* name);
+int databaseListFull(DatabaseList* dbl);
+int databaseListContains(DatabaseList* dbl, const Database* db);
+
+void lockCatalog();
+void unlockCatalog();
 
-#endif
\ No newline at end of file
+#endif
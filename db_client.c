@@ -1 +1,436 @@
-#include "db_client.h"
\ No newline at end of file
+#define _GNU_SOURCE // fmemopen
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "db_client.h"
+#include "replication.h"
+#include "database_list.h"
+#include "database.h"
+#include "snapshot.h"
+#include "expr.h"
+
+static DatabaseList* replicaList = NULL;
+static char primaryAddress[REPL_ADDRESS_LEN];
+static int replicaRunning = 0;
+
+// Replication progress, guarded by statusLock and broadcast on statusChanged
+static pthread_mutex_t statusLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t statusChanged = PTHREAD_COND_INITIALIZER;
+static int connected = 0;
+static int synced = 0;
+static uint64_t appliedLsn = 0;
+static uint64_t primaryLsn = 0;
+static uint64_t lastHeartbeatNs = 0;
+static uint64_t lastHeartbeatSentNs = 0;
+static uint64_t applyDelayNs = 0;
+static size_t reconnects = 0;
+
+// Tables received during the bootstrap, anything else is dropped once it's done
+static char (*bootstrapNames)[STRING_LEN] = NULL;
+static size_t numBootstrapNames = 0;
+
+static void rememberBootstrapTable(const char* name) {
+
+    char (*names)[STRING_LEN] = realloc(bootstrapNames, (numBootstrapNames + 1) * sizeof(*names));
+
+    if (!names) {
+        fprintf(stderr, "realloc returned NULL pointer for bootstrap table names\n");
+        exit(1);
+    }
+
+    bootstrapNames = names;
+    memcpy(bootstrapNames[numBootstrapNames++], name, STRING_LEN);
+}
+
+static void dropTablesNotInBootstrap() {
+
+    DatabaseEntry* entry = replicaList->first;
+
+    while (entry) {
+
+        DatabaseEntry* next = entry->next;
+        int keep = 0;
+
+        for (size_t i = 0; i < numBootstrapNames && !keep; i++)
+            keep = strncmp(bootstrapNames[i], entry->dbName, STRING_LEN) == 0;
+
+        if (!keep)
+            removeDatabaseEntry(replicaList, entry);
+
+        entry = next;
+    }
+
+    free(bootstrapNames);
+    bootstrapNames = NULL;
+    numBootstrapNames = 0;
+}
+
+// Replaces (or adds) a table with the snapshot in payload, returns -1 if it can't be read
+static int applyTable(const ReplRecord* rec, char* payload) {
+
+    FILE* image = fmemopen(payload, rec->size, "rb");
+    Database* fresh = image ? readSnapshot(image, rec->table, "replication stream") : NULL;
+
+    if (image)
+        fclose(image);
+
+    if (!fresh) {
+        fprintf(stderr, "Replica could not read table %s from the primary\n", rec->table);
+        return -1;
+    }
+
+    if (!synced)
+        rememberBootstrapTable(rec->table);
+
+    DatabaseEntry* entry = findDatabaseInList(replicaList, rec->table);
+
+    if (entry && entry->db) {
+        // Swap the contents so the CLI's pointer to the table stays valid
+        Database old = *entry->db;
+        *entry->db = *fresh;
+        *fresh = old;
+        deleteDatabase(fresh);
+
+        entry->db->observed = 1;
+        notifyTableMutation(entry->db, MUTATION_ADD_TABLE, 0, 0, 0, (DataValues){0});
+        return 0;
+    }
+
+    if (entry)
+        removeDatabaseEntry(replicaList, entry);
+
+    if (!addDatabaseToList(fresh, replicaList)) {
+        fprintf(stderr, "Replica has no room for table %s\n", rec->table);
+        deleteDatabase(fresh);
+    }
+
+    return 0;
+}
+
+static Database* replicaTable(const char* name) {
+
+    DatabaseEntry* entry = findDatabaseInList(replicaList, name);
+
+    return entry ? openDatabaseEntry(replicaList, entry) : NULL;
+}
+
+// Applies one record to the catalog, the caller holds the catalog lock
+// Returns -1 for a malformed record, the replica can't stay in step and has to bootstrap again
+static int applyRecord(const ReplRecord* rec, char* payload) {
+
+    if (rec->type == REPL_TABLE)
+        return applyTable(rec, payload);
+
+    if (rec->type == REPL_DROP_TABLE) {
+        DatabaseEntry* entry = findDatabaseInList(replicaList, rec->table);
+        if (entry)
+            removeDatabaseEntry(replicaList, entry);
+        return 0;
+    }
+
+    if (rec->type == REPL_SYNCED) {
+        dropTablesNotInBootstrap();
+        return 0;
+    }
+
+    Database* db = replicaTable(rec->table);
+
+    if (!db) {
+        fprintf(stderr, "Replica has no table %s, ignoring a change to it\n", rec->table);
+        return 0;
+    }
+
+    switch (rec->type) {
+        case REPL_CREATE_COLUMN :
+            createColumn(db, rec->name, (DataTypes)rec->value);
+            break;
+        case REPL_DELETE_COLUMN :
+            deleteColumn(db, rec->col);
+            break;
+        case REPL_RENAME_COLUMN :
+            if (rec->col < db->numCols) {
+                char oldName[STRING_LEN];
+                memcpy(oldName, db->cols[rec->col].colName, STRING_LEN);
+                memcpy(db->cols[rec->col].colName, rec->name, STRING_LEN);
+                db->cols[rec->col].colName[STRING_LEN - 1] = '\0';
+                renameComputedSource(db, oldName, db->cols[rec->col].colName);
+                notifyTableMutation(db, MUTATION_RENAME_COLUMN, 0, 0, rec->col, (DataValues){0});
+            }
+            break;
+        case REPL_APPEND_ROWS : {
+
+            BulkBatch batch = {ROW_MAJOR, rec->count, rec->col, NULL, (const DataValues*)payload, NULL, NULL};
+            size_t valuesSize = rec->count * rec->col * sizeof(DataValues);
+            const uint64_t** validity = NULL;
+
+            // Checked by division so a huge count can't wrap valuesSize around
+            if (rec->col && rec->size / sizeof(DataValues) / rec->col < rec->count) {
+                fprintf(stderr, "Replica got a truncated append to %s from the primary\n", rec->table);
+                return -1;
+            }
+
+            if (rec->size >= valuesSize + rec->col * VALIDITY_WORDS(rec->count) * sizeof(uint64_t) && rec->col) {
+
+                validity = malloc(rec->col * sizeof(uint64_t*));
+
+                if (!validity) {
+                    fprintf(stderr, "malloc returned NULL pointer for replication validity\n");
+                    exit(1);
+                }
+
+                for (size_t col = 0; col < rec->col; col++)
+                    validity[col] = (const uint64_t*)(payload + valuesSize) + col * VALIDITY_WORDS(rec->count);
+
+                batch.validity = validity;
+            }
+
+            // A batch the table won't take (e.g. a different column count) means the replica has diverged
+            int appended = appendRows(db, &batch);
+
+            free(validity);
+
+            if (appended < 0) {
+                fprintf(stderr, "Replica could not append to %s, resyncing\n", rec->table);
+                return -1;
+            }
+            break;
+        }
+        case REPL_DELETE_ROW :
+            removeRow(db, rec->row);
+            break;
+        case REPL_WRITE_CELL : {
+
+            DataValues value;
+            memcpy(&value, &rec->value, sizeof(value));
+
+            if (rec->row >= db->numRows || rec->col >= db->numCols)
+                break;
+
+            writeCell(db, rec->row, rec->col, db->cols[rec->col].type, value);
+            break;
+        }
+        case REPL_WRITE_NULL :
+            setCellNull(db, rec->row, rec->col);
+            break;
+        default :
+            break;
+    }
+
+    return 0;
+}
+
+static void sendAck(int fd, uint64_t lsn) {
+
+    ReplRecord ack;
+
+    memset(&ack, 0, sizeof(ack));
+    ack.type = REPL_ACK;
+    ack.lsn = lsn;
+
+    sendFully(fd, &ack, sizeof(ack));
+}
+
+// Applies the stream from one connection until it breaks
+static void followPrimary(int fd) {
+
+    ReplRecord rec;
+    char* payload = NULL;
+    size_t payloadCapacity = 0;
+    size_t sinceAck = 0;
+
+    while (recvFully(fd, &rec, sizeof(rec)) == 0) {
+
+        if (rec.size > payloadCapacity) {
+
+            char* grown = realloc(payload, rec.size);
+
+            if (!grown) {
+                fprintf(stderr, "realloc returned NULL pointer for replication record\n");
+                exit(1);
+            }
+
+            payload = grown;
+            payloadCapacity = rec.size;
+        }
+
+        if (rec.size && recvFully(fd, payload, rec.size) < 0)
+            break;
+
+        rec.table[STRING_LEN - 1] = '\0';
+        rec.name[STRING_LEN - 1] = '\0';
+
+        if (rec.type != REPL_HEARTBEAT) {
+
+            lockCatalog();
+            int applied = applyRecord(&rec, payload);
+            unlockCatalog();
+
+            // Dropping the connection makes the primary send every table again
+            if (applied < 0)
+                break;
+        }
+
+        pthread_mutex_lock(&statusLock);
+
+        if (rec.lsn > appliedLsn)
+            appliedLsn = rec.lsn;
+        if (rec.lsn > primaryLsn)
+            primaryLsn = rec.lsn;
+
+        if (rec.type == REPL_SYNCED) {
+            synced = 1;
+            printf("Replica synced with %s at LSN %llu.\n", primaryAddress, (unsigned long long)rec.lsn);
+            fflush(stdout);
+        } else if (rec.type == REPL_HEARTBEAT) {
+            lastHeartbeatNs = wallClockNs();
+            lastHeartbeatSentNs = rec.value;
+            applyDelayNs = lastHeartbeatNs > rec.value ? lastHeartbeatNs - rec.value : 0;
+        }
+
+        pthread_cond_broadcast(&statusChanged);
+        pthread_mutex_unlock(&statusLock);
+
+        if (rec.type == REPL_HEARTBEAT || rec.type == REPL_SYNCED || ++sinceAck == REPL_ACK_INTERVAL) {
+            sendAck(fd, rec.lsn);
+            sinceAck = 0;
+        }
+    }
+
+    free(payload);
+}
+
+// Connects to the primary, follows it and reconnects whenever the connection drops
+static void* replicaLoop(void* arg) {
+
+    int warned = 0;
+
+    while (1) {
+
+        int fd = openReplicationSocket(primaryAddress, 0);
+
+        if (fd < 0) {
+            if (!warned)
+                fprintf(stderr, "Unable to reach primary %s, retrying\n", primaryAddress);
+            warned = 1;
+            usleep(REPL_RETRY_MS * 1000);
+            continue;
+        }
+
+        warned = 0;
+
+        pthread_mutex_lock(&statusLock);
+        connected = 1;
+        synced = 0;
+        // The primary may have restarted with a new log
+        appliedLsn = primaryLsn = 0;
+        pthread_cond_broadcast(&statusChanged);
+        pthread_mutex_unlock(&statusLock);
+
+        // A fresh bootstrap replaces everything, forget a half finished one
+        free(bootstrapNames);
+        bootstrapNames = NULL;
+        numBootstrapNames = 0;
+
+        followPrimary(fd);
+        close(fd);
+
+        pthread_mutex_lock(&statusLock);
+        connected = 0;
+        synced = 0;
+        reconnects++;
+        pthread_cond_broadcast(&statusChanged);
+        pthread_mutex_unlock(&statusLock);
+
+        fprintf(stderr, "Lost connection to primary %s, reconnecting\n", primaryAddress);
+        usleep(REPL_RETRY_MS * 1000);
+    }
+
+    return NULL;
+}
+
+// Makes this process a read replica of the primary at address, the tables in dbl follow the primary's
+int startReplica(DatabaseList* dbl, const char* address) {
+
+    if (replicaRunning) {
+        printf("Already a replica of %s.\n", primaryAddress);
+        return -1;
+    }
+
+    replicaList = dbl;
+    snprintf(primaryAddress, sizeof(primaryAddress), "%s", address);
+
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, replicaLoop, NULL) != 0) {
+        fprintf(stderr, "Unable to start replica thread\n");
+        return -1;
+    }
+
+    pthread_detach(thread);
+    replicaRunning = 1;
+
+    return 0;
+}
+
+int isReplica() {
+    return replicaRunning;
+}
+
+const char* replicaPrimaryAddress() {
+    return primaryAddress;
+}
+
+/* Waits until the replica has applied everything the primary had when we
+   started waiting: synced, and a heartbeat sent after that point applied.
+   Returns 0 once caught up, -1 on timeout */
+int waitForReplica(double seconds) {
+
+    if (!replicaRunning)
+        return -1;
+
+    uint64_t start = wallClockNs();
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)seconds;
+    deadline.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+    deadline.tv_nsec %= 1000000000l;
+
+    int caughtUp = 0;
+
+    pthread_mutex_lock(&statusLock);
+
+    while (!(caughtUp = synced && lastHeartbeatSentNs > start && appliedLsn >= primaryLsn)) {
+        if (pthread_cond_timedwait(&statusChanged, &statusLock, &deadline) != 0)
+            break;
+    }
+
+    caughtUp = synced && lastHeartbeatSentNs > start && appliedLsn >= primaryLsn;
+
+    pthread_mutex_unlock(&statusLock);
+
+    return caughtUp ? 0 : -1;
+}
+
+void printReplicaStatus() {
+
+    if (!replicaRunning)
+        return;
+
+    pthread_mutex_lock(&statusLock);
+
+    printf("Replica of %s: %s, applied LSN %llu of %llu (%llu behind)\n", primaryAddress,
+        !connected ? "reconnecting" : synced ? "streaming" : "bootstrapping", (unsigned long long)appliedLsn,
+        (unsigned long long)primaryLsn, (unsigned long long)(primaryLsn - appliedLsn));
+
+    if (lastHeartbeatNs)
+        printf("  last heartbeat %.1fms ago, delivered %.2fms after it was sent, %zu reconnects\n",
+            (wallClockNs() - lastHeartbeatNs) / 1e6, applyDelayNs / 1e6, reconnects);
+
+    pthread_mutex_unlock(&statusLock);
+}
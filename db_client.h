@@ -1,4 +1,12 @@
 #ifndef DB_CLIENT_H
 #define DB_CLIENT_H
 
-#endif
\ No newline at end of file
+#include "database_list.h"
+
+int startReplica(DatabaseList* dbl, const char* address);
+int isReplica();
+const char* replicaPrimaryAddress();
+int waitForReplica(double seconds);
+void printReplicaStatus();
+
+#endif
@@ -0,0 +1,719 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "db_server.h"
+#include "replication.h"
+#include "database_list.h"
+#include "snapshot.h"
+#include "compress.h"
+#include "stats.h"
+
+static int metricsSocket = -1;
+
+// Answers every connection with the current stats in Prometheus text format
+static void* metricsLoop(void* arg) {
+
+    char request[4096];
+
+    while (1) {
+
+        int client = accept(metricsSocket, NULL, NULL);
+
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Metrics server stopped: %s\n", strerror(errno));
+            return NULL;
+        }
+
+        // We serve the same page for any path, just drain the request
+        ssize_t received = recv(client, request, sizeof(request), 0);
+        (void)received;
+
+        FILE* out = fdopen(client, "w");
+
+        if (!out) {
+            close(client);
+            continue;
+        }
+
+        fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+        statsWritePrometheus(out);
+        fclose(out);
+    }
+
+    return NULL;
+}
+
+// Starts serving /metrics on port in a background thread, returns 0 on success
+int startMetricsServer(int port) {
+
+    if (metricsSocket >= 0) {
+        printf("Metrics server is already running.\n");
+        return -1;
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sock < 0) {
+        fprintf(stderr, "Unable to create metrics socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        fprintf(stderr, "Unable to listen on port %d: %s\n", port, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    metricsSocket = sock;
+
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, metricsLoop, NULL) != 0) {
+        fprintf(stderr, "Unable to start metrics thread\n");
+        close(sock);
+        metricsSocket = -1;
+        return -1;
+    }
+
+    pthread_detach(thread);
+
+    return 0;
+}
+
+uint64_t wallClockNs() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int sendFully(int fd, const void* data, size_t size) {
+
+    const char* p = data;
+
+    while (size) {
+
+        // A replica that went away shouldn't kill us with SIGPIPE
+        ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+
+        p += sent;
+        size -= sent;
+    }
+
+    return 0;
+}
+
+int recvFully(int fd, void* data, size_t size) {
+
+    char* p = data;
+
+    while (size) {
+
+        ssize_t received = recv(fd, p, size, 0);
+
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return -1;
+
+        p += received;
+        size -= received;
+    }
+
+    return 0;
+}
+
+/* Listens on (or connects to) a replication address: "unix:/path", "host:port" or
+   just "port". Returns the socket or -1 after printing what went wrong */
+int openReplicationSocket(const char* address, int listening) {
+
+    if (strncmp(address, "unix:", 5) == 0) {
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", address + 5);
+            return -1;
+        }
+
+        strcpy(addr.sun_path, address + 5);
+
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (sock < 0) {
+            fprintf(stderr, "Unable to create socket: %s\n", strerror(errno));
+            return -1;
+        }
+
+        // A socket file left behind by an earlier primary would make bind fail
+        if (listening)
+            unlink(addr.sun_path);
+
+        int failed = listening ? bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0
+            : connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0;
+
+        if (failed) {
+            if (listening)
+                fprintf(stderr, "Unable to listen on %s: %s\n", address, strerror(errno));
+            close(sock);
+            return -1;
+        }
+
+        return sock;
+    }
+
+    char host[REPL_ADDRESS_LEN];
+    const char* colon = strrchr(address, ':');
+    const char* port = colon ? colon + 1 : address;
+
+    if (colon)
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+    else
+        snprintf(host, sizeof(host), "%s", listening ? "" : "127.0.0.1");
+
+    struct addrinfo hints;
+    struct addrinfo* found;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+
+    int err = getaddrinfo(host[0] ? host : NULL, port, &hints, &found);
+
+    if (err != 0) {
+        fprintf(stderr, "Invalid address %s: %s\n", address, gai_strerror(err));
+        return -1;
+    }
+
+    int sock = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+
+    if (sock < 0) {
+        fprintf(stderr, "Unable to create socket: %s\n", strerror(errno));
+        freeaddrinfo(found);
+        return -1;
+    }
+
+    int one = 1;
+    int failed;
+
+    if (listening) {
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        failed = bind(sock, found->ai_addr, found->ai_addrlen) < 0 || listen(sock, 16) < 0;
+    } else {
+        failed = connect(sock, found->ai_addr, found->ai_addrlen) < 0;
+    }
+
+    freeaddrinfo(found);
+
+    if (failed) {
+        if (listening)
+            fprintf(stderr, "Unable to listen on %s: %s\n", address, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    // Records are small, don't hold them back waiting for more
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return sock;
+}
+
+// One connected replica. Records are queued on its backlog and written out by its sender thread
+typedef struct Replica {
+
+    int fd;
+    pthread_t sender;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    ByteBuffer backlog;
+    int closed;
+
+    uint64_t ackedLsn;
+    uint64_t connectedNs;
+
+    struct Replica* next;
+
+} Replica;
+
+static int replicationSocket = -1;
+static char replicationAddress[REPL_ADDRESS_LEN];
+static DatabaseList* primaryList = NULL;
+
+// Replicas getting the stream, and the LSN of the last change sent to them
+static Replica* replicas = NULL;
+static size_t replicaCount = 0;
+static uint64_t primaryLsn = 0;
+static pthread_mutex_t replicasLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void initRecord(ReplRecord* rec, ReplRecordType type, const char* table) {
+
+    memset(rec, 0, sizeof(*rec));
+    rec->type = type;
+
+    if (table)
+        strncpy(rec->table, table, STRING_LEN - 1);
+}
+
+static void appendRecord(ByteBuffer* out, ReplRecord* rec, uint64_t lsn, const void* payload, size_t size) {
+
+    rec->lsn = lsn;
+    rec->size = size;
+
+    appendBytes(out, rec, sizeof(*rec));
+
+    if (size)
+        appendBytes(out, payload, size);
+}
+
+// REPL_TABLE with a snapshot of db, returns -1 if it couldn't be written
+static int appendTable(ByteBuffer* out, Database* db, const char* name, uint64_t lsn) {
+
+    char* image = NULL;
+    size_t imageSize = 0;
+    FILE* file = open_memstream(&image, &imageSize);
+
+    if (!file)
+        return -1;
+
+    if (writeSnapshot(db, file) | (fclose(file) != 0)) {
+        free(image);
+        return -1;
+    }
+
+    ReplRecord rec;
+
+    initRecord(&rec, REPL_TABLE, name);
+    appendRecord(out, &rec, lsn, image, imageSize);
+    free(image);
+
+    return 0;
+}
+
+// Spilled tables are already snapshots on disk, they're sent as they are
+static int appendSpillFile(ByteBuffer* out, const char* fileName, const char* name, uint64_t lsn) {
+
+    FILE* file = fopen(fileName, "rb");
+
+    if (!file)
+        return -1;
+
+    ByteBuffer image;
+    char chunk[1 << 16];
+    size_t n;
+
+    initByteBuffer(&image);
+
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        appendBytes(&image, chunk, n);
+
+    int failed = ferror(file);
+    fclose(file);
+
+    if (!failed) {
+        ReplRecord rec;
+        initRecord(&rec, REPL_TABLE, name);
+        appendRecord(out, &rec, lsn, image.data, image.size);
+    }
+
+    freeByteBuffer(&image);
+
+    return failed ? -1 : 0;
+}
+
+// Turns a change into records. Called with replicasLock held, every record takes the next LSN
+static void encodeMutation(const Mutation* m, ByteBuffer* out) {
+
+    ReplRecord rec;
+    Database* db = m->db;
+
+    switch (m->type) {
+        case MUTATION_ADD_TABLE :
+            appendTable(out, db, m->table, ++primaryLsn);
+            break;
+        case MUTATION_DROP_TABLE :
+            initRecord(&rec, REPL_DROP_TABLE, m->table);
+            appendRecord(out, &rec, ++primaryLsn, NULL, 0);
+            break;
+        case MUTATION_CREATE_COLUMN :
+            initRecord(&rec, REPL_CREATE_COLUMN, m->table);
+            strncpy(rec.name, db->cols[m->col].colName, STRING_LEN - 1);
+            rec.value = db->cols[m->col].type;
+            appendRecord(out, &rec, ++primaryLsn, NULL, 0);
+            break;
+        case MUTATION_DELETE_COLUMN :
+        case MUTATION_RENAME_COLUMN :
+            initRecord(&rec, m->type == MUTATION_DELETE_COLUMN ? REPL_DELETE_COLUMN : REPL_RENAME_COLUMN, m->table);
+            strncpy(rec.name, db->cols[m->col].colName, STRING_LEN - 1);
+            rec.col = m->col;
+            appendRecord(out, &rec, ++primaryLsn, NULL, 0);
+            break;
+        case MUTATION_APPEND_ROWS : {
+
+            size_t numCols = db->numCols ? db->numCols : 1;
+            DataValues* values = malloc(REPL_BATCH_ROWS * numCols * sizeof(DataValues)
+                + numCols * VALIDITY_WORDS(REPL_BATCH_ROWS) * sizeof(uint64_t));
+
+            if (!values) {
+                fprintf(stderr, "malloc returned NULL pointer for replication rows\n");
+                exit(1);
+            }
+
+            for (size_t from = 0; from < m->numRows; from += REPL_BATCH_ROWS) {
+
+                size_t n = m->numRows - from < REPL_BATCH_ROWS ? m->numRows - from : REPL_BATCH_ROWS;
+
+                for (size_t r = 0; r < n; r++)
+                    memcpy(values + r * db->numCols, db->rows[m->row + from + r].cells, db->numCols * sizeof(Cell));
+
+                // The bitmaps only go along when there's a NULL to send
+                uint64_t* validity = (uint64_t*)(values + n * db->numCols);
+                size_t nulls = 0;
+
+                for (size_t col = 0; col < db->numCols; col++)
+                    nulls += gatherValidity(db, col, m->row + from, n, validity + col * VALIDITY_WORDS(n));
+
+                initRecord(&rec, REPL_APPEND_ROWS, m->table);
+                rec.count = n;
+                rec.col = db->numCols;
+                appendRecord(out, &rec, ++primaryLsn, values, n * db->numCols * sizeof(DataValues)
+                    + (nulls ? db->numCols * VALIDITY_WORDS(n) * sizeof(uint64_t) : 0));
+            }
+
+            free(values);
+            break;
+        }
+        case MUTATION_DELETE_ROW :
+            initRecord(&rec, REPL_DELETE_ROW, m->table);
+            rec.row = m->row;
+            appendRecord(out, &rec, ++primaryLsn, NULL, 0);
+            break;
+        case MUTATION_WRITE_CELL :
+            initRecord(&rec, isCellNull(db, m->row, m->col) ? REPL_WRITE_NULL : REPL_WRITE_CELL, m->table);
+            rec.row = m->row;
+            rec.col = m->col;
+            memcpy(&rec.value, &db->rows[m->row].cells[m->col].value, sizeof(DataValues));
+            appendRecord(out, &rec, ++primaryLsn, NULL, 0);
+            break;
+    }
+}
+
+// Caller holds replica->lock. A replica that can't keep up is dropped, it reconnects and bootstraps again
+static void queueForReplica(Replica* replica, const void* data, size_t size) {
+
+    if (replica->closed)
+        return;
+
+    if (replica->backlog.size + size > REPL_MAX_BACKLOG) {
+        fprintf(stderr, "Replica fell more than %d bytes behind, disconnecting it\n", REPL_MAX_BACKLOG);
+        replica->closed = 1;
+        shutdown(replica->fd, SHUT_RDWR);
+        pthread_cond_signal(&replica->wake);
+        return;
+    }
+
+    appendBytes(&replica->backlog, data, size);
+    pthread_cond_signal(&replica->wake);
+}
+
+static void replicateMutation(const Mutation* mutation, void* ctx) {
+
+    pthread_mutex_lock(&replicasLock);
+
+    if (replicas) {
+
+        ByteBuffer out;
+
+        initByteBuffer(&out);
+        encodeMutation(mutation, &out);
+
+        for (Replica* replica = replicas; replica; replica = replica->next) {
+            pthread_mutex_lock(&replica->lock);
+            queueForReplica(replica, out.data, out.size);
+            pthread_mutex_unlock(&replica->lock);
+        }
+
+        freeByteBuffer(&out);
+    }
+
+    pthread_mutex_unlock(&replicasLock);
+}
+
+// Writes out whatever is queued, and a heartbeat whenever there's been nothing to send for a while
+static void* replicaSender(void* arg) {
+
+    Replica* replica = arg;
+
+    pthread_mutex_lock(&replica->lock);
+
+    while (!replica->closed) {
+
+        if (!replica->backlog.size) {
+
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += REPL_HEARTBEAT_MS * 1000000l;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+            deadline.tv_nsec %= 1000000000l;
+
+            if (pthread_cond_timedwait(&replica->wake, &replica->lock, &deadline) == ETIMEDOUT
+                && !replica->backlog.size && !replica->closed) {
+
+                // Lock order is replicasLock then replica->lock. Once we hold both nothing can be
+                // halfway through queueing, so primaryLsn covers everything already in the stream
+                pthread_mutex_unlock(&replica->lock);
+                pthread_mutex_lock(&replicasLock);
+                pthread_mutex_lock(&replica->lock);
+
+                if (!replica->backlog.size) {
+                    ReplRecord rec;
+                    initRecord(&rec, REPL_HEARTBEAT, NULL);
+                    rec.value = wallClockNs();
+                    appendRecord(&replica->backlog, &rec, primaryLsn, NULL, 0);
+                }
+
+                pthread_mutex_unlock(&replicasLock);
+            }
+
+            continue;
+        }
+
+        ByteBuffer chunk = replica->backlog;
+        initByteBuffer(&replica->backlog);
+
+        pthread_mutex_unlock(&replica->lock);
+
+        int failed = sendFully(replica->fd, chunk.data, chunk.size) < 0;
+        freeByteBuffer(&chunk);
+
+        pthread_mutex_lock(&replica->lock);
+
+        if (failed) {
+            replica->closed = 1;
+            shutdown(replica->fd, SHUT_RDWR);
+        }
+    }
+
+    pthread_mutex_unlock(&replica->lock);
+
+    return NULL;
+}
+
+// Snapshot of every table, taken with the catalog locked so no change can slip in between it and the stream
+static void bootstrapReplica(Replica* replica) {
+
+    ReplRecord rec;
+
+    for (DatabaseEntry* entry = primaryList->first; entry; entry = entry->next) {
+
+        int failed = 0;
+
+        if (entry->db) {
+            failed = appendTable(&replica->backlog, entry->db, entry->dbName, primaryLsn);
+        } else if (entry->image) {
+            initRecord(&rec, REPL_TABLE, entry->dbName);
+            appendRecord(&replica->backlog, &rec, primaryLsn, entry->image, entry->imageSize);
+        } else if (entry->spillFile[0]) {
+            failed = appendSpillFile(&replica->backlog, entry->spillFile, entry->dbName, primaryLsn);
+        }
+
+        // Attached tables that were never opened are sent once they are
+
+        if (failed)
+            fprintf(stderr, "Unable to snapshot %s for a replica\n", entry->dbName);
+    }
+
+    initRecord(&rec, REPL_SYNCED, NULL);
+    appendRecord(&replica->backlog, &rec, primaryLsn, NULL, 0);
+}
+
+// Owns one replica connection: bootstraps it, then reads its acknowledgements until it goes away
+static void* replicaConnection(void* arg) {
+
+    Replica* replica = arg;
+    ReplRecord rec;
+
+    lockCatalog();
+    pthread_mutex_lock(&replicasLock);
+
+    bootstrapReplica(replica);
+
+    replica->next = replicas;
+    replicas = replica;
+    replicaCount++;
+
+    pthread_mutex_unlock(&replicasLock);
+    unlockCatalog();
+
+    if (pthread_create(&replica->sender, NULL, replicaSender, replica) != 0) {
+        fprintf(stderr, "Unable to start replica sender thread\n");
+        shutdown(replica->fd, SHUT_RDWR);
+    }
+
+    while (recvFully(replica->fd, &rec, sizeof(rec)) == 0) {
+        if (rec.type == REPL_ACK)
+            __atomic_store_n(&replica->ackedLsn, rec.lsn, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&replicasLock);
+
+    for (Replica** link = &replicas; *link; link = &(*link)->next) {
+        if (*link == replica) {
+            *link = replica->next;
+            replicaCount--;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&replica->lock);
+    replica->closed = 1;
+    pthread_cond_signal(&replica->wake);
+    pthread_mutex_unlock(&replica->lock);
+
+    pthread_mutex_unlock(&replicasLock);
+
+    pthread_join(replica->sender, NULL);
+
+    close(replica->fd);
+    freeByteBuffer(&replica->backlog);
+    pthread_mutex_destroy(&replica->lock);
+    pthread_cond_destroy(&replica->wake);
+    free(replica);
+
+    return NULL;
+}
+
+static void* replicationAcceptLoop(void* arg) {
+
+    while (1) {
+
+        int client = accept(replicationSocket, NULL, NULL);
+
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Replication server stopped: %s\n", strerror(errno));
+            return NULL;
+        }
+
+        Replica* replica = calloc(1, sizeof(Replica));
+
+        if (!replica) {
+            fprintf(stderr, "calloc returned NULL pointer for Replica\n");
+            exit(1);
+        }
+
+        replica->fd = client;
+        replica->connectedNs = wallClockNs();
+        initByteBuffer(&replica->backlog);
+        pthread_mutex_init(&replica->lock, NULL);
+        pthread_cond_init(&replica->wake, NULL);
+
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, replicaConnection, replica) != 0) {
+            fprintf(stderr, "Unable to start replica thread\n");
+            close(client);
+            freeByteBuffer(&replica->backlog);
+            free(replica);
+            continue;
+        }
+
+        pthread_detach(thread);
+    }
+
+    return NULL;
+}
+
+// Makes this process a primary: changes to dbl's tables are streamed to replicas connecting on address
+int startReplicationServer(DatabaseList* dbl, const char* address) {
+
+    if (replicationSocket >= 0) {
+        printf("Already accepting replicas on %s.\n", replicationAddress);
+        return -1;
+    }
+
+    int sock = openReplicationSocket(address, 1);
+
+    if (sock < 0)
+        return -1;
+
+    replicationSocket = sock;
+    primaryList = dbl;
+    snprintf(replicationAddress, sizeof(replicationAddress), "%s", address);
+
+    addMutationObserver(replicateMutation, NULL);
+
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, replicationAcceptLoop, NULL) != 0) {
+        fprintf(stderr, "Unable to start replication thread\n");
+        removeMutationObserver(replicateMutation, NULL);
+        close(sock);
+        replicationSocket = -1;
+        return -1;
+    }
+
+    pthread_detach(thread);
+
+    return 0;
+}
+
+int isPrimary() {
+    return replicationSocket >= 0;
+}
+
+void printPrimaryStatus() {
+
+    if (replicationSocket < 0)
+        return;
+
+    pthread_mutex_lock(&replicasLock);
+
+    printf("Primary on %s at LSN %llu, %zu replicas\n", replicationAddress, (unsigned long long)primaryLsn,
+        replicaCount);
+
+    size_t i = 0;
+
+    for (Replica* replica = replicas; replica; replica = replica->next, i++) {
+
+        uint64_t acked = __atomic_load_n(&replica->ackedLsn, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&replica->lock);
+        printf("  replica %zu: applied LSN %llu (%llu behind), %zu bytes queued, connected %.1fs\n", i,
+            (unsigned long long)acked, (unsigned long long)(primaryLsn - acked), replica->backlog.size,
+            (wallClockNs() - replica->connectedNs) / 1e9);
+        pthread_mutex_unlock(&replica->lock);
+    }
+
+    pthread_mutex_unlock(&replicasLock);
+}
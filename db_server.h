@@ -1,4 +1,12 @@
 #ifndef DB_SERVER_H
 #define DB_SERVER_H
 
-#endif
\ No newline at end of file
+#include "database_list.h"
+
+int startMetricsServer(int port);
+
+int startReplicationServer(DatabaseList* dbl, const char* address);
+int isPrimary();
+void printPrimaryStatus();
+
+#endif
@@ -0,0 +1,1149 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "expr.h"
+#include "stats.h"
+#include "cache.h"
+#include "bloom.h"
+#include "hugemem.h"
+
+// Constant for a type: integer types drop the .5
+#define IS_INTEGRAL(ctype) ((ctype)0.5 == 0)
+
+/* Typed loops over a batch, one set per entry in DATA_TYPE_LIST. Integer
+   arithmetic wraps around instead of overflowing (it goes through unsigned
+   long long), and the operations that can give NULL clear bits in valid
+   and return how many they cleared */
+#define DEFINE_EXPR_KERNELS(id, name, ctype, member, format, exact, parse) \
+\
+static void fill_##id(void* out, DataValues value, size_t n) { \
+    ctype* o = out; \
+    for (size_t i = 0; i < n; i++) \
+        o[i] = value.member; \
+} \
+\
+static void neg_##id(const void* a, void* out, size_t n) { \
+    const ctype* x = a; \
+    ctype* o = out; \
+    for (size_t i = 0; i < n; i++) \
+        o[i] = IS_INTEGRAL(ctype) ? (ctype)(0ull - (unsigned long long)x[i]) : -x[i]; \
+} \
+\
+static void add_##id(const void* a, const void* b, void* out, size_t n) { \
+    const ctype* x = a; \
+    const ctype* y = b; \
+    ctype* o = out; \
+    for (size_t i = 0; i < n; i++) \
+        o[i] = IS_INTEGRAL(ctype) ? (ctype)((unsigned long long)x[i] + (unsigned long long)y[i]) : x[i] + y[i]; \
+} \
+\
+static void sub_##id(const void* a, const void* b, void* out, size_t n) { \
+    const ctype* x = a; \
+    const ctype* y = b; \
+    ctype* o = out; \
+    for (size_t i = 0; i < n; i++) \
+        o[i] = IS_INTEGRAL(ctype) ? (ctype)((unsigned long long)x[i] - (unsigned long long)y[i]) : x[i] - y[i]; \
+} \
+\
+static void mul_##id(const void* a, const void* b, void* out, size_t n) { \
+    const ctype* x = a; \
+    const ctype* y = b; \
+    ctype* o = out; \
+    for (size_t i = 0; i < n; i++) \
+        o[i] = IS_INTEGRAL(ctype) ? (ctype)((unsigned long long)x[i] * (unsigned long long)y[i]) : x[i] * y[i]; \
+} \
+\
+/* Integer division by 0 is NULL, and by -1 is a negation so the smallest value wraps */ \
+static size_t div_##id(const void* a, const void* b, void* out, uint64_t* valid, size_t n) { \
+    const ctype* x = a; \
+    const ctype* y = b; \
+    ctype* o = out; \
+    size_t nulls = 0; \
+    if (!IS_INTEGRAL(ctype)) { \
+        for (size_t i = 0; i < n; i++) \
+            o[i] = x[i] / y[i]; \
+        return 0; \
+    } \
+    for (size_t i = 0; i < n; i++) { \
+        if (y[i] == 0) { \
+            o[i] = 0; \
+            valid[i / 64] &= ~(1ull << (i % 64)); \
+            nulls++; \
+        } else { \
+            o[i] = y[i] == (ctype)-1 ? (ctype)(0ull - (unsigned long long)x[i]) : x[i] / y[i]; \
+        } \
+    } \
+    return nulls; \
+} \
+\
+static void toDoubles_##id(const void* in, double* out, size_t n) { \
+    const ctype* x = in; \
+    for (size_t i = 0; i < n; i++) \
+        out[i] = (double)x[i]; \
+} \
+\
+/* Every type fits in a double, so casts go through one. Values an integer type can't hold are NULL */ \
+static size_t fromDoubles_##id(const double* in, void* out, uint64_t* valid, size_t n) { \
+    ctype* o = out; \
+    size_t nulls = 0; \
+    if (!IS_INTEGRAL(ctype)) { \
+        for (size_t i = 0; i < n; i++) \
+            o[i] = (ctype)in[i]; \
+        return 0; \
+    } \
+    double limit = (double)(1ull << (sizeof(ctype) * 8 - 1)); \
+    for (size_t i = 0; i < n; i++) { \
+        if (in[i] >= -limit && in[i] < limit) { \
+            o[i] = (ctype)in[i]; \
+        } else { \
+            o[i] = 0; \
+            valid[i / 64] &= ~(1ull << (i % 64)); \
+            nulls++; \
+        } \
+    } \
+    return nulls; \
+}
+
+DATA_TYPE_LIST(DEFINE_EXPR_KERNELS)
+
+typedef struct {
+
+    void (*fill)(void* out, DataValues value, size_t n);
+    void (*neg)(const void* a, void* out, size_t n);
+    void (*add)(const void* a, const void* b, void* out, size_t n);
+    void (*sub)(const void* a, const void* b, void* out, size_t n);
+    void (*mul)(const void* a, const void* b, void* out, size_t n);
+    size_t (*div)(const void* a, const void* b, void* out, uint64_t* valid, size_t n);
+    void (*toDoubles)(const void* in, double* out, size_t n);
+    size_t (*fromDoubles)(const double* in, void* out, uint64_t* valid, size_t n);
+
+} ExprKernels;
+
+#define X(id, name, ctype, member, format, exact, parse) \
+    [id] = {fill_##id, neg_##id, add_##id, sub_##id, mul_##id, div_##id, toDoubles_##id, fromDoubles_##id},
+static const ExprKernels expr_kernels[DATA_TYPE_COUNT] = { DATA_TYPE_LIST(X) };
+#undef X
+
+/* ---- Compiling ---- */
+
+typedef struct {
+
+    Database* db;
+    ExprProgram* prog;
+    const char* pos;
+    int error;
+
+} ExprParser;
+
+// Adds an instruction writing a new register, returns the register or -1 if the program is full
+static long emit(ExprProgram* prog, ExprInstr instr) {
+
+    if (prog->numCode == EXPR_MAX_CODE)
+        return -1;
+
+    instr.dst = prog->numCode;
+    prog->code[prog->numCode] = instr;
+    prog->type = instr.type;
+
+    return prog->numCode++;
+}
+
+// Runs a one value cast on a constant, so literals never get cast per batch
+static void castConstant(ExprInstr* instr, DataTypes type) {
+
+    double wide;
+    uint64_t valid = 1;
+
+    expr_kernels[instr->type].toDoubles(&instr->value, &wide, 1);
+    instr->value = (DataValues){0};
+
+    if (expr_kernels[type].fromDoubles(&wide, &instr->value, &valid, 1))
+        instr->null = 1;
+
+    instr->type = type;
+}
+
+static long emitCast(ExprProgram* prog, long reg, DataTypes type) {
+
+    ExprInstr* from = &prog->code[reg];
+
+    if (from->type == type)
+        return reg;
+
+    // Every register is read by exactly one instruction, the one being built, so constants fold in place
+    if (from->op == EXPR_CONST) {
+        castConstant(from, type);
+        prog->type = type;
+        return reg;
+    }
+
+    return emit(prog, (ExprInstr){EXPR_CAST, type, 0, reg, 0, 0, {0}, 0});
+}
+
+static void skipSpace(ExprParser* p) {
+    p->pos += strspn(p->pos, " \t");
+}
+
+static int fail(ExprParser* p, int error) {
+
+    if (!p->error)
+        p->error = error;
+
+    return -1;
+}
+
+static long parseSum(ExprParser* p);
+
+static long parseNumber(ExprParser* p) {
+
+    const char* start = p->pos;
+    char* end;
+    ExprInstr instr = {EXPR_CONST, DOUBLE_TYPE, 0, 0, 0, 0, {0}, 0};
+
+    errno = 0;
+    instr.value.d = strtod(start, &end);
+
+    if (end == start)
+        return fail(p, -1);
+
+    size_t len = end - start;
+    long whole;
+
+    // Whole numbers that fit are INTs, like C
+    if (!memchr(start, '.', len) && !memchr(start, 'e', len) && !memchr(start, 'E', len)) {
+
+        whole = strtol(start, &end, 10);
+
+        if (errno == 0 && (size_t)(end - start) == len && whole >= -2147483647l - 1 && whole <= 2147483647l) {
+            instr.type = INT_TYPE;
+            instr.value = (DataValues){0};
+            instr.value.i = (int)whole;
+        }
+    }
+
+    p->pos = start + len;
+
+    long reg = emit(p->prog, instr);
+
+    return reg < 0 ? fail(p, -3) : reg;
+}
+
+// A column, a cast like int(...) or null
+static long parseName(ExprParser* p) {
+
+    char name[STRING_LEN];
+    const char* start = p->pos;
+    size_t len = strspn(p->pos, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+
+    if (len >= sizeof(name))
+        return fail(p, -2);
+
+    memcpy(name, p->pos, len);
+    name[len] = '\0';
+    p->pos += len;
+    skipSpace(p);
+
+    DataTypes type;
+
+    if (*p->pos == '(' && findDataType(name, &type) == 0) {
+
+        p->pos++;
+
+        long reg = parseSum(p);
+
+        if (reg < 0)
+            return -1;
+
+        skipSpace(p);
+
+        if (*p->pos != ')')
+            return fail(p, -1);
+
+        p->pos++;
+        reg = emitCast(p->prog, reg, type);
+
+        return reg < 0 ? fail(p, -3) : reg;
+    }
+
+    ExprInstr instr = {EXPR_CONST, INT_TYPE, 0, 0, 0, 0, {0}, 1};
+
+    if (!isNullText(name)) {
+
+        int col = findColumn(p->db, name);
+
+        if (col < 0) {
+            p->pos = start;
+            return fail(p, -2);
+        }
+
+        instr.op = EXPR_LOAD;
+        instr.type = p->db->cols[col].type;
+        instr.col = col;
+        instr.null = 0;
+    }
+
+    long reg = emit(p->prog, instr);
+
+    return reg < 0 ? fail(p, -3) : reg;
+}
+
+static long parseUnary(ExprParser* p) {
+
+    skipSpace(p);
+
+    char c = *p->pos;
+
+    if (c == '+') {
+        p->pos++;
+        return parseUnary(p);
+    }
+
+    if (c == '-') {
+
+        p->pos++;
+
+        long reg = parseUnary(p);
+
+        if (reg < 0)
+            return -1;
+
+        ExprInstr* operand = &p->prog->code[reg];
+
+        // -literal is a literal
+        if (operand->op == EXPR_CONST) {
+            expr_kernels[operand->type].neg(&operand->value, &operand->value, 1);
+            return reg;
+        }
+
+        reg = emit(p->prog, (ExprInstr){EXPR_NEG, operand->type, 0, reg, 0, 0, {0}, 0});
+
+        return reg < 0 ? fail(p, -3) : reg;
+    }
+
+    if (c == '(') {
+
+        p->pos++;
+
+        long reg = parseSum(p);
+
+        if (reg < 0)
+            return -1;
+
+        skipSpace(p);
+
+        if (*p->pos != ')')
+            return fail(p, -1);
+
+        p->pos++;
+
+        return reg;
+    }
+
+    if (isdigit((unsigned char)c) || (c == '.' && isdigit((unsigned char)p->pos[1])))
+        return parseNumber(p);
+
+    if (isalpha((unsigned char)c) || c == '_')
+        return parseName(p);
+
+    return fail(p, -1);
+}
+
+// Both sides are cast to the wider type first
+static long emitBinary(ExprParser* p, ExprOpcode op, long a, long b) {
+
+    DataTypes type = p->prog->code[a].type > p->prog->code[b].type ? p->prog->code[a].type : p->prog->code[b].type;
+
+    if ((a = emitCast(p->prog, a, type)) < 0 || (b = emitCast(p->prog, b, type)) < 0)
+        return fail(p, -3);
+
+    long reg = emit(p->prog, (ExprInstr){op, type, 0, a, b, 0, {0}, 0});
+
+    return reg < 0 ? fail(p, -3) : reg;
+}
+
+static long parseProduct(ExprParser* p) {
+
+    long reg = parseUnary(p);
+
+    while (reg >= 0) {
+
+        skipSpace(p);
+
+        char c = *p->pos;
+
+        if (c != '*' && c != '/')
+            break;
+
+        p->pos++;
+
+        long rhs = parseUnary(p);
+
+        if (rhs < 0)
+            return -1;
+
+        reg = emitBinary(p, c == '*' ? EXPR_MUL : EXPR_DIV, reg, rhs);
+    }
+
+    return reg;
+}
+
+static long parseSum(ExprParser* p) {
+
+    long reg = parseProduct(p);
+
+    while (reg >= 0) {
+
+        skipSpace(p);
+
+        char c = *p->pos;
+
+        if (c != '+' && c != '-')
+            break;
+
+        p->pos++;
+
+        long rhs = parseProduct(p);
+
+        if (rhs < 0)
+            return -1;
+
+        reg = emitBinary(p, c == '+' ? EXPR_ADD : EXPR_SUB, reg, rhs);
+    }
+
+    return reg;
+}
+
+/* Compiles text against the columns of db. Returns 0, or -1 for a syntax error,
+   -2 for an unknown column and -3 if the expression is too long. out->errorAt is
+   where in the text it went wrong */
+int compileExpr(Database* db, const char* text, ExprProgram* out) {
+
+    memset(out, 0, sizeof(ExprProgram));
+    snprintf(out->text, sizeof(out->text), "%s", text);
+
+    if (strlen(text) >= sizeof(out->text))
+        return -3;
+
+    ExprParser p = {db, out, out->text, 0};
+    long reg = parseSum(&p);
+
+    skipSpace(&p);
+
+    if (reg >= 0 && *p.pos != '\0')
+        fail(&p, -1);
+
+    out->errorAt = p.pos - out->text;
+
+    return p.error;
+}
+
+// Makes the program give type, e.g. the type of the column it's stored in. Returns -3 if it's full
+int castExpr(ExprProgram* prog, DataTypes type) {
+
+    if (!prog->numCode)
+        return -1;
+
+    return emitCast(prog, prog->numCode - 1, type) < 0 ? -3 : 0;
+}
+
+/* ---- Evaluating ---- */
+
+typedef struct {
+
+    void* data;
+    uint64_t valid[VALIDITY_WORDS(EXPR_BATCH_ROWS)];
+    int hasNulls;
+
+} ExprRegister;
+
+struct ExprState {
+
+    const ExprProgram* prog;
+    ExprRegister* regs;
+    double* wide;
+
+};
+
+// Registers for one evaluation at a time, constants are filled in here once
+ExprState* newExprState(const ExprProgram* prog) {
+
+    ExprState* state = malloc(sizeof(ExprState));
+    ExprRegister* regs = calloc(prog->numCode ? prog->numCode : 1, sizeof(ExprRegister));
+    unsigned char* data = malloc((prog->numCode + 1) * EXPR_BATCH_ROWS * sizeof(double));
+
+    if (!state || !regs || !data) {
+        fprintf(stderr, "malloc returned NULL pointer for ExprState\n");
+        exit(1);
+    }
+
+    state->prog = prog;
+    state->regs = regs;
+    state->wide = (double*)data;
+
+    for (size_t i = 0; i < prog->numCode; i++) {
+
+        const ExprInstr* instr = &prog->code[i];
+
+        regs[i].data = data + (i + 1) * EXPR_BATCH_ROWS * sizeof(double);
+
+        if (instr->op == EXPR_CONST) {
+            expr_kernels[instr->type].fill(regs[i].data, instr->value, EXPR_BATCH_ROWS);
+            regs[i].hasNulls = instr->null;
+        }
+    }
+
+    return state;
+}
+
+void freeExprState(ExprState* state) {
+
+    if (!state)
+        return;
+
+    free(state->wide);
+    free(state->regs);
+    free(state);
+}
+
+// NULL wherever either side is NULL
+static void combineValidity(ExprRegister* dst, const ExprRegister* a, const ExprRegister* b, size_t count) {
+
+    dst->hasNulls = a->hasNulls || (b && b->hasNulls);
+
+    if (!dst->hasNulls)
+        return;
+
+    for (size_t w = 0; w < VALIDITY_WORDS(count); w++)
+        dst->valid[w] = (a->hasNulls ? a->valid[w] : ~0ull) & (b && b->hasNulls ? b->valid[w] : ~0ull);
+}
+
+// Before a kernel that can clear bits
+static void prepareValidity(ExprRegister* dst, size_t count) {
+
+    if (!dst->hasNulls)
+        memset(dst->valid, 0xff, VALIDITY_WORDS(count) * sizeof(uint64_t));
+}
+
+/* Evaluates the program for count (at most EXPR_BATCH_ROWS) rows of db. Returns a typed
+   array of the program's type that's good until the next call, *validity is set to its
+   bitmap or NULL if none of it is NULL. Returns NULL if db no longer has the columns the
+   program was compiled against */
+const void* evalExpr(ExprState* state, Database* db, const size_t* rowIndexes, size_t count,
+    const uint64_t** validity) {
+
+    const ExprProgram* prog = state->prog;
+    ExprRegister* regs = state->regs;
+
+    if (count > EXPR_BATCH_ROWS || !prog->numCode)
+        return NULL;
+
+    for (size_t i = 0; i < prog->numCode; i++) {
+
+        const ExprInstr* instr = &prog->code[i];
+        const ExprKernels* k = &expr_kernels[instr->type];
+        ExprRegister* dst = &regs[i];
+        ExprRegister* a = &regs[instr->a];
+        ExprRegister* b = &regs[instr->b];
+
+        switch (instr->op) {
+            case EXPR_LOAD :
+                if (instr->col >= db->numCols || db->cols[instr->col].type != instr->type)
+                    return NULL;
+                typeOps(instr->type)->gatherRows(db->rows, rowIndexes, instr->col, count, dst->data);
+                dst->hasNulls = db->cols[instr->col].nullCount
+                    && gatherValidityRows(db, instr->col, rowIndexes, count, dst->valid);
+                break;
+            case EXPR_CONST :
+                break;
+            case EXPR_NEG :
+                k->neg(a->data, dst->data, count);
+                combineValidity(dst, a, NULL, count);
+                break;
+            case EXPR_ADD :
+                k->add(a->data, b->data, dst->data, count);
+                combineValidity(dst, a, b, count);
+                break;
+            case EXPR_SUB :
+                k->sub(a->data, b->data, dst->data, count);
+                combineValidity(dst, a, b, count);
+                break;
+            case EXPR_MUL :
+                k->mul(a->data, b->data, dst->data, count);
+                combineValidity(dst, a, b, count);
+                break;
+            case EXPR_DIV :
+                combineValidity(dst, a, b, count);
+                prepareValidity(dst, count);
+                dst->hasNulls |= k->div(a->data, b->data, dst->data, dst->valid, count) > 0;
+                break;
+            case EXPR_CAST :
+                combineValidity(dst, a, NULL, count);
+                prepareValidity(dst, count);
+                expr_kernels[prog->code[instr->a].type].toDoubles(a->data, state->wide, count);
+                dst->hasNulls |= k->fromDoubles(state->wide, dst->data, dst->valid, count) > 0;
+                break;
+            default :
+                return NULL;
+        }
+    }
+
+    ExprRegister* result = &regs[prog->numCode - 1];
+
+    *validity = result->hasNulls ? result->valid : NULL;
+
+    return result->data;
+}
+
+/* ---- UPDATE ---- */
+
+// One worker's share of an update: rows [next, end), evaluated a round at a time
+typedef struct {
+
+    Database* db;
+    const ExprProgram* prog;
+    const Predicate* preds;
+    size_t numPreds;
+    size_t width;
+
+    // Which worker this is, picks the CPU when workers are pinned
+    size_t index;
+    size_t next;
+    size_t end;
+
+    ExprState* state;
+
+    // This round's results, waiting to be written
+    size_t* rowIndexes;
+    unsigned char* values;
+    uint64_t* validity;
+    size_t count;
+    int hasNulls;
+    int failed;
+
+} UpdateWorker;
+
+// Evaluates the next EXPR_ROUND_ROWS rows that match into the worker's buffers. Only reads the table
+static void* evalRound(void* arg) {
+
+    UpdateWorker* w = arg;
+    size_t batch[EXPR_BATCH_ROWS];
+
+    w->count = 0;
+    w->hasNulls = 0;
+
+    while (w->next < w->end && w->count + EXPR_BATCH_ROWS <= EXPR_ROUND_ROWS) {
+
+        // Slices and batches start on a block, so whole blocks the Bloom filters rule out are skipped
+        size_t first = firstCandidateRow(w->db, w->next, w->preds, w->numPreds);
+
+        if ((w->next = first < w->end ? first : w->end) == w->end)
+            break;
+
+        size_t last = w->end - w->next < EXPR_BATCH_ROWS ? w->end : w->next + EXPR_BATCH_ROWS;
+        size_t n = 0;
+
+        for (size_t r = w->next; r < last; r++) {
+            if (!w->numPreds || rowMatches(w->db, r, w->preds, w->numPreds))
+                batch[n++] = r;
+        }
+
+        w->next = last;
+
+        if (!n)
+            continue;
+
+        const uint64_t* validity;
+        const void* values = evalExpr(w->state, w->db, batch, n, &validity);
+
+        if (!values) {
+            w->failed = 1;
+            return NULL;
+        }
+
+        memcpy(w->rowIndexes + w->count, batch, n * sizeof(size_t));
+        memcpy(w->values + w->count * w->width, values, n * w->width);
+
+        if (validity && !w->hasNulls) {
+            memset(w->validity, 0xff, VALIDITY_WORDS(EXPR_ROUND_ROWS) * sizeof(uint64_t));
+            w->hasNulls = 1;
+        }
+
+        for (size_t i = 0; validity && i < n; i++) {
+            if (!((validity[i / 64] >> (i % 64)) & 1))
+                w->validity[(w->count + i) / 64] &= ~(1ull << ((w->count + i) % 64));
+        }
+
+        w->count += n;
+    }
+
+    return NULL;
+}
+
+// evalRound on a thread of its own, on the worker's CPU when workers are pinned
+static void* evalRoundThread(void* arg) {
+
+    pinWorker(((UpdateWorker*)arg)->index);
+
+    return evalRound(arg);
+}
+
+static size_t updateThreads(Database* db, size_t numThreads) {
+
+    if (numThreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = db->numRows < EXPR_PARALLEL_MIN_ROWS || cpus < 1 ? 1 : (size_t)cpus;
+    }
+
+    if (numThreads > EXPR_MAX_THREADS)
+        numThreads = EXPR_MAX_THREADS;
+
+    // Every thread gets at least a round of rows
+    while (numThreads > 1 && db->numRows / numThreads < EXPR_ROUND_ROWS)
+        numThreads--;
+
+    return numThreads;
+}
+
+/* UPDATE col = prog [WHERE preds]. The value is cast to the column's type. Rows are
+   split between numThreads threads (0 picks one per CPU for big tables), which
+   evaluate a round of rows each while the table is left alone. Their results are
+   then written a whole batch at a time, so the table is only ever changed from
+   this thread. Returns the number of rows updated, -1 for a bad column, -2 if the
+   program doesn't fit the table and -3 if it's too long to cast */
+long updateColumnExpr(Database* db, size_t col, const ExprProgram* prog, const Predicate* preds, size_t numPreds,
+    size_t numThreads) {
+
+    if (col >= db->numCols)
+        return -1;
+
+    // Computed columns in the filter are read through their one block buffer
+    for (size_t p = 0; p < numPreds; p++) {
+        if (preds[p].col >= db->numCols)
+            numThreads = 1;
+    }
+
+    ExprProgram* program = malloc(sizeof(ExprProgram));
+
+    if (!program) {
+        fprintf(stderr, "malloc returned NULL pointer for ExprProgram\n");
+        exit(1);
+    }
+
+    *program = *prog;
+
+    if (castExpr(program, db->cols[col].type) < 0) {
+        free(program);
+        return -3;
+    }
+
+    STATS_BEGIN();
+
+    // The workers only read the filters
+    syncBloomFilters(db);
+
+    size_t threads = updateThreads(db, numThreads);
+    UpdateWorker* workers = calloc(threads, sizeof(UpdateWorker));
+    pthread_t* ids = malloc(threads * sizeof(pthread_t));
+
+    if (!workers || !ids) {
+        fprintf(stderr, "malloc returned NULL pointer for update workers\n");
+        exit(1);
+    }
+
+    size_t width = typeOps(db->cols[col].type)->width;
+    // Slices start on a block, so each block's dirty bit and validity words come from one thread
+    size_t slice = (db->numRows / threads + BLOCK_ROWS - 1) / BLOCK_ROWS * BLOCK_ROWS;
+
+    for (size_t t = 0; t < threads; t++) {
+
+        UpdateWorker* w = &workers[t];
+
+        w->db = db;
+        w->prog = program;
+        w->preds = preds;
+        w->numPreds = numPreds;
+        w->width = width;
+        w->index = t;
+        w->next = t * slice < db->numRows ? t * slice : db->numRows;
+        w->end = t == threads - 1 || (t + 1) * slice > db->numRows ? db->numRows : (t + 1) * slice;
+        w->state = newExprState(program);
+        w->rowIndexes = malloc(EXPR_ROUND_ROWS * sizeof(size_t));
+        w->values = malloc(EXPR_ROUND_ROWS * width);
+        w->validity = malloc(VALIDITY_WORDS(EXPR_ROUND_ROWS) * sizeof(uint64_t));
+
+        if (!w->rowIndexes || !w->values || !w->validity) {
+            fprintf(stderr, "malloc returned NULL pointer for update buffers\n");
+            exit(1);
+        }
+    }
+
+    long updated = 0;
+    int more = 1;
+
+    while (more && updated >= 0) {
+
+        if (threads == 1) {
+            evalRound(&workers[0]);
+        } else {
+            for (size_t t = 0; t < threads; t++) {
+                if (pthread_create(&ids[t], NULL, evalRoundThread, &workers[t]) != 0) {
+                    fprintf(stderr, "pthread_create failed for update worker\n");
+                    exit(1);
+                }
+            }
+            for (size_t t = 0; t < threads; t++)
+                pthread_join(ids[t], NULL);
+        }
+
+        more = 0;
+
+        for (size_t t = 0; t < threads && updated >= 0; t++) {
+
+            UpdateWorker* w = &workers[t];
+
+            if (w->failed) {
+                updated = -2;
+                break;
+            }
+
+            if (writeColumnRows(db, col, db->cols[col].type, w->rowIndexes, w->count, w->values,
+                    w->hasNulls ? w->validity : NULL) < 0) {
+                updated = -2;
+                break;
+            }
+
+            updated += w->count;
+            more |= w->next < w->end;
+        }
+    }
+
+    for (size_t t = 0; t < threads; t++) {
+        freeExprState(workers[t].state);
+        free(workers[t].rowIndexes);
+        free(workers[t].values);
+        free(workers[t].validity);
+    }
+
+    free(workers);
+    free(ids);
+    free(program);
+
+    STATS_END(STAT_UPDATE_COLUMN);
+
+    return updated;
+}
+
+/* ---- Computed columns ---- */
+
+_Static_assert(EXPR_BATCH_ROWS >= BLOCK_ROWS, "a computed block is evaluated in one batch");
+
+static ComputedColumn* computedColumn(const Database* db, size_t col) {
+    return db->computed[col - db->numCols];
+}
+
+// Index of a computed column by name (numCols and up), -1 if there isn't one
+int findComputedColumn(Database* db, const char* name) {
+
+    for (size_t i = 0; i < db->numComputed; i++) {
+        if (strcmp(db->computed[i]->name, name) == 0)
+            return (int)(db->numCols + i);
+    }
+
+    return -1;
+}
+
+DataTypes columnType(const Database* db, size_t col) {
+    return col < db->numCols ? db->cols[col].type : computedColumn(db, col)->prog.type;
+}
+
+const char* columnName(const Database* db, size_t col) {
+    return col < db->numCols ? db->cols[col].colName : computedColumn(db, col)->name;
+}
+
+/* What a computed column gives only changes when its definition, or a column it
+   reads, does. Every change takes the next version from one clock, so the largest
+   of those versions is a version for the computed column */
+static unsigned long long computedVersion(const Database* db, const ComputedColumn* cc) {
+
+    unsigned long long version = cc->defined;
+
+    for (size_t i = 0; i < cc->prog.numCode; i++) {
+
+        const ExprInstr* instr = &cc->prog.code[i];
+
+        if (instr->op == EXPR_LOAD && instr->col < db->numCols && db->cols[instr->col].version > version)
+            version = db->cols[instr->col].version;
+    }
+
+    return version;
+}
+
+// Changes whenever a cell of the column (stored or computed) may have changed
+unsigned long long columnVersion(const Database* db, size_t col) {
+    return col < db->numCols ? db->cols[col].version : computedVersion(db, computedColumn(db, col));
+}
+
+/* Defines a column as prog, compiled against db. Returns 0, or -1 if there's
+   already a column with that name */
+int addComputedColumn(Database* db, const char* name, const ExprProgram* prog) {
+
+    if (findColumn(db, name) >= 0 || findComputedColumn(db, name) >= 0 || !prog->numCode)
+        return -1;
+
+    ComputedColumn** computed = realloc(db->computed, (db->numComputed + 1) * sizeof(ComputedColumn*));
+    ComputedColumn* cc = malloc(sizeof(ComputedColumn));
+
+    if (!computed || !cc) {
+        fprintf(stderr, "malloc returned NULL pointer for ComputedColumn\n");
+        exit(1);
+    }
+
+    snprintf(cc->name, sizeof(cc->name), "%s", name);
+    cc->prog = *prog;
+    cc->state = newExprState(&cc->prog);
+    cc->defined = nextVersion();
+    cc->hasBlock = 0;
+
+    db->computed = computed;
+    db->computed[db->numComputed++] = cc;
+
+    return 0;
+}
+
+// Returns 0, or -1 if col isn't a computed column
+int dropComputedColumn(Database* db, size_t col) {
+
+    if (col < db->numCols || col >= totalColumns(db))
+        return -1;
+
+    size_t index = col - db->numCols;
+
+    freeExprState(db->computed[index]->state);
+    free(db->computed[index]);
+
+    for (size_t i = index; i + 1 < db->numComputed; i++)
+        db->computed[i] = db->computed[i + 1];
+
+    db->numComputed--;
+
+    return 0;
+}
+
+/* Turns a computed column into a stored one of the same name and type holding
+   its current values, for expressions read often enough to be worth the space.
+   Returns the number of rows written, or -1 if col isn't a computed column and
+   the errors of updateColumnExpr */
+long materializeColumn(Database* db, size_t col, size_t numThreads) {
+
+    if (col < db->numCols || col >= totalColumns(db))
+        return -1;
+
+    ComputedColumn* cc = computedColumn(db, col);
+    ExprProgram* prog = malloc(sizeof(ExprProgram));
+    char name[STRING_LEN];
+
+    if (!prog) {
+        fprintf(stderr, "malloc returned NULL pointer for ExprProgram\n");
+        exit(1);
+    }
+
+    *prog = cc->prog;
+    memcpy(name, cc->name, STRING_LEN);
+
+    // The new column takes the name, and adding it renumbers the computed columns anyway
+    dropComputedColumn(db, col);
+    createColumn(db, name, prog->type);
+
+    long written = updateColumnExpr(db, db->numCols - 1, prog, NULL, 0, numThreads);
+
+    free(prog);
+
+    return written;
+}
+
+// Evaluates block of the column into its block buffer, or copies it from the result cache
+static int loadComputedBlock(Database* db, ComputedColumn* cc, size_t block, unsigned long long version) {
+
+    ComputedBlock* b = &cc->block;
+    size_t first = block * BLOCK_ROWS;
+    size_t rows = db->numRows - first < BLOCK_ROWS ? db->numRows - first : BLOCK_ROWS;
+    size_t size = offsetof(ComputedBlock, values) + rows * typeOps(cc->prog.type)->width;
+    CacheStamp stamp = {2, {db->rowsVersion, version}};
+    char key[STRING_LEN * 2 + 48];
+
+    snprintf(key, sizeof(key), "computed|%s|%s|%zu", db->dbName, cc->name, block);
+
+    cc->hasBlock = 0;
+
+    if (!cacheLookup(key, &stamp, b, size)) {
+
+        size_t rowIndexes[BLOCK_ROWS];
+        const uint64_t* validity;
+
+        for (size_t i = 0; i < rows; i++)
+            rowIndexes[i] = first + i;
+
+        const void* values = evalExpr(cc->state, db, rowIndexes, rows, &validity);
+
+        if (!values)
+            return -1;
+
+        b->rows = rows;
+        b->hasNulls = validity != NULL;
+        memcpy(b->values, values, rows * typeOps(cc->prog.type)->width);
+
+        if (validity)
+            memcpy(b->valid, validity, VALIDITY_WORDS(rows) * sizeof(uint64_t));
+
+        cacheStore(key, &stamp, b, size);
+    }
+
+    cc->blockIndex = block;
+    cc->blockRowsVersion = db->rowsVersion;
+    cc->blockVersion = version;
+    cc->hasBlock = 1;
+
+    return 0;
+}
+
+/* Reads one cell of computed column col. Returns 1 with the value in *out, 0 if
+   it's NULL and -1 if the row or column doesn't exist */
+int computedCell(Database* db, size_t col, size_t rowIndex, DataValues* out) {
+
+    if (col < db->numCols || col >= totalColumns(db) || rowIndex >= db->numRows)
+        return -1;
+
+    ComputedColumn* cc = computedColumn(db, col);
+    size_t block = rowIndex / BLOCK_ROWS;
+    unsigned long long version = computedVersion(db, cc);
+
+    if ((!cc->hasBlock || cc->blockIndex != block || cc->blockRowsVersion != db->rowsVersion
+            || cc->blockVersion != version) && loadComputedBlock(db, cc, block, version) < 0)
+        return -1;
+
+    size_t i = rowIndex % BLOCK_ROWS;
+
+    if (cc->block.hasNulls && !((cc->block.valid[i / 64] >> (i % 64)) & 1))
+        return 0;
+
+    *out = typeOps(cc->prog.type)->load(cc->block.values, i);
+
+    return 1;
+}
+
+/* Computed column col for count (at most EXPR_BATCH_ROWS) rows, same as evalExpr:
+   the typed array is good until the column is next read */
+const void* evalComputed(Database* db, size_t col, const size_t* rowIndexes, size_t count,
+    const uint64_t** validity) {
+
+    if (col < db->numCols || col >= totalColumns(db))
+        return NULL;
+
+    return evalExpr(computedColumn(db, col)->state, db, rowIndexes, count, validity);
+}
+
+/* Compiles every computed column again from its text, after the stored columns
+   were renumbered or renamed. Columns that no longer compile are dropped */
+void refreshComputedColumns(Database* db) {
+
+    ExprProgram* prog = malloc(sizeof(ExprProgram));
+
+    if (!prog) {
+        fprintf(stderr, "malloc returned NULL pointer for ExprProgram\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < db->numComputed;) {
+
+        ComputedColumn* cc = db->computed[i];
+
+        if (compileExpr(db, cc->prog.text, prog) < 0) {
+            printf("Dropped computed column %s, '%s' no longer compiles.\n", cc->name, cc->prog.text);
+            dropComputedColumn(db, db->numCols + i);
+            continue;
+        }
+
+        freeExprState(cc->state);
+        cc->prog = *prog;
+        cc->state = newExprState(&cc->prog);
+        cc->defined = nextVersion();
+        cc->hasBlock = 0;
+        i++;
+    }
+
+    free(prog);
+}
+
+// Length of the name or number at text, 0 if it's neither
+static size_t tokenLength(const char* text) {
+
+    size_t len = 0;
+
+    if (isalpha((unsigned char)*text) || *text == '_') {
+        while (isalnum((unsigned char)text[len]) || text[len] == '_')
+            len++;
+    } else if (isdigit((unsigned char)*text) || *text == '.') {
+        // Numbers can have letters (1e5), which mustn't be taken for a name
+        while (isalnum((unsigned char)text[len]) || text[len] == '.'
+            || ((text[len] == '+' || text[len] == '-') && (text[len - 1] == 'e' || text[len - 1] == 'E')))
+            len++;
+    }
+
+    return len;
+}
+
+// Rewrites the expressions that read stored column oldName to read newName
+void renameComputedSource(Database* db, const char* oldName, const char* newName) {
+
+    for (size_t i = 0; i < db->numComputed; i++) {
+
+        ExprProgram* prog = &db->computed[i]->prog;
+        char text[2 * EXPR_TEXT_LEN];
+        size_t len = 0;
+
+        for (const char* p = prog->text; *p && len < sizeof(text) - STRING_LEN;) {
+
+            size_t n = tokenLength(p);
+            const char* next = p + (n ? n : 1);
+
+            while (isspace((unsigned char)*next))
+                next++;
+
+            // A name followed by '(' is a cast
+            if (n && strlen(oldName) == n && memcmp(p, oldName, n) == 0 && *next != '(') {
+                len += snprintf(text + len, sizeof(text) - len, "%s", newName);
+            } else {
+                memcpy(text + len, p, n ? n : 1);
+                len += n ? n : 1;
+            }
+
+            p += n ? n : 1;
+        }
+
+        text[len] = '\0';
+        snprintf(prog->text, sizeof(prog->text), "%s", text);
+
+        // Too long for the program now, refreshing drops it
+        if (len >= sizeof(prog->text))
+            prog->text[0] = '\0';
+    }
+
+    refreshComputedColumns(db);
+}
+
+void freeComputedColumns(Database* db) {
+
+    for (size_t i = 0; i < db->numComputed; i++) {
+        freeExprState(db->computed[i]->state);
+        free(db->computed[i]);
+    }
+
+    free(db->computed);
+    db->computed = NULL;
+    db->numComputed = 0;
+}
@@ -0,0 +1,140 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include "database.h"
+#include "query.h"
+
+/* Column expressions like "price * 1.1 + int(qty) / 2", compiled to a small
+   bytecode program and evaluated a batch of EXPR_BATCH_ROWS rows at a time.
+   Every instruction runs one typed loop over the whole batch into its own
+   register, so the type switch happens once per instruction per batch and
+   not once per cell.
+
+   Types follow C: an operation on two types gives the one further down
+   DATA_TYPE_LIST (INT, FLOAT, DOUBLE), and int(), float() and double() cast.
+   A NULL operand gives NULL, and so do an INT divided by 0 and a cast to INT
+   of a value out of its range. Literals with a '.' or exponent are DOUBLE,
+   null is a NULL. */
+
+#define EXPR_BATCH_ROWS CURSOR_BATCH_ROWS
+#define EXPR_MAX_CODE 64
+#define EXPR_TEXT_LEN 256
+
+// Rows per thread between writes when an update runs in parallel, and the
+// smallest table worth starting threads for
+#define EXPR_ROUND_ROWS (16 * EXPR_BATCH_ROWS)
+#define EXPR_PARALLEL_MIN_ROWS (4 * EXPR_ROUND_ROWS)
+#define EXPR_MAX_THREADS 16
+
+typedef enum {
+
+    EXPR_LOAD,   // col
+    EXPR_CONST,  // value, null
+    EXPR_NEG,    // a
+    EXPR_ADD,    // a, b
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV,
+    EXPR_CAST,   // a, to type
+    EXPR_OP_COUNT
+
+} ExprOpcode;
+
+// Writes register dst with the result, of type type
+typedef struct {
+
+    ExprOpcode op;
+    DataTypes type;
+    size_t dst;
+    size_t a;
+    size_t b;
+
+    size_t col;
+    DataValues value;
+    int null;
+
+} ExprInstr;
+
+typedef struct ExprProgram {
+
+    ExprInstr code[EXPR_MAX_CODE];
+    size_t numCode;
+
+    // One register per instruction, the last one holds the result
+    DataTypes type;
+
+    // The text it was compiled from, and where compiling stopped on an error
+    char text[EXPR_TEXT_LEN];
+    size_t errorAt;
+
+} ExprProgram;
+
+typedef struct ExprState ExprState;
+
+int compileExpr(Database* db, const char* text, ExprProgram* out);
+int castExpr(ExprProgram* prog, DataTypes type);
+
+ExprState* newExprState(const ExprProgram* prog);
+void freeExprState(ExprState* state);
+const void* evalExpr(ExprState* state, Database* db, const size_t* rowIndexes, size_t count,
+    const uint64_t** validity);
+
+long updateColumnExpr(Database* db, size_t col, const ExprProgram* prog, const Predicate* preds, size_t numPreds,
+    size_t numThreads);
+
+/* Computed columns, e.g. total = price * qty, keep only their compiled program
+   and are evaluated when they're read. Query code numbers them after the stored
+   columns (see totalColumns) and they can be printed, exported, filtered on,
+   sorted on and aggregated like stored ones, but not written.
+
+   A cell is read by evaluating the whole BLOCK_ROWS block it's in, which the
+   column keeps and also puts in the result cache. Both are stamped with the
+   versions of the rows and of the columns the program reads, so writes to any
+   other column leave them valid. The block buffer is per column, so reads of a
+   computed column have to come from one thread at a time */
+
+typedef struct {
+
+    size_t rows;
+    int hasNulls;
+    uint64_t valid[VALIDITY_WORDS(BLOCK_ROWS)];
+    unsigned char values[BLOCK_ROWS * sizeof(DataValues)];
+
+} ComputedBlock;
+
+typedef struct ComputedColumn {
+
+    char name[STRING_LEN];
+    ExprProgram prog;
+    ExprState* state;
+
+    // Changes whenever the column is (re)compiled
+    unsigned long long defined;
+
+    // The block last evaluated and the versions it was evaluated at
+    ComputedBlock block;
+    size_t blockIndex;
+    unsigned long long blockRowsVersion;
+    unsigned long long blockVersion;
+    int hasBlock;
+
+} ComputedColumn;
+
+int addComputedColumn(Database* db, const char* name, const ExprProgram* prog);
+int dropComputedColumn(Database* db, size_t col);
+long materializeColumn(Database* db, size_t col, size_t numThreads);
+int findComputedColumn(Database* db, const char* name);
+
+DataTypes columnType(const Database* db, size_t col);
+const char* columnName(const Database* db, size_t col);
+unsigned long long columnVersion(const Database* db, size_t col);
+
+int computedCell(Database* db, size_t col, size_t rowIndex, DataValues* out);
+const void* evalComputed(Database* db, size_t col, const size_t* rowIndexes, size_t count,
+    const uint64_t** validity);
+
+void refreshComputedColumns(Database* db);
+void renameComputedSource(Database* db, const char* oldName, const char* newName);
+void freeComputedColumns(Database* db);
+
+#endif
@@ -0,0 +1,712 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "fileio.h"
+#include "stats.h"
+
+const char* io_backend_names[IO_BACKEND_COUNT] = {"uring", "threads", "sync"};
+
+static IoConfig ioConfig = {IO_BACKEND_URING, 0, IO_DEFAULT_DEPTH, IO_DEFAULT_CHUNK};
+
+// Set once the kernel has refused io_uring, so later files go straight to threads
+static int uringUnavailable = 0;
+
+typedef enum { SLOT_IDLE, SLOT_PENDING, SLOT_DONE } SlotState;
+
+typedef struct {
+
+    char* buffer;
+    off_t offset;
+    size_t length;
+    ssize_t result;
+    SlotState state;
+
+} IoSlot;
+
+typedef struct {
+
+    int fd;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+
+} Uring;
+
+// Workers take slots off queue, the slot states are guarded by lock
+typedef struct {
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    size_t queue[IO_MAX_DEPTH];
+    size_t queueHead;
+    size_t queued;
+    int stop;
+
+    pthread_t threads[IO_MAX_THREADS];
+    size_t numThreads;
+
+} IoPool;
+
+struct IoFile {
+
+    int fd;
+    int writing;
+    int direct;
+    IoBackend backend;
+
+    IoSlot slots[IO_MAX_DEPTH];
+    size_t depth;
+    size_t chunkSize;
+
+    // Reader: the size of the file and the next offset to submit. Writer: bytes handed to ioWrite
+    off_t size;
+    off_t nextOffset;
+
+    // Reader: the slot handed out by ioReadChunk. Writer: the slot being filled and its bytes
+    size_t head;
+    int consuming;
+    size_t fill;
+
+    // First errno seen, 0 while everything has worked
+    int error;
+
+    Uring ring;
+    IoPool* pool;
+
+    // ioReadLine's place in the current chunk, and lines that run over the end of one
+    char* chunk;
+    size_t chunkLen;
+    size_t chunkPos;
+    char* carry;
+    size_t carryLen;
+    size_t carryCap;
+};
+
+/* Changes the settings for files opened from now on. depth is clamped to
+   [1, IO_MAX_DEPTH], chunkSize must be a multiple of IO_ALIGN. Returns 0, -1 for
+   a chunk size that isn't */
+int setIoConfig(const IoConfig* config) {
+
+    if (!config->chunkSize || config->chunkSize % IO_ALIGN || config->backend >= IO_BACKEND_COUNT)
+        return -1;
+
+    ioConfig = *config;
+
+    if (ioConfig.depth < 1)
+        ioConfig.depth = 1;
+    if (ioConfig.depth > IO_MAX_DEPTH)
+        ioConfig.depth = IO_MAX_DEPTH;
+
+    return 0;
+}
+
+IoConfig getIoConfig() {
+    return ioConfig;
+}
+
+// The backend files actually get, io_uring turns into threads once the kernel has refused it
+IoBackend effectiveIoBackend() {
+    return ioConfig.backend == IO_BACKEND_URING && uringUnavailable ? IO_BACKEND_THREADS : ioConfig.backend;
+}
+
+// Reads or writes all of a slot (or up to the end of the file), the way every backend finishes a short transfer
+static ssize_t transferRest(IoFile* file, IoSlot* slot, size_t done) {
+
+    while (done < slot->length) {
+
+        ssize_t n = file->writing ? pwrite(file->fd, slot->buffer + done, slot->length - done, slot->offset + done)
+            : pread(file->fd, slot->buffer + done, slot->length - done, slot->offset + done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0)
+            return -errno;
+
+        if (n == 0)
+            break;
+
+        done += n;
+    }
+
+    return done;
+}
+
+/* io_uring without liburing */
+
+static int uringSetup(Uring* ring, unsigned entries) {
+
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both rings in one go
+    int single = params.features & IORING_FEAT_SINGLE_MMAP;
+
+    if (single) {
+        if (ring->cqRingSize > ring->sqRingSize)
+            ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = 0;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_SQ_RING);
+    ring->cqRing = single ? ring->sqRing : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_SQES);
+
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sqRing != MAP_FAILED)
+            munmap(ring->sqRing, ring->sqRingSize);
+        if (!single && ring->cqRing != MAP_FAILED)
+            munmap(ring->cqRing, ring->cqRingSize);
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqesSize);
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+
+    char* sq = ring->sqRing;
+    char* cq = ring->cqRing;
+
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+static void uringTeardown(Uring* ring) {
+
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRingSize)
+        munmap(ring->cqRing, ring->cqRingSize);
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+static int uringEnter(Uring* ring, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+
+    int result;
+
+    do {
+        result = syscall(__NR_io_uring_enter, ring->fd, toSubmit, minComplete, flags, NULL, 0);
+    } while (result < 0 && errno == EINTR);
+
+    return result;
+}
+
+static void uringSubmit(IoFile* file, size_t index) {
+
+    Uring* ring = &file->ring;
+    IoSlot* slot = &file->slots[index];
+    unsigned tail = *ring->sqTail;
+    unsigned entry = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[entry];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = file->writing ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = file->fd;
+    sqe->addr = (uint64_t)(uintptr_t)slot->buffer;
+    sqe->len = slot->length;
+    sqe->off = slot->offset;
+    sqe->user_data = index;
+
+    ring->sqArray[entry] = entry;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    if (uringEnter(ring, 1, 0, 0) < 0) {
+        // Nothing was queued, the slot fails like a transfer would
+        __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+        slot->result = -errno;
+        slot->state = SLOT_DONE;
+    }
+}
+
+static void uringReap(IoFile* file) {
+
+    Uring* ring = &file->ring;
+    unsigned head = *ring->cqHead;
+
+    while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+        IoSlot* slot = &file->slots[cqe->user_data];
+
+        slot->result = cqe->res;
+        slot->state = SLOT_DONE;
+        head++;
+    }
+
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/* Thread pool */
+
+static void* ioWorker(void* arg) {
+
+    IoFile* file = arg;
+    IoPool* pool = file->pool;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+
+        while (!pool->queued && !pool->stop)
+            pthread_cond_wait(&pool->work, &pool->lock);
+
+        if (!pool->queued)
+            break;
+
+        IoSlot* slot = &file->slots[pool->queue[pool->queueHead]];
+
+        pool->queueHead = (pool->queueHead + 1) % IO_MAX_DEPTH;
+        pool->queued--;
+
+        pthread_mutex_unlock(&pool->lock);
+        ssize_t result = transferRest(file, slot, 0);
+        pthread_mutex_lock(&pool->lock);
+
+        slot->result = result;
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&pool->done);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static int startPool(IoFile* file) {
+
+    IoPool* pool = calloc(1, sizeof(IoPool));
+
+    if (!pool) {
+        fprintf(stderr, "calloc returned NULL pointer for IoPool\n");
+        exit(1);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    file->pool = pool;
+
+    size_t threads = file->depth < IO_MAX_THREADS ? file->depth : IO_MAX_THREADS;
+
+    for (size_t t = 0; t < threads; t++) {
+        if (pthread_create(&pool->threads[t], NULL, ioWorker, file) != 0)
+            break;
+        pool->numThreads++;
+    }
+
+    return pool->numThreads ? 0 : -1;
+}
+
+static void stopPool(IoFile* file) {
+
+    IoPool* pool = file->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t t = 0; t < pool->numThreads; t++)
+        pthread_join(pool->threads[t], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool);
+    file->pool = NULL;
+}
+
+/* Common to the backends */
+
+static void submitSlot(IoFile* file, size_t index, off_t offset, size_t length) {
+
+    IoSlot* slot = &file->slots[index];
+
+    slot->offset = offset;
+    slot->length = length;
+    slot->result = 0;
+    slot->state = SLOT_PENDING;
+
+    switch (file->backend) {
+
+        case IO_BACKEND_URING :
+            uringSubmit(file, index);
+            break;
+
+        case IO_BACKEND_THREADS :
+            pthread_mutex_lock(&file->pool->lock);
+            file->pool->queue[(file->pool->queueHead + file->pool->queued) % IO_MAX_DEPTH] = index;
+            file->pool->queued++;
+            pthread_cond_signal(&file->pool->work);
+            pthread_mutex_unlock(&file->pool->lock);
+            break;
+
+        default :
+            slot->result = transferRest(file, slot, 0);
+            slot->state = SLOT_DONE;
+            break;
+    }
+}
+
+// Waits for a submitted slot, returns the bytes it moved or -1 after recording the error
+static ssize_t waitSlot(IoFile* file, size_t index) {
+
+    IoSlot* slot = &file->slots[index];
+
+    if (slot->state == SLOT_IDLE)
+        return 0;
+
+    if (file->backend == IO_BACKEND_URING) {
+
+        uringReap(file);
+
+        while (slot->state != SLOT_DONE) {
+
+            if (uringEnter(&file->ring, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+                slot->result = -errno;
+                slot->state = SLOT_DONE;
+                break;
+            }
+
+            uringReap(file);
+        }
+
+        // The ring may hand back less than asked for, the rest is read or written here
+        if (slot->result >= 0 && (size_t)slot->result < slot->length
+            && (file->writing || slot->offset + slot->result < file->size))
+            slot->result = transferRest(file, slot, slot->result);
+
+    } else if (file->backend == IO_BACKEND_THREADS) {
+
+        pthread_mutex_lock(&file->pool->lock);
+        while (slot->state != SLOT_DONE)
+            pthread_cond_wait(&file->pool->done, &file->pool->lock);
+        pthread_mutex_unlock(&file->pool->lock);
+    }
+
+    ssize_t result = slot->result;
+
+    slot->state = SLOT_IDLE;
+
+    if (result < 0) {
+        if (!file->error)
+            file->error = -result;
+        return -1;
+    }
+
+    return result;
+}
+
+static IoFile* openIoFile(const char* fileName, int writing) {
+
+    int flags = writing ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+    int direct = ioConfig.direct;
+    int fd = open(fileName, flags | (direct ? O_DIRECT : 0), 0666);
+
+    // tmpfs and some other filesystems refuse O_DIRECT
+    if (fd < 0 && direct && errno == EINVAL) {
+        direct = 0;
+        fd = open(fileName, flags, 0666);
+    }
+
+    if (fd < 0)
+        return NULL;
+
+    IoFile* file = calloc(1, sizeof(IoFile));
+
+    if (!file) {
+        fprintf(stderr, "calloc returned NULL pointer for IoFile\n");
+        exit(1);
+    }
+
+    file->fd = fd;
+    file->writing = writing;
+    file->direct = direct;
+    file->depth = ioConfig.depth;
+    file->chunkSize = ioConfig.chunkSize;
+    file->backend = effectiveIoBackend();
+
+    for (size_t i = 0; i < file->depth; i++) {
+        if (posix_memalign((void**)&file->slots[i].buffer, IO_ALIGN, file->chunkSize) != 0) {
+            fprintf(stderr, "posix_memalign returned NULL pointer for I/O buffer\n");
+            exit(1);
+        }
+    }
+
+    if (file->backend == IO_BACKEND_URING && uringSetup(&file->ring, file->depth) < 0) {
+        uringUnavailable = 1;
+        file->backend = IO_BACKEND_THREADS;
+    }
+
+    if (file->backend == IO_BACKEND_THREADS && startPool(file) < 0) {
+        stopPool(file);
+        file->backend = IO_BACKEND_SYNC;
+    }
+
+    if (!writing) {
+
+        struct stat st;
+
+        file->size = fstat(fd, &st) == 0 ? st.st_size : 0;
+
+        // Read-ahead: every buffer goes out before the caller asks for the first chunk
+        for (size_t i = 0; i < file->depth && file->nextOffset < file->size; i++) {
+            submitSlot(file, i, file->nextOffset, file->chunkSize);
+            file->nextOffset += file->chunkSize;
+        }
+    }
+
+    return file;
+}
+
+// Opens a file to read with ioReadChunk or ioReadLine, NULL with errno set if it can't be opened
+IoFile* ioOpenRead(const char* fileName) {
+    return openIoFile(fileName, 0);
+}
+
+// Creates or truncates a file to write with ioWrite, NULL with errno set if it can't be opened
+IoFile* ioOpenWrite(const char* fileName) {
+    return openIoFile(fileName, 1);
+}
+
+int ioFailed(const IoFile* file) {
+    return file->error != 0;
+}
+
+/* The next chunk of the file in order, waiting for it if it isn't in yet. *data
+   stays valid (and may be changed) until the next call. Returns its size, 0 at the
+   end of the file and -1 on a read error */
+ssize_t ioReadChunk(IoFile* file, char** data) {
+
+    if (file->error)
+        return -1;
+
+    // The chunk handed out last time is done with, its buffer reads ahead again
+    if (file->consuming) {
+
+        if (file->nextOffset < file->size) {
+            submitSlot(file, file->head, file->nextOffset, file->chunkSize);
+            file->nextOffset += file->chunkSize;
+        }
+
+        file->head = (file->head + 1) % file->depth;
+        file->consuming = 0;
+    }
+
+    if (file->slots[file->head].state == SLOT_IDLE)
+        return 0;
+
+    ssize_t bytes = waitSlot(file, file->head);
+
+    if (bytes < 0)
+        return -1;
+
+    STATS_ADD(STAT_COUNTER_BYTES_READ, bytes);
+
+    *data = file->slots[file->head].buffer;
+    file->consuming = 1;
+
+    return bytes;
+}
+
+static void appendCarry(IoFile* file, const char* text, size_t length) {
+
+    if (file->carryLen + length + 1 > file->carryCap) {
+
+        size_t capacity = file->carryCap ? file->carryCap : 256;
+
+        while (capacity < file->carryLen + length + 1)
+            capacity *= 2;
+
+        char* carry = realloc(file->carry, capacity);
+
+        if (!carry) {
+            fprintf(stderr, "realloc returned NULL pointer for line buffer\n");
+            exit(1);
+        }
+
+        file->carry = carry;
+        file->carryCap = capacity;
+    }
+
+    memcpy(file->carry + file->carryLen, text, length);
+    file->carryLen += length;
+    file->carry[file->carryLen] = '\0';
+}
+
+/* The next line without its newline, NUL terminated and writable until the next
+   call. Lines can be any length. Returns NULL at the end of the file or on an error,
+   tell them apart with ioFailed */
+char* ioReadLine(IoFile* file, size_t* length) {
+
+    file->carryLen = 0;
+
+    for (;;) {
+
+        if (file->chunkPos < file->chunkLen) {
+
+            char* start = file->chunk + file->chunkPos;
+            size_t available = file->chunkLen - file->chunkPos;
+            char* newline = memchr(start, '\n', available);
+
+            // Most lines are inside one chunk and are handed out where they are
+            if (newline && !file->carryLen) {
+                *newline = '\0';
+                file->chunkPos += newline - start + 1;
+                *length = newline - start;
+                return start;
+            }
+
+            size_t taken = newline ? (size_t)(newline - start) : available;
+
+            appendCarry(file, start, taken);
+            file->chunkPos += taken + (newline != NULL);
+
+            if (newline) {
+                *length = file->carryLen;
+                return file->carry;
+            }
+        }
+
+        ssize_t bytes = ioReadChunk(file, &file->chunk);
+
+        file->chunkPos = 0;
+        file->chunkLen = bytes > 0 ? bytes : 0;
+
+        if (bytes <= 0) {
+
+            // A last line without a newline
+            if (bytes == 0 && file->carryLen) {
+                *length = file->carryLen;
+                return file->carry;
+            }
+
+            return NULL;
+        }
+    }
+}
+
+static void submitWrite(IoFile* file) {
+
+    size_t length = file->fill;
+
+    // O_DIRECT writes whole aligned blocks, ioClose cuts the padding off again
+    if (file->direct && length % IO_ALIGN) {
+        size_t padded = (length + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+        memset(file->slots[file->head].buffer + length, 0, padded - length);
+        length = padded;
+    }
+
+    submitSlot(file, file->head, file->nextOffset, length);
+    file->nextOffset += file->fill;
+    file->fill = 0;
+    file->head = (file->head + 1) % file->depth;
+
+    // The next buffer may still be on its way out from the last time round
+    waitSlot(file, file->head);
+}
+
+// Queues size bytes to be written, returns 0 or -1 once a write has failed
+int ioWrite(IoFile* file, const void* data, size_t size) {
+
+    const char* bytes = data;
+
+    while (size && !file->error) {
+
+        size_t space = file->chunkSize - file->fill;
+        size_t taken = size < space ? size : space;
+
+        memcpy(file->slots[file->head].buffer + file->fill, bytes, taken);
+        file->fill += taken;
+        file->size += taken;
+        bytes += taken;
+        size -= taken;
+
+        if (file->fill == file->chunkSize)
+            submitWrite(file);
+    }
+
+    return file->error ? -1 : 0;
+}
+
+/* Finishes whatever is in flight and closes the file. Returns 0, or -1 if a read
+   or write failed along the way (errno is set to the first error) */
+int ioClose(IoFile* file) {
+
+    if (file->writing && file->fill && !file->error)
+        submitWrite(file);
+
+    for (size_t i = 0; i < file->depth; i++)
+        waitSlot(file, i);
+
+    if (file->writing && file->direct && !file->error && ftruncate(file->fd, file->size) < 0)
+        file->error = errno;
+
+    if (file->writing)
+        STATS_ADD(STAT_COUNTER_BYTES_WRITTEN, file->size);
+
+    if (file->backend == IO_BACKEND_URING)
+        uringTeardown(&file->ring);
+    else if (file->backend == IO_BACKEND_THREADS)
+        stopPool(file);
+
+    if (close(file->fd) < 0 && !file->error)
+        file->error = errno;
+
+    int error = file->error;
+
+    for (size_t i = 0; i < file->depth; i++)
+        free(file->slots[i].buffer);
+
+    free(file->carry);
+    free(file);
+
+    errno = error;
+
+    return error ? -1 : 0;
+}
@@ -0,0 +1,68 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Chunked file I/O that keeps several large reads or writes in flight, used by
+   the .csv load and save so parsing and formatting overlap with the disk.
+
+   A file is read or written in IO_DEFAULT_CHUNK byte chunks through a ring of
+   depth buffers. A reader submits the next depth chunks as soon as it opens
+   and resubmits each buffer as soon as the caller is done with it (read-ahead),
+   a writer submits each buffer as it fills and only waits when it comes back
+   round to one still being written.
+
+   Backends:
+   IO_BACKEND_URING    io_uring through the raw syscalls, one ring per open file
+   IO_BACKEND_THREADS  a few threads per file doing pread/pwrite, works anywhere
+   IO_BACKEND_SYNC     one blocking pread/pwrite at a time
+   io_uring falls back to threads when the kernel refuses it.
+
+   With direct set the file is opened O_DIRECT (bypassing the page cache);
+   buffers, offsets and lengths are kept IO_ALIGN aligned and the padding of the
+   last written chunk is truncated away. Filesystems that don't support O_DIRECT
+   are opened without it. */
+
+#define IO_ALIGN 4096
+#define IO_DEFAULT_CHUNK (1 << 20)
+#define IO_DEFAULT_DEPTH 8
+#define IO_MAX_DEPTH 64
+#define IO_MAX_THREADS 4
+
+typedef enum {
+
+    IO_BACKEND_URING,
+    IO_BACKEND_THREADS,
+    IO_BACKEND_SYNC,
+    IO_BACKEND_COUNT
+
+} IoBackend;
+
+typedef struct {
+
+    IoBackend backend;
+    int direct;
+    size_t depth;
+    size_t chunkSize;
+
+} IoConfig;
+
+typedef struct IoFile IoFile;
+
+extern const char* io_backend_names[IO_BACKEND_COUNT];
+
+int setIoConfig(const IoConfig* config);
+IoConfig getIoConfig();
+IoBackend effectiveIoBackend();
+
+IoFile* ioOpenRead(const char* fileName);
+IoFile* ioOpenWrite(const char* fileName);
+int ioClose(IoFile* file);
+int ioFailed(const IoFile* file);
+
+ssize_t ioReadChunk(IoFile* file, char** data);
+char* ioReadLine(IoFile* file, size_t* length);
+int ioWrite(IoFile* file, const void* data, size_t size);
+
+#endif
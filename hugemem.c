@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "hugemem.h"
+
+const char* huge_page_names[HUGE_PAGES_COUNT] = {"off", "thp", "hugetlb"};
+const char* numa_policy_names[NUMA_POLICY_COUNT] = {"default", "interleave", "local"};
+
+static MemoryConfig memoryConfig = {HUGE_PAGES_OFF, NUMA_DEFAULT, 0};
+
+// Machine layout, read from sysfs once
+static pthread_once_t topologyOnce = PTHREAD_ONCE_INIT;
+static unsigned long nodeMask[HUGE_MAX_NODES / 64];
+static size_t numNodes;
+static int maxNode;
+
+// CPUs taken one node at a time, so consecutive workers land on different nodes
+static int cpuOrder[HUGE_MAX_CPUS];
+static size_t numCpus;
+
+// Updated by whichever thread maps or unmaps
+static size_t mappedBytes;
+static size_t mappedRegions;
+static size_t hugetlbFallbacks;
+static size_t bindFailures;
+
+// Parses a sysfs list like "0-3,8,10-11" into out, returns how many it holds
+static size_t parseCpuList(const char* list, int* out, size_t max) {
+
+    size_t count = 0;
+    char* end;
+
+    while (*list && *list != '\n') {
+
+        long first = strtol(list, &end, 10);
+        long last = first;
+
+        if (end == list)
+            break;
+
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+
+        for (long n = first; n <= last && count < max; n++)
+            out[count++] = n;
+
+        list = *end == ',' ? end + 1 : end;
+    }
+
+    return count;
+}
+
+static size_t readList(const char* path, int* out, size_t max) {
+
+    FILE* file = fopen(path, "r");
+
+    if (!file)
+        return 0;
+
+    char line[4096] = "";
+    size_t count = 0;
+
+    if (fgets(line, sizeof(line), file))
+        count = parseCpuList(line, out, max);
+
+    fclose(file);
+
+    return count;
+}
+
+static void readTopology(void) {
+
+    static int nodeCpus[HUGE_MAX_NODES][HUGE_MAX_CPUS];
+    static size_t nodeCpuCount[HUGE_MAX_NODES];
+    int nodes[HUGE_MAX_NODES];
+
+    size_t count = readList("/sys/devices/system/node/has_memory", nodes, HUGE_MAX_NODES);
+
+    // No sysfs node directory means no NUMA, treat the machine as node 0
+    if (!count) {
+        nodes[0] = 0;
+        count = 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+
+        if (nodes[i] < 0 || nodes[i] >= HUGE_MAX_NODES)
+            continue;
+
+        nodeMask[nodes[i] / 64] |= 1ul << (nodes[i] % 64);
+        numNodes++;
+
+        if (nodes[i] > maxNode)
+            maxNode = nodes[i];
+    }
+
+    size_t mostCpus = 0;
+
+    for (int n = 0; n <= maxNode; n++) {
+
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+
+        nodeCpuCount[n] = readList(path, nodeCpus[n], HUGE_MAX_CPUS);
+
+        if (nodeCpuCount[n] > mostCpus)
+            mostCpus = nodeCpuCount[n];
+    }
+
+    for (size_t i = 0; i < mostCpus; i++) {
+        for (int n = 0; n <= maxNode; n++) {
+            if (i < nodeCpuCount[n] && numCpus < HUGE_MAX_CPUS)
+                cpuOrder[numCpus++] = nodeCpus[n][i];
+        }
+    }
+
+    if (!numCpus) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+        for (long c = 0; c < online && c < HUGE_MAX_CPUS; c++)
+            cpuOrder[numCpus++] = c;
+    }
+}
+
+void setMemoryConfig(const MemoryConfig* config) {
+    memoryConfig = *config;
+}
+
+MemoryConfig getMemoryConfig() {
+    return memoryConfig;
+}
+
+static int placementEnabled(const MemoryConfig* config) {
+    return config->hugePages != HUGE_PAGES_OFF || config->numa != NUMA_DEFAULT;
+}
+
+// Binds a new mapping before it's touched, so its pages are placed as they fault in
+static void bindRegion(void* ptr, size_t bytes, NumaPolicy numa) {
+
+    long result = 0;
+
+    if (numa == NUMA_INTERLEAVE) {
+        pthread_once(&topologyOnce, readTopology);
+
+        // maxnode counts one past the highest node, the way the kernel reads it
+        result = syscall(SYS_mbind, ptr, bytes, MPOL_INTERLEAVE, nodeMask, (unsigned long)maxNode + 2, 0);
+    } else if (numa == NUMA_LOCAL) {
+        result = syscall(SYS_mbind, ptr, bytes, MPOL_LOCAL, NULL, 0, 0);
+    }
+
+    if (result != 0)
+        __atomic_add_fetch(&bindFailures, 1, __ATOMIC_RELAXED);
+}
+
+// A mapping of bytes (a multiple of HUGE_PAGE_SIZE) starting on a huge page boundary, or NULL
+static void* mapRegion(size_t bytes, const MemoryConfig* config) {
+
+    void* ptr = MAP_FAILED;
+
+    if (config->hugePages == HUGE_PAGES_HUGETLB) {
+
+        ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        // The reserved pool is empty or too small, THP is the next best thing
+        if (ptr == MAP_FAILED)
+            __atomic_add_fetch(&hugetlbFallbacks, 1, __ATOMIC_RELAXED);
+    }
+
+    if (ptr == MAP_FAILED) {
+
+        // Map a huge page extra and trim both ends so the region is aligned
+        char* raw = mmap(NULL, bytes + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (raw == MAP_FAILED)
+            return NULL;
+
+        char* aligned = (char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+
+        if (aligned > raw)
+            munmap(raw, aligned - raw);
+        munmap(aligned + bytes, raw + HUGE_PAGE_SIZE - aligned);
+
+        ptr = aligned;
+
+        if (config->hugePages != HUGE_PAGES_OFF)
+            madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+
+    bindRegion(ptr, bytes, config->numa);
+
+    __atomic_add_fetch(&mappedBytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mappedRegions, 1, __ATOMIC_RELAXED);
+
+    return ptr;
+}
+
+/* realloc for the large buffers. *mapped is the size of the mapping ptr lives in,
+   0 when it came from malloc, and is updated to match the returned buffer.
+   oldBytes is how much of the old buffer to keep. Buffers under a huge page, or
+   any buffer while placement is off, are malloc'd. Returns NULL on failure with
+   the old buffer left as it was */
+void* largeResize(void* ptr, size_t* mapped, size_t oldBytes, size_t newBytes) {
+
+    MemoryConfig config = memoryConfig;
+    int useMapping = newBytes >= HUGE_PAGE_SIZE && placementEnabled(&config);
+
+    if (!useMapping && !*mapped)
+        return realloc(ptr, newBytes);
+
+    if (!newBytes) {
+        largeFree(ptr, *mapped);
+        *mapped = 0;
+        return NULL;
+    }
+
+    size_t newMapped = useMapping ? (newBytes + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1) : 0;
+
+    // Shrinking a mapping gives back its tail in place
+    if (*mapped && newMapped && newMapped <= *mapped) {
+
+        if (newMapped < *mapped) {
+            munmap((char*)ptr + newMapped, *mapped - newMapped);
+            __atomic_sub_fetch(&mappedBytes, *mapped - newMapped, __ATOMIC_RELAXED);
+            *mapped = newMapped;
+        }
+
+        return ptr;
+    }
+
+    void* newPtr = newMapped ? mapRegion(newMapped, &config) : malloc(newBytes);
+
+    if (!newPtr)
+        return NULL;
+
+    if (ptr)
+        memcpy(newPtr, ptr, oldBytes < newBytes ? oldBytes : newBytes);
+
+    largeFree(ptr, *mapped);
+    *mapped = newMapped;
+
+    return newPtr;
+}
+
+void* largeAlloc(size_t bytes, size_t* mapped) {
+
+    *mapped = 0;
+
+    return largeResize(NULL, mapped, 0, bytes);
+}
+
+void largeFree(void* ptr, size_t mapped) {
+
+    if (!ptr)
+        return;
+
+    if (!mapped) {
+        free(ptr);
+        return;
+    }
+
+    munmap(ptr, mapped);
+    __atomic_sub_fetch(&mappedBytes, mapped, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&mappedRegions, 1, __ATOMIC_RELAXED);
+}
+
+// Migrates a mapped buffer to the calling thread's node and keeps it there, malloc'd buffers share pages and stay put
+void largeMoveHere(void* ptr, size_t mapped) {
+
+    if (!ptr || !mapped)
+        return;
+
+    if (syscall(SYS_mbind, ptr, mapped, MPOL_LOCAL, NULL, 0, MPOL_MF_MOVE) != 0)
+        __atomic_add_fetch(&bindFailures, 1, __ATOMIC_RELAXED);
+}
+
+// Size of the arena slabs that get a mapping to themselves, 0 while placement is off
+size_t largeSlabSize() {
+    return placementEnabled(&memoryConfig) ? HUGE_PAGE_SIZE : 0;
+}
+
+// Binds the calling thread to the worker'th CPU, nodes taken in turn. Does nothing with pinning off
+void pinWorker(size_t worker) {
+
+    if (!memoryConfig.pinWorkers)
+        return;
+
+    pthread_once(&topologyOnce, readTopology);
+
+    if (!numCpus)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpuOrder[worker % numCpus], &set);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Sums the N<node>=<pages> fields of /proc/self/numa_maps into kB per node
+static void readNodeUsage(size_t* kbPerNode) {
+
+    FILE* file = fopen("/proc/self/numa_maps", "r");
+
+    if (!file)
+        return;
+
+    char line[4096];
+
+    while (fgets(line, sizeof(line), file)) {
+
+        size_t pageKb = 4;
+        char* field = strstr(line, "kernelpagesize_kB=");
+
+        if (field)
+            pageKb = strtoul(field + strlen("kernelpagesize_kB="), NULL, 10);
+
+        for (field = strstr(line, " N"); field; field = strstr(field + 1, " N")) {
+
+            char* end;
+            long node = strtol(field + 2, &end, 10);
+
+            if (end == field + 2 || *end != '=' || node < 0 || node >= HUGE_MAX_NODES)
+                continue;
+
+            kbPerNode[node] += strtoul(end + 1, NULL, 10) * pageKb;
+        }
+    }
+
+    fclose(file);
+}
+
+// Returns the AnonHugePages line of /proc/self/smaps_rollup in kB, or -1 without it
+static long readAnonHugePages(void) {
+
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+
+    if (!file)
+        return -1;
+
+    char line[256];
+    long kb = -1;
+
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    }
+
+    fclose(file);
+
+    return kb;
+}
+
+void printMemoryPlacement() {
+
+    pthread_once(&topologyOnce, readTopology);
+
+    MemoryConfig config = memoryConfig;
+
+    printf("Huge pages: %s, NUMA: %s, workers pinned: %s\n", huge_page_names[config.hugePages],
+        numa_policy_names[config.numa], config.pinWorkers ? "on" : "off");
+
+    printf("Nodes with memory: %zu, CPUs: %zu (pinning order", numNodes, numCpus);
+    for (size_t i = 0; i < numCpus && i < 16; i++)
+        printf(" %d", cpuOrder[i]);
+    printf("%s)\n", numCpus > 16 ? " ..." : "");
+
+    printf("Large buffers mapped: %zu (%zu KB), hugetlb fallbacks: %zu, mbind failures: %zu\n",
+        __atomic_load_n(&mappedRegions, __ATOMIC_RELAXED), __atomic_load_n(&mappedBytes, __ATOMIC_RELAXED) / 1024,
+        __atomic_load_n(&hugetlbFallbacks, __ATOMIC_RELAXED), __atomic_load_n(&bindFailures, __ATOMIC_RELAXED));
+
+    long hugeKb = readAnonHugePages();
+
+    if (hugeKb >= 0)
+        printf("Process memory in transparent huge pages: %ld KB\n", hugeKb);
+
+    size_t kbPerNode[HUGE_MAX_NODES] = {0};
+    readNodeUsage(kbPerNode);
+
+    printf("Process memory per node:");
+    for (int n = 0; n <= maxNode; n++)
+        printf(" N%d=%zu KB", n, kbPerNode[n]);
+    printf("\n");
+}
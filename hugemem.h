@@ -0,0 +1,71 @@
+#ifndef HUGEMEM_H
+#define HUGEMEM_H
+
+#include <stddef.h>
+
+/* Placement of the big per-table buffers (the row arrays and the arena's
+   largest slabs): backed by huge pages so a scan over them takes a TLB miss
+   every 2MB instead of every 4KB, and bound to NUMA nodes so the threads
+   scanning them read local memory.
+
+   Huge pages:
+   HUGE_PAGES_OFF      plain malloc, the default
+   HUGE_PAGES_THP      2MB aligned anonymous mappings with MADV_HUGEPAGE
+   HUGE_PAGES_HUGETLB  MAP_HUGETLB from the reserved pool, THP when it's empty
+
+   NUMA policy, applied with mbind to every mapping:
+   NUMA_DEFAULT     first touch
+   NUMA_INTERLEAVE  pages spread round-robin over the nodes with memory
+   NUMA_LOCAL       pages on the node of the thread that touches them, which
+                    with pinned workers is the node of the shard's worker
+
+   With pinning on, shard and update workers are bound to CPUs taken round
+   robin across the nodes. A new setting applies to buffers as they're next
+   allocated or grown, tables already loaded stay where they are. */
+
+#define HUGE_PAGE_SIZE (2 << 20)
+#define HUGE_MAX_NODES 64
+#define HUGE_MAX_CPUS 1024
+
+typedef enum {
+
+    HUGE_PAGES_OFF,
+    HUGE_PAGES_THP,
+    HUGE_PAGES_HUGETLB,
+    HUGE_PAGES_COUNT
+
+} HugePageMode;
+
+typedef enum {
+
+    NUMA_DEFAULT,
+    NUMA_INTERLEAVE,
+    NUMA_LOCAL,
+    NUMA_POLICY_COUNT
+
+} NumaPolicy;
+
+typedef struct {
+
+    HugePageMode hugePages;
+    NumaPolicy numa;
+    int pinWorkers;
+
+} MemoryConfig;
+
+extern const char* huge_page_names[HUGE_PAGES_COUNT];
+extern const char* numa_policy_names[NUMA_POLICY_COUNT];
+
+void setMemoryConfig(const MemoryConfig* config);
+MemoryConfig getMemoryConfig();
+
+void* largeResize(void* ptr, size_t* mapped, size_t oldBytes, size_t newBytes);
+void* largeAlloc(size_t bytes, size_t* mapped);
+void largeFree(void* ptr, size_t mapped);
+void largeMoveHere(void* ptr, size_t mapped);
+size_t largeSlabSize();
+
+void pinWorker(size_t worker);
+void printMemoryPlacement();
+
+#endif
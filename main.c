@@ -1,10 +1,23 @@
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include "user_interface.h"
 #include "database.h"
 
 int main(int argc, char* argv[]) {
 
-    userMenu();
+    // "./main -f script.scdb" runs a script, piping commands into stdin works the same way
+    if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+        if (!freopen(argv[2], "r", stdin)) {
+            fprintf(stderr, "Unable to open script: %s\n", argv[2]);
+            return 1;
+        }
+    } else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [-f script.scdb]\n", argv[0]);
+        return 1;
+    }
+
+    userMenu(isatty(STDIN_FILENO));
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,742 @@
+#define _GNU_SOURCE // qsort_r
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "query.h"
+#include "database.h"
+#include "stats.h"
+#include "cache.h"
+#include "expr.h"
+#include "bloom.h"
+#include "sketch.h"
+
+const char* predicate_ops[] = {"=", "!=", "<", "<=", ">", ">=", " is null", " is not null", " in "};
+const char* aggregate_ops[] = {"count", "sum", "avg", "min", "max"};
+
+Cursor* openCursor(Database* db, const Predicate* preds, size_t numPreds) {
+
+    Cursor* cursor = calloc(1, sizeof(Cursor));
+
+    if (!cursor) {
+        fprintf(stderr, "calloc returned NULL pointer for Cursor\n");
+        exit(1);
+    }
+
+    if (numPreds > MAX_PREDICATES)
+        numPreds = MAX_PREDICATES;
+
+    cursor->db = db;
+    cursor->numPreds = numPreds;
+
+    if (numPreds)
+        memcpy(cursor->preds, preds, numPreds * sizeof(Predicate));
+
+    // Rows moved by deletes since the last scan go back into the Bloom filters
+    syncBloomFilters(db);
+
+    return cursor;
+}
+
+void closeCursor(Cursor* cursor) {
+
+    if (!cursor)
+        return;
+
+    free(cursor->order);
+    free(cursor);
+}
+
+int rowMatches(Database* db, size_t rowIndex, const Predicate* preds, size_t numPreds) {
+
+    Cell* cells = db->rows[rowIndex].cells;
+
+    for (size_t p = 0; p < numPreds; p++) {
+
+        size_t col = preds[p].col;
+        DataValues value;
+        DataTypes type;
+        int isNull;
+
+        if (col < db->numCols) {
+            isNull = isCellNull(db, rowIndex, col);
+            value = cells[col].value;
+            type = db->cols[col].type;
+        } else {
+            int found = computedCell(db, col, rowIndex, &value);
+            if (found < 0)
+                return 0;
+            isNull = !found;
+            type = columnType(db, col);
+        }
+
+        if (preds[p].op == PRED_IS_NULL || preds[p].op == PRED_NOT_NULL || isNull) {
+            if (isNull != (preds[p].op == PRED_IS_NULL))
+                return 0;
+            continue;
+        }
+
+        const TypeOps* ops = typeOps(type);
+
+        if (preds[p].op == PRED_IN) {
+
+            size_t v = 0;
+
+            while (v < preds[p].numValues && ops->compare(value, preds[p].values[v]) != 0)
+                v++;
+
+            if (v == preds[p].numValues)
+                return 0;
+            continue;
+        }
+
+        int cmp = ops->compare(value, preds[p].value);
+        int match;
+
+        switch (preds[p].op) {
+            case PRED_EQ : match = cmp == 0; break;
+            case PRED_NE : match = cmp != 0; break;
+            case PRED_LT : match = cmp < 0; break;
+            case PRED_LE : match = cmp <= 0; break;
+            case PRED_GT : match = cmp > 0; break;
+            default : match = cmp >= 0; break;
+        }
+
+        if (!match)
+            return 0;
+    }
+
+    return 1;
+}
+
+// 0 if the Bloom filters rule out every row of block for one of the = or in predicates
+static int blockMayMatch(Database* db, size_t block, const Predicate* preds, size_t numPreds) {
+
+    for (size_t p = 0; p < numPreds; p++) {
+
+        const Predicate* pred = &preds[p];
+
+        if (pred->col >= db->numCols || !db->cols[pred->col].bloom)
+            continue;
+
+        if (pred->op == PRED_EQ && !bloomMayContain(db, pred->col, block, pred->value))
+            return 0;
+
+        if (pred->op == PRED_IN) {
+
+            size_t v = 0;
+
+            while (v < pred->numValues && !bloomMayContain(db, pred->col, block, pred->values[v]))
+                v++;
+
+            if (v == pred->numValues)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Where a scan at rowIndex should carry on: rowIndex itself unless it starts a block,
+   then the first row of the next block the Bloom filters don't rule out (numRows if
+   none is left). Reads the filters only, callers sync them first with syncBloomFilters */
+size_t firstCandidateRow(Database* db, size_t rowIndex, const Predicate* preds, size_t numPreds) {
+
+    if (!numPreds || rowIndex % BLOCK_ROWS)
+        return rowIndex;
+
+    size_t skipped = 0;
+
+    while (rowIndex < db->numRows && !blockMayMatch(db, rowIndex / BLOCK_ROWS, preds, numPreds)) {
+        rowIndex += BLOCK_ROWS;
+        skipped++;
+    }
+
+    STATS_ADD(STAT_COUNTER_BLOCKS_SKIPPED, skipped);
+
+    return rowIndex < db->numRows ? rowIndex : db->numRows;
+}
+
+typedef struct {
+
+    Database* db;
+    size_t col;
+    int descending;
+    const TypeOps* ops;
+
+    // A computed column is evaluated once up front, values and valid are indexed by row
+    const DataValues* values;
+    const uint64_t* valid;
+
+} SortKey;
+
+static int sortKeyNull(const SortKey* key, size_t row) {
+    return key->values ? !((key->valid[row / 64] >> (row % 64)) & 1) : isCellNull(key->db, row, key->col);
+}
+
+static DataValues sortKeyValue(const SortKey* key, size_t row) {
+    return key->values ? key->values[row] : key->db->rows[row].cells[key->col].value;
+}
+
+static int compareRows(const void* a, const void* b, void* ctx) {
+
+    const SortKey* key = ctx;
+    size_t rowA = *(const size_t*)a;
+    size_t rowB = *(const size_t*)b;
+
+    int nullA = sortKeyNull(key, rowA);
+    int nullB = sortKeyNull(key, rowB);
+
+    // NULLs sort before every value
+    int cmp = nullA || nullB ? nullB - nullA : key->ops->compare(sortKeyValue(key, rowA), sortKeyValue(key, rowB));
+
+    if (key->descending)
+        cmp = -cmp;
+
+    // Ties keep storage order so the result is the same every time
+    return cmp ? cmp : (rowA > rowB) - (rowA < rowB);
+}
+
+// Evaluates computed column col for the sorted rows into key, a batch at a time
+static void evalSortKey(Database* db, size_t col, const size_t* rows, size_t count, SortKey* key) {
+
+    DataValues* values = malloc((db->numRows ? db->numRows : 1) * sizeof(DataValues));
+    uint64_t* valid = calloc(VALIDITY_WORDS(db->numRows) + 1, sizeof(uint64_t));
+
+    if (!values || !valid) {
+        fprintf(stderr, "malloc returned NULL pointer for sort key\n");
+        exit(1);
+    }
+
+    for (size_t first = 0; first < count; first += CURSOR_BATCH_ROWS) {
+
+        size_t n = count - first < CURSOR_BATCH_ROWS ? count - first : CURSOR_BATCH_ROWS;
+        const uint64_t* validity;
+        const void* typed = evalComputed(db, col, rows + first, n, &validity);
+
+        for (size_t i = 0; typed && i < n; i++) {
+
+            size_t row = rows[first + i];
+
+            if (!validity || ((validity[i / 64] >> (i % 64)) & 1)) {
+                values[row] = key->ops->load(typed, i);
+                valid[row / 64] |= 1ull << (row % 64);
+            }
+        }
+    }
+
+    key->values = values;
+    key->valid = valid;
+}
+
+/* Sorts the matching rows on a column. Only the row indexes are sorted (8 bytes
+   per matching row), the rows themselves stay where they are.
+   Returns 0 on success, -1 if the column doesn't exist */
+int cursorOrderBy(Cursor* cursor, size_t col, int descending) {
+
+    Database* db = cursor->db;
+
+    if (col >= totalColumns(db))
+        return -1;
+
+    free(cursor->order);
+    cursor->order = malloc((db->numRows ? db->numRows : 1) * sizeof(size_t));
+
+    if (!cursor->order) {
+        fprintf(stderr, "malloc returned NULL pointer for cursor order\n");
+        exit(1);
+    }
+
+    cursor->numOrdered = 0;
+
+    for (size_t r = 0; r < db->numRows; r++) {
+
+        if (r % BLOCK_ROWS == 0 && (r = firstCandidateRow(db, r, cursor->preds, cursor->numPreds)) == db->numRows)
+            break;
+
+        if (rowMatches(db, r, cursor->preds, cursor->numPreds))
+            cursor->order[cursor->numOrdered++] = r;
+    }
+
+    SortKey key = {db, col, descending, typeOps(columnType(db, col)), NULL, NULL};
+
+    if (col >= db->numCols)
+        evalSortKey(db, col, cursor->order, cursor->numOrdered, &key);
+
+    qsort_r(cursor->order, cursor->numOrdered, sizeof(size_t), compareRows, &key);
+
+    free((void*)key.values);
+    free((void*)key.valid);
+
+    cursor->position = 0;
+
+    return 0;
+}
+
+// Fills rowIndexes with up to max matching rows, returns how many were produced (0 at the end)
+size_t cursorNextBatch(Cursor* cursor, size_t* rowIndexes, size_t max) {
+
+    size_t count = 0;
+
+    if (cursor->order) {
+        while (count < max && cursor->position < cursor->numOrdered)
+            rowIndexes[count++] = cursor->order[cursor->position++];
+
+        return count;
+    }
+
+    Database* db = cursor->db;
+    size_t scanned = cursor->position;
+    size_t skipped = 0;
+
+    while (count < max && cursor->position < db->numRows) {
+
+        // Blocks the Bloom filters rule out aren't read at all
+        if (cursor->position % BLOCK_ROWS == 0) {
+
+            size_t next = firstCandidateRow(db, cursor->position, cursor->preds, cursor->numPreds);
+
+            skipped += next - cursor->position;
+            cursor->position = next;
+
+            if (next == db->numRows)
+                break;
+        }
+
+        size_t r = cursor->position++;
+
+        if (rowMatches(db, r, cursor->preds, cursor->numPreds))
+            rowIndexes[count++] = r;
+    }
+
+    STATS_ADD(STAT_COUNTER_ROWS_SCANNED, cursor->position - scanned - skipped);
+
+    return count;
+}
+
+// Next matching row, or NULL at the end
+Row* cursorNext(Cursor* cursor) {
+
+    size_t rowIndex;
+
+    if (!cursorNextBatch(cursor, &rowIndex, 1))
+        return NULL;
+
+    return &cursor->db->rows[rowIndex];
+}
+
+void cursorRewind(Cursor* cursor) {
+    cursor->position = 0;
+}
+
+// Number of matching rows, leaves the cursor rewound
+size_t cursorCount(Cursor* cursor) {
+
+    if (cursor->order) {
+        cursorRewind(cursor);
+        return cursor->numOrdered;
+    }
+
+    Database* db = cursor->db;
+    size_t count = 0;
+
+    for (size_t r = 0; r < db->numRows; r++) {
+
+        if (r % BLOCK_ROWS == 0 && (r = firstCandidateRow(db, r, cursor->preds, cursor->numPreds)) == db->numRows)
+            break;
+
+        count += rowMatches(db, r, cursor->preds, cursor->numPreds);
+    }
+
+    cursorRewind(cursor);
+
+    return count;
+}
+
+// Index of a column by name, -1 if there isn't one
+int findColumn(Database* db, const char* colName) {
+
+    for (size_t col = 0; col < db->numCols; col++) {
+        if (strcmp(db->cols[col].colName, colName) == 0)
+            return (int)col;
+    }
+
+    return -1;
+}
+
+// Same as findColumn, but also finds computed columns (numbered from numCols)
+int findAnyColumn(Database* db, const char* colName) {
+
+    int col = findColumn(db, colName);
+
+    return col >= 0 ? col : findComputedColumn(db, colName);
+}
+
+// "1,5,9" into out->values, sorted so the same set always gives the same predicate
+static int parseInList(const TypeOps* ops, const char* list, Predicate* out) {
+
+    char text[VALUE_TEXT_LEN];
+
+    for (const char* p = list; ; p++) {
+
+        size_t len = strcspn(p, ",");
+
+        if (len == 0 || len >= sizeof(text) || out->numValues == MAX_IN_VALUES)
+            return -3;
+
+        memcpy(text, p, len);
+        text[len] = '\0';
+
+        DataValues value;
+
+        if (ops->parse(text, &value) < 0)
+            return -3;
+
+        size_t at = 0;
+
+        while (at < out->numValues && ops->compare(out->values[at], value) < 0)
+            at++;
+
+        if (at == out->numValues || ops->compare(out->values[at], value) != 0) {
+            memmove(&out->values[at + 1], &out->values[at], (out->numValues - at) * sizeof(DataValues));
+            out->values[at] = value;
+            out->numValues++;
+        }
+
+        p += len;
+
+        if (*p == '\0')
+            return 0;
+    }
+}
+
+// Builds a predicate from its text form, e.g. ("price", ">=", "2.5") or ("id", "in", "1,5,9")
+// Returns 0 on success, -1 for an unknown column, -2 for an unknown operator, -3 for a bad value
+int parsePredicate(Database* db, const char* colName, const char* op, const char* value, Predicate* out) {
+
+    int col = findAnyColumn(db, colName);
+
+    if (col < 0)
+        return -1;
+
+    out->col = col;
+    out->op = strcmp(op, "in") == 0 ? PRED_IN : PRED_COUNT;
+
+    for (int p = 0; p < PRED_IS_NULL; p++) {
+        if (strcmp(op, predicate_ops[p]) == 0)
+            out->op = p;
+    }
+
+    if (out->op == PRED_COUNT)
+        return -2;
+
+    out->value = (DataValues){0};
+    out->numValues = 0;
+
+    if (out->op == PRED_IN)
+        return parseInList(typeOps(columnType(db, col)), value, out);
+
+    if (isNullText(value)) {
+        if (out->op != PRED_EQ && out->op != PRED_NE)
+            return -3;
+        out->op = out->op == PRED_EQ ? PRED_IS_NULL : PRED_NOT_NULL;
+        return 0;
+    }
+
+    if (typeOps(columnType(db, col))->parse(value, &out->value) < 0)
+        return -3;
+
+    return 0;
+}
+
+// Writes the cursor's rows as a .csv in the same layout as saveDatabaseToCSV, with the
+// computed columns after the stored ones, one batch of rows at a time.
+// Returns the number of rows written or -1 on failure
+long exportCursorToCSV(Cursor* cursor, FILE* file) {
+
+    Database* db = cursor->db;
+    size_t numCols = totalColumns(db);
+    size_t rowIndexes[CURSOR_BATCH_ROWS];
+    size_t batch;
+    long written = 0;
+    char cell[VALUE_TEXT_LEN];
+
+    // This batch of each computed column
+    const void** computed = malloc((db->numComputed ? db->numComputed : 1) * sizeof(void*));
+    const uint64_t** computedValid = malloc((db->numComputed ? db->numComputed : 1) * sizeof(uint64_t*));
+
+    if (!computed || !computedValid) {
+        fprintf(stderr, "malloc returned NULL pointer for export\n");
+        exit(1);
+    }
+
+    for (size_t col = 0; col < numCols; col++)
+        fprintf(file, "%s%c", columnName(db, col), col < numCols - 1 ? ',' : '\n');
+
+    for (size_t col = 0; col < numCols; col++)
+        fprintf(file, "%s%c", data_types[columnType(db, col)], col < numCols - 1 ? ',' : '\n');
+
+    while ((batch = cursorNextBatch(cursor, rowIndexes, CURSOR_BATCH_ROWS)) > 0) {
+
+        for (size_t v = 0; v < db->numComputed; v++) {
+            if (!(computed[v] = evalComputed(db, db->numCols + v, rowIndexes, batch, &computedValid[v]))) {
+                written = -1;
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < batch && written >= 0; i++) {
+
+            Cell* cells = db->rows[rowIndexes[i]].cells;
+
+            for (size_t col = 0; col < numCols; col++) {
+
+                int len;
+
+                // NULL is an empty field
+                if (col < db->numCols) {
+                    len = isCellNull(db, rowIndexes[i], col) ? 0
+                        : typeOps(db->cols[col].type)->format(cell, sizeof(cell) - 1, cells[col].value);
+                } else {
+                    size_t v = col - db->numCols;
+                    const TypeOps* ops = typeOps(columnType(db, col));
+                    len = computedValid[v] && !((computedValid[v][i / 64] >> (i % 64)) & 1) ? 0
+                        : ops->format(cell, sizeof(cell) - 1, ops->load(computed[v], i));
+                }
+
+                cell[len++] = col < numCols - 1 ? ',' : '\n';
+                fwrite(cell, 1, len, file);
+            }
+        }
+
+        // Writes block on a full pipe or socket, so a slow reader throttles the export
+        if (written < 0 || ferror(file)) {
+            written = -1;
+            break;
+        }
+
+        written += batch;
+    }
+
+    free(computed);
+    free(computedValid);
+
+    return written;
+}
+
+// Deletes every matching row in one pass (deleteRow shifts the rows once per call), returns how many went
+size_t deleteRowsMatching(Database* db, const Predicate* preds, size_t numPreds) {
+
+    size_t kept = 0;
+    size_t firstDeleted = db->numRows;
+
+    // Observers see each row before it goes, last first so the indexes they're given stay valid in order
+    if (db->observed) {
+        for (size_t r = db->numRows; r-- > 0;) {
+            if (rowMatches(db, r, preds, numPreds))
+                notifyTableMutation(db, MUTATION_DELETE_ROW, r, 1, 0, (DataValues){0});
+        }
+    }
+
+    for (size_t r = 0; r < db->numRows; r++) {
+
+        if (rowMatches(db, r, preds, numPreds)) {
+            if (firstDeleted == db->numRows)
+                firstDeleted = r;
+            sketchRemoveRow(db, r);
+            arenaFree(db->arena, db->rows[r].cells, db->numCols * sizeof(Cell));
+        } else {
+            if (kept != r)
+                moveRowValidity(db, r, kept);
+            db->rows[kept++] = db->rows[r];
+        }
+    }
+
+    size_t deleted = db->numRows - kept;
+
+    if (deleted) {
+        markRowsDirty(db, firstDeleted);
+        db->numRows = kept;
+        trimValidity(db);
+    }
+
+    return deleted;
+}
+
+// Sets col to value in every matching row, returns how many rows were updated
+size_t updateRowsMatching(Database* db, const Predicate* preds, size_t numPreds, size_t col, DataValues value) {
+
+    size_t updated = 0;
+
+    if (col >= db->numCols)
+        return 0;
+
+    syncBloomFilters(db);
+
+    for (size_t r = 0; r < db->numRows; r++) {
+
+        if (r % BLOCK_ROWS == 0 && (r = firstCandidateRow(db, r, preds, numPreds)) == db->numRows)
+            break;
+
+        if (rowMatches(db, r, preds, numPreds)) {
+            writeCell(db, r, col, db->cols[col].type, value);
+            updated++;
+        }
+    }
+
+    return updated;
+}
+
+// Computes op over the column for the rows matching preds
+// Returns 0 on success, -1 if the column doesn't exist
+int aggregateColumn(Database* db, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out) {
+
+    if (col >= totalColumns(db))
+        return -1;
+
+    Cursor* cursor = openCursor(db, preds, numPreds);
+    size_t rowIndexes[CURSOR_BATCH_ROWS];
+    double values[CURSOR_BATCH_ROWS];
+    size_t batch;
+    const TypeOps* ops = typeOps(columnType(db, col));
+
+    out->value = 0.0;
+    out->rows = 0;
+
+    while ((batch = cursorNextBatch(cursor, rowIndexes, CURSOR_BATCH_ROWS)) > 0) {
+
+        if (col >= db->numCols) {
+
+            // Computed columns are evaluated for the batch, leaving out the NULLs
+            const uint64_t* validity;
+            const void* typed = evalComputed(db, col, rowIndexes, batch, &validity);
+            size_t valid = 0;
+
+            for (size_t i = 0; typed && i < batch; i++) {
+                if (!validity || ((validity[i / 64] >> (i % 64)) & 1))
+                    values[valid++] = ops->toDouble(ops->load(typed, i));
+            }
+
+            batch = valid;
+
+        } else if (db->cols[col].nullCount) {
+
+            // NULLs are left out, so only columns that have any pay for the check
+            size_t valid = 0;
+
+            for (size_t i = 0; i < batch; i++) {
+                if (!isCellNull(db, rowIndexes[i], col))
+                    rowIndexes[valid++] = rowIndexes[i];
+            }
+
+            batch = valid;
+        }
+
+        // Pull the batch out as doubles in one typed loop, then aggregate them
+        if (col < db->numCols)
+            ops->gatherDoubles(db->rows, rowIndexes, col, batch, values);
+
+        for (size_t i = 0; i < batch; i++) {
+
+            double v = values[i];
+
+            switch (op) {
+                case AGG_MIN : if (!out->rows || v < out->value) out->value = v; break;
+                case AGG_MAX : if (!out->rows || v > out->value) out->value = v; break;
+                case AGG_SUM : case AGG_AVG : out->value += v; break;
+                default : break;
+            }
+
+            out->rows++;
+        }
+    }
+
+    closeCursor(cursor);
+
+    if (op == AGG_COUNT)
+        out->value = out->rows;
+    else if (op == AGG_AVG && out->rows)
+        out->value /= out->rows;
+
+    return 0;
+}
+
+typedef struct {
+
+    char text[STRING_LEN + 40 + MAX_IN_VALUES * 32];
+    size_t index;
+
+} PredicateText;
+
+static int comparePredicateText(const void* a, const void* b) {
+    return strcmp(((const PredicateText*)a)->text, ((const PredicateText*)b)->text);
+}
+
+/* Cache key and stamp for an aggregate. The same query always gives the same key
+   however it was written: predicates are sorted and values printed in a canonical
+   form, and the stamp lists the column versions in that same order. Columns are
+   named rather than numbered so deleting a column doesn't alias keys */
+static void aggregateKey(Database* db, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    char* key, size_t size, CacheStamp* stamp) {
+
+    PredicateText sorted[MAX_PREDICATES];
+
+    for (size_t p = 0; p < numPreds; p++) {
+
+        const Predicate* pred = &preds[p];
+        const TypeOps* ops = typeOps(columnType(db, pred->col));
+        char value[MAX_IN_VALUES * 32] = "";
+
+        if (pred->op == PRED_IN) {
+            for (size_t v = 0, len = 0; v < pred->numValues && len < sizeof(value); v++) {
+                len += v ? snprintf(value + len, sizeof(value) - len, ",") : 0;
+                len += ops->formatExact(value + len, sizeof(value) - len, pred->values[v]);
+            }
+        } else if (pred->op != PRED_IS_NULL && pred->op != PRED_NOT_NULL) {
+            ops->formatExact(value, sizeof(value), pred->value);
+        }
+
+        snprintf(sorted[p].text, sizeof(sorted[p].text), "%s%s%s", columnName(db, pred->col),
+            predicate_ops[pred->op], value);
+        sorted[p].index = p;
+    }
+
+    qsort(sorted, numPreds, sizeof(PredicateText), comparePredicateText);
+
+    int len = snprintf(key, size, "agg|%s|%s|%s", db->dbName, aggregate_ops[op], columnName(db, col));
+
+    stamp->numDeps = 0;
+    stamp->versions[stamp->numDeps++] = db->rowsVersion;
+    stamp->versions[stamp->numDeps++] = columnVersion(db, col);
+
+    for (size_t p = 0; p < numPreds; p++) {
+
+        if (len > 0 && (size_t)len < size)
+            len += snprintf(key + len, size - len, "|%s", sorted[p].text);
+
+        if (stamp->numDeps < CACHE_MAX_DEPS)
+            stamp->versions[stamp->numDeps++] = columnVersion(db, preds[sorted[p].index].col);
+    }
+}
+
+// Same as aggregateColumn, served from the result cache while the rows and the columns it reads are unchanged
+// Returns 1 for a cache hit, 0 if it was computed and -1 if the column doesn't exist
+int cachedAggregate(Database* db, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out) {
+
+    if (col >= totalColumns(db))
+        return -1;
+
+    char key[MAX_PREDICATES * sizeof(((PredicateText*)0)->text) + 128];
+    CacheStamp stamp;
+
+    aggregateKey(db, op, col, preds, numPreds, key, sizeof(key), &stamp);
+
+    if (cacheLookup(key, &stamp, out, sizeof(*out)))
+        return 1;
+
+    aggregateColumn(db, op, col, preds, numPreds, out);
+    cacheStore(key, &stamp, out, sizeof(*out));
+
+    return 0;
+}
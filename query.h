@@ -0,0 +1,105 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdio.h>
+#include "database.h"
+
+/* Cursors walk the rows of a table that match a set of predicates, a batch
+   of row indexes at a time, so results can be streamed out without copying
+   them into a new Database. A cursor is only valid until the table is changed. */
+
+#define CURSOR_BATCH_ROWS 4096
+#define MAX_PREDICATES 8
+#define MAX_IN_VALUES 16
+
+typedef enum {
+
+    PRED_EQ,
+    PRED_NE,
+    PRED_LT,
+    PRED_LE,
+    PRED_GT,
+    PRED_GE,
+    PRED_IS_NULL,
+    PRED_NOT_NULL,
+    PRED_IN,
+    PRED_COUNT
+
+} PredicateOp;
+
+extern const char* predicate_ops[];
+
+// col <op> value, value holds the type of the column. A NULL cell only matches PRED_IS_NULL,
+// which is written "col = null" (and PRED_NOT_NULL "col != null").
+// PRED_IN ("col in 1,5,9") matches any of values, kept sorted and without duplicates
+typedef struct {
+
+    size_t col;
+    PredicateOp op;
+    DataValues value;
+
+    DataValues values[MAX_IN_VALUES];
+    size_t numValues;
+
+} Predicate;
+
+typedef struct {
+
+    Database* db;
+    Predicate preds[MAX_PREDICATES];
+    size_t numPreds;
+
+    // Matching rows in sorted order once cursorOrderBy is called, NULL scans in storage order
+    size_t* order;
+    size_t numOrdered;
+
+    size_t position;
+
+} Cursor;
+
+Cursor* openCursor(Database* db, const Predicate* preds, size_t numPreds);
+void closeCursor(Cursor* cursor);
+
+int cursorOrderBy(Cursor* cursor, size_t col, int descending);
+size_t cursorNextBatch(Cursor* cursor, size_t* rowIndexes, size_t max);
+Row* cursorNext(Cursor* cursor);
+void cursorRewind(Cursor* cursor);
+size_t cursorCount(Cursor* cursor);
+
+int rowMatches(Database* db, size_t rowIndex, const Predicate* preds, size_t numPreds);
+size_t firstCandidateRow(Database* db, size_t rowIndex, const Predicate* preds, size_t numPreds);
+int parsePredicate(Database* db, const char* colName, const char* op, const char* value, Predicate* out);
+int findColumn(Database* db, const char* colName);
+int findAnyColumn(Database* db, const char* colName);
+
+long exportCursorToCSV(Cursor* cursor, FILE* file);
+
+size_t deleteRowsMatching(Database* db, const Predicate* preds, size_t numPreds);
+size_t updateRowsMatching(Database* db, const Predicate* preds, size_t numPreds, size_t col, DataValues value);
+
+typedef enum {
+
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_AVG,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_OP_COUNT
+
+} AggregateOp;
+
+extern const char* aggregate_ops[];
+
+typedef struct {
+
+    double value;
+    size_t rows;
+
+} AggregateResult;
+
+int aggregateColumn(Database* db, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out);
+int cachedAggregate(Database* db, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out);
+
+#endif
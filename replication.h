@@ -0,0 +1,67 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "database.h"
+
+/* Primary/replica replication. The primary turns every change to a table in its
+   catalog into a record (see MutationObserver) and streams the records to each
+   connected replica, which applies them in order on a background thread.
+
+   A replica that connects first gets a bootstrap: one REPL_TABLE record per table
+   holding a binary snapshot of it, then REPL_SYNCED. Everything after that is the
+   live stream. Records carry the primary's log sequence number (LSN), which only
+   advances for changes, so a replica's lag is the primary's LSN minus the last
+   one it applied. An idle primary sends heartbeats with its current LSN, replicas
+   acknowledge what they've applied.
+
+   The wire format is the ReplRecord below followed by size bytes of payload, in
+   native byte order, so a primary and its replicas must run on the same kind of
+   machine. Addresses are "port" or "host:port" for TCP and "unix:/path" for a Unix socket */
+
+#define REPL_HEARTBEAT_MS 250
+#define REPL_RETRY_MS 1000
+#define REPL_ACK_INTERVAL 256
+#define REPL_BATCH_ROWS 4096
+#define REPL_MAX_BACKLOG (64 * 1024 * 1024)
+#define REPL_ADDRESS_LEN 256
+
+typedef enum {
+
+    REPL_TABLE,         // payload: snapshot of the whole table, replaces any table with the name
+    REPL_DROP_TABLE,
+    REPL_CREATE_COLUMN, // name, value: DataTypes
+    REPL_DELETE_COLUMN, // col
+    REPL_RENAME_COLUMN, // col, name: the new name
+    REPL_APPEND_ROWS,   // count rows of col values, payload: count x col DataValues, then
+                        // col validity bitmaps of VALIDITY_WORDS(count) words if any is NULL
+    REPL_DELETE_ROW,    // row
+    REPL_WRITE_CELL,    // row, col, value: the new DataValues
+    REPL_WRITE_NULL,    // row, col
+    REPL_SYNCED,        // end of the bootstrap
+    REPL_HEARTBEAT,     // value: primary's wall clock in ns
+    REPL_ACK            // replica to primary, lsn: last applied
+
+} ReplRecordType;
+
+typedef struct {
+
+    uint32_t type;
+    uint32_t size;
+    uint64_t lsn;
+    uint64_t row;
+    uint64_t col;
+    uint64_t count;
+    uint64_t value;
+    char table[STRING_LEN];
+    char name[STRING_LEN];
+
+} ReplRecord;
+
+int openReplicationSocket(const char* address, int listening);
+int sendFully(int fd, const void* data, size_t size);
+int recvFully(int fd, void* data, size_t size);
+uint64_t wallClockNs();
+
+#endif
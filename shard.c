@@ -0,0 +1,734 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "shard.h"
+#include "query.h"
+#include "database.h"
+#include "hugemem.h"
+
+typedef enum {
+
+    TASK_APPEND,
+    TASK_UPDATE,
+    TASK_DELETE,
+    TASK_AGGREGATE,
+    TASK_SYNC,
+    TASK_STOP
+
+} ShardTaskType;
+
+// Lets a caller wait for the tasks it sent to several shards
+typedef struct {
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    size_t remaining;
+
+} ShardLatch;
+
+struct ShardTask {
+
+    ShardTaskType type;
+
+    // TASK_APPEND: numRows rows, freed by the worker along with the task. validity
+    // is NULL or one VALIDITY_WORDS(numRows) bitmap per column
+    DataValues* values;
+    uint64_t* validity;
+    size_t numRows;
+
+    // TASK_UPDATE sets col to value in the rows matching preds
+    Predicate preds[MAX_PREDICATES];
+    size_t numPreds;
+    size_t col;
+    DataValues value;
+    AggregateOp op;
+
+    AggregateResult result;
+    size_t affected;
+
+    // Set for tasks the caller waits on, those belong to the caller
+    ShardLatch* latch;
+
+    ShardTask* next;
+};
+
+// Values that compare equal (0.0 and -0.0) have to land on the same shard
+static uint64_t hashValue(DataTypes type, DataValues value) {
+    return mixBits(typeOps(type)->hashBits(value));
+}
+
+size_t shardForKey(ShardedTable* table, DataValues key) {
+    return hashValue(table->types[table->keyCol], key) % table->numShards;
+}
+
+// Validity for numRows rows of numCols columns, every cell starts out NULL
+static uint64_t* allocValidityParts(size_t numRows, size_t numCols) {
+
+    uint64_t* validity = calloc(numCols * VALIDITY_WORDS(numRows) + 1, sizeof(uint64_t));
+
+    if (!validity) {
+        fprintf(stderr, "calloc returned NULL pointer for shard validity\n");
+        exit(1);
+    }
+
+    return validity;
+}
+
+// Points a batch at the per column bitmaps in validity, the caller frees the result
+static const uint64_t** validityColumns(const uint64_t* validity, size_t numRows, size_t numCols) {
+
+    const uint64_t** columns = malloc((numCols ? numCols : 1) * sizeof(uint64_t*));
+
+    if (!columns) {
+        fprintf(stderr, "malloc returned NULL pointer for shard validity\n");
+        exit(1);
+    }
+
+    for (size_t c = 0; c < numCols; c++)
+        columns[c] = validity + c * VALIDITY_WORDS(numRows);
+
+    return columns;
+}
+
+static void markValid(uint64_t* validity, size_t numRows, size_t col, size_t row) {
+    validity[col * VALIDITY_WORDS(numRows) + row / 64] |= 1ull << (row % 64);
+}
+
+static void runTask(Shard* shard, ShardTask* task, size_t numCols, const DataTypes* types) {
+
+    switch (task->type) {
+        case TASK_APPEND : {
+            BulkBatch batch = {ROW_MAJOR, task->numRows, numCols, types, task->values, NULL, NULL};
+            if (task->validity)
+                batch.validity = validityColumns(task->validity, task->numRows, numCols);
+            appendRows(shard->db, &batch);
+            free((void*)batch.validity);
+            break;
+        }
+        case TASK_UPDATE :
+            task->affected = updateRowsMatching(shard->db, task->preds, task->numPreds, task->col, task->value);
+            break;
+        case TASK_DELETE :
+            task->affected = deleteRowsMatching(shard->db, task->preds, task->numPreds);
+            break;
+        case TASK_AGGREGATE :
+            // Averages are merged from per shard sums and counts
+            aggregateColumn(shard->db, task->op == AGG_AVG ? AGG_SUM : task->op, task->col, task->preds,
+                task->numPreds, &task->result);
+            break;
+        case TASK_SYNC :
+            task->affected = shard->db->numRows;
+            break;
+        case TASK_STOP :
+            break;
+    }
+}
+
+typedef struct {
+
+    ShardedTable* table;
+    Shard* shard;
+    size_t index;
+
+} WorkerArgs;
+
+// Runs a shard's tasks in order, this thread is the only one that touches shard->db
+static void* shardWorker(void* arg) {
+
+    WorkerArgs args = *(WorkerArgs*)arg;
+    Shard* shard = args.shard;
+    free(arg);
+
+    pinWorker(args.index);
+
+    // The main thread filled the shard, with NUMA local its mapped buffers follow the worker to its node
+    if (getMemoryConfig().numa == NUMA_LOCAL) {
+        largeMoveHere(shard->db->rows, shard->db->rowsMapped);
+        arenaMoveHere(shard->db->arena);
+    }
+
+    for (;;) {
+
+        pthread_mutex_lock(&shard->lock);
+
+        while (!shard->head)
+            pthread_cond_wait(&shard->ready, &shard->lock);
+
+        ShardTask* task = shard->head;
+        shard->head = task->next;
+
+        if (!shard->head)
+            shard->tail = NULL;
+
+        shard->queued--;
+        pthread_cond_signal(&shard->space);
+        pthread_mutex_unlock(&shard->lock);
+
+        runTask(shard, task, args.table->numCols, args.table->types);
+
+        ShardTaskType type = task->type;
+
+        if (task->latch) {
+            ShardLatch* latch = task->latch;
+            pthread_mutex_lock(&latch->lock);
+            if (--latch->remaining == 0)
+                pthread_cond_signal(&latch->done);
+            pthread_mutex_unlock(&latch->lock);
+        } else {
+            free(task->values);
+            free(task->validity);
+            free(task);
+        }
+
+        if (type == TASK_STOP)
+            return NULL;
+    }
+}
+
+// Queues a task for a shard, blocking while the shard is SHARD_QUEUE_LIMIT tasks behind
+static void submitTask(Shard* shard, ShardTask* task) {
+
+    task->next = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+
+    while (shard->queued >= SHARD_QUEUE_LIMIT)
+        pthread_cond_wait(&shard->space, &shard->lock);
+
+    if (shard->tail)
+        shard->tail->next = task;
+    else
+        shard->head = task;
+
+    shard->tail = task;
+    shard->queued++;
+
+    pthread_cond_signal(&shard->ready);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static ShardTask* newTask(ShardTaskType type) {
+
+    ShardTask* task = calloc(1, sizeof(ShardTask));
+
+    if (!task) {
+        fprintf(stderr, "calloc returned NULL pointer for ShardTask\n");
+        exit(1);
+    }
+
+    task->type = type;
+
+    return task;
+}
+
+static void sendRows(ShardedTable* table, size_t shardIndex, DataValues* values, uint64_t* validity, size_t numRows) {
+
+    ShardTask* task = newTask(TASK_APPEND);
+
+    task->values = values;
+    task->validity = validity;
+    task->numRows = numRows;
+
+    submitTask(&table->shards[shardIndex], task);
+}
+
+/* Sends the same task to every shard and waits for all of them. tasks holds one
+   copy per shard, filled in from the template, and has the per shard results after */
+static void broadcast(ShardedTable* table, const ShardTask* template, ShardTask* tasks) {
+
+    ShardLatch latch;
+
+    pthread_mutex_init(&latch.lock, NULL);
+    pthread_cond_init(&latch.done, NULL);
+    latch.remaining = table->numShards;
+
+    for (size_t s = 0; s < table->numShards; s++) {
+        tasks[s] = *template;
+        tasks[s].latch = &latch;
+        submitTask(&table->shards[s], &tasks[s]);
+    }
+
+    pthread_mutex_lock(&latch.lock);
+
+    while (latch.remaining)
+        pthread_cond_wait(&latch.done, &latch.lock);
+
+    pthread_mutex_unlock(&latch.lock);
+
+    pthread_mutex_destroy(&latch.lock);
+    pthread_cond_destroy(&latch.done);
+}
+
+static DataValues* allocRows(size_t numRows, size_t numCols) {
+
+    DataValues* values = malloc((numRows ? numRows : 1) * numCols * sizeof(DataValues));
+
+    if (!values) {
+        fprintf(stderr, "malloc returned NULL pointer for shard rows\n");
+        exit(1);
+    }
+
+    return values;
+}
+
+static void startShard(ShardedTable* table, Shard* shard, Database* db) {
+
+    shard->db = db;
+    shard->head = shard->tail = NULL;
+    shard->queued = 0;
+    shard->pending = NULL;
+    shard->numPending = 0;
+
+    pthread_mutex_init(&shard->lock, NULL);
+    pthread_cond_init(&shard->ready, NULL);
+    pthread_cond_init(&shard->space, NULL);
+
+    WorkerArgs* args = malloc(sizeof(WorkerArgs));
+
+    if (!args) {
+        fprintf(stderr, "malloc returned NULL pointer for WorkerArgs\n");
+        exit(1);
+    }
+
+    args->table = table;
+    args->shard = shard;
+    args->index = shard - table->shards;
+
+    if (pthread_create(&shard->thread, NULL, shardWorker, args) != 0) {
+        fprintf(stderr, "pthread_create failed for shard worker\n");
+        exit(1);
+    }
+}
+
+/* Partitions db into numShards shards on keyCol and starts their workers.
+   The rows are copied, db is left as it was. Returns NULL if the key column
+   or shard count is out of range */
+ShardedTable* shardDatabase(Database* db, size_t keyCol, size_t numShards) {
+
+    if (keyCol >= db->numCols || numShards == 0 || numShards > MAX_SHARDS)
+        return NULL;
+
+    ShardedTable* table = malloc(sizeof(ShardedTable));
+    Shard* shards = calloc(numShards, sizeof(Shard));
+    DataTypes* types = malloc(db->numCols * sizeof(DataTypes));
+    size_t* counts = calloc(numShards, sizeof(size_t));
+    size_t* home = malloc((db->numRows ? db->numRows : 1) * sizeof(size_t));
+
+    if (!table || !shards || !types || !counts || !home) {
+        fprintf(stderr, "malloc returned NULL pointer for ShardedTable\n");
+        exit(1);
+    }
+
+    snprintf(table->name, sizeof(table->name), "%s", db->dbName);
+    table->keyCol = keyCol;
+    table->numCols = db->numCols;
+    table->types = types;
+    table->shards = shards;
+    table->numShards = numShards;
+
+    size_t nulls = 0;
+
+    for (size_t c = 0; c < db->numCols; c++) {
+        types[c] = db->cols[c].type;
+        nulls += db->cols[c].nullCount;
+    }
+
+    for (size_t r = 0; r < db->numRows; r++) {
+        home[r] = shardForKey(table, db->rows[r].cells[keyCol].value);
+        counts[home[r]]++;
+    }
+
+    // The workers aren't running yet, so the shards can be filled from here
+    for (size_t s = 0; s < numShards; s++) {
+
+        Database* shardDB = createDatabase(db->dbName);
+
+        for (size_t c = 0; c < db->numCols; c++)
+            createColumn(shardDB, db->cols[c].colName, db->cols[c].type);
+
+        DataValues* values = allocRows(counts[s], db->numCols);
+        uint64_t* validity = nulls ? allocValidityParts(counts[s], db->numCols) : NULL;
+        size_t n = 0;
+
+        for (size_t r = 0; r < db->numRows; r++) {
+            if (home[r] != s)
+                continue;
+            for (size_t c = 0; c < db->numCols; c++) {
+                values[n * db->numCols + c] = db->rows[r].cells[c].value;
+                if (validity && !isCellNull(db, r, c))
+                    markValid(validity, counts[s], c, n);
+            }
+            n++;
+        }
+
+        BulkBatch batch = {ROW_MAJOR, n, db->numCols, types, values, NULL, NULL};
+        if (validity)
+            batch.validity = validityColumns(validity, n, db->numCols);
+        appendRows(shardDB, &batch);
+        free((void*)batch.validity);
+        free(validity);
+        free(values);
+
+        startShard(table, &shards[s], shardDB);
+    }
+
+    free(counts);
+    free(home);
+
+    return table;
+}
+
+// Routes the rows of a batch to the shards that own their keys, returns -1 if it doesn't fit the table
+int shardAppendRows(ShardedTable* table, const BulkBatch* batch) {
+
+    if (batch->numCols != table->numCols)
+        return -1;
+
+    if (batch->types) {
+        for (size_t c = 0; c < table->numCols; c++) {
+            if (batch->types[c] != table->types[c])
+                return -1;
+        }
+    }
+
+    size_t numCols = table->numCols;
+    size_t* counts = calloc(table->numShards, sizeof(size_t));
+    size_t* home = malloc((batch->numRows ? batch->numRows : 1) * sizeof(size_t));
+    DataValues** parts = malloc(table->numShards * sizeof(DataValues*));
+    uint64_t** validity = calloc(table->numShards, sizeof(uint64_t*));
+
+    if (!counts || !home || !parts || !validity) {
+        fprintf(stderr, "malloc returned NULL pointer for shard batch\n");
+        exit(1);
+    }
+
+    for (size_t r = 0; r < batch->numRows; r++) {
+
+        DataValues key;
+
+        if (batch->layout == ROW_MAJOR) {
+            key = batch->values[r * numCols + table->keyCol];
+        } else {
+            key = typeOps(table->types[table->keyCol])->load(batch->columns[table->keyCol], r);
+        }
+
+        home[r] = shardForKey(table, key);
+        counts[home[r]]++;
+    }
+
+    for (size_t s = 0; s < table->numShards; s++) {
+        parts[s] = counts[s] ? allocRows(counts[s], numCols) : NULL;
+        if (counts[s] && batch->validity)
+            validity[s] = allocValidityParts(counts[s], numCols);
+    }
+
+    size_t* filled = calloc(table->numShards, sizeof(size_t));
+
+    if (!filled) {
+        fprintf(stderr, "calloc returned NULL pointer for shard batch\n");
+        exit(1);
+    }
+
+    for (size_t r = 0; r < batch->numRows; r++) {
+
+        size_t s = home[r];
+        size_t slot = filled[s]++;
+        DataValues* row = parts[s] + slot * numCols;
+
+        if (validity[s]) {
+            for (size_t c = 0; c < numCols; c++) {
+                const uint64_t* bits = batch->validity[c];
+                if (!bits || bits[r / 64] >> (r % 64) & 1)
+                    markValid(validity[s], counts[s], c, slot);
+            }
+        }
+
+        if (batch->layout == ROW_MAJOR) {
+            memcpy(row, batch->values + r * numCols, numCols * sizeof(DataValues));
+            continue;
+        }
+
+        for (size_t c = 0; c < numCols; c++)
+            row[c] = typeOps(table->types[c])->load(batch->columns[c], r);
+    }
+
+    for (size_t s = 0; s < table->numShards; s++) {
+        if (parts[s])
+            sendRows(table, s, parts[s], validity[s], counts[s]);
+    }
+
+    free(counts);
+    free(filled);
+    free(home);
+    free(parts);
+    free(validity);
+
+    return 0;
+}
+
+// Buffers one row for its shard, full buffers are sent as a batch. values holds numCols values
+void shardInsertRow(ShardedTable* table, const DataValues* values) {
+
+    size_t s = shardForKey(table, values[table->keyCol]);
+    Shard* shard = &table->shards[s];
+
+    if (!shard->pending)
+        shard->pending = allocRows(SHARD_INSERT_BATCH, table->numCols);
+
+    memcpy(shard->pending + shard->numPending * table->numCols, values, table->numCols * sizeof(DataValues));
+
+    if (++shard->numPending == SHARD_INSERT_BATCH) {
+        sendRows(table, s, shard->pending, NULL, shard->numPending);
+        shard->pending = NULL;
+        shard->numPending = 0;
+    }
+}
+
+// Sends every row still buffered by shardInsertRow
+void shardFlush(ShardedTable* table) {
+
+    for (size_t s = 0; s < table->numShards; s++) {
+
+        Shard* shard = &table->shards[s];
+
+        if (shard->numPending)
+            sendRows(table, s, shard->pending, NULL, shard->numPending);
+        else
+            free(shard->pending);
+
+        shard->pending = NULL;
+        shard->numPending = 0;
+    }
+}
+
+// Runs a task on the shard that owns key and waits for it
+static size_t runOnOwner(ShardedTable* table, ShardTask* task, DataValues key) {
+
+    ShardLatch latch;
+
+    pthread_mutex_init(&latch.lock, NULL);
+    pthread_cond_init(&latch.done, NULL);
+    latch.remaining = 1;
+
+    task->preds[0].col = table->keyCol;
+    task->preds[0].op = PRED_EQ;
+    task->preds[0].value = key;
+    task->numPreds = 1;
+    task->latch = &latch;
+
+    submitTask(&table->shards[shardForKey(table, key)], task);
+
+    pthread_mutex_lock(&latch.lock);
+
+    while (latch.remaining)
+        pthread_cond_wait(&latch.done, &latch.lock);
+
+    pthread_mutex_unlock(&latch.lock);
+
+    pthread_mutex_destroy(&latch.lock);
+    pthread_cond_destroy(&latch.done);
+
+    return task->affected;
+}
+
+// Sets col to value in every row with this key, returns how many rows changed
+size_t shardUpdateKey(ShardedTable* table, DataValues key, size_t col, DataValues value) {
+
+    if (col >= table->numCols)
+        return 0;
+
+    shardFlush(table);
+
+    ShardTask task = {0};
+
+    task.type = TASK_UPDATE;
+    task.col = col;
+    task.value = value;
+
+    return runOnOwner(table, &task, key);
+}
+
+// Deletes every row with this key, returns how many went
+size_t shardDeleteKey(ShardedTable* table, DataValues key) {
+
+    shardFlush(table);
+
+    ShardTask task = {0};
+    task.type = TASK_DELETE;
+
+    return runOnOwner(table, &task, key);
+}
+
+// aggregateColumn over every shard, returns -1 if the column doesn't exist
+int shardAggregate(ShardedTable* table, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out) {
+
+    if (col >= table->numCols || numPreds > MAX_PREDICATES)
+        return -1;
+
+    shardFlush(table);
+
+    ShardTask template = {0};
+    ShardTask tasks[MAX_SHARDS];
+
+    template.type = TASK_AGGREGATE;
+    template.op = op;
+    template.col = col;
+    template.numPreds = numPreds;
+    memcpy(template.preds, preds, numPreds * sizeof(Predicate));
+
+    broadcast(table, &template, tasks);
+
+    out->value = 0.0;
+    out->rows = 0;
+
+    for (size_t s = 0; s < table->numShards; s++) {
+
+        AggregateResult* part = &tasks[s].result;
+
+        if (!part->rows)
+            continue;
+
+        switch (op) {
+            case AGG_MIN : if (!out->rows || part->value < out->value) out->value = part->value; break;
+            case AGG_MAX : if (!out->rows || part->value > out->value) out->value = part->value; break;
+            default : out->value += part->value; break;
+        }
+
+        out->rows += part->rows;
+    }
+
+    if (op == AGG_AVG && out->rows)
+        out->value /= out->rows;
+
+    return 0;
+}
+
+size_t shardNumRows(ShardedTable* table) {
+
+    shardFlush(table);
+
+    ShardTask template = {0};
+    ShardTask tasks[MAX_SHARDS];
+    size_t rows = 0;
+
+    template.type = TASK_SYNC;
+    broadcast(table, &template, tasks);
+
+    for (size_t s = 0; s < table->numShards; s++)
+        rows += tasks[s].affected;
+
+    return rows;
+}
+
+void printShardedTable(ShardedTable* table) {
+
+    shardFlush(table);
+
+    ShardTask template = {0};
+    ShardTask tasks[MAX_SHARDS];
+    size_t total = 0;
+
+    template.type = TASK_SYNC;
+    broadcast(table, &template, tasks);
+
+    for (size_t s = 0; s < table->numShards; s++)
+        total += tasks[s].affected;
+
+    printf("%s: %zu rows in %zu shards on %s\n", table->name, total, table->numShards,
+        table->shards[0].db->cols[table->keyCol].colName);
+
+    for (size_t s = 0; s < table->numShards; s++)
+        printf("  shard %zu: %zu rows\n", s, tasks[s].affected);
+}
+
+static void stopWorkers(ShardedTable* table) {
+
+    shardFlush(table);
+
+    for (size_t s = 0; s < table->numShards; s++) {
+
+        Shard* shard = &table->shards[s];
+
+        submitTask(shard, newTask(TASK_STOP));
+        pthread_join(shard->thread, NULL);
+
+        pthread_mutex_destroy(&shard->lock);
+        pthread_cond_destroy(&shard->ready);
+        pthread_cond_destroy(&shard->space);
+    }
+}
+
+static void freeShardedTable(ShardedTable* table) {
+
+    for (size_t s = 0; s < table->numShards; s++)
+        deleteDatabase(table->shards[s].db);
+
+    free(table->shards);
+    free(table->types);
+    free(table);
+}
+
+// Stops the workers and gathers every shard back into one Database, grouped by shard. Frees the table
+Database* unshardTable(ShardedTable* table) {
+
+    stopWorkers(table);
+
+    Database* first = table->shards[0].db;
+    Database* db = createDatabase(table->name);
+    size_t numCols = table->numCols;
+
+    for (size_t c = 0; c < numCols; c++)
+        createColumn(db, first->cols[c].colName, first->cols[c].type);
+
+    size_t total = 0;
+
+    for (size_t s = 0; s < table->numShards; s++)
+        total += table->shards[s].db->numRows;
+
+    reserveRows(db, total);
+
+    DataValues* values = allocRows(CSV_BATCH_ROWS, numCols);
+    uint64_t* validity = allocValidityParts(CSV_BATCH_ROWS, numCols);
+    const uint64_t** columns = validityColumns(validity, CSV_BATCH_ROWS, numCols);
+
+    for (size_t s = 0; s < table->numShards; s++) {
+
+        Database* shardDB = table->shards[s].db;
+
+        for (size_t from = 0; from < shardDB->numRows; from += CSV_BATCH_ROWS) {
+
+            size_t n = shardDB->numRows - from < CSV_BATCH_ROWS ? shardDB->numRows - from : CSV_BATCH_ROWS;
+
+            for (size_t r = 0; r < n; r++) {
+                for (size_t c = 0; c < numCols; c++)
+                    values[r * numCols + c] = shardDB->rows[from + r].cells[c].value;
+            }
+
+            size_t nulls = 0;
+
+            for (size_t c = 0; c < numCols; c++)
+                nulls += gatherValidity(shardDB, c, from, n, validity + c * VALIDITY_WORDS(CSV_BATCH_ROWS));
+
+            BulkBatch batch = {ROW_MAJOR, n, numCols, table->types, values, NULL, nulls ? columns : NULL};
+            appendRows(db, &batch);
+        }
+    }
+
+    free(values);
+    free(validity);
+    free((void*)columns);
+    freeShardedTable(table);
+
+    return db;
+}
+
+void deleteShardedTable(ShardedTable* table) {
+
+    if (!table) return;
+
+    stopWorkers(table);
+    freeShardedTable(table);
+}
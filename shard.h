@@ -0,0 +1,75 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "database.h"
+#include "query.h"
+
+/* Hash-partitioned tables. Rows are spread over N shards by a hash of the key
+   column, and every shard is a Database of its own (own rows, own arena) that
+   only its worker thread touches. Callers never lock a shard, they queue tasks
+   for it: writes go to the one shard that owns the key, scans and aggregates go
+   to every shard and the partial results are merged. Writes to different shards
+   never contend, so ingest scales with the number of workers.
+
+   Writes are asynchronous. A read waits for everything queued before it on each
+   shard, so a caller always sees its own writes. Queues are bounded and a
+   producer that gets ahead of a worker blocks until it catches up.
+   shardInsertRow buffers rows per shard and is meant for a single producer,
+   shardAppendRows may be called from several threads at once. */
+
+#define MAX_SHARDS 64
+#define SHARD_QUEUE_LIMIT 64
+#define SHARD_INSERT_BATCH 1024
+
+typedef struct ShardTask ShardTask;
+
+typedef struct {
+
+    Database* db;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    ShardTask* head;
+    ShardTask* tail;
+    size_t queued;
+
+    // Rows from shardInsertRow waiting to be sent as one batch
+    DataValues* pending;
+    size_t numPending;
+
+} Shard;
+
+typedef struct {
+
+    char name[STRING_LEN];
+    size_t keyCol;
+    size_t numCols;
+    DataTypes* types;
+
+    Shard* shards;
+    size_t numShards;
+
+} ShardedTable;
+
+ShardedTable* shardDatabase(Database* db, size_t keyCol, size_t numShards);
+Database* unshardTable(ShardedTable* table);
+void deleteShardedTable(ShardedTable* table);
+
+size_t shardForKey(ShardedTable* table, DataValues key);
+int shardAppendRows(ShardedTable* table, const BulkBatch* batch);
+void shardInsertRow(ShardedTable* table, const DataValues* values);
+void shardFlush(ShardedTable* table);
+
+size_t shardUpdateKey(ShardedTable* table, DataValues key, size_t col, DataValues value);
+size_t shardDeleteKey(ShardedTable* table, DataValues key);
+
+int shardAggregate(ShardedTable* table, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out);
+size_t shardNumRows(ShardedTable* table);
+void printShardedTable(ShardedTable* table);
+
+#endif
@@ -0,0 +1,428 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sketch.h"
+
+static int compareDoubles(const void* a, const void* b) {
+
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+// xorshift64, only decides which half of a compacted level moves up
+static uint64_t nextRandom(ColumnSketch* sketch) {
+
+    uint64_t x = sketch->rng;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return sketch->rng = x;
+}
+
+static void addToRegisters(ColumnSketch* sketch, uint64_t hashBits) {
+
+    uint64_t hash = mixBits(hashBits);
+    size_t index = hash >> (64 - SKETCH_HLL_BITS);
+
+    // Position of the first set bit after the index bits, the guard bit caps it
+    uint64_t rest = (hash << SKETCH_HLL_BITS) | (1ull << (SKETCH_HLL_BITS - 1));
+    uint8_t rank = __builtin_clzll(rest) + 1;
+
+    if (rank > sketch->registers[index])
+        sketch->registers[index] = rank;
+}
+
+static double estimateDistinct(const ColumnSketch* sketch) {
+
+    const double m = SKETCH_HLL_REGISTERS;
+    double sum = 0;
+    size_t zeros = 0;
+
+    // A register never goes past 64 - SKETCH_HLL_BITS + 1, so 2^-register comes out of a table
+    static double inversePowers[66];
+
+    if (!inversePowers[0]) {
+        for (int r = 0; r < 66; r++)
+            inversePowers[r] = ldexp(1.0, -r);
+    }
+
+    for (size_t i = 0; i < SKETCH_HLL_REGISTERS; i++) {
+        sum += inversePowers[sketch->registers[i]];
+        zeros += !sketch->registers[i];
+    }
+
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+    // Small counts leave registers empty, linear counting is closer there
+    if (estimate <= 2.5 * m && zeros)
+        estimate = m * log(m / zeros);
+
+    return estimate;
+}
+
+// Lower levels get less room the taller the stack, the top level gets SKETCH_KLL_K
+static size_t levelCapacity(const ColumnSketch* sketch, size_t level) {
+
+    double capacity = SKETCH_KLL_K;
+
+    for (size_t h = level + 1; h < sketch->numLevels; h++)
+        capacity *= 2.0 / 3.0;
+
+    return capacity < SKETCH_KLL_MIN_CAPACITY ? SKETCH_KLL_MIN_CAPACITY : (size_t)capacity;
+}
+
+static void pushItem(KllLevel* level, double value) {
+
+    if (level->count == level->capacity) {
+
+        size_t capacity = level->capacity ? level->capacity * 2 : SKETCH_KLL_MIN_CAPACITY * 2;
+        double* items = realloc(level->items, capacity * sizeof(double));
+
+        if (!items) {
+            fprintf(stderr, "realloc returned NULL pointer for sketch level\n");
+            exit(1);
+        }
+
+        level->items = items;
+        level->capacity = capacity;
+    }
+
+    level->items[level->count++] = value;
+}
+
+/* Halves every full level: sorts it and moves every other item, starting at a random
+   one of the first two, up a level where it stands for twice as many values. An odd
+   item out stays behind */
+static void compactLevels(ColumnSketch* sketch) {
+
+    for (size_t h = 0; h < sketch->numLevels; h++) {
+
+        KllLevel* level = &sketch->levels[h];
+
+        if (level->count < levelCapacity(sketch, h))
+            continue;
+
+        if (h + 1 == sketch->numLevels) {
+            if (sketch->numLevels == SKETCH_KLL_MAX_LEVELS)
+                return;
+            sketch->numLevels++;
+        }
+
+        qsort(level->items, level->count, sizeof(double), compareDoubles);
+
+        size_t odd = level->count % 2;
+        size_t paired = level->count - odd;
+        size_t offset = nextRandom(sketch) & 1;
+
+        for (size_t i = offset; i < paired; i += 2)
+            pushItem(&sketch->levels[h + 1], level->items[i]);
+
+        if (odd)
+            level->items[0] = level->items[level->count - 1];
+
+        level->count = odd;
+    }
+}
+
+static void addToSketch(ColumnSketch* sketch, const TypeOps* ops, DataValues value) {
+
+    addToRegisters(sketch, ops->hashBits(value));
+
+    double d = ops->toDouble(value);
+
+    // NaN has no rank
+    if (d != d)
+        return;
+
+    if (!sketch->count || d < sketch->min)
+        sketch->min = d;
+    if (!sketch->count || d > sketch->max)
+        sketch->max = d;
+
+    sketch->count++;
+
+    pushItem(&sketch->levels[0], d);
+
+    if (sketch->levels[0].count >= levelCapacity(sketch, 0))
+        compactLevels(sketch);
+}
+
+static void resetSketch(ColumnSketch* sketch) {
+
+    memset(sketch->registers, 0, sizeof(sketch->registers));
+
+    for (size_t h = 0; h < sketch->numLevels; h++)
+        sketch->levels[h].count = 0;
+
+    sketch->numLevels = 1;
+    sketch->count = 0;
+    sketch->min = 0;
+    sketch->max = 0;
+    sketch->added = 0;
+    sketch->removed = 0;
+}
+
+static void buildSketch(Database* db, size_t col) {
+
+    ColumnSketch* sketch = db->cols[col].sketch;
+    const TypeOps* ops = typeOps(db->cols[col].type);
+
+    resetSketch(sketch);
+
+    for (size_t r = 0; r < db->numRows; r++) {
+        if (!isCellNull(db, r, col))
+            addToSketch(sketch, ops, db->rows[r].cells[col].value);
+    }
+
+    sketch->added = db->numRows - db->cols[col].nullCount;
+    sketch->built = 1;
+}
+
+// The sketch for col, rebuilt first if too much of what it holds was overwritten or deleted
+static ColumnSketch* readySketch(Database* db, size_t col) {
+
+    if (col >= db->numCols || !db->cols[col].sketch)
+        return NULL;
+
+    ColumnSketch* sketch = db->cols[col].sketch;
+
+    if (!sketch->built || sketch->removed * SKETCH_REBUILD_RATIO > sketch->added)
+        buildSketch(db, col);
+
+    return sketch;
+}
+
+static ColumnSketch* newSketch(void) {
+
+    ColumnSketch* sketch = calloc(1, sizeof(ColumnSketch));
+
+    if (!sketch) {
+        fprintf(stderr, "calloc returned NULL pointer for ColumnSketch\n");
+        exit(1);
+    }
+
+    sketch->numLevels = 1;
+    sketch->rng = 0x9e3779b97f4a7c15ull;
+
+    return sketch;
+}
+
+/* Starts keeping sketches on a column, built from the rows already there.
+   Returns 0, 1 if the column already has them and -1 if it doesn't exist */
+int addColumnSketch(Database* db, size_t col) {
+
+    if (col >= db->numCols)
+        return -1;
+
+    if (db->cols[col].sketch)
+        return 1;
+
+    db->cols[col].sketch = newSketch();
+    buildSketch(db, col);
+
+    return 0;
+}
+
+/* Sketches named in a snapshot. They aren't saved, so they're built from the
+   column on their first query. Returns the same as addColumnSketch */
+int restoreColumnSketch(Database* db, size_t col) {
+
+    if (col >= db->numCols)
+        return -1;
+
+    if (db->cols[col].sketch)
+        return 1;
+
+    db->cols[col].sketch = newSketch();
+
+    return 0;
+}
+
+// Returns 0, or -1 if the column has no sketch
+int dropColumnSketch(Database* db, size_t col) {
+
+    if (col >= db->numCols || !db->cols[col].sketch)
+        return -1;
+
+    freeColumnSketch(db->cols[col].sketch);
+    db->cols[col].sketch = NULL;
+
+    return 0;
+}
+
+void freeColumnSketch(ColumnSketch* sketch) {
+
+    if (!sketch)
+        return;
+
+    for (size_t h = 0; h < SKETCH_KLL_MAX_LEVELS; h++)
+        free(sketch->levels[h].items);
+
+    free(sketch);
+}
+
+size_t sketchBytes(const Database* db) {
+
+    size_t bytes = 0;
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        const ColumnSketch* sketch = db->cols[col].sketch;
+
+        if (!sketch)
+            continue;
+
+        bytes += sizeof(ColumnSketch);
+
+        for (size_t h = 0; h < SKETCH_KLL_MAX_LEVELS; h++)
+            bytes += sketch->levels[h].capacity * sizeof(double);
+    }
+
+    return bytes;
+}
+
+// A value written to the column. Sketches waiting for a rebuild will pick it up from the column
+void sketchAddValue(Database* db, size_t col, DataValues value) {
+
+    ColumnSketch* sketch = db->cols[col].sketch;
+
+    if (!sketch || !sketch->built)
+        return;
+
+    addToSketch(sketch, typeOps(db->cols[col].type), value);
+    sketch->added++;
+}
+
+// Rows [firstRow, firstRow + count) were appended
+void sketchAddRows(Database* db, size_t firstRow, size_t count) {
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        ColumnSketch* sketch = db->cols[col].sketch;
+
+        if (!sketch || !sketch->built)
+            continue;
+
+        const TypeOps* ops = typeOps(db->cols[col].type);
+
+        for (size_t r = firstRow; r < firstRow + count; r++) {
+            if (!isCellNull(db, r, col)) {
+                addToSketch(sketch, ops, db->rows[r].cells[col].value);
+                sketch->added++;
+            }
+        }
+    }
+}
+
+// count values of the column were overwritten or cleared to NULL
+void sketchRemoveValues(Database* db, size_t col, size_t count) {
+
+    ColumnSketch* sketch = db->cols[col].sketch;
+
+    if (sketch && sketch->built)
+        sketch->removed += count;
+}
+
+// Called before a row is deleted, for its values in every sketched column
+void sketchRemoveRow(Database* db, size_t rowIndex) {
+
+    for (size_t col = 0; col < db->numCols; col++) {
+        if (db->cols[col].sketch && !isCellNull(db, rowIndex, col))
+            sketchRemoveValues(db, col, 1);
+    }
+}
+
+// Returns 0, or -1 if the column has no sketch
+int sketchSummary(Database* db, size_t col, SketchSummary* out) {
+
+    ColumnSketch* sketch = readySketch(db, col);
+
+    if (!sketch)
+        return -1;
+
+    out->distinct = estimateDistinct(sketch);
+    out->count = db->numRows - db->cols[col].nullCount;
+
+    // Deleted extremes stay until the next rebuild, values are only counted out
+    out->min = sketch->min;
+    out->max = sketch->max;
+
+    return 0;
+}
+
+typedef struct {
+
+    double value;
+    uint64_t weight;
+
+} WeightedItem;
+
+static int compareItems(const void* a, const void* b) {
+
+    return compareDoubles(&((const WeightedItem*)a)->value, &((const WeightedItem*)b)->value);
+}
+
+/* The values at ranks qs[0..count) (each 0 to 1) of the column, sorting the sketch
+   once for all of them. Returns 0, 1 if the column holds no values to rank and -1 if
+   it has no sketch */
+int sketchQuantiles(Database* db, size_t col, const double* qs, size_t count, double* out) {
+
+    ColumnSketch* sketch = readySketch(db, col);
+
+    if (!sketch)
+        return -1;
+
+    if (!sketch->count)
+        return 1;
+
+    size_t numItems = 0;
+
+    for (size_t h = 0; h < sketch->numLevels; h++)
+        numItems += sketch->levels[h].count;
+
+    WeightedItem* items = malloc(numItems * sizeof(WeightedItem));
+
+    if (!items) {
+        fprintf(stderr, "malloc returned NULL pointer for sketch items\n");
+        exit(1);
+    }
+
+    uint64_t total = 0;
+    size_t n = 0;
+
+    for (size_t h = 0; h < sketch->numLevels; h++) {
+        for (size_t i = 0; i < sketch->levels[h].count; i++) {
+            items[n++] = (WeightedItem){sketch->levels[h].items[i], 1ull << h};
+            total += 1ull << h;
+        }
+    }
+
+    qsort(items, numItems, sizeof(WeightedItem), compareItems);
+
+    for (size_t k = 0; k < count; k++) {
+
+        // The ends are known exactly
+        if (qs[k] <= 0 || qs[k] >= 1) {
+            out[k] = qs[k] <= 0 ? sketch->min : sketch->max;
+            continue;
+        }
+
+        double target = qs[k] * total;
+        uint64_t seen = 0;
+        size_t i = 0;
+
+        while (i + 1 < numItems && (seen += items[i].weight) < target)
+            i++;
+
+        out[k] = items[i].value;
+    }
+
+    free(items);
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "database.h"
+
+/* Optional per column sketches that answer approximate COUNT DISTINCT and
+   percentiles without a scan:
+
+   HyperLogLog, 2^SKETCH_HLL_BITS one byte registers (16KB), about 0.8%
+   standard error on the distinct count.
+
+   KLL, a stack of compactors holding about 3 * SKETCH_KLL_K samples, about
+   1% rank error on quantiles. Quantiles are of the values as doubles.
+
+   Appends and writes add their values as they happen. Neither sketch can take
+   a value back out, so overwritten and deleted values are only counted, and
+   once they're more than 1 / SKETCH_REBUILD_RATIO of what was added the next
+   query rebuilds the sketch from the column. NULLs are left out */
+
+#define SKETCH_HLL_BITS 14
+#define SKETCH_HLL_REGISTERS (1 << SKETCH_HLL_BITS)
+#define SKETCH_KLL_K 200
+#define SKETCH_KLL_MIN_CAPACITY 8
+#define SKETCH_KLL_MAX_LEVELS 48
+#define SKETCH_REBUILD_RATIO 8
+
+typedef struct {
+
+    double* items;
+    size_t count;
+    size_t capacity;
+
+} KllLevel;
+
+typedef struct ColumnSketch {
+
+    uint8_t registers[SKETCH_HLL_REGISTERS];
+
+    KllLevel levels[SKETCH_KLL_MAX_LEVELS];
+    size_t numLevels;
+    uint64_t rng;
+
+    // Values in the KLL sketch, and the smallest and largest of them
+    uint64_t count;
+    double min;
+    double max;
+
+    // Values added and taken away since the sketch was last built
+    uint64_t added;
+    uint64_t removed;
+
+    // Cleared when the sketch has to be built from the column before it's read
+    int built;
+
+} ColumnSketch;
+
+typedef struct {
+
+    double distinct;
+    uint64_t count;
+    double min;
+    double max;
+
+} SketchSummary;
+
+int addColumnSketch(Database* db, size_t col);
+int dropColumnSketch(Database* db, size_t col);
+int restoreColumnSketch(Database* db, size_t col);
+void freeColumnSketch(ColumnSketch* sketch);
+size_t sketchBytes(const Database* db);
+
+void sketchAddValue(Database* db, size_t col, DataValues value);
+void sketchAddRows(Database* db, size_t firstRow, size_t count);
+void sketchRemoveValues(Database* db, size_t col, size_t count);
+void sketchRemoveRow(Database* db, size_t rowIndex);
+
+int sketchSummary(Database* db, size_t col, SketchSummary* out);
+int sketchQuantiles(Database* db, size_t col, const double* qs, size_t count, double* out);
+
+#endif
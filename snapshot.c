@@ -0,0 +1,640 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "snapshot.h"
+#include "database.h"
+#include "compress.h"
+#include "query.h"
+#include "stats.h"
+#include "expr.h"
+#include "bloom.h"
+#include "sketch.h"
+
+#define SNAPSHOT_IO_BUFFER (1 << 20)
+
+// Writes the cursor's rows to an open stream as a snapshot, each column is compressed
+// COMPRESS_BLOCK_ROWS rows at a time so only one block is held in memory.
+// Returns 0 on success, -1 on failure
+int writeCursorSnapshot(Cursor* cursor, FILE* file) {
+
+    Database* db = cursor->db;
+    uint32_t version = SNAPSHOT_VERSION;
+    uint64_t numCols = db->numCols;
+    // The header needs the row count up front, a filtered cursor counts its rows in an extra pass
+    // rather than buffering them, so the output can still be a pipe
+    uint64_t numRows = cursor->numPreds || cursor->order ? cursorCount(cursor) : db->numRows;
+    uint32_t blockRows = COMPRESS_BLOCK_ROWS;
+
+    fwrite(SNAPSHOT_MAGIC, 1, 4, file);
+    fwrite(&version, sizeof(version), 1, file);
+    fwrite(&numCols, sizeof(numCols), 1, file);
+    fwrite(&numRows, sizeof(numRows), 1, file);
+    fwrite(&blockRows, sizeof(blockRows), 1, file);
+
+    for (size_t col = 0; col < db->numCols; col++) {
+        uint32_t type = db->cols[col].type;
+        fwrite(&type, sizeof(type), 1, file);
+        fwrite(db->cols[col].colName, 1, STRING_LEN, file);
+    }
+
+    size_t* rowIndexes = malloc(COMPRESS_BLOCK_ROWS * sizeof(size_t));
+    void* column = malloc(COMPRESS_BLOCK_ROWS * sizeof(double));
+    uint64_t* validity = malloc(VALIDITY_WORDS(COMPRESS_BLOCK_ROWS) * sizeof(uint64_t));
+
+    if (!rowIndexes || !column || !validity) {
+        fprintf(stderr, "malloc returned NULL pointer for snapshot block\n");
+        exit(1);
+    }
+
+    ByteBuffer block;
+    initByteBuffer(&block);
+
+    size_t count;
+
+    while (db->numCols && (count = cursorNextBatch(cursor, rowIndexes, COMPRESS_BLOCK_ROWS)) > 0) {
+
+        for (size_t col = 0; col < db->numCols; col++) {
+
+            gatherRows(db, col, rowIndexes, count, column);
+
+            block.size = 0;
+            uint32_t size = compressBlock(db->cols[col].type, column, count, &block);
+
+            fwrite(&size, sizeof(size), 1, file);
+            fwrite(block.data, 1, size, file);
+
+            uint32_t nulls = gatherValidityRows(db, col, rowIndexes, count, validity);
+
+            fwrite(&nulls, sizeof(nulls), 1, file);
+
+            if (nulls)
+                fwrite(validity, sizeof(uint64_t), VALIDITY_WORDS(count), file);
+        }
+    }
+
+    freeByteBuffer(&block);
+    free(validity);
+    free(column);
+    free(rowIndexes);
+
+    // Computed columns are saved as their text and compiled again when loaded
+    uint32_t numComputed = db->numComputed;
+
+    fwrite(&numComputed, sizeof(numComputed), 1, file);
+
+    for (size_t i = 0; i < db->numComputed; i++) {
+
+        const ComputedColumn* cc = db->computed[i];
+        uint32_t length = strlen(cc->prog.text);
+
+        fwrite(cc->name, 1, STRING_LEN, file);
+        fwrite(&length, sizeof(length), 1, file);
+        fwrite(cc->prog.text, 1, length, file);
+    }
+
+    // Bloom filters are saved as they are, unless the snapshot holds other rows than the table
+    uint32_t numFilters = 0;
+
+    for (size_t col = 0; col < db->numCols; col++)
+        numFilters += db->cols[col].bloom != NULL;
+
+    fwrite(&numFilters, sizeof(numFilters), 1, file);
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        const BloomFilter* bloom = db->cols[col].bloom;
+
+        if (!bloom)
+            continue;
+
+        uint32_t index = col;
+        uint64_t blocks = cursor->numPreds || cursor->order || bloom->builtRows != db->numRows ? 0
+            : (db->numRows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+
+        fwrite(&index, sizeof(index), 1, file);
+        fwrite(&blocks, sizeof(blocks), 1, file);
+        fwrite(bloom->words, sizeof(uint64_t), blocks * BLOOM_BLOCK_WORDS, file);
+    }
+
+    // Only which columns have sketches, they're cheaper to rebuild than to keep in step with a filtered cursor
+    uint32_t numSketches = 0;
+
+    for (size_t col = 0; col < db->numCols; col++)
+        numSketches += db->cols[col].sketch != NULL;
+
+    fwrite(&numSketches, sizeof(numSketches), 1, file);
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        uint32_t index = col;
+
+        if (db->cols[col].sketch)
+            fwrite(&index, sizeof(index), 1, file);
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+int writeSnapshot(Database* db, FILE* file) {
+
+    Cursor* cursor = openCursor(db, NULL, 0);
+    int result = writeCursorSnapshot(cursor, file);
+
+    closeCursor(cursor);
+
+    return result;
+}
+
+int saveDatabaseToBinary(Database* db, const char* fileName) {
+
+    FILE* file = fopen(fileName, "wb");
+
+    if (!file) {
+        fprintf(stderr, "Unable to create file: %s\n", fileName);
+        return -1;
+    }
+
+    STATS_BEGIN();
+
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_IO_BUFFER);
+
+    if (writeSnapshot(db, file) | (fclose(file) != 0)) {
+        fprintf(stderr, "Error writing file: %s\n", fileName);
+        return -1;
+    }
+
+    STATS_END(STAT_SAVE_BINARY);
+
+    return 0;
+}
+
+// Version 1 snapshots hold the rows uncompressed, read them straight into row-major batches
+static uint64_t readRawRows(Database* db, FILE* file, uint64_t numRows, const char* sourceName) {
+
+    DataValues* values = malloc(CSV_BATCH_ROWS * db->numCols * sizeof(DataValues));
+
+    if (!values) {
+        fprintf(stderr, "malloc returned NULL pointer for snapshot batch\n");
+        exit(1);
+    }
+
+    BulkBatch batch = {ROW_MAJOR, 0, db->numCols, NULL, values, NULL};
+    uint64_t loaded = 0;
+
+    while (loaded < numRows) {
+
+        batch.numRows = numRows - loaded < CSV_BATCH_ROWS ? numRows - loaded : CSV_BATCH_ROWS;
+
+        if (fread(values, sizeof(DataValues) * db->numCols, batch.numRows, file) != batch.numRows) {
+            fprintf(stderr, "Error: %s is truncated\n", sourceName);
+            break;
+        }
+
+        appendRows(db, &batch);
+        loaded += batch.numRows;
+    }
+
+    free(values);
+
+    return loaded;
+}
+
+// Version 2 and 3: decompress every column of a block, then append the block as a column-major batch
+static uint64_t readCompressedRows(Database* db, FILE* file, uint32_t version, uint64_t numRows, uint32_t blockRows,
+    const char* sourceName) {
+
+    void** columns = malloc(db->numCols * sizeof(void*));
+    uint64_t* validity = malloc(db->numCols * VALIDITY_WORDS(blockRows) * sizeof(uint64_t));
+    const uint64_t** nullableCols = malloc(db->numCols * sizeof(uint64_t*));
+    uint8_t* scratch = NULL;
+    size_t scratchSize = 0;
+    uint64_t loaded = 0;
+
+    if (!columns || !validity || !nullableCols) {
+        fprintf(stderr, "malloc returned NULL pointer for snapshot columns\n");
+        exit(1);
+    }
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        columns[col] = malloc(blockRows * sizeof(double));
+
+        if (!columns[col]) {
+            fprintf(stderr, "malloc returned NULL pointer for snapshot column\n");
+            exit(1);
+        }
+    }
+
+    BulkBatch batch = {COLUMN_MAJOR, 0, db->numCols, NULL, NULL, (const void* const*)columns, nullableCols};
+    int bad = 0;
+
+    while (loaded < numRows && !bad) {
+
+        batch.numRows = numRows - loaded < blockRows ? numRows - loaded : blockRows;
+
+        for (size_t col = 0; col < db->numCols && !bad; col++) {
+
+            uint32_t size;
+
+            if (fread(&size, sizeof(size), 1, file) != 1) {
+                bad = 1;
+                break;
+            }
+
+            if (size > scratchSize) {
+
+                uint8_t* newScratch = realloc(scratch, size);
+
+                if (!newScratch) {
+                    fprintf(stderr, "realloc returned NULL pointer for snapshot block\n");
+                    exit(1);
+                }
+
+                scratch = newScratch;
+                scratchSize = size;
+            }
+
+            bad = fread(scratch, 1, size, file) != size
+                || decompressBlock(scratch, size, db->cols[col].type, columns[col], blockRows) != (int)batch.numRows;
+
+            uint32_t nulls = 0;
+            uint64_t* bits = validity + col * VALIDITY_WORDS(blockRows);
+            size_t words = VALIDITY_WORDS(batch.numRows);
+
+            if (!bad && version >= 3)
+                bad = fread(&nulls, sizeof(nulls), 1, file) != 1
+                    || (nulls && fread(bits, sizeof(uint64_t), words, file) != words);
+
+            nullableCols[col] = nulls ? bits : NULL;
+        }
+
+        if (bad) {
+            fprintf(stderr, "Error: %s is truncated or corrupt\n", sourceName);
+            break;
+        }
+
+        appendRows(db, &batch);
+        loaded += batch.numRows;
+    }
+
+    for (size_t col = 0; col < db->numCols; col++)
+        free(columns[col]);
+
+    free(columns);
+    free(validity);
+    free(nullableCols);
+    free(scratch);
+
+    return loaded;
+}
+
+// Version 4 ends with the computed columns, any that don't compile against the table are left out
+static int readComputedColumns(Database* db, FILE* file) {
+
+    uint32_t numComputed;
+    ExprProgram* prog = malloc(sizeof(ExprProgram));
+
+    if (!prog) {
+        fprintf(stderr, "malloc returned NULL pointer for ExprProgram\n");
+        exit(1);
+    }
+
+    if (fread(&numComputed, sizeof(numComputed), 1, file) != 1) {
+        free(prog);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < numComputed; i++) {
+
+        char name[STRING_LEN];
+        char text[EXPR_TEXT_LEN];
+        uint32_t length;
+
+        if (fread(name, 1, STRING_LEN, file) != STRING_LEN || fread(&length, sizeof(length), 1, file) != 1
+            || length >= EXPR_TEXT_LEN || fread(text, 1, length, file) != length) {
+            free(prog);
+            return -1;
+        }
+
+        name[STRING_LEN - 1] = '\0';
+        text[length] = '\0';
+
+        if (compileExpr(db, text, prog) < 0 || addComputedColumn(db, name, prog) < 0)
+            fprintf(stderr, "Skipped computed column %s = %s\n", name, text);
+    }
+
+    free(prog);
+
+    return 0;
+}
+
+// Version 5 ends with the Bloom filters, a filter saved without its blocks is built again
+static int readBloomFilters(Database* db, FILE* file) {
+
+    uint32_t numFilters;
+
+    if (fread(&numFilters, sizeof(numFilters), 1, file) != 1)
+        return -1;
+
+    for (uint32_t i = 0; i < numFilters; i++) {
+
+        uint32_t col;
+        uint64_t blocks;
+        uint64_t* words = NULL;
+
+        if (fread(&col, sizeof(col), 1, file) != 1 || fread(&blocks, sizeof(blocks), 1, file) != 1
+            || blocks > (db->numRows + BLOCK_ROWS - 1) / BLOCK_ROWS)
+            return -1;
+
+        if (blocks) {
+
+            words = malloc(blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+
+            if (!words) {
+                fprintf(stderr, "malloc returned NULL pointer for bloom filter\n");
+                exit(1);
+            }
+
+            if (fread(words, sizeof(uint64_t), blocks * BLOOM_BLOCK_WORDS, file) != blocks * BLOOM_BLOCK_WORDS) {
+                free(words);
+                return -1;
+            }
+        }
+
+        restoreBloomFilter(db, col, words, blocks);
+    }
+
+    return 0;
+}
+
+// Version 6 ends with the columns that keep sketches
+static int readSketchColumns(Database* db, FILE* file) {
+
+    uint32_t numSketches;
+
+    if (fread(&numSketches, sizeof(numSketches), 1, file) != 1)
+        return -1;
+
+    for (uint32_t i = 0; i < numSketches; i++) {
+
+        uint32_t col;
+
+        if (fread(&col, sizeof(col), 1, file) != 1 || restoreColumnSketch(db, col) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+// Reads the header and the column list, leaving the stream at the first row.
+// Returns an empty table with the snapshot's columns, or NULL if it isn't a snapshot
+static Database* readSnapshotHeader(FILE* file, const char* dbName, const char* sourceName, uint32_t* version,
+    uint64_t* numRows, uint32_t* blockRows) {
+
+    char magic[4];
+    uint64_t numCols;
+
+    *blockRows = 0;
+
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, SNAPSHOT_MAGIC, 4) != 0
+        || fread(version, sizeof(*version), 1, file) != 1 || *version < 1 || *version > SNAPSHOT_VERSION
+        || fread(&numCols, sizeof(numCols), 1, file) != 1
+        || fread(numRows, sizeof(*numRows), 1, file) != 1
+        || (*version >= 2 && (fread(blockRows, sizeof(*blockRows), 1, file) != 1 || !*blockRows))) {
+        fprintf(stderr, "Error: %s is not an SCDB snapshot\n", sourceName);
+        return NULL;
+    }
+
+    Database* db = createDatabase(dbName);
+
+    for (uint64_t col = 0; col < numCols; col++) {
+
+        uint32_t type;
+        char name[STRING_LEN];
+
+        if (fread(&type, sizeof(type), 1, file) != 1 || fread(name, 1, STRING_LEN, file) != STRING_LEN
+            || type >= DATA_TYPE_COUNT) {
+            fprintf(stderr, "Error: bad column header in %s\n", sourceName);
+            deleteDatabase(db);
+            return NULL;
+        }
+
+        name[STRING_LEN - 1] = '\0';
+        createColumn(db, name, type);
+    }
+
+    return db;
+}
+
+// Reads a snapshot from an open stream into a new table called dbName, sourceName is only used in errors
+Database* readSnapshot(FILE* file, const char* dbName, const char* sourceName) {
+
+    uint32_t version;
+    uint64_t numRows;
+    uint32_t blockRows;
+    Database* db = readSnapshotHeader(file, dbName, sourceName, &version, &numRows, &blockRows);
+
+    if (!db)
+        return NULL;
+
+    // Anything short of the whole table is an error, a partial one would pass for the real thing
+    int bad = 0;
+
+    if (db->numCols) {
+
+        reserveRows(db, numRows);
+
+        uint64_t loaded = version == 1 ? readRawRows(db, file, numRows, sourceName)
+            : readCompressedRows(db, file, version, numRows, blockRows, sourceName);
+
+        STATS_ADD(STAT_COUNTER_ROWS_LOADED, loaded);
+
+        bad = loaded != numRows;
+    }
+
+    if (!bad && version >= 4 && (bad = readComputedColumns(db, file) < 0))
+        fprintf(stderr, "Error: bad computed columns in %s\n", sourceName);
+    else if (!bad && version >= 5 && (bad = readBloomFilters(db, file) < 0))
+        fprintf(stderr, "Error: bad Bloom filters in %s\n", sourceName);
+    else if (!bad && version >= 6 && (bad = readSketchColumns(db, file) < 0))
+        fprintf(stderr, "Error: bad sketch columns in %s\n", sourceName);
+
+    if (bad) {
+        deleteDatabase(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+// Only the stored columns of a snapshot, as an empty table, without reading any rows
+Database* readSnapshotSchema(FILE* file, const char* dbName, const char* sourceName) {
+
+    uint32_t version;
+    uint64_t numRows;
+    uint32_t blockRows;
+
+    return readSnapshotHeader(file, dbName, sourceName, &version, &numRows, &blockRows);
+}
+
+/* count, sum or avg of a stored column straight from a snapshot's compressed blocks,
+   optionally for the rows where that column = value (INT columns only, the kernels
+   compare bit patterns which for floats isn't the same as ==). Blocks without NULLs
+   go through the compressed kernels, so RLE and FOR blocks are never decoded; blocks
+   with NULLs are decoded and the NULLs skipped with their validity bitmap. The other
+   columns' blocks are skipped over unread.
+   Returns 0 on success, -1 if the snapshot is bad and -2 if the query needs the table loaded */
+int aggregateSnapshot(FILE* file, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out, const char* sourceName) {
+
+    uint32_t version;
+    uint64_t numRows;
+    uint32_t blockRows;
+    Database* schema = readSnapshotHeader(file, sourceName, sourceName, &version, &numRows, &blockRows);
+
+    if (!schema)
+        return -1;
+
+    size_t numCols = schema->numCols;
+    DataTypes type = col < numCols ? schema->cols[col].type : INT_TYPE;
+
+    deleteDatabase(schema);
+
+    if (version < 2 || col >= numCols || (op != AGG_COUNT && op != AGG_SUM && op != AGG_AVG)
+        || numPreds > 1 || (numPreds && (preds[0].op != PRED_EQ || preds[0].col != col || type != INT_TYPE)))
+        return -2;
+
+    const TypeOps* ops = typeOps(type);
+    void* values = malloc(blockRows * typeWidth(type));
+    uint64_t* validity = malloc(VALIDITY_WORDS(blockRows) * sizeof(uint64_t));
+    uint8_t* scratch = NULL;
+    size_t scratchSize = 0;
+    uint64_t seen = 0;
+    int bad = 0;
+
+    if (!values || !validity) {
+        fprintf(stderr, "malloc returned NULL pointer for snapshot aggregate\n");
+        exit(1);
+    }
+
+    out->value = 0.0;
+    out->rows = 0;
+
+    while (seen < numRows && !bad) {
+
+        size_t rows = numRows - seen < blockRows ? numRows - seen : blockRows;
+        size_t words = VALIDITY_WORDS(rows);
+
+        for (size_t c = 0; c < numCols && !bad; c++) {
+
+            uint32_t size;
+            uint32_t nulls = 0;
+
+            if (fread(&size, sizeof(size), 1, file) != 1) {
+                bad = 1;
+                break;
+            }
+
+            if (c != col) {
+                bad = fseek(file, size, SEEK_CUR) != 0
+                    || (version >= 3 && (fread(&nulls, sizeof(nulls), 1, file) != 1
+                    || (nulls && fseek(file, words * sizeof(uint64_t), SEEK_CUR) != 0)));
+                continue;
+            }
+
+            if (size > scratchSize) {
+
+                uint8_t* newScratch = realloc(scratch, size);
+
+                if (!newScratch) {
+                    fprintf(stderr, "realloc returned NULL pointer for snapshot block\n");
+                    exit(1);
+                }
+
+                scratch = newScratch;
+                scratchSize = size;
+            }
+
+            // The block's 8 byte header holds its row count
+            bad = fread(scratch, 1, size, file) != size || size < sizeof(uint64_t) || blockCount(scratch) != rows
+                || (version >= 3 && (fread(&nulls, sizeof(nulls), 1, file) != 1
+                || (nulls && fread(validity, sizeof(uint64_t), words, file) != words)));
+
+            if (bad)
+                break;
+
+            if (!nulls) {
+
+                double sum = 0.0;
+                long matches = rows;
+
+                if (numPreds)
+                    matches = compressedBlockCountEqual(scratch, size, type, &preds[0].value);
+                else if (op != AGG_COUNT && compressedBlockSum(scratch, size, type, &sum) < 0)
+                    matches = -1;
+
+                bad = matches < 0;
+                out->value += numPreds ? (double)matches * preds[0].value.i : sum;
+                out->rows += matches > 0 ? matches : 0;
+                continue;
+            }
+
+            bad = decompressBlock(scratch, size, type, values, blockRows) != (int)rows;
+
+            for (size_t i = 0; !bad && i < rows; i++) {
+
+                if (!((validity[i / 64] >> (i % 64)) & 1))
+                    continue;
+
+                double v = ops->toDouble(ops->load(values, i));
+
+                if (numPreds && v != preds[0].value.i)
+                    continue;
+
+                out->value += v;
+                out->rows++;
+            }
+        }
+
+        seen += rows;
+    }
+
+    free(scratch);
+    free(validity);
+    free(values);
+
+    if (bad) {
+        fprintf(stderr, "Error: %s is truncated or corrupt\n", sourceName);
+        return -1;
+    }
+
+    if (op == AGG_COUNT)
+        out->value = out->rows;
+    else if (op == AGG_AVG && out->rows)
+        out->value /= out->rows;
+
+    return 0;
+}
+
+Database* loadDatabaseFromBinary(const char* fileName, const char* dbName) {
+
+    FILE* file = fopen(fileName, "rb");
+
+    if (!file) {
+        fprintf(stderr, "Unable to open file: %s\n", fileName);
+        return NULL;
+    }
+
+    STATS_BEGIN();
+
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_IO_BUFFER);
+
+    Database* db = readSnapshot(file, dbName, fileName);
+
+    fclose(file);
+
+    STATS_END(STAT_LOAD_BINARY);
+
+    return db;
+}
@@ -0,0 +1,42 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include "database.h"
+#include "query.h"
+
+#define SNAPSHOT_MAGIC "SCDB"
+#define SNAPSHOT_VERSION 6
+
+/* Binary snapshot layout (native byte order):
+   "SCDB", uint32 version, uint64 numCols, uint64 numRows,
+   version 2 and up: uint32 blockRows,
+   numCols x (uint32 type, char name[STRING_LEN]),
+   version 1: numRows x numCols x DataValues
+   version 2: for every block of blockRows rows, numCols x (uint32 size, compressed column block)
+   version 3: same as 2, each column block followed by uint32 nulls and, when nulls isn't 0,
+   the block's validity bitmap (VALIDITY_WORDS(rows in the block) x uint64)
+   version 4: same as 3, followed by uint32 numComputed and numComputed x
+   (char name[STRING_LEN], uint32 length, length bytes of expression text)
+   version 5: same as 4, followed by uint32 numFilters and numFilters x (uint32 column,
+   uint64 blocks, blocks x BLOOM_BLOCK_WORDS x uint64 Bloom filter words), blocks is 0
+   when the filter is to be built again on load
+   version 6: same as 5, followed by uint32 numSketches and numSketches x uint32 column,
+   the sketches themselves are built again from the rows */
+
+int saveDatabaseToBinary(Database* db, const char* fileName);
+Database* loadDatabaseFromBinary(const char* fileName, const char* dbName);
+
+// Same as above on an already open stream, used for in-memory images
+int writeSnapshot(Database* db, FILE* file);
+Database* readSnapshot(FILE* file, const char* dbName, const char* sourceName);
+Database* readSnapshotSchema(FILE* file, const char* dbName, const char* sourceName);
+
+// Aggregates a column without loading the table, -2 if the query can't be answered that way
+int aggregateSnapshot(FILE* file, AggregateOp op, size_t col, const Predicate* preds, size_t numPreds,
+    AggregateResult* out, const char* sourceName);
+
+// Streams the rows of a cursor (e.g. a filtered or sorted result) into a snapshot
+int writeCursorSnapshot(Cursor* cursor, FILE* file);
+
+#endif
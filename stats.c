@@ -0,0 +1,396 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+typedef struct {
+
+    uint64_t count;
+    uint64_t timed;
+    uint64_t sumNs;
+    uint64_t maxNs;
+    uint64_t buckets[STATS_BUCKETS];
+
+} OpStats;
+
+// Everything one thread has recorded. Only the owning thread writes to a shard,
+// readers may see a value that's one update behind which is fine for stats
+typedef struct StatsShard {
+
+    OpStats ops[STATS_MAX_OPS];
+    uint64_t counters[STAT_COUNTER_COUNT];
+    uint64_t sampleTick;
+    struct StatsShard* next;
+
+} StatsShard;
+
+int statsEnabled = 1;
+
+#define X(id, name) name,
+static const char* opNames[STATS_MAX_OPS] = { STATS_CORE_OPS(X) };
+#undef X
+
+#define X(id, name, help) name,
+static const char* counterNames[] = { STATS_COUNTERS(X) };
+static const char* gaugeNames[] = { STATS_GAUGES(X) };
+#undef X
+
+#define X(id, name, help) help,
+static const char* counterHelp[] = { STATS_COUNTERS(X) };
+static const char* gaugeHelp[] = { STATS_GAUGES(X) };
+#undef X
+
+static size_t opCount = STAT_CORE_OP_COUNT;
+static uint64_t gauges[STAT_GAUGE_COUNT];
+
+static StatsShard* shards = NULL;
+static pthread_mutex_t shardLock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local StatsShard* localShard = NULL;
+
+/* Threads come and go (shard workers, update workers, replica connections), so
+   a shard doesn't outlive its thread: a key destructor folds its counts into
+   the retired shard, which stays in the list, and keeps it for the next thread */
+static StatsShard retiredShard;
+static StatsShard* freeShards = NULL;
+static pthread_key_t shardKey;
+static pthread_once_t shardKeyOnce = PTHREAD_ONCE_INIT;
+
+uint64_t statsNow() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Runs as a thread exits, on that thread, so nothing writes to the shard while it's folded in
+static void retireShard(void* arg) {
+
+    StatsShard* shard = arg;
+
+    pthread_mutex_lock(&shardLock);
+
+    for (size_t op = 0; op < STATS_MAX_OPS; op++) {
+
+        OpStats* src = &shard->ops[op];
+        OpStats* dst = &retiredShard.ops[op];
+
+        dst->count += src->count;
+        dst->timed += src->timed;
+        dst->sumNs += src->sumNs;
+
+        if (src->maxNs > dst->maxNs)
+            dst->maxNs = src->maxNs;
+
+        for (size_t b = 0; b < STATS_BUCKETS; b++)
+            dst->buckets[b] += src->buckets[b];
+    }
+
+    for (size_t c = 0; c < STAT_COUNTER_COUNT; c++)
+        retiredShard.counters[c] += shard->counters[c];
+
+    StatsShard** link = &shards;
+
+    while (*link != shard)
+        link = &(*link)->next;
+
+    *link = shard->next;
+
+    memset(shard, 0, sizeof(*shard));
+    shard->next = freeShards;
+    freeShards = shard;
+
+    pthread_mutex_unlock(&shardLock);
+
+    // Anything recorded later on this thread takes a fresh shard
+    localShard = NULL;
+}
+
+static void createShardKey() {
+
+    pthread_key_create(&shardKey, retireShard);
+
+    pthread_mutex_lock(&shardLock);
+    retiredShard.next = shards;
+    shards = &retiredShard;
+    pthread_mutex_unlock(&shardLock);
+}
+
+// First use on a thread takes a shard (a retired thread's or a new one) and links it into the global list
+static StatsShard* getShard() {
+
+    if (localShard)
+        return localShard;
+
+    pthread_once(&shardKeyOnce, createShardKey);
+
+    pthread_mutex_lock(&shardLock);
+
+    StatsShard* shard = freeShards;
+
+    if (shard) {
+        freeShards = shard->next;
+    } else if (!(shard = calloc(1, sizeof(StatsShard)))) {
+        fprintf(stderr, "calloc returned NULL pointer for StatsShard\n");
+        exit(1);
+    }
+
+    shard->next = shards;
+    shards = shard;
+    pthread_mutex_unlock(&shardLock);
+
+    pthread_setspecific(shardKey, shard);
+    localShard = shard;
+
+    return shard;
+}
+
+// Registers an extra operation (e.g. a CLI command), returns its id for statsRecord
+size_t statsRegisterOp(const char* name) {
+
+    pthread_mutex_lock(&shardLock);
+
+    size_t op = opCount;
+
+    if (opCount < STATS_MAX_OPS)
+        opNames[opCount++] = name;
+    else
+        op = STATS_MAX_OPS - 1;
+
+    pthread_mutex_unlock(&shardLock);
+
+    return op;
+}
+
+/* Log-linear buckets like HDR histograms: values below STATS_SUB_BUCKETS get
+   their own bucket, above that every power of two is split into
+   STATS_SUB_BUCKETS equal parts, so each bucket is within 12.5% of its values */
+static size_t bucketIndex(uint64_t ns) {
+
+    if (ns < STATS_SUB_BUCKETS)
+        return ns;
+
+    int exponent = 63 - __builtin_clzll(ns);
+    size_t index = STATS_SUB_BUCKETS + (exponent - 3) * STATS_SUB_BUCKETS
+        + ((ns >> (exponent - 3)) & (STATS_SUB_BUCKETS - 1));
+
+    return index < STATS_BUCKETS ? index : STATS_BUCKETS - 1;
+}
+
+// Largest value that falls in a bucket
+static uint64_t bucketUpperBound(size_t index) {
+
+    if (index < STATS_SUB_BUCKETS)
+        return index;
+
+    size_t exponent = (index - STATS_SUB_BUCKETS) / STATS_SUB_BUCKETS + 3;
+    size_t sub = (index - STATS_SUB_BUCKETS) % STATS_SUB_BUCKETS;
+
+    return ((STATS_SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+}
+
+void statsRecord(size_t op, uint64_t ns) {
+
+    OpStats* stats = &getShard()->ops[op];
+
+    stats->count++;
+    stats->timed++;
+    stats->sumNs += ns;
+    stats->buckets[bucketIndex(ns)]++;
+
+    if (ns > stats->maxNs)
+        stats->maxNs = ns;
+}
+
+void statsCount(size_t op) {
+    getShard()->ops[op].count++;
+}
+
+void statsAdd(StatCounter counter, uint64_t amount) {
+    getShard()->counters[counter] += amount;
+}
+
+void statsSetGauge(StatGauge gauge, uint64_t value) {
+    gauges[gauge] = value;
+}
+
+// Returns 1 once every STATS_SAMPLE_EVERY calls on this thread
+int statsSampleTick() {
+    return getShard()->sampleTick++ % STATS_SAMPLE_EVERY == 0;
+}
+
+void statsReset() {
+
+    pthread_mutex_lock(&shardLock);
+
+    for (StatsShard* shard = shards; shard; shard = shard->next) {
+        memset(shard->ops, 0, sizeof(shard->ops));
+        memset(shard->counters, 0, sizeof(shard->counters));
+    }
+
+    pthread_mutex_unlock(&shardLock);
+}
+
+// Merge every thread's shard into one snapshot
+static void mergeShards(OpStats* ops, uint64_t* counters) {
+
+    memset(ops, 0, STATS_MAX_OPS * sizeof(OpStats));
+    memset(counters, 0, STAT_COUNTER_COUNT * sizeof(uint64_t));
+
+    pthread_mutex_lock(&shardLock);
+
+    for (StatsShard* shard = shards; shard; shard = shard->next) {
+
+        for (size_t op = 0; op < opCount; op++) {
+
+            OpStats* src = &shard->ops[op];
+
+            if (!src->count)
+                continue;
+
+            ops[op].count += src->count;
+            ops[op].timed += src->timed;
+            ops[op].sumNs += src->sumNs;
+
+            if (src->maxNs > ops[op].maxNs)
+                ops[op].maxNs = src->maxNs;
+
+            for (size_t b = 0; b < STATS_BUCKETS; b++)
+                ops[op].buckets[b] += src->buckets[b];
+        }
+
+        for (size_t c = 0; c < STAT_COUNTER_COUNT; c++)
+            counters[c] += shard->counters[c];
+    }
+
+    pthread_mutex_unlock(&shardLock);
+}
+
+static uint64_t percentile(OpStats* stats, double p) {
+
+    if (!stats->timed)
+        return 0;
+
+    uint64_t target = (uint64_t)(p * stats->timed);
+    uint64_t seen = 0;
+
+    for (size_t b = 0; b < STATS_BUCKETS; b++) {
+        seen += stats->buckets[b];
+        if (seen > target)
+            return bucketUpperBound(b) < stats->maxNs ? bucketUpperBound(b) : stats->maxNs;
+    }
+
+    return stats->maxNs;
+}
+
+static OpStats* allocSnapshot() {
+
+    OpStats* ops = malloc(STATS_MAX_OPS * sizeof(OpStats));
+
+    if (!ops) {
+        fprintf(stderr, "malloc returned NULL pointer for stats snapshot\n");
+        exit(1);
+    }
+
+    return ops;
+}
+
+// Human readable table of every operation that has run, times in microseconds
+void printStats(FILE* out) {
+
+    OpStats* ops = allocSnapshot();
+    uint64_t counters[STAT_COUNTER_COUNT];
+
+    mergeShards(ops, counters);
+
+    fprintf(out, "%-24s %12s %10s %10s %10s %10s %12s\n", "operation", "count", "mean(us)", "p50(us)",
+        "p99(us)", "max(us)", "total(ms)");
+
+    for (size_t op = 0; op < opCount; op++) {
+
+        OpStats* stats = &ops[op];
+
+        if (!stats->count)
+            continue;
+
+        double mean = stats->timed ? (double)stats->sumNs / stats->timed : 0.0;
+
+        fprintf(out, "%-24s %12llu %10.2f %10.2f %10.2f %10.2f %12.2f\n", opNames[op],
+            (unsigned long long)stats->count, mean / 1e3, percentile(stats, 0.50) / 1e3,
+            percentile(stats, 0.99) / 1e3, stats->maxNs / 1e3, mean * stats->count / 1e6);
+    }
+
+    fprintf(out, "\n");
+
+    for (size_t c = 0; c < STAT_COUNTER_COUNT; c++)
+        fprintf(out, "%-24s %12llu\n", counterNames[c], (unsigned long long)counters[c]);
+
+    for (size_t g = 0; g < STAT_GAUGE_COUNT; g++)
+        fprintf(out, "%-24s %12llu\n", gaugeNames[g], (unsigned long long)gauges[g]);
+
+    free(ops);
+}
+
+// Same data in the Prometheus text exposition format
+void statsWritePrometheus(FILE* out) {
+
+    static const double bounds[] = {1e-6, 1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1.0, 10.0};
+    size_t numBounds = sizeof(bounds) / sizeof(bounds[0]);
+
+    OpStats* ops = allocSnapshot();
+    uint64_t counters[STAT_COUNTER_COUNT];
+
+    mergeShards(ops, counters);
+
+    fprintf(out, "# HELP scdb_op_total Operations executed.\n# TYPE scdb_op_total counter\n");
+
+    for (size_t op = 0; op < opCount; op++) {
+        if (ops[op].count)
+            fprintf(out, "scdb_op_total{op=\"%s\"} %llu\n", opNames[op], (unsigned long long)ops[op].count);
+    }
+
+    fprintf(out, "# HELP scdb_op_duration_seconds Operation latency (hot operations are sampled).\n");
+    fprintf(out, "# TYPE scdb_op_duration_seconds histogram\n");
+
+    for (size_t op = 0; op < opCount; op++) {
+
+        OpStats* stats = &ops[op];
+
+        if (!stats->timed)
+            continue;
+
+        size_t b = 0;
+        uint64_t cumulative = 0;
+
+        for (size_t i = 0; i < numBounds; i++) {
+
+            uint64_t limit = (uint64_t)(bounds[i] * 1e9);
+
+            for (; b < STATS_BUCKETS && bucketUpperBound(b) <= limit; b++)
+                cumulative += stats->buckets[b];
+
+            fprintf(out, "scdb_op_duration_seconds_bucket{op=\"%s\",le=\"%g\"} %llu\n", opNames[op], bounds[i],
+                (unsigned long long)cumulative);
+        }
+
+        fprintf(out, "scdb_op_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", opNames[op],
+            (unsigned long long)stats->timed);
+        fprintf(out, "scdb_op_duration_seconds_sum{op=\"%s\"} %.9f\n", opNames[op], stats->sumNs / 1e9);
+        fprintf(out, "scdb_op_duration_seconds_count{op=\"%s\"} %llu\n", opNames[op], (unsigned long long)stats->timed);
+    }
+
+    for (size_t c = 0; c < STAT_COUNTER_COUNT; c++) {
+        fprintf(out, "# HELP scdb_%s_total %s.\n# TYPE scdb_%s_total counter\nscdb_%s_total %llu\n", counterNames[c],
+            counterHelp[c], counterNames[c], counterNames[c], (unsigned long long)counters[c]);
+    }
+
+    for (size_t g = 0; g < STAT_GAUGE_COUNT; g++) {
+        fprintf(out, "# HELP scdb_%s %s.\n# TYPE scdb_%s gauge\nscdb_%s %llu\n", gaugeNames[g], gaugeHelp[g],
+            gaugeNames[g], gaugeNames[g], (unsigned long long)gauges[g]);
+    }
+
+    free(ops);
+}
@@ -0,0 +1,96 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Low overhead instrumentation. Every thread records into its own shard
+   (no locks or atomics on the hot path), readers merge all shards. */
+
+#define STATS_MAX_OPS 96
+#define STATS_SUB_BUCKETS 8
+#define STATS_BUCKETS 320
+
+// Hot ops only time one call in STATS_SAMPLE_EVERY, their counts are still exact
+#define STATS_SAMPLE_EVERY 16
+
+// Core engine operations, UI commands are registered after these at runtime
+#define STATS_CORE_OPS(X) \
+    X(CREATE_ROW, "createRow") \
+    X(APPEND_ROWS, "appendRows") \
+    X(CREATE_COLUMN, "createColumn") \
+    X(DELETE_ROW, "deleteRow") \
+    X(DELETE_COLUMN, "deleteColumn") \
+    X(ADD_INT, "addInt") \
+    X(ADD_FLOAT, "addFloat") \
+    X(ADD_DOUBLE, "addDouble") \
+    X(PRINT_DB, "printDatabase") \
+    X(LOAD_CSV, "loadDatabaseFromCSV") \
+    X(SAVE_CSV, "saveDatabaseToCSV") \
+    X(LOAD_BINARY, "loadDatabaseFromBinary") \
+    X(SAVE_BINARY, "saveDatabaseToBinary") \
+    X(LOAD_STORE, "loadDatabaseFromStore") \
+    X(SAVE_STORE, "saveDatabaseToStore") \
+    X(LOAD_ARROW, "loadDatabaseFromArrow") \
+    X(SAVE_ARROW, "saveDatabaseToArrow") \
+    X(UPDATE_COLUMN, "updateColumnExpr") \
+    X(FIND_DB, "findDatabaseInList") \
+    X(EVICT_DB, "evictDatabase")
+
+#define STATS_COUNTERS(X) \
+    X(ROWS_SCANNED, "rows_scanned", "Rows read by scans, prints and saves") \
+    X(ROWS_LOADED, "rows_loaded", "Rows read in from files") \
+    X(ROWS_APPENDED, "rows_appended", "Rows added through createRow and appendRows") \
+    X(CELLS_WRITTEN, "cells_written", "Cells written through addInt/addFloat/addDouble") \
+    X(CACHE_HITS, "cache_hits", "Query results served from the result cache") \
+    X(CACHE_MISSES, "cache_misses", "Query results that had to be computed") \
+    X(BLOCKS_SKIPPED, "blocks_skipped", "Row blocks skipped by scans because a Bloom filter ruled them out") \
+    X(BYTES_READ, "bytes_read", "Bytes read from .csv and Arrow files") \
+    X(BYTES_WRITTEN, "bytes_written", "Bytes written to .csv and Arrow files")
+
+#define X(id, name) STAT_##id,
+typedef enum { STATS_CORE_OPS(X) STAT_CORE_OP_COUNT } StatOp;
+#undef X
+
+#define X(id, name, help) STAT_COUNTER_##id,
+typedef enum { STATS_COUNTERS(X) STAT_COUNTER_COUNT } StatCounter;
+#undef X
+
+#define STATS_GAUGES(X) \
+    X(MEMORY_BYTES, "memory_bytes", "Bytes held by resident tables") \
+    X(TABLES, "tables", "Tables in the catalog")
+
+#define X(id, name, help) STAT_GAUGE_##id,
+typedef enum { STATS_GAUGES(X) STAT_GAUGE_COUNT } StatGauge;
+#undef X
+
+extern int statsEnabled;
+
+uint64_t statsNow();
+
+size_t statsRegisterOp(const char* name);
+
+void statsRecord(size_t op, uint64_t ns);
+void statsCount(size_t op);
+void statsAdd(StatCounter counter, uint64_t amount);
+void statsSetGauge(StatGauge gauge, uint64_t value);
+int statsSampleTick();
+
+void statsReset();
+void printStats(FILE* out);
+void statsWritePrometheus(FILE* out);
+
+// Time the rest of a block: STATS_BEGIN(); ... STATS_END(STAT_CREATE_ROW);
+#define STATS_BEGIN() uint64_t statsStart_ = statsEnabled ? statsNow() : 0
+#define STATS_END(op) do { if (statsEnabled) statsRecord((op), statsNow() - statsStart_); } while (0)
+
+// Same for hot paths, the call is always counted but only every STATS_SAMPLE_EVERY-th one is timed
+#define STATS_BEGIN_SAMPLED() uint64_t statsStart_ = (statsEnabled && statsSampleTick()) ? statsNow() : 0
+#define STATS_END_SAMPLED(op) do { \
+        if (statsStart_) statsRecord((op), statsNow() - statsStart_); \
+        else if (statsEnabled) statsCount(op); \
+    } while (0)
+
+#define STATS_ADD(counter, amount) do { if (statsEnabled) statsAdd((counter), (amount)); } while (0)
+
+#endif
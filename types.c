@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "types.h"
+
+// One set of kernels per entry in DATA_TYPE_LIST, each a plain loop over a single C type
+#define DEFINE_KERNELS(id, name, ctype, member, format, exact, parse) \
+\
+static int format_##id(char* out, size_t size, DataValues value) { \
+    return snprintf(out, size, format, value.member); \
+} \
+\
+static int formatExact_##id(char* out, size_t size, DataValues value) { \
+    return snprintf(out, size, exact, value.member); \
+} \
+\
+static int parse_##id(const char* text, DataValues* out) { \
+    char* endPtr; \
+    char** end = &endPtr; \
+    out->member = (ctype)(parse); \
+    return endPtr == text || *endPtr != '\0' ? -1 : 0; \
+} \
+\
+static int compare_##id(DataValues a, DataValues b) { \
+    return (a.member > b.member) - (a.member < b.member); \
+} \
+\
+static double toDouble_##id(DataValues value) { \
+    return (double)value.member; \
+} \
+\
+static uint64_t hashBits_##id(DataValues value) { \
+    /* 0.0 and -0.0 compare equal */ \
+    ctype v = value.member == 0 ? 0 : value.member; \
+    uint64_t bits = 0; \
+    memcpy(&bits, &v, sizeof(v)); \
+    return bits; \
+} \
+\
+static DataValues load_##id(const void* values, size_t i) { \
+    DataValues out = {0}; \
+    memcpy(&out.member, (const unsigned char*)values + i * sizeof(ctype), sizeof(ctype)); \
+    return out; \
+} \
+\
+static void gather_##id(const Row* rows, size_t col, size_t count, void* out) { \
+    ctype* dst = out; \
+    for (size_t r = 0; r < count; r++) \
+        dst[r] = rows[r].cells[col].value.member; \
+} \
+\
+static void gatherRows_##id(const Row* rows, const size_t* rowIndexes, size_t col, size_t count, void* out) { \
+    ctype* dst = out; \
+    for (size_t r = 0; r < count; r++) \
+        dst[r] = rows[rowIndexes[r]].cells[col].value.member; \
+} \
+\
+static void gatherDoubles_##id(const Row* rows, const size_t* rowIndexes, size_t col, size_t count, double* out) { \
+    for (size_t r = 0; r < count; r++) \
+        out[r] = (double)rows[rowIndexes[r]].cells[col].value.member; \
+} \
+\
+static void scatter_##id(Row* rows, size_t col, size_t count, const void* values) { \
+    const ctype* src = values; \
+    for (size_t r = 0; r < count; r++) \
+        rows[r].cells[col].value.member = src[r]; \
+} \
+\
+static void scatterRows_##id(Row* rows, const size_t* rowIndexes, size_t col, size_t count, const void* values) { \
+    const ctype* src = values; \
+    for (size_t r = 0; r < count; r++) \
+        rows[rowIndexes[r]].cells[col].value.member = src[r]; \
+} \
+\
+static double sum_##id(const Row* rows, size_t col, size_t count) { \
+    double sum = 0.0; \
+    for (size_t r = 0; r < count; r++) \
+        sum += rows[r].cells[col].value.member; \
+    return sum; \
+}
+
+DATA_TYPE_LIST(DEFINE_KERNELS)
+
+#define X(id, name, ctype, member, format, exact, parse) \
+    [id] = {name, sizeof(ctype), format_##id, formatExact_##id, parse_##id, compare_##id, toDouble_##id, \
+        hashBits_##id, load_##id, gather_##id, gatherRows_##id, gatherDoubles_##id, scatter_##id, scatterRows_##id, \
+        sum_##id},
+const TypeOps type_ops[DATA_TYPE_COUNT] = { DATA_TYPE_LIST(X) };
+#undef X
+
+#define X(id, name, ctype, member, format, exact, parse) [id] = name,
+const char* data_types[DATA_TYPE_COUNT] = { DATA_TYPE_LIST(X) };
+#undef X
+
+// Looks a type up by its name, ignoring case. Returns -1 if there's no such type
+int findDataType(const char* name, DataTypes* out) {
+
+    for (int type = 0; type < DATA_TYPE_COUNT; type++) {
+        if (strcasecmp(name, data_types[type]) == 0) {
+            *out = type;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// "null" in any case, how commands and filters spell a NULL value
+int isNullText(const char* text) {
+    return strcasecmp(text, "null") == 0;
+}
@@ -0,0 +1,105 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Column types. Each entry generates the DataTypes value, the DataValues member
+   and the typed kernels in types.c, so adding a type is one line here:
+
+   X(id, name in .csv headers, C type, DataValues member, display format, exact format, parse)
+
+   The display format is what tables and .csv files show, the exact format prints
+   a value that reads back the same (cache keys). parse is an expression over
+   (const char* text, char** end) */
+#define DATA_TYPE_LIST(X) \
+    X(INT_TYPE, "INT", int, i, "%d", "%d", strtol(text, end, 10)) \
+    X(FLOAT_TYPE, "FLOAT", float, f, "%f", "%.9g", strtof(text, end)) \
+    X(DOUBLE_TYPE, "DOUBLE", double, d, "%lf", "%.17g", strtod(text, end))
+
+// Room for any value in either format, "%f" of -DBL_MAX is 317 characters
+#define VALUE_TEXT_LEN 330
+
+#define X(id, name, ctype, member, format, exact, parse) id,
+typedef enum { DATA_TYPE_LIST(X) DATA_TYPE_COUNT } DataTypes;
+#undef X
+
+#define X(id, name, ctype, member, format, exact, parse) ctype member;
+typedef union { DATA_TYPE_LIST(X) } DataValues;
+#undef X
+
+// Snapshots, replication records and ROW_MAJOR batches hold each value in 8 bytes
+_Static_assert(sizeof(DataValues) == sizeof(uint64_t), "DataValues must stay 8 bytes");
+
+typedef struct {
+
+    DataValues value;
+
+} Cell;
+
+typedef struct {
+
+    Cell* cells;
+
+} Row;
+
+/* Per type operations. Callers look these up once per column with typeOps and
+   then run the typed loop, instead of switching on the type for every cell.
+   Typed arrays (COLUMN_MAJOR batches, compressed blocks) hold width bytes per value */
+typedef struct {
+
+    const char* name;
+    size_t width;
+
+    // snprintf style, return the length of the text
+    int (*format)(char* out, size_t size, DataValues value);
+    int (*formatExact)(char* out, size_t size, DataValues value);
+
+    // Parses all of text into *out, returns -1 if it isn't a valid value
+    int (*parse)(const char* text, DataValues* out);
+
+    // -1, 0 or 1
+    int (*compare)(DataValues a, DataValues b);
+    double (*toDouble)(DataValues value);
+
+    // Bits to hash, values that compare equal get the same bits
+    uint64_t (*hashBits)(DataValues value);
+
+    // Value i of a typed array, which doesn't have to be aligned
+    DataValues (*load)(const void* values, size_t i);
+
+    // Column col of count rows to and from a typed array
+    void (*gather)(const Row* rows, size_t col, size_t count, void* out);
+    void (*gatherRows)(const Row* rows, const size_t* rowIndexes, size_t col, size_t count, void* out);
+    void (*gatherDoubles)(const Row* rows, const size_t* rowIndexes, size_t col, size_t count, double* out);
+    void (*scatter)(Row* rows, size_t col, size_t count, const void* values);
+    void (*scatterRows)(Row* rows, const size_t* rowIndexes, size_t col, size_t count, const void* values);
+
+    double (*sum)(const Row* rows, size_t col, size_t count);
+
+} TypeOps;
+
+extern const TypeOps type_ops[DATA_TYPE_COUNT];
+extern const char* data_types[DATA_TYPE_COUNT];
+
+static inline const TypeOps* typeOps(DataTypes type) {
+    return &type_ops[type];
+}
+
+// Spreads hashBits over all 64 bits for hash tables, shards and sketches (splitmix64's finalizer)
+static inline uint64_t mixBits(uint64_t x) {
+
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+int findDataType(const char* name, DataTypes* out);
+int isNullText(const char* text);
+
+#endif
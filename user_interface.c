@@ -5,8 +5,25 @@
 #include "user_interface.h"
 #include "database.h"
 #include "database_list.h"
-
- uiCmd uiCommands[] = { 
+#include "bgsave.h"
+#include "stats.h"
+#include "db_server.h"
+#include "snapshot.h"
+#include "compress.h"
+#include "query.h"
+#include "blockstore.h"
+#include "cache.h"
+#include "shard.h"
+#include "db_client.h"
+#include "expr.h"
+#include "bloom.h"
+#include "sketch.h"
+#include "view.h"
+#include "fileio.h"
+#include "hugemem.h"
+#include "arrow.h"
+
+ uiCmd uiCommands[] = {
         {"-quit", cmdQuit},
         {"-print", cmdPrintDB},
         {"-list", cmdPrintDBList},
@@ -21,67 +38,254 @@
         {"-delcol", cmdDeleteCol},
         {"-save", cmdSaveDbToFile},
         {"-load", cmdLoadDbFromFile},
-        {"-colname", cmdChangeColName}
+        {"-colname", cmdChangeColName},
+        {"-bgsave", cmdBgSaveDbToFile},
+        {"-bgstatus", cmdBgSaveStatus},
+        {"-insert", cmdInsertRow},
+        {"-autoprint", cmdAutoPrint},
+        {"-bulkload", cmdBulkLoad},
+        {"-attach", cmdAttachDbFile},
+        {"-budget", cmdMemoryBudget},
+        {"-memstats", cmdMemoryStats},
+        {"-stats", cmdStats},
+        {"-metrics", cmdMetricsServer},
+        {"-savebin", cmdSaveDbToBinary},
+        {"-loadbin", cmdLoadDbFromBinary},
+        {"-compressinfo", cmdCompressInfo},
+        {"-export", cmdExport},
+        {"-savestore", cmdSaveDbToStore},
+        {"-loadstore", cmdLoadDbFromStore},
+        {"-agg", cmdAggregate},
+        {"-update", cmdUpdate},
+        {"-computed", cmdComputed},
+        {"-materialize", cmdMaterialize},
+        {"-bloom", cmdBloom},
+        {"-sketch", cmdSketch},
+        {"-view", cmdView},
+        {"-io", cmdIo},
+        {"-memconfig", cmdMemConfig},
+        {"-savearrow", cmdSaveDbToArrow},
+        {"-loadarrow", cmdLoadDbFromArrow},
+        {"-cachestats", cmdCacheStats},
+        {"-shard", cmdShardDB},
+        {"-sharded", cmdShardedOp},
+        {"-unshard", cmdUnshardDB},
+        {"-replicate", cmdReplicate}
     };
 
+// Stats op id for each command, registered when the menu starts
+static size_t commandStatOps[sizeof(uiCommands) / sizeof(uiCommands[0])];
+
+// In batch mode (script file or piped stdin) we skip prompts and table reprints
+static int interactiveMode = 1;
+// Rows reprinted around the changed row after a change, 0 turns it off
+static size_t autoPrintRows = AUTO_PRINT_ROWS;
+// Tables split with -shard live here until -unshard puts them back in the list
+static ShardedTable* shardedTables[MAX_SHARDED_TABLES];
+
+// Commands that change tables, refused on a read replica
+static const char* writeCommands[] = {"-new", "-delete", "-newcol", "-newrow", "-writecell", "-delrow", "-delcol",
+    "-load", "-colname", "-insert", "-bulkload", "-attach", "-loadbin", "-loadstore", "-shard", "-sharded", "-unshard",
+    "-update", "-computed", "-materialize", "-bloom", "-view", "-loadarrow"};
+
+static int isWriteCommand(const char* command) {
+
+    for (size_t i = 0; i < sizeof(writeCommands) / sizeof(writeCommands[0]); i++) {
+        if (strcmp(command, writeCommands[i]) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
 /* Refactored this to use handler design pattern */
 
-void userMenu() {
+// Commands can take their arguments inline, e.g. "-writecell 0 1 42".
+// Handlers call readArg for each argument they need, if it was not given on
+// the command line we fall back to prompting for it like before.
+static int readArg(char** args, const char* prompt, char* out, size_t size) {
+
+    // Skip any whitespace before the next inline argument
+    if (args && *args) {
+        *args += strspn(*args, " \t");
+
+        if (**args != '\0') {
+            size_t len = strcspn(*args, " \t");
+
+            if (len >= size)
+                len = size - 1;
+
+            memcpy(out, *args, len);
+            out[len] = '\0';
+
+            *args += strcspn(*args, " \t");
+            return 0;
+        }
+    }
+
+    if (prompt && interactiveMode) {
+        printf("%s", prompt);
+        fflush(stdout);
+    }
+
+    if (fgets(out, size, stdin) == NULL) {
+        out[0] = '\0';
+        return -1;
+    }
+
+    out[strcspn(out, "\n")] = '\0';
+    return 0;
+}
+
+// True if there's another inline argument, for optional arguments that shouldn't fall back to a prompt
+static int hasArg(char* args) {
+    return args && args[strspn(args, " \t")] != '\0';
+}
+
+// Make db the selected table. The selected table is pinned so the memory budget never evicts it
+static void selectDatabase(DatabaseList* dbl, Database** currentDB, Database* db) {
+
+    DatabaseEntry* entry;
+
+    if (*currentDB && (entry = findDatabaseInList(dbl, (*currentDB)->dbName)))
+        unpinDatabaseEntry(entry);
+
+    *currentDB = db;
+
+    if (db && (entry = findDatabaseInList(dbl, db->dbName)))
+        pinDatabaseEntry(entry);
+}
+
+// Reprint the rows around the one that changed, unless it's been turned off
+static void autoPrintDatabase(Database* db, size_t row) {
+
+    if (!autoPrintRows)
+        return;
+
+    size_t offset = row > autoPrintRows / 2 ? row - autoPrintRows / 2 : 0;
+
+    printDatabaseRows(db, offset, autoPrintRows);
+}
+
+void userMenu(int interactive) {
 
-    printf("------ Welcome to SCDB! ------\n");
-    printf("Type -help to see the list of available commands and features.\n");
+    interactiveMode = interactive;
+    autoPrintRows = interactive ? AUTO_PRINT_ROWS : 0;
+
+    if (interactiveMode) {
+        printf("------ Welcome to SCDB! ------\n");
+        printf("Type -help to see the list of available commands and features.\n");
+    } else {
+        // Scripts produce a lot of output, write it out in large chunks
+        setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    }
 
     size_t commandCount = sizeof(uiCommands)/sizeof(uiCommands[0]);
 
+    for (size_t i = 0; i < commandCount; i++)
+        commandStatOps[i] = statsRegisterOp(uiCommands[i].command);
+
     // Current DB we are working with, need to avoid dangling pointers!
     // If the DB this is pointing to is deleted, we need to set this back to NULL
     Database* currentDB = NULL;
 
-    DatabaseList* dbl = createDatabaseList(DB_LIMIT);
+    DatabaseList* dbl = createDatabaseList(0);
 
-    char inputBuffer[STRING_LEN];
+    char inputBuffer[LINE_LEN];
+    size_t lineNumber = 0;
 
     // Get input from the user so they can do shit
     while(1) {
 
+        // Report on a background save that finished while we were busy
+        pollBackgroundSave();
+
         // Prompt for the user
-        if (!currentDB)  printf("(scdb) >> ");
-        else printf("(%s) >> ", currentDB->dbName);
+        if (interactiveMode) {
+            if (!currentDB)  printf("(scdb) >> ");
+            else printf("(%s) >> ", currentDB->dbName);
+        }
 
-        // Get the user input 
-        if (fgets(inputBuffer, sizeof(inputBuffer), stdin) != NULL) {
-            inputBuffer[strcspn(inputBuffer, "\n ")] = '\0';
+        // Get the user input, end of input is the same as -quit
+        if (fgets(inputBuffer, sizeof(inputBuffer), stdin) == NULL) {
+            cmdQuit(dbl, &currentDB, NULL);
         }
 
+        inputBuffer[strcspn(inputBuffer, "\r\n")] = '\0';
+        lineNumber++;
+
+        // Split the command from its inline arguments
+        char* args = inputBuffer + strcspn(inputBuffer, " \t");
+
+        if (*args != '\0')
+            *args++ = '\0';
+
+        // Blank lines and comments are allowed in scripts
+        if (inputBuffer[0] == '\0' || inputBuffer[0] == '#')
+            continue;
 
         int found = 0;
 
+        if (isReplica() && isWriteCommand(inputBuffer)) {
+            printf("This is a read replica of %s, make changes on the primary.\n", replicaPrimaryAddress());
+            continue;
+        }
+
+        // Replication works on the catalog from its own threads, it waits while a command runs
+        lockCatalog();
+
+        // On a replica the selected table may have been dropped by the primary
+        if (currentDB && !databaseListContains(dbl, currentDB)) {
+            printf("The selected table was dropped by the primary.\n");
+            currentDB = NULL;
+        }
+
         // Search for the correct command
         for (size_t i = 0; i < commandCount; i++) {
             if (strcmp(inputBuffer, uiCommands[i].command) == 0) {
-                uiCommands[i].cmdFunction(dbl, &currentDB, inputBuffer);
+                STATS_BEGIN();
+                uiCommands[i].cmdFunction(dbl, &currentDB, args);
+                STATS_END(commandStatOps[i]);
                 found = 1;
+
+                // The command may have grown a table past the memory budget
+                enforceMemoryBudget(dbl);
+
+                statsSetGauge(STAT_GAUGE_MEMORY_BYTES, databaseListMemoryUsage(dbl));
+                statsSetGauge(STAT_GAUGE_TABLES, dbl->dbCount);
                 break;
             }
         }
 
+        unlockCatalog();
+
         if (!found) {
-            printf("Invalid command. Type -help to see the list of available commands.\n");
+            if (interactiveMode)
+                printf("Invalid command. Type -help to see the list of available commands.\n");
+            else
+                fprintf(stderr, "line %zu: invalid command '%s'\n", lineNumber, inputBuffer);
         }
     }
 }
 
-void cmdQuit(DatabaseList* dbl, Database** db, char* name) {
+void cmdQuit(DatabaseList* dbl, Database** db, char* args) {
+
+    // Don't leave a half written file behind
+    waitBackgroundSave();
+
+    for (size_t i = 0; i < MAX_SHARDED_TABLES; i++)
+        deleteShardedTable(shardedTables[i]);
 
     // Free the memory for the database list
     deleteDatabaseList(dbl);
 
     // Exit
-    printf("Exiting scdb...\n");
+    if (interactiveMode)
+        printf("Exiting scdb...\n");
     exit(0);
 }
 
-void cmdHelp(DatabaseList* dbl, Database** db, char* name) {
+void cmdHelp(DatabaseList* dbl, Database** db, char* args) {
 
     printf("\nSupported commands: \n");
     printf("------------------------\n");
@@ -89,57 +293,160 @@ void cmdHelp(DatabaseList* dbl, Database** db, char* name) {
     printf("2) -new\t\tCreate a new database\n");
     printf("3) -newcol\tCreate a new column (Columns MUST be created before rows)\n");
     printf("4) -newrow\tCreate a new row\n");
-    printf("5) -writecell\tWrite a cell\n");
+    printf("5) -writecell\tWrite a cell, or clear it with -writecell 0 1 null\n");
     printf("6) -colname\tChange a column name\n");
     printf("7) -delete\tDelete the current database\n");
     printf("8) -delrow\tDelete a row specified by it's index\n");
     printf("9) -delcol\tDelete a column specified by it's index\n");
-    printf("10) -print\tPrint a table\n");
+    printf("10) -print\tPrint a table (-print all | head N | tail N | offset O limit L)\n");
     printf("11) -switch\tSwitch to a different database\n");
     printf("12) -list\tList the available databases\n");
     printf("13) -quit\tExit the program\n");
     printf("14) -save\tSave the database to a .csv file\n");
     printf("15) -load\tLoad a database from a .csv file\n");
+    printf("16) -bgsave\tSave the database to a .csv file in the background\n");
+    printf("17) -bgstatus\tShow the progress of a background save\n");
+    printf("18) -insert\tAppend a row, e.g. -insert 1 2.5 3.0 (null for a missing value)\n");
+    printf("19) -autoprint\tReprint rows around a change: on, off, or a number of rows\n");
+    printf("20) -bulkload\tAppend pasted or streamed rows, one per line, ending with a '.' line\n");
+    printf("21) -attach\tRegister a .csv, .scdb, .scdbm or Arrow file as a table, it's loaded the first time\n");
+    printf("\t\tyou -switch to it\n");
+    printf("22) -budget\tSet a memory budget (e.g. 512M, 0 for none), least recently used tables are evicted to disk\n");
+    printf("\t\tor kept compressed in memory with -budget 512M memory\n");
+    printf("23) -memstats\tShow memory used per table and eviction hit/miss counters\n");
+    printf("24) -stats\tShow operation counts and latencies (-stats reset|prom|on|off)\n");
+    printf("25) -metrics\tServe the stats for Prometheus on a port, e.g. -metrics 9100\n");
+    printf("26) -savebin\tSave the database to a compressed binary snapshot (<name>.scdb)\n");
+    printf("27) -loadbin\tLoad a database from a binary snapshot, e.g. -loadbin sales.scdb sales\n");
+    printf("28) -compressinfo\tShow how each column of the database compresses\n");
+    printf("29) -export\tStream rows to a .csv or .scdb file without copying the table,\n");
+    printf("\t\te.g. -export big.csv where price > 2.5 and id != 7 orderby price desc\n");
+    printf("30) -savestore\tSave to a block store (<name>.scdbm), later saves only write the blocks that changed\n");
+    printf("31) -loadstore\tLoad a database from a block store, e.g. -loadstore sales.scdbm sales\n");
+    printf("32) -agg\t\tcount, sum, avg, min or max of a column, e.g. -agg avg price where id > 10\n");
+    printf("\t\tor the average of a row with -agg rowavg 3. Results are cached until the data changes.\n");
+    printf("\t\t-agg sum price from sales works on another table, evicted ones are read compressed\n");
+    printf("33) -cachestats\tShow result cache hit rates (-cachestats clear | budget 64M)\n");
+    printf("34) -shard\tSplit the database over worker threads by a key column, e.g. -shard id 4\n");
+    printf("35) -sharded\tWork on a sharded table: -sharded sales insert 1 2.5 3 | update <key> <col> <value>\n");
+    printf("\t\t| delete <key> | agg avg price [where ...] | info\n");
+    printf("36) -unshard\tMerge a sharded table back into a normal database, e.g. -unshard sales.\n");
+    printf("\t\tRows come back grouped by shard, not in the order they were added\n");
+    printf("37) -replicate\tStream changes to replicas with -replicate listen 7000 (or unix:/tmp/scdb.sock),\n");
+    printf("\t\tfollow a primary with -replicate from 127.0.0.1:7000, see lag with -replicate status\n");
+    printf("\t\tand wait for a replica to catch up with -replicate wait [seconds]\n");
+    printf("38) -update\tSet a column from an expression over the row, e.g. -update total = price * int(qty) where id > 10\n");
+    printf("\t\tadd 'threads N' to pick the number of threads (1 runs it on this one)\n");
+    printf("39) -computed\tDefine a column evaluated when it's read, e.g. -computed total = price * qty,\n");
+    printf("\t\tremove one with -computed drop total and show them with -computed list\n");
+    printf("40) -materialize\tStore a computed column's values instead of its expression, e.g. -materialize total\n");
+    printf("41) -bloom\tKeep per block Bloom filters on a column so where col = x and where col in 1,5,9\n");
+    printf("\t\tskip the blocks without the value, e.g. -bloom id (-bloom drop id, -bloom list)\n");
+    printf("42) -sketch\tKeep distinct count and percentile sketches on a column with -sketch add price, then\n");
+    printf("\t\t-sketch price p50 p99 answers without a scan (-sketch drop price, -sketch list)\n");
+    printf("43) -view\tKeep a grouped rollup of this table up to date as a table of its own, e.g.\n");
+    printf("\t\t-view create bycat = count, sum price, avg price by cat (-view drop bycat, -view list)\n");
+    printf("44) -io\t\tShow or set how .csv files are read and written: -io uring|threads|sync,\n");
+    printf("\t\t-io direct on|off, -io depth 16 (reads or writes in flight), -io chunk 1MB\n");
+    printf("45) -memconfig\tShow or set where large table buffers live: -memconfig hugepages off|thp|hugetlb,\n");
+    printf("\t\t-memconfig numa default|interleave|local, -memconfig pin on|off (shard and update workers)\n");
+    printf("46) -savearrow\tSave the database as an Apache Arrow file (<name>.arrow), add 'stream' for the stream\n");
+    printf("\t\tformat, e.g. -savearrow sales.arrows stream\n");
+    printf("47) -loadarrow\tLoad a database from an Arrow file or stream, e.g. -loadarrow sales.arrow sales\n");
+    printf("\nArguments can be given on the same line, e.g. -newcol price double or -writecell 0 1 42\n");
+    printf("Run './main -f script.scdb' or pipe commands into stdin to run a script.\n");
     printf("\n");
 }
 
-void cmdPrintDB(DatabaseList* dbl, Database** currentDB, char* name) {
-    if (*currentDB)
-        printDatabase(*currentDB);
-    else 
+// Reads an optional inline count, returns -1 if it's missing or not a number
+static int readSizeArg(char** args, size_t* out) {
+
+    char buf[32];
+
+    if (!hasArg(*args) || readArg(args, NULL, buf, sizeof(buf)) < 0 || sscanf(buf, "%zu", out) != 1)
+        return -1;
+
+    return 0;
+}
+
+/* "-print" shows the first PRINT_PAGE_ROWS rows, or
+   -print all | head N | tail N | offset O [limit L] */
+void cmdPrintDB(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
         printf("No database selected, use -switch to switch to a Database or -new to create a new one.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    size_t offset = 0;
+    size_t limit = PRINT_PAGE_ROWS;
+    char mode[STRING_LEN] = "";
+
+    if (hasArg(args))
+        readArg(&args, NULL, mode, sizeof(mode));
+
+    if (strcmp(mode, "all") == 0) {
+        limit = db->numRows;
+    } else if (strcmp(mode, "head") == 0 || strcmp(mode, "tail") == 0) {
+        if (hasArg(args) && readSizeArg(&args, &limit) < 0) {
+            printf("Invalid row count.\n");
+            return;
+        }
+
+        if (mode[0] == 't')
+            offset = db->numRows > limit ? db->numRows - limit : 0;
+    } else if (strcmp(mode, "offset") == 0) {
+        char word[STRING_LEN] = "";
+
+        if (readSizeArg(&args, &offset) < 0 || (hasArg(args) && (readArg(&args, NULL, word, sizeof(word)) < 0
+            || strcmp(word, "limit") != 0 || readSizeArg(&args, &limit) < 0))) {
+            printf("Expected -print offset O [limit L].\n");
+            return;
+        }
+    } else if (mode[0] != '\0') {
+        printf("Unknown option '%s'. Use all, head N, tail N or offset O [limit L].\n", mode);
+        return;
+    }
+
+    printDatabaseRows(db, offset, limit);
+
+    if (mode[0] == '\0' && limit < db->numRows)
+        printf("Use -print all, -print tail N or -print offset O limit L to see more.\n");
 }
 
-void cmdPrintDBList(DatabaseList* dbl, Database** currentDB, char* name) {
+void cmdPrintDBList(DatabaseList* dbl, Database** currentDB, char* args) {
+
     printDatabaseList(dbl);
+
+    for (size_t i = 0; i < MAX_SHARDED_TABLES; i++) {
+        if (shardedTables[i])
+            printf("   %s (sharded %zu ways)\n", shardedTables[i]->name, shardedTables[i]->numShards);
+    }
 }
 
-void cmdCreateDB(DatabaseList* dbl, Database** currentDB, char* name) {
+void cmdCreateDB(DatabaseList* dbl, Database** currentDB, char* args) {
 
-    printf("Enter the name of the Database:\ndbName > ");
     char dbName[STRING_LEN];
 
-    if (fgets(dbName, sizeof(dbName), stdin) != NULL) {
-        dbName[strcspn(dbName, "\n")] = '\0';
-    }
+    readArg(&args, "Enter the name of the Database:\ndbName > ", dbName, sizeof(dbName));
 
     // Verify that a database with that name does not exist already
-    for (size_t index = 0; index < dbl->dbCount; index++) {
-        if (strcmp(dbName, dbl->dbList[index]->dbName) == 0) {
-            printf("Database with name %s already exists. Choose a new name.\n");
-            return;
-        }
+    if (findDatabaseInList(dbl, dbName)) {
+        printf("Database with name %s already exists. Choose a new name.\n", dbName);
+        return;
     }
 
     // If there's space in the database, add the new database
-    if (dbl->dbCount < dbl->dbLimit) {
+    if (!databaseListFull(dbl)) {
 
         Database* db = createDatabase(dbName);
-        addDatabaseToList(db, dbl);
 
-        if (db) {
+        if (addDatabaseToList(db, dbl)) {
             printf("Succesfully created Database: %s\n", dbName);
-            *currentDB = db;
+            selectDatabase(dbl, currentDB, db);
+        } else {
+            deleteDatabase(db);
         }
 
     } else {
@@ -148,15 +455,12 @@ void cmdCreateDB(DatabaseList* dbl, Database** currentDB, char* name) {
 }
 
 // Delete a database from the UI
-void cmdDeleteDB(DatabaseList* dbl, Database** currentDB, char* name) {
-
-    printf("Enter the name of the Database to delete:\ndbName > ");
+void cmdDeleteDB(DatabaseList* dbl, Database** currentDB, char* args) {
 
     char dbName[STRING_LEN];
 
-    if (fgets(dbName, sizeof(dbName), stdin) != NULL) {
-        dbName[strcspn(dbName, "\n ")] = '\0';
-    }
+    readArg(&args, "Enter the name of the Database to delete:\ndbName > ", dbName, sizeof(dbName));
+    dbName[strcspn(dbName, " ")] = '\0';
 
     if (*currentDB && strcmp(dbName, (*currentDB)->dbName) == 0)
         *currentDB = NULL;
@@ -165,60 +469,61 @@ void cmdDeleteDB(DatabaseList* dbl, Database** currentDB, char* name) {
 }
 
 // Switch to a different database
-void cmdSwitchDB(DatabaseList* dbl, Database** currentDB, char* name) {
+void cmdSwitchDB(DatabaseList* dbl, Database** currentDB, char* args) {
 
-    printf("Enter the name of the Database to switch to:\ndbName > ");
     char dbName[STRING_LEN];
 
-    if (fgets(dbName, sizeof(dbName), stdin) != NULL) {
-        dbName[strcspn(dbName, "\n")] = '\0';
-    }
+    readArg(&args, "Enter the name of the Database to switch to:\ndbName > ", dbName, sizeof(dbName));
+
+    DatabaseEntry* entry = findDatabaseInList(dbl, dbName);
 
-    int index = findDatabaseInList(dbl, dbName);
+    if (entry) {
+        // Tables registered with -attach or evicted under the memory budget are loaded here
+        Database* db = openDatabaseEntry(dbl, entry);
 
-    if (index >= 0) {
-        *currentDB = dbl->dbList[index];
+        if (!db)
+            return;
+
+        selectDatabase(dbl, currentDB, db);
         printf("Successfully switched to: %s\n", dbName);
     } else {
         printf("Could not find Database %s\n", dbName);
     }
 }
 
-void cmdNewCol(DatabaseList* dbl, Database** currentDB, char* name) {
-    char colName[STRING_LEN];
-    printf("Enter the name of the column: > ");
+void cmdNewCol(DatabaseList* dbl, Database** currentDB, char* args) {
 
-    if (fgets(colName, sizeof(colName), stdin) != NULL) {
-        colName[strcspn(colName, "\n")] = '\0';
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
     }
 
-    printf("Enter the type of data: (int, float, double) > ");
+    char colName[STRING_LEN];
+    readArg(&args, "Enter the name of the column: > ", colName, sizeof(colName));
 
     char type[STRING_LEN];
     DataTypes colType;
 
-    if (fgets(type, sizeof(type), stdin) != NULL) {
-        type[strcspn(type, "\n")] = '\0';
-    }
+    readArg(&args, "Enter the type of data: (int, float, double) > ", type, sizeof(type));
 
-    if (strcmp(type, "int") == 0)
-        colType = INT_TYPE;
-    else if (strcmp(type, "float") == 0)
-        colType = FLOAT_TYPE;
-    else if (strcmp(type, "double") == 0)
-        colType = DOUBLE_TYPE;
-    else {
+    if (findDataType(type, &colType) < 0) {
         printf("Invalid column type entered.\n");
         return;
     }
+
+    if (findComputedColumn(*currentDB, colName) >= 0) {
+        printf("%s is a computed column. Use -materialize %s to store it.\n", colName, colName);
+        return;
+    }
     // Add a new column
     createColumn(*currentDB, colName, colType);
     printf("Column %s successfully created\n", colName);
 
-    printDatabase(*currentDB);
+    autoPrintDatabase(*currentDB, 0);
 }
 
-void cmdNewRow(DatabaseList* dbl, Database** currentDB, char* name) {
+// Creates one row, or as many as given inline (e.g. "-newrow 1000")
+void cmdNewRow(DatabaseList* dbl, Database** currentDB, char* args) {
 
     // Ensure the user is operating on an existing database
     if (!currentDB || !*currentDB) {
@@ -226,15 +531,32 @@ void cmdNewRow(DatabaseList* dbl, Database** currentDB, char* name) {
         return;
     }
 
+    size_t count = 1;
+    char countBuf[32];
+
+    if (args && *(args + strspn(args, " \t")) != '\0') {
+        readArg(&args, NULL, countBuf, sizeof(countBuf));
+
+        if (sscanf(countBuf, "%zu", &count) != 1 || count == 0) {
+            printf("Invalid row count.\n");
+            return;
+        }
+    }
+
     // Ensure the Database has columns
     if ((*currentDB)->cols && (*currentDB)->numCols > 0) {
-        createRow(*currentDB);
-        printf("New row for %s successfully created.\n", (*currentDB)->dbName);
+        for (size_t i = 0; i < count; i++)
+            createRow(*currentDB);
+
+        if (count == 1)
+            printf("New row for %s successfully created.\n", (*currentDB)->dbName);
+        else
+            printf("%zu new rows for %s successfully created.\n", count, (*currentDB)->dbName);
 
-        printDatabase(*currentDB);
+        autoPrintDatabase(*currentDB, (*currentDB)->numRows - 1);
 
     } else {
-        printf("Rows for database %s cannot be added until it has columns\nUse -newcol to add a column.\n", 
+        printf("Rows for database %s cannot be added until it has columns\nUse -newcol to add a column.\n",
             (*currentDB)->dbName);
         return;
 
@@ -242,7 +564,7 @@ void cmdNewRow(DatabaseList* dbl, Database** currentDB, char* name) {
 }
 
 // Write data to a cell in a database
-void cmdWriteCell(DatabaseList* dbl, Database** currentDB, char* name) {
+void cmdWriteCell(DatabaseList* dbl, Database** currentDB, char* args) {
 
     // Check if there is a valid Database to write to
     if (!*currentDB || !dbl) {
@@ -257,23 +579,28 @@ void cmdWriteCell(DatabaseList* dbl, Database** currentDB, char* name) {
         return;
     }
 
-    printf("Available table indices: (%d, %d)\n", (*currentDB)->numRows-1, (*currentDB)->numCols-1);
-    // 1) ask the user which cell they want to write to
-    printf("Enter the table index to enter a value to: ");
-
-    char input[100];
+    if (interactiveMode && !*(args + strspn(args, " \t")))
+        printf("Available table indices: (%zu, %zu)\n", (*currentDB)->numRows-1, (*currentDB)->numCols-1);
 
     size_t rowValue;
     size_t colValue;
 
-    if (fgets(input, sizeof(input), stdin) == NULL) {
+    // 1) ask the user which cell they want to write to
+    char rowBuf[32];
+    char colBuf[32];
+
+    if (readArg(&args, "Enter the table index to enter a value to: ", rowBuf, sizeof(rowBuf)) < 0) {
         printf("Input error.\n");
         return;
     }
 
-    if (sscanf(input, "%zu %zu", &rowValue, &colValue) != 2) {
-        printf("Invalid input.\n");
-        return;
+    // The prompted form takes "row col" on one line
+    if (sscanf(rowBuf, "%zu %zu", &rowValue, &colValue) != 2) {
+        if (sscanf(rowBuf, "%zu", &rowValue) != 1 || readArg(&args, NULL, colBuf, sizeof(colBuf)) < 0
+            || sscanf(colBuf, "%zu", &colValue) != 1) {
+            printf("Invalid input.\n");
+            return;
+        }
     }
 
     if ((rowValue >= (*currentDB)->numRows) || (colValue >= (*currentDB)->numCols)) {
@@ -281,68 +608,242 @@ void cmdWriteCell(DatabaseList* dbl, Database** currentDB, char* name) {
         return;
     }
 
-    switch ((*currentDB)->cols[colValue].type) {
+    char prompt[100];
 
-        case INT_TYPE :
-            printf("Index (%zu, %zu) has type INT. Enter an integer: ", rowValue, colValue);
+    snprintf(prompt, sizeof(prompt), "Index (%zu, %zu) has type %s. Enter a value: ", rowValue, colValue,
+        data_types[(*currentDB)->cols[colValue].type]);
 
-            if (safeReadInt(*currentDB, rowValue, colValue) < 0) {
-                printf("Error adding value to cell.\n");
-                return;
-            }
-            break;
+    if (safeReadValue(*currentDB, rowValue, colValue, &args, prompt) < 0) {
+        printf("Error adding value to cell.\n");
+        return;
+    }
+
+    autoPrintDatabase(*currentDB, rowValue);
+}
 
-        case FLOAT_TYPE :
-            printf("Index (%zu, %zu) has type FLOAT. Enter a float: ", rowValue, colValue);
+// Append a row with every value given inline, e.g. "-insert 1 null 3.0"
+// All values are parsed before the row is created so a bad value leaves the table untouched
+void cmdInsertRow(DatabaseList* dbl, Database** currentDB, char* args) {
 
-            if (safeReadFloat(*currentDB, rowValue, colValue) < 0) {
-                printf("Error adding value to cell.\n");
-                return;
-            }
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+
+    if (!db->numCols) {
+        printf("Rows for database %s cannot be added until it has columns\nUse -newcol to add a column.\n", db->dbName);
+        return;
+    }
+
+    DataValues* values = malloc(db->numCols * sizeof(DataValues));
+    const uint64_t** validity = calloc(db->numCols, sizeof(uint64_t*));
+
+    if (!values || !validity) {
+        fprintf(stderr, "malloc returned NULL pointer for insert values\n");
+        exit(1);
+    }
+
+    // A one row bitmap with its bit clear, for the columns given "null"
+    static const uint64_t nullBit = 0;
+    char valBuf[64];
+
+    for (size_t col = 0; col < db->numCols; col++) {
+
+        if (readArg(&args, NULL, valBuf, sizeof(valBuf)) < 0 || valBuf[0] == '\0') {
+            printf("Expected %zu values, got %zu.\n", db->numCols, col);
+            free(values);
+            free(validity);
+            return;
+        }
+
+        if (isNullText(valBuf)) {
+            values[col] = (DataValues){0};
+            validity[col] = &nullBit;
+            continue;
+        }
+
+        if (typeOps(db->cols[col].type)->parse(valBuf, &values[col]) < 0) {
+            printf("Invalid %s value '%s' for column %s.\n", data_types[db->cols[col].type], valBuf, db->cols[col].colName);
+            free(values);
+            free(validity);
+            return;
+        }
+    }
+
+    // One row batch, so the new row is reported to observers with its values
+    BulkBatch batch = {ROW_MAJOR, 1, db->numCols, NULL, values, NULL, validity};
+    appendRows(db, &batch);
+
+    free(values);
+    free(validity);
+
+    autoPrintDatabase(db, db->numRows - 1);
+}
+
+// Append rows read from stdin, one row of comma or space separated values per line,
+// until a line with just "." or the end of input. Rows go in through appendRows in batches.
+// "null" stands for a NULL value
+void cmdBulkLoad(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+
+    if (!db->numCols) {
+        printf("Rows for database %s cannot be added until it has columns\nUse -newcol to add a column.\n", db->dbName);
+        return;
+    }
+
+    if (interactiveMode)
+        printf("Enter rows of %zu values, finish with a line containing only '.'\n", db->numCols);
+
+    DataValues* values = malloc(CSV_BATCH_ROWS * db->numCols * sizeof(DataValues));
+    uint64_t* validity = calloc(db->numCols * VALIDITY_WORDS(CSV_BATCH_ROWS), sizeof(uint64_t));
+    const uint64_t** nullableCols = calloc(db->numCols, sizeof(uint64_t*));
+
+    if (!values || !validity || !nullableCols) {
+        fprintf(stderr, "malloc returned NULL pointer for bulk load batch\n");
+        exit(1);
+    }
+
+    BulkBatch batch = {ROW_MAJOR, 0, db->numCols, NULL, values, NULL, nullableCols};
+
+    char line[LINE_LEN];
+    size_t lineNumber = 0;
+    size_t loaded = 0;
+    size_t rejected = 0;
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+
+        line[strcspn(line, "\r\n")] = '\0';
+        lineNumber++;
+
+        if (strcmp(line, ".") == 0)
             break;
 
-        case DOUBLE_TYPE :
-            printf("Index (%zu, %zu) has type DOUBLE. Enter a double: ", rowValue, colValue);
+        if (line[0] == '\0')
+            continue;
 
-            if (safeReadDouble(*currentDB, rowValue, colValue) < 0) {
-                printf("Error adding value to cell.\n");
-                return;
+        DataValues* row = values + batch.numRows * db->numCols;
+        char* save;
+        char* token = strtok_r(line, ", \t", &save);
+        size_t col = 0;
+
+        for (; token && col < db->numCols; col++) {
+
+            uint64_t* bits = validity + col * VALIDITY_WORDS(CSV_BATCH_ROWS);
+            uint64_t mask = 1ull << (batch.numRows % 64);
+
+            if (isNullText(token)) {
+                row[col] = (DataValues){0};
+                bits[batch.numRows / 64] &= ~mask;
+            } else if (typeOps(db->cols[col].type)->parse(token, &row[col]) < 0) {
+                break;
+            } else {
+                bits[batch.numRows / 64] |= mask;
             }
-            break;
-        
-        default :
-            fprintf(stderr, "Index (%zu, %zu) has unrecognized type.\n", rowValue, colValue);
-            
+
+            token = strtok_r(NULL, ", \t", &save);
+        }
+
+        if (col != db->numCols || token) {
+            fprintf(stderr, "line %zu: expected %zu valid values, row skipped\n", lineNumber, db->numCols);
+            rejected++;
+            continue;
+        }
+
+        // Only the columns that got a NULL go in with a bitmap
+        for (col = 0; col < db->numCols; col++) {
+            const uint64_t* bits = validity + col * VALIDITY_WORDS(CSV_BATCH_ROWS);
+            if (!(bits[batch.numRows / 64] >> (batch.numRows % 64) & 1))
+                nullableCols[col] = bits;
+        }
+
+        loaded++;
+
+        if (++batch.numRows == CSV_BATCH_ROWS) {
+            appendRows(db, &batch);
+            batch.numRows = 0;
+            memset(nullableCols, 0, db->numCols * sizeof(uint64_t*));
+        }
+    }
+
+    if (batch.numRows)
+        appendRows(db, &batch);
+
+    free(values);
+    free(validity);
+    free(nullableCols);
+
+    printf("Loaded %zu rows into %s", loaded, db->dbName);
+    if (rejected)
+        printf(", %zu rows skipped", rejected);
+    printf(".\n");
+}
+
+// Turn reprinting the table after -newcol/-newrow/-writecell/-insert on or off
+// "-autoprint on|off|N", N is the number of rows shown around the changed row
+void cmdAutoPrint(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char setting[STRING_LEN];
+    size_t rows;
+
+    readArg(&args, "Reprint the table after changes? (on, off, or a number of rows) > ", setting, sizeof(setting));
+
+    if (strcmp(setting, "on") == 0)
+        autoPrintRows = AUTO_PRINT_ROWS;
+    else if (strcmp(setting, "off") == 0)
+        autoPrintRows = 0;
+    else if (sscanf(setting, "%zu", &rows) == 1)
+        autoPrintRows = rows;
+    else {
+        printf("Expected 'on', 'off' or a number of rows.\n");
+        return;
     }
 
-    printDatabase(*currentDB);
+    if (autoPrintRows)
+        printf("Auto print is on, showing %zu rows.\n", autoPrintRows);
+    else
+        printf("Auto print is off.\n");
 }
 
 // Delete a specified row (user specifies by index)
-void cmdDeleteRow(DatabaseList* dbl, Database** currentDB, char* name) {
+void cmdDeleteRow(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
 
     if (!(*currentDB)->rows) {
         printf("Database '%s' has no rows to delete.\n", (*currentDB)->dbName);
         return;
     }
 
-    printf("Database '%s' has row indices (0-%zu) available.\n", (*currentDB)->dbName, (*currentDB)->numRows - 1);
-    printf("Enter the index of the row to delete > ");
+    if (interactiveMode && !*(args + strspn(args, " \t")))
+        printf("Database '%s' has row indices (0-%zu) available.\n", (*currentDB)->dbName, (*currentDB)->numRows - 1);
 
-    size_t index = safeReadSize();
+    size_t index = safeReadSize(&args, "Enter the index of the row to delete > ");
     deleteRow(*currentDB, index);
 }
 
 // Delete a specified column (user specifies by index)
-void cmdDeleteCol(DatabaseList* dbl, Database** currentDB, char* name) {
-    
-    printf("Enter the name of the column to delete > ");
-    char colName[STRING_LEN];
+void cmdDeleteCol(DatabaseList* dbl, Database** currentDB, char* args) {
 
-    if (fgets(colName, sizeof(colName), stdin) != NULL) {
-        colName[strcspn(colName, "\n")] = '\0';
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
     }
 
+    char colName[STRING_LEN];
+
+    readArg(&args, "Enter the name of the column to delete > ", colName, sizeof(colName));
+
     int found = 0;
     size_t index = 0;
     // search for the column
@@ -370,134 +871,131 @@ void cmdDeleteCol(DatabaseList* dbl, Database** currentDB, char* name) {
     }
 }
 
-size_t safeReadSize() {
+size_t safeReadSize(char** args, const char* prompt) {
 
-    char indexBuf[16];
+    char indexBuf[32];
     size_t index;
 
-    if (fgets(indexBuf, sizeof(indexBuf), stdin) == NULL) {
+    if (readArg(args, prompt, indexBuf, sizeof(indexBuf)) < 0) {
         fprintf(stderr, "Input error.\n");
         return __SIZE_MAX__;
     }
 
     if (sscanf(indexBuf, "%zu", &index) != 1) {
         fprintf(stderr, "Invlaid input.\n");
-        return __SIZE_MAX__; 
+        return __SIZE_MAX__;
     }
 
     return index;
 }
-// Safely read an integer value from stdin
-int safeReadInt(Database* currentDB, size_t rowValue, size_t colValue) {
-    int tableValue;
-    char valBuf[16];
-
-    if (fgets(valBuf, sizeof(valBuf), stdin) == NULL) {
-        fprintf(stderr, "Input error.\n");
-        return -1;
-    }
-
-    if (sscanf(valBuf, "%d", &tableValue) != 1) {
-        fprintf(stderr, "Invalid input.\n");
-        return -1;
-    }
-
-    if (addInt(currentDB, rowValue, colValue, tableValue) < 0){
-        return -1;
-    }
-
-    return 0;
-}
+// Safely read a value of the cell's column type from the inline arguments or stdin and write it
+int safeReadValue(Database* currentDB, size_t rowValue, size_t colValue, char** args, const char* prompt) {
 
-// Safely read a float value from stdin
-int safeReadFloat(Database* currentDB, size_t rowValue, size_t colValue) {
+    DataTypes type = currentDB->cols[colValue].type;
+    DataValues tableValue;
+    char valBuf[64];
 
-    float tableValue;
-    char valBuf[16];
-
-    if (fgets(valBuf, sizeof(valBuf), stdin) == NULL) {
+    if (readArg(args, prompt, valBuf, sizeof(valBuf)) < 0) {
         printf("Input error.\n");
         return -1;
     }
 
-    if (sscanf(valBuf, "%f", &tableValue) != 1) {
-        printf("Invalid input.\n");
-        return -1;
-    }
-
-    if (addFloat(currentDB, rowValue, colValue, tableValue) < 0){
-        return -1;
-    }
-
-    return 0;
-}
-
-// Safely read a double value from stdin
-int safeReadDouble(Database* currentDB, size_t rowValue, size_t colValue) {
-
-    double tableValue;
-    char valBuf[16];
-
-    if (fgets(valBuf, sizeof(valBuf), stdin) == NULL) {
-        printf("Input error.\n");
-        return -1;
-    }
+    if (isNullText(valBuf))
+        return setCellNull(currentDB, rowValue, colValue) < 0 ? -1 : 0;
 
-    if (sscanf(valBuf, "%lf", &tableValue) != 1) {
+    if (typeOps(type)->parse(valBuf, &tableValue) < 0) {
         printf("Invalid input.\n");
         return -1;
     }
 
-    if (addDouble(currentDB, rowValue, colValue, tableValue) < 0){
+    if (writeCell(currentDB, rowValue, colValue, type, tableValue) < 0)
         return -1;
-    }
 
     return 0;
 }
 
-void cmdSaveDbToFile(DatabaseList* dbl, Database** currentDB, char* name) {
-
-    printf("Saving %s to a .csv file...\n", (*currentDB)->dbName);
+// Builds "<dbName>.csv", caller frees the result
+static char* csvFileName(Database* db) {
 
     // Create a duplicate string to add the extension (if it doesnt have it)
     const char* csv = ".csv";
 
-    size_t newSize = strlen((*currentDB)->dbName) + strlen(csv) + 1;
+    size_t newSize = strlen(db->dbName) + strlen(csv) + 1;
 
     char* fileName = malloc(newSize);
 
     if (!fileName) {
         fprintf(stderr, "Failed to allocate memory for filename\n");
-        return;
+        return NULL;
     }
 
-    strcpy(fileName, (*currentDB)->dbName);
+    strcpy(fileName, db->dbName);
 
     strcat(fileName, csv);
 
-    saveDatabaseToCSV(*currentDB, fileName);
-
-    free(fileName);
+    return fileName;
 }
 
-void cmdLoadDbFromFile(DatabaseList* dbl, Database** currentDB, char* name) {
-    
-    char csvName[STRING_LEN];
-
-    printf("Enter the name of the .csv file to load > ");
+void cmdSaveDbToFile(DatabaseList* dbl, Database** currentDB, char* args) {
 
-    if (fgets(csvName, sizeof(csvName), stdin) != NULL) {
-        csvName[strcspn(csvName, "\n")] = '\0';
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
     }
 
-    if (dbl->dbCount < dbl->dbLimit) {
+    printf("Saving %s to a .csv file...\n", (*currentDB)->dbName);
 
-        Database* db = loadDatabaseFromCSV(csvName);
+    char* fileName = csvFileName(*currentDB);
 
-        if (db) {
-            printf("Succesfully loaded Database: %s\n", csvName);
-            addDatabaseToList(db, dbl);
-            *currentDB = db;
+    if (!fileName)
+        return;
+
+    saveDatabaseToCSV(*currentDB, fileName);
+
+    free(fileName);
+}
+
+// Save in a forked child so the prompt stays responsive while large tables are written
+void cmdBgSaveDbToFile(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    char* fileName = csvFileName(*currentDB);
+
+    if (!fileName)
+        return;
+
+    startBackgroundSave(*currentDB, fileName);
+
+    free(fileName);
+}
+
+void cmdBgSaveStatus(DatabaseList* dbl, Database** currentDB, char* args) {
+    printBackgroundSaveStatus();
+}
+
+void cmdLoadDbFromFile(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char csvName[STRING_LEN];
+
+    readArg(&args, "Enter the name of the .csv file to load > ", csvName, sizeof(csvName));
+
+    if (findDatabaseInList(dbl, csvName)) {
+        printf("Database with name %s already exists. Delete it or use -switch.\n", csvName);
+        return;
+    }
+
+    if (!databaseListFull(dbl)) {
+
+        Database* db = loadDatabaseFromCSV(csvName);
+
+        if (db) {
+            printf("Succesfully loaded Database: %s\n", csvName);
+            addDatabaseToList(db, dbl);
+            selectDatabase(dbl, currentDB, db);
         } else {
             printf("Unable to load: %s. File does not exist.\n", csvName);
             return;
@@ -511,23 +1009,1569 @@ void cmdLoadDbFromFile(DatabaseList* dbl, Database** currentDB, char* name) {
         return;
 }
 
+// Register a file as a table without reading it, it's loaded on the first -switch to it.
+// .csv files, binary snapshots, block stores and Arrow files are told apart by their first bytes
+void cmdAttachDbFile(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char fileName[FILE_NAME_LEN];
+    char dbName[STRING_LEN];
+
+    readArg(&args, "Enter the name of the file to attach > ", fileName, sizeof(fileName));
+
+    // The table is named after the file unless a name is given inline
+    if (!hasArg(args) || readArg(&args, NULL, dbName, sizeof(dbName)) < 0 || dbName[0] == '\0') {
+        strncpy(dbName, fileName, STRING_LEN);
+        dbName[STRING_LEN - 1] = '\0';
+    }
+
+    FILE* file = fopen(fileName, "r");
+
+    if (!file) {
+        printf("Unable to attach: %s. File does not exist.\n", fileName);
+        return;
+    }
+
+    fclose(file);
+
+    registerDatabaseFile(dbl, dbName, fileName);
+}
+
 // Allows user to change a column name
-void cmdChangeColName(DatabaseList* dbl, Database** currentDB, char* name) {
+void cmdChangeColName(DatabaseList* dbl, Database** currentDB, char* args) {
 
-    // Get the column to 
-    printf("Enter the column name to change > ");
+    // Get the column to
     char inputBuffer[STRING_LEN];
 
-    if (fgets(inputBuffer, sizeof(inputBuffer), stdin) != NULL) {
-        inputBuffer[strcspn(inputBuffer, "\n ")] = '\0';
-    }
+    readArg(&args, "Enter the column name to change > ", inputBuffer, sizeof(inputBuffer));
+    inputBuffer[strcspn(inputBuffer, " ")] = '\0';
 
     char newName[STRING_LEN];
-    printf("Enter the new name > ");
 
-    if (fgets(newName, sizeof(newName), stdin) != NULL) {
-        newName[strcspn(newName, "\n")] = '\0';
-    }
+    readArg(&args, "Enter the new name > ", newName, sizeof(newName));
 
     changeColumnName(*currentDB, newName, inputBuffer);
-}
\ No newline at end of file
+}
+
+// Parses a byte count with an optional K/M/G suffix, returns -1 if it isn't one
+static int parseByteSize(const char* text, unsigned long long* bytes) {
+
+    char* endPtr;
+
+    *bytes = strtoull(text, &endPtr, 10);
+
+    if (endPtr == text)
+        return -1;
+
+    switch (*endPtr) {
+        case 'G' : case 'g' : *bytes <<= 10; /* fall through */
+        case 'M' : case 'm' : *bytes <<= 10; /* fall through */
+        case 'K' : case 'k' : *bytes <<= 10; endPtr++; break;
+        default : break;
+    }
+
+    return *endPtr == '\0' ? 0 : -1;
+}
+
+// Set the memory budget for resident tables, accepts K/M/G suffixes
+void cmdMemoryBudget(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char sizeBuf[STRING_LEN];
+
+    readArg(&args, "Enter the memory budget (e.g. 512M, 0 for unlimited) > ", sizeBuf, sizeof(sizeBuf));
+
+    unsigned long long budget;
+
+    if (parseByteSize(sizeBuf, &budget) < 0) {
+        printf("Invalid memory budget.\n");
+        return;
+    }
+
+    // Optional eviction target, disk (spill files) or memory (compressed images)
+    if (hasArg(args)) {
+
+        char target[STRING_LEN];
+
+        readArg(&args, NULL, target, sizeof(target));
+
+        if (strcmp(target, "memory") == 0 || strcmp(target, "disk") == 0) {
+            dbl->evictToMemory = strcmp(target, "memory") == 0;
+        } else {
+            printf("Unknown eviction target '%s'. Use disk or memory.\n", target);
+            return;
+        }
+    }
+
+    setMemoryBudget(dbl, budget);
+
+    if (budget)
+        printf("Memory budget set to %llu bytes, evicting to %s.\n", budget, dbl->evictToMemory ? "memory" : "disk");
+    else
+        printf("Memory budget removed.\n");
+}
+
+void cmdMemoryStats(DatabaseList* dbl, Database** currentDB, char* args) {
+    printMemoryStats(dbl);
+}
+
+// Show the operation counters and latency histograms
+// "-stats reset" clears them, "-stats prom" prints the Prometheus format, "-stats on|off" toggles recording
+void cmdStats(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char option[STRING_LEN] = "";
+
+    if (hasArg(args))
+        readArg(&args, NULL, option, sizeof(option));
+
+    if (option[0] == '\0') {
+        printStats(stdout);
+
+        // Bytes held by each resident table
+        printf("\n");
+        for (DatabaseEntry* entry = dbl->first; entry; entry = entry->next) {
+            if (entry->db)
+                printf("%-24s %12zu bytes, %zu rows\n", entry->dbName, databaseMemoryUsage(entry->db), entry->db->numRows);
+        }
+    } else if (strcmp(option, "reset") == 0) {
+        statsReset();
+        printf("Stats reset.\n");
+    } else if (strcmp(option, "prom") == 0) {
+        statsWritePrometheus(stdout);
+    } else if (strcmp(option, "on") == 0 || strcmp(option, "off") == 0) {
+        statsEnabled = strcmp(option, "on") == 0;
+        printf("Stats recording is %s.\n", option);
+    } else {
+        printf("Unknown option '%s'. Use reset, prom, on or off.\n", option);
+    }
+}
+
+void cmdMetricsServer(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char portBuf[STRING_LEN];
+
+    readArg(&args, "Enter the port to serve metrics on > ", portBuf, sizeof(portBuf));
+
+    int port = atoi(portBuf);
+
+    if (port <= 0 || port > 65535) {
+        printf("Invalid port.\n");
+        return;
+    }
+
+    if (startMetricsServer(port) == 0)
+        printf("Serving Prometheus metrics on port %d.\n", port);
+}
+
+// Save to a compressed binary snapshot, named after the table unless a file is given inline
+void cmdSaveDbToBinary(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    char fileName[FILE_NAME_LEN];
+
+    if (hasArg(args))
+        readArg(&args, NULL, fileName, sizeof(fileName));
+    else
+        snprintf(fileName, sizeof(fileName), "%s.scdb", (*currentDB)->dbName);
+
+    if (saveDatabaseToBinary(*currentDB, fileName) == 0)
+        printf("Saved %s to %s.\n", (*currentDB)->dbName, fileName);
+}
+
+void cmdLoadDbFromBinary(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char fileName[FILE_NAME_LEN];
+    char dbName[STRING_LEN];
+
+    readArg(&args, "Enter the name of the snapshot file to load > ", fileName, sizeof(fileName));
+
+    // The table is named after the file unless a name is given inline
+    if (!hasArg(args) || readArg(&args, NULL, dbName, sizeof(dbName)) < 0 || dbName[0] == '\0') {
+        strncpy(dbName, fileName, STRING_LEN);
+        dbName[STRING_LEN - 1] = '\0';
+    }
+
+    if (findDatabaseInList(dbl, dbName)) {
+        printf("Database with name %s already exists. Delete it or use -switch.\n", dbName);
+        return;
+    }
+
+    if (databaseListFull(dbl)) {
+        printf("Unable to load DB. Delete a database and try again.\n");
+        return;
+    }
+
+    Database* db = loadDatabaseFromBinary(fileName, dbName);
+
+    if (!db) {
+        printf("Unable to load: %s.\n", fileName);
+        return;
+    }
+
+    printf("Succesfully loaded Database: %s\n", dbName);
+    addDatabaseToList(db, dbl);
+    selectDatabase(dbl, currentDB, db);
+}
+
+// "-savearrow [file] [stream]" writes the current table in the Arrow file format, or the stream format
+void cmdSaveDbToArrow(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    char fileName[FILE_NAME_LEN];
+    char format[STRING_LEN] = "";
+
+    if (hasArg(args))
+        readArg(&args, NULL, fileName, sizeof(fileName));
+    else
+        snprintf(fileName, sizeof(fileName), "%s.arrow", (*currentDB)->dbName);
+
+    if (hasArg(args))
+        readArg(&args, NULL, format, sizeof(format));
+
+    if (format[0] != '\0' && strcmp(format, "stream") != 0 && strcmp(format, "file") != 0) {
+        printf("Unknown format '%s'. Use file or stream.\n", format);
+        return;
+    }
+
+    ArrowFormat arrowFormat = strcmp(format, "stream") == 0 ? ARROW_STREAM : ARROW_FILE;
+
+    if (saveDatabaseToArrow(*currentDB, fileName, arrowFormat) == 0)
+        printf("Saved %s to %s.\n", (*currentDB)->dbName, fileName);
+}
+
+void cmdLoadDbFromArrow(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char fileName[FILE_NAME_LEN];
+    char dbName[STRING_LEN];
+
+    readArg(&args, "Enter the name of the Arrow file to load > ", fileName, sizeof(fileName));
+
+    // The table is named after the file unless a name is given inline
+    if (!hasArg(args) || readArg(&args, NULL, dbName, sizeof(dbName)) < 0 || dbName[0] == '\0') {
+        strncpy(dbName, fileName, STRING_LEN);
+        dbName[STRING_LEN - 1] = '\0';
+    }
+
+    if (findDatabaseInList(dbl, dbName)) {
+        printf("Database with name %s already exists. Delete it or use -switch.\n", dbName);
+        return;
+    }
+
+    if (databaseListFull(dbl)) {
+        printf("Unable to load DB. Delete a database and try again.\n");
+        return;
+    }
+
+    Database* db = loadDatabaseFromArrow(fileName, dbName);
+
+    if (!db) {
+        printf("Unable to load: %s.\n", fileName);
+        return;
+    }
+
+    printf("Succesfully loaded Database: %s\n", dbName);
+    addDatabaseToList(db, dbl);
+    selectDatabase(dbl, currentDB, db);
+}
+
+void cmdCompressInfo(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    printCompressionInfo(*currentDB);
+}
+
+// Reads the "<column> <op> <value>" after a where/and into preds[*numPreds], returns -1 after printing what's wrong
+static int readPredicateArgs(Database* db, char** args, const char* word, Predicate* preds, size_t* numPreds) {
+
+    // Room for an in list, e.g. "in 1,5,9"
+    char colName[STRING_LEN], op[STRING_LEN], value[MAX_IN_VALUES * 32];
+
+    if (!hasArg(*args) || readArg(args, NULL, colName, sizeof(colName)) < 0 || !hasArg(*args)
+        || readArg(args, NULL, op, sizeof(op)) < 0 || !hasArg(*args)
+        || readArg(args, NULL, value, sizeof(value)) < 0) {
+        printf("Expected '%s <column> <op> <value>'.\n", word);
+        return -1;
+    }
+
+    if (*numPreds == MAX_PREDICATES) {
+        printf("At most %d conditions are supported.\n", MAX_PREDICATES);
+        return -1;
+    }
+
+    switch (parsePredicate(db, colName, op, value, &preds[*numPreds])) {
+        case -1 : printf("Column: '%s' not found.\n", colName); return -1;
+        case -2 : printf("Unknown operator '%s'. Use = != < <= > >= in.\n", op); return -1;
+        case -3 : printf("Invalid value '%s' for column %s. NULLs are matched with = null or != null,\n"
+            "in takes up to %d values separated by commas.\n", value, colName, MAX_IN_VALUES); return -1;
+        default : (*numPreds)++;
+    }
+
+    return 0;
+}
+
+/* Export the rows matching a filter, optionally sorted, straight from the table:
+   -export <file> [where <col> <op> <value> [and ...]] [orderby <col> [asc|desc]]
+   Files ending in .scdb are written as binary snapshots, anything else as .csv */
+void cmdExport(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    char fileName[FILE_NAME_LEN];
+    char word[STRING_LEN];
+    Predicate preds[MAX_PREDICATES];
+    size_t numPreds = 0;
+    int orderCol = -1;
+    int descending = 0;
+
+    readArg(&args, "Enter the file to export to > ", fileName, sizeof(fileName));
+
+    while (hasArg(args)) {
+
+        readArg(&args, NULL, word, sizeof(word));
+
+        if (strcmp(word, "where") == 0 || strcmp(word, "and") == 0) {
+            if (readPredicateArgs(db, &args, word, preds, &numPreds) < 0)
+                return;
+        } else if (strcmp(word, "orderby") == 0) {
+
+            if (!hasArg(args) || readArg(&args, NULL, word, sizeof(word)) < 0 || (orderCol = findAnyColumn(db, word)) < 0) {
+                printf("Expected 'orderby <column>'.\n");
+                return;
+            }
+        } else if (strcmp(word, "desc") == 0 || strcmp(word, "asc") == 0) {
+            descending = strcmp(word, "desc") == 0;
+        } else {
+            printf("Unexpected '%s'. Use where, and, orderby.\n", word);
+            return;
+        }
+    }
+
+    size_t nameLen = strlen(fileName);
+    int binary = nameLen > 5 && strcmp(fileName + nameLen - 5, ".scdb") == 0;
+    FILE* file = fopen(fileName, binary ? "wb" : "w");
+
+    if (!file) {
+        printf("Unable to create file: %s\n", fileName);
+        return;
+    }
+
+    Cursor* cursor = openCursor(db, preds, numPreds);
+
+    if (orderCol >= 0)
+        cursorOrderBy(cursor, orderCol, descending);
+
+    long rows;
+
+    if (binary)
+        rows = writeCursorSnapshot(cursor, file) < 0 ? -1 : (long)cursorCount(cursor);
+    else
+        rows = exportCursorToCSV(cursor, file);
+
+    closeCursor(cursor);
+
+    if ((fclose(file) != 0) | (rows < 0))
+        printf("Error writing file: %s\n", fileName);
+    else
+        printf("Exported %ld rows from %s to %s.\n", rows, db->dbName, fileName);
+}
+
+// Incremental save, only blocks changed since the last -savestore to the same file are written
+void cmdSaveDbToStore(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    char fileName[FILE_NAME_LEN];
+    StoreSaveInfo info;
+
+    if (hasArg(args))
+        readArg(&args, NULL, fileName, sizeof(fileName));
+    else
+        snprintf(fileName, sizeof(fileName), "%s.scdbm", (*currentDB)->dbName);
+
+    if (saveDatabaseToStore(*currentDB, fileName, &info) < 0) {
+        printf("Unable to save %s.\n", (*currentDB)->dbName);
+        return;
+    }
+
+    printf("Saved %s to %s: %zu of %zu blocks written (%zu bytes)%s.\n", (*currentDB)->dbName, fileName,
+        info.blocksWritten, info.blocksTotal, info.bytesWritten, info.fullRewrite ? ", full rewrite" : "");
+}
+
+void cmdLoadDbFromStore(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char fileName[FILE_NAME_LEN];
+    char dbName[STRING_LEN];
+
+    readArg(&args, "Enter the name of the block store to load > ", fileName, sizeof(fileName));
+
+    // The table is named after the file unless a name is given inline
+    if (!hasArg(args) || readArg(&args, NULL, dbName, sizeof(dbName)) < 0 || dbName[0] == '\0') {
+        strncpy(dbName, fileName, STRING_LEN);
+        dbName[STRING_LEN - 1] = '\0';
+    }
+
+    if (findDatabaseInList(dbl, dbName)) {
+        printf("Database with name %s already exists. Delete it or use -switch.\n", dbName);
+        return;
+    }
+
+    if (databaseListFull(dbl)) {
+        printf("Unable to load DB. Delete a database and try again.\n");
+        return;
+    }
+
+    Database* db = loadDatabaseFromStore(fileName, dbName);
+
+    if (!db) {
+        printf("Unable to load: %s.\n", fileName);
+        return;
+    }
+
+    printf("Succesfully loaded Database: %s\n", dbName);
+    addDatabaseToList(db, dbl);
+    selectDatabase(dbl, currentDB, db);
+}
+
+// Where word first appears on its own in text, NULL if it doesn't
+static char* findWord(char* text, const char* word) {
+
+    size_t len = strlen(word);
+
+    for (char* p = text; (p = strstr(p, word)) != NULL; p += len) {
+        if ((p == text || p[-1] == ' ' || p[-1] == '\t') && (p[len] == '\0' || p[len] == ' ' || p[len] == '\t'))
+            return p;
+    }
+
+    return NULL;
+}
+
+/* Set a column for every row, or the rows matching a filter, from an expression:
+   -update <col> = <expression> [where <col> <op> <value> [and ...]] [threads N] */
+void cmdUpdate(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    char line[LINE_LEN];
+    char colName[STRING_LEN];
+    char word[STRING_LEN];
+    Predicate preds[MAX_PREDICATES];
+    size_t numPreds = 0;
+    size_t threads = 0;
+
+    if (!hasArg(args)) {
+        readArg(&args, "Enter the update (column = expression [where ...]) > ", line, sizeof(line));
+        args = line;
+    }
+
+    char* eq = strchr(args, '=');
+
+    if (!eq) {
+        printf("Expected '<column> = <expression>'.\n");
+        return;
+    }
+
+    *eq = '\0';
+    readArg(&args, NULL, colName, sizeof(colName));
+
+    int col = findColumn(db, colName);
+
+    if (col < 0 && findComputedColumn(db, colName) >= 0) {
+        printf("%s is a computed column, change it with -computed.\n", colName);
+        return;
+    }
+
+    if (col < 0 || hasArg(args)) {
+        printf("Column: '%s' not found.\n", colName);
+        return;
+    }
+
+    args = eq + 1;
+
+    // The expression runs up to the first where or threads
+    char* where = findWord(args, "where");
+    char* threadsWord = findWord(args, "threads");
+    char* tail = !where || (threadsWord && threadsWord < where) ? threadsWord : where;
+
+    if (tail)
+        tail[-1] = '\0';
+
+    while (hasArg(tail)) {
+
+        readArg(&tail, NULL, word, sizeof(word));
+
+        if (strcmp(word, "where") == 0 || strcmp(word, "and") == 0) {
+            if (readPredicateArgs(db, &tail, word, preds, &numPreds) < 0)
+                return;
+        } else if (strcmp(word, "threads") == 0) {
+            if (!hasArg(tail) || readArg(&tail, NULL, word, sizeof(word)) < 0 || sscanf(word, "%zu", &threads) != 1
+                || threads == 0) {
+                printf("Expected 'threads <count>'.\n");
+                return;
+            }
+        } else {
+            printf("Unexpected '%s'. Use where, and, threads.\n", word);
+            return;
+        }
+    }
+
+    ExprProgram* prog = malloc(sizeof(ExprProgram));
+
+    if (!prog) {
+        fprintf(stderr, "malloc returned NULL pointer for ExprProgram\n");
+        exit(1);
+    }
+
+    switch (compileExpr(db, args, prog)) {
+        case -1 : printf("Syntax error in expression at '%s'.\n", prog->text + prog->errorAt); free(prog); return;
+        case -2 : printf("Unknown column at '%s'.\n", prog->text + prog->errorAt); free(prog); return;
+        case -3 : printf("Expression is too long.\n"); free(prog); return;
+        default : break;
+    }
+
+    long updated = updateColumnExpr(db, col, prog, preds, numPreds, threads);
+
+    free(prog);
+
+    if (updated < 0) {
+        printf("Unable to update column %s.\n", colName);
+        return;
+    }
+
+    printf("Updated %s in %ld rows.\n", colName, updated);
+}
+
+/* Columns computed from an expression when they're read:
+   -computed <name> = <expression> | drop <name> | list */
+void cmdComputed(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    char line[LINE_LEN];
+    char name[STRING_LEN];
+
+    if (!hasArg(args)) {
+        readArg(&args, "Enter the column (name = expression), drop <name> or list > ", line, sizeof(line));
+        args = line;
+    }
+
+    char* eq = strchr(args, '=');
+
+    if (!eq) {
+
+        readArg(&args, NULL, name, sizeof(name));
+
+        if (strcmp(name, "list") == 0) {
+
+            if (!db->numComputed)
+                printf("%s has no computed columns.\n", db->dbName);
+
+            for (size_t i = 0; i < db->numComputed; i++)
+                printf("%s %s = %s\n", data_types[db->computed[i]->prog.type], db->computed[i]->name,
+                    db->computed[i]->prog.text);
+
+        } else if (strcmp(name, "drop") == 0 && hasArg(args)) {
+
+            readArg(&args, NULL, name, sizeof(name));
+
+            if (dropComputedColumn(db, findComputedColumn(db, name)) < 0)
+                printf("Computed column: '%s' not found.\n", name);
+            else
+                printf("Dropped computed column %s.\n", name);
+
+        } else {
+            printf("Expected '<name> = <expression>', 'drop <name>' or 'list'.\n");
+        }
+
+        return;
+    }
+
+    *eq = '\0';
+    readArg(&args, NULL, name, sizeof(name));
+
+    if (name[0] == '\0' || hasArg(args)) {
+        printf("Expected '<name> = <expression>'.\n");
+        return;
+    }
+
+    ExprProgram* prog = malloc(sizeof(ExprProgram));
+
+    if (!prog) {
+        fprintf(stderr, "malloc returned NULL pointer for ExprProgram\n");
+        exit(1);
+    }
+
+    // Listed and saved as written, without the spaces around it
+    char* text = eq + 1 + strspn(eq + 1, " \t");
+    size_t len = strlen(text);
+
+    while (len && (text[len - 1] == ' ' || text[len - 1] == '\t' || text[len - 1] == '\n'))
+        text[--len] = '\0';
+
+    switch (compileExpr(db, text, prog)) {
+        case -1 : printf("Syntax error in expression at '%s'.\n", prog->text + prog->errorAt); free(prog); return;
+        case -2 : printf("Unknown column at '%s'.\n", prog->text + prog->errorAt); free(prog); return;
+        case -3 : printf("Expression is too long.\n"); free(prog); return;
+        default : break;
+    }
+
+    if (addComputedColumn(db, name, prog) < 0)
+        printf("A column named %s already exists.\n", name);
+    else
+        printf("Computed column %s %s = %s\n", data_types[prog->type], name, prog->text);
+
+    free(prog);
+}
+
+// "-materialize <computed column> [threads N]" stores the column's values in place of its expression
+void cmdMaterialize(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    char name[STRING_LEN];
+    char word[STRING_LEN];
+    size_t threads = 0;
+
+    readArg(&args, "Enter the computed column > ", name, sizeof(name));
+
+    if (hasArg(args) && (readArg(&args, NULL, word, sizeof(word)) < 0 || strcmp(word, "threads") != 0
+            || !hasArg(args) || readArg(&args, NULL, word, sizeof(word)) < 0 || sscanf(word, "%zu", &threads) != 1
+            || threads == 0)) {
+        printf("Expected '-materialize <column> [threads <count>]'.\n");
+        return;
+    }
+
+    int col = findComputedColumn(db, name);
+
+    if (col < 0) {
+        printf("Computed column: '%s' not found.\n", name);
+        return;
+    }
+
+    long written = materializeColumn(db, col, threads);
+
+    if (written < 0) {
+        printf("Unable to materialize column %s.\n", name);
+        return;
+    }
+
+    printf("Stored %s in %ld rows.\n", name, written);
+}
+
+// "-bloom <column>" keeps a Bloom filter per block on the column, "-bloom drop <column>" and "-bloom list"
+void cmdBloom(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    char word[STRING_LEN];
+    char colName[STRING_LEN];
+
+    readArg(&args, "Enter the column (or drop <column>, list) > ", word, sizeof(word));
+
+    if (strcmp(word, "list") == 0) {
+
+        size_t filters = 0;
+
+        for (size_t col = 0; col < db->numCols; col++) {
+
+            const BloomFilter* bloom = db->cols[col].bloom;
+
+            if (!bloom)
+                continue;
+
+            printf("%s: %zu blocks, %zu KB\n", db->cols[col].colName, (db->numRows + BLOCK_ROWS - 1) / BLOCK_ROWS,
+                bloom->numBlocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t) / 1024);
+            filters++;
+        }
+
+        if (!filters)
+            printf("%s has no Bloom filters.\n", db->dbName);
+
+        return;
+    }
+
+    int drop = strcmp(word, "drop") == 0;
+
+    if (drop)
+        readArg(&args, "Enter the column > ", colName, sizeof(colName));
+    else
+        snprintf(colName, sizeof(colName), "%s", word);
+
+    int col = findColumn(db, colName);
+
+    if (col < 0) {
+        printf("Column: '%s' not found.\n", colName);
+        return;
+    }
+
+    if (drop) {
+        if (dropBloomFilter(db, col) < 0)
+            printf("Column %s has no Bloom filter.\n", colName);
+        else
+            printf("Dropped the Bloom filter on %s.\n", colName);
+    } else if (addBloomFilter(db, col) > 0) {
+        printf("Column %s already has a Bloom filter.\n", colName);
+    } else {
+        printf("Added a Bloom filter on %s, = and in filters on it skip the blocks it rules out.\n", colName);
+    }
+}
+
+/* "-sketch add <column>" keeps HyperLogLog and KLL sketches on a column, "-sketch <column> [p50 p99 ...]"
+   reads the approximate distinct count and percentiles from them, "-sketch drop <column>" and "-sketch list" */
+void cmdSketch(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    char word[STRING_LEN];
+    char colName[STRING_LEN];
+
+    readArg(&args, "Enter the column (or add <column>, drop <column>, list) > ", word, sizeof(word));
+
+    if (strcmp(word, "list") == 0) {
+
+        size_t sketches = 0;
+
+        for (size_t col = 0; col < db->numCols; col++) {
+            if (db->cols[col].sketch) {
+                printf("%s\n", db->cols[col].colName);
+                sketches++;
+            }
+        }
+
+        if (!sketches)
+            printf("%s has no sketches.\n", db->dbName);
+
+        return;
+    }
+
+    int add = strcmp(word, "add") == 0;
+    int drop = strcmp(word, "drop") == 0;
+
+    if (add || drop)
+        readArg(&args, "Enter the column > ", colName, sizeof(colName));
+    else
+        snprintf(colName, sizeof(colName), "%s", word);
+
+    int col = findColumn(db, colName);
+
+    if (col < 0) {
+        printf("Column: '%s' not found.\n", colName);
+        return;
+    }
+
+    if (drop) {
+        if (dropColumnSketch(db, col) < 0)
+            printf("Column %s has no sketch.\n", colName);
+        else
+            printf("Dropped the sketch on %s.\n", colName);
+        return;
+    }
+
+    if (add) {
+        if (addColumnSketch(db, col) > 0)
+            printf("Column %s already has a sketch.\n", colName);
+        else
+            printf("Added a sketch on %s, query it with -sketch %s p50 p99.\n", colName, colName);
+        return;
+    }
+
+    if (!db->cols[col].sketch) {
+        printf("Column %s has no sketch, add one with -sketch add %s.\n", colName, colName);
+        return;
+    }
+
+    // Percentiles asked for, p50 and p99 if none were
+    double percents[MAX_PERCENTILES] = {50, 99};
+    size_t numPercents = 0;
+    char arg[STRING_LEN];
+
+    while (numPercents < MAX_PERCENTILES && args && *(args + strspn(args, " \t"))) {
+
+        char* end;
+
+        readArg(&args, NULL, arg, sizeof(arg));
+        percents[numPercents] = strtod(arg + (arg[0] == 'p'), &end);
+
+        if (*end || end == arg + (arg[0] == 'p') || percents[numPercents] < 0 || percents[numPercents] > 100) {
+            printf("Percentiles are p0 to p100, e.g. p50 p99.9\n");
+            return;
+        }
+
+        numPercents++;
+    }
+
+    if (!numPercents)
+        numPercents = 2;
+
+    double ranks[MAX_PERCENTILES];
+    double values[MAX_PERCENTILES];
+
+    for (size_t i = 0; i < numPercents; i++)
+        ranks[i] = percents[i] / 100;
+
+    uint64_t start = statsNow();
+    SketchSummary summary;
+
+    sketchSummary(db, col, &summary);
+
+    int ranked = sketchQuantiles(db, col, ranks, numPercents, values) == 0;
+    uint64_t elapsed = statsNow() - start;
+
+    printf("%s: ~%.0f distinct of %llu values", colName, summary.distinct, (unsigned long long)summary.count);
+
+    if (ranked) {
+        printf(", min %g, max %g", summary.min, summary.max);
+        for (size_t i = 0; i < numPercents; i++)
+            printf(", p%g %g", percents[i], values[i]);
+    }
+
+    printf(" (%.1f us)\n", elapsed / 1000.0);
+}
+
+/* "-view create <name> = <aggregate>[, ...] by <column>" keeps a rollup of the current table
+   in the table name, each aggregate is count, count <column>, sum <column> or avg <column>.
+   "-view drop <name>" removes it with its table and "-view list" shows them */
+void cmdView(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char word[STRING_LEN];
+    char name[STRING_LEN];
+
+    readArg(&args, "Enter create, drop or list > ", word, sizeof(word));
+
+    if (strcmp(word, "list") == 0) {
+        printViews();
+        return;
+    }
+
+    if (strcmp(word, "drop") == 0) {
+
+        readArg(&args, "Enter the view > ", name, sizeof(name));
+
+        if (!findView(name)) {
+            printf("View: '%s' not found.\n", name);
+            return;
+        }
+
+        // Dropping its table stops the view
+        if (*currentDB && strcmp(name, (*currentDB)->dbName) == 0)
+            *currentDB = NULL;
+
+        deleteDatabaseFromList(dbl, name);
+        return;
+    }
+
+    if (strcmp(word, "create") != 0) {
+        printf("Unknown option '%s'. Use create, drop or list.\n", word);
+        return;
+    }
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    char line[LINE_LEN];
+
+    readArg(&args, "Enter the view name > ", name, sizeof(name));
+
+    if (!hasArg(args)) {
+        readArg(&args, "Enter the aggregates (= count, sum price, avg price by cat) > ", line, sizeof(line));
+        args = line;
+    }
+
+    char* body = args + strspn(args, " \t");
+
+    if (*body == '=')
+        body++;
+
+    char* by = findWord(body, "by");
+
+    if (!by) {
+        printf("Missing 'by <column>'.\n");
+        return;
+    }
+
+    *by = '\0';
+
+    char groupName[STRING_LEN];
+    char* rest = by + 2;
+
+    readArg(&rest, NULL, groupName, sizeof(groupName));
+
+    int groupCol = findColumn(db, groupName);
+
+    if (groupCol < 0) {
+        printf("Column: '%s' not found.\n", groupName);
+        return;
+    }
+
+    ViewAggregate aggs[MAX_VIEW_AGGREGATES];
+    size_t numAggs = 0;
+
+    char* save;
+
+    for (char* item = strtok_r(body, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+
+        char opName[STRING_LEN] = "";
+        char colName[STRING_LEN] = "";
+
+        readArg(&item, NULL, opName, sizeof(opName));
+
+        if (hasArg(item))
+            readArg(&item, NULL, colName, sizeof(colName));
+
+        if (!opName[0])
+            continue;
+
+        if (numAggs == MAX_VIEW_AGGREGATES) {
+            printf("A view can have at most %d aggregates.\n", MAX_VIEW_AGGREGATES);
+            return;
+        }
+
+        ViewAggregate* agg = &aggs[numAggs];
+
+        if (strcmp(opName, "count") == 0)
+            agg->op = colName[0] ? VIEW_COUNT : VIEW_COUNT_ROWS;
+        else if (strcmp(opName, "sum") == 0)
+            agg->op = VIEW_SUM;
+        else if (strcmp(opName, "avg") == 0)
+            agg->op = VIEW_AVG;
+        else {
+            printf("Unknown aggregate '%s'. Use count, sum or avg.\n", opName);
+            return;
+        }
+
+        if (agg->op != VIEW_COUNT_ROWS) {
+
+            // Computed columns don't report changes, only stored ones can be kept up to date
+            int col = findColumn(db, colName);
+
+            if (col < 0) {
+                printf("Column: '%s' not found.\n", colName[0] ? colName : "(none)");
+                return;
+            }
+
+            agg->col = col;
+        }
+
+        numAggs++;
+    }
+
+    if (!numAggs) {
+        printf("Give at least one aggregate, e.g. count.\n");
+        return;
+    }
+
+    int result = createView(dbl, db, name, groupCol, aggs, numAggs);
+
+    if (result == -1)
+        printf("A table called %s already exists.\n", name);
+    else if (result == -2)
+        printf("No room for another view.\n");
+    else if (result == -3)
+        printf("Views can't be built on other views.\n");
+    else
+        printf("View %s keeps %zu groups of %s up to date, switch to it to read them.\n", name,
+            findView(name)->numGroups, db->dbName);
+}
+
+// "-agg <count|sum|avg|min|max> <column> [from <table>] [where ...]" or "-agg rowavg <row>"
+// A table evicted under the memory budget is aggregated on its compressed snapshot when it can be
+void cmdAggregate(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    Database* db = *currentDB;
+    Database* schema = NULL;
+    DatabaseEntry* entry = NULL;
+    char opName[STRING_LEN];
+    char colName[STRING_LEN];
+    char word[STRING_LEN];
+    Predicate preds[MAX_PREDICATES];
+    size_t numPreds = 0;
+    int op = -1;
+
+    readArg(&args, "Enter the aggregate (count, sum, avg, min, max, rowavg) > ", opName, sizeof(opName));
+
+    if (strcmp(opName, "rowavg") == 0) {
+
+        if (!db) {
+            printf("No database selected.\n");
+            return;
+        }
+
+        size_t row = safeReadSize(&args, "Enter the row index > ");
+
+        if (row >= db->numRows) {
+            printf("Invalid row index.\n");
+            return;
+        }
+
+        printf("avg(row %zu) = %g\n", row, calculateRowAverage(db, row));
+        return;
+    }
+
+    for (int a = 0; a < AGG_OP_COUNT; a++) {
+        if (strcmp(opName, aggregate_ops[a]) == 0)
+            op = a;
+    }
+
+    if (op < 0) {
+        printf("Unknown aggregate '%s'. Use count, sum, avg, min, max or rowavg.\n", opName);
+        return;
+    }
+
+    readArg(&args, "Enter the column > ", colName, sizeof(colName));
+
+    // Look past the column for "from", without using up a "where"
+    char* next = args;
+
+    if (hasArg(next) && readArg(&next, NULL, word, sizeof(word)) == 0 && strcmp(word, "from") == 0) {
+
+        char tableName[STRING_LEN];
+
+        args = next;
+        readArg(&args, "Enter the table > ", tableName, sizeof(tableName));
+
+        entry = findDatabaseInList(dbl, tableName);
+
+        if (!entry) {
+            printf("Could not find Database %s\n", tableName);
+            return;
+        }
+
+        schema = readEvictedSchema(entry);
+
+        if (!(db = schema ? schema : openDatabaseEntry(dbl, entry)))
+            return;
+    }
+
+    if (!db) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    int col = findAnyColumn(db, colName);
+
+    // Computed columns aren't in the snapshot's schema, those need the table
+    if (col < 0 && schema) {
+        deleteDatabase(schema);
+        schema = NULL;
+        db = openDatabaseEntry(dbl, entry);
+        col = db ? findAnyColumn(db, colName) : -1;
+    }
+
+    if (col < 0) {
+        printf("Column: '%s' not found.\n", colName);
+        deleteDatabase(schema);
+        return;
+    }
+
+    while (hasArg(args)) {
+
+        readArg(&args, NULL, word, sizeof(word));
+
+        if (strcmp(word, "where") != 0 && strcmp(word, "and") != 0) {
+            printf("Unexpected '%s'. Use where and and.\n", word);
+            deleteDatabase(schema);
+            return;
+        }
+
+        if (readPredicateArgs(db, &args, word, preds, &numPreds) < 0) {
+            deleteDatabase(schema);
+            return;
+        }
+    }
+
+    AggregateResult result;
+    int hit;
+
+    if (schema) {
+
+        hit = aggregateEvictedEntry(entry, op, col, preds, numPreds, &result);
+        deleteDatabase(schema);
+
+        if (hit == 0) {
+            printf("%s(%s) = %g over %zu rows (compressed)\n", aggregate_ops[op], colName, result.value, result.rows);
+            return;
+        }
+
+        // Anything the compressed blocks can't answer runs on the table as usual
+        if (!(db = openDatabaseEntry(dbl, entry)))
+            return;
+    }
+
+    hit = cachedAggregate(db, op, col, preds, numPreds, &result);
+
+    printf("%s(%s) = %g over %zu rows%s\n", aggregate_ops[op], colName, result.value, result.rows,
+        hit ? " (cached)" : "");
+}
+
+void cmdCacheStats(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char option[STRING_LEN] = "";
+
+    if (hasArg(args))
+        readArg(&args, NULL, option, sizeof(option));
+
+    if (option[0] == '\0') {
+        printCacheStats();
+    } else if (strcmp(option, "clear") == 0) {
+        cacheClear();
+        printf("Result cache cleared.\n");
+    } else if (strcmp(option, "budget") == 0 && hasArg(args)) {
+        char sizeBuf[STRING_LEN];
+        unsigned long long budget;
+
+        readArg(&args, NULL, sizeBuf, sizeof(sizeBuf));
+
+        if (parseByteSize(sizeBuf, &budget) < 0) {
+            printf("Invalid cache budget.\n");
+            return;
+        }
+
+        setCacheBudget(budget);
+        printf("Result cache budget set to %llu bytes.\n", budget);
+    } else {
+        printf("Unknown option '%s'. Use clear or budget <size>.\n", option);
+    }
+}
+
+/* "-io" shows the file I/O settings, "-io uring|threads|sync" picks the backend,
+   "-io direct on|off", "-io depth <n>" and "-io chunk <size>" tune it */
+void cmdIo(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    IoConfig config = getIoConfig();
+    char option[STRING_LEN] = "";
+    char value[STRING_LEN] = "";
+
+    if (hasArg(args))
+        readArg(&args, NULL, option, sizeof(option));
+    if (hasArg(args))
+        readArg(&args, NULL, value, sizeof(value));
+
+    if (option[0] == '\0') {
+
+        IoBackend backend = effectiveIoBackend();
+
+        printf("Backend: %s", io_backend_names[backend]);
+        if (backend != config.backend)
+            printf(" (%s is not available)", io_backend_names[config.backend]);
+        printf(", O_DIRECT: %s, depth: %zu, chunk: %zu KB\n", config.direct ? "on" : "off", config.depth,
+            config.chunkSize / 1024);
+        return;
+    }
+
+    int backend = -1;
+
+    for (int b = 0; b < IO_BACKEND_COUNT; b++) {
+        if (strcmp(option, io_backend_names[b]) == 0)
+            backend = b;
+    }
+
+    if (backend >= 0) {
+        config.backend = backend;
+    } else if (strcmp(option, "direct") == 0 && (strcmp(value, "on") == 0 || strcmp(value, "off") == 0)) {
+        config.direct = strcmp(value, "on") == 0;
+    } else if (strcmp(option, "depth") == 0 && atoi(value) > 0) {
+        config.depth = atoi(value);
+    } else if (strcmp(option, "chunk") == 0) {
+        unsigned long long bytes;
+
+        if (parseByteSize(value, &bytes) < 0 || !bytes || bytes % IO_ALIGN) {
+            printf("The chunk size has to be a multiple of %d bytes.\n", IO_ALIGN);
+            return;
+        }
+
+        config.chunkSize = bytes;
+    } else {
+        printf("Unknown option '%s'. Use uring, threads, sync, direct on|off, depth <n> or chunk <size>.\n", option);
+        return;
+    }
+
+    setIoConfig(&config);
+    cmdIo(dbl, currentDB, NULL);
+}
+
+/* "-memconfig" shows huge page and NUMA placement, "-memconfig hugepages off|thp|hugetlb",
+   "-memconfig numa default|interleave|local" and "-memconfig pin on|off" change it */
+void cmdMemConfig(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    MemoryConfig config = getMemoryConfig();
+    char option[STRING_LEN] = "";
+    char value[STRING_LEN] = "";
+
+    if (hasArg(args))
+        readArg(&args, NULL, option, sizeof(option));
+    if (hasArg(args))
+        readArg(&args, NULL, value, sizeof(value));
+
+    if (option[0] == '\0') {
+        printMemoryPlacement();
+        return;
+    }
+
+    int choice = -1;
+
+    if (strcmp(option, "hugepages") == 0) {
+        for (int m = 0; m < HUGE_PAGES_COUNT; m++) {
+            if (strcmp(value, huge_page_names[m]) == 0)
+                choice = m;
+        }
+        if (choice >= 0)
+            config.hugePages = choice;
+    } else if (strcmp(option, "numa") == 0) {
+        for (int p = 0; p < NUMA_POLICY_COUNT; p++) {
+            if (strcmp(value, numa_policy_names[p]) == 0)
+                choice = p;
+        }
+        if (choice >= 0)
+            config.numa = choice;
+    } else if (strcmp(option, "pin") == 0 && (strcmp(value, "on") == 0 || strcmp(value, "off") == 0)) {
+        config.pinWorkers = strcmp(value, "on") == 0;
+        choice = 0;
+    }
+
+    if (choice < 0) {
+        printf("Unknown option '%s %s'. Use hugepages off|thp|hugetlb, numa default|interleave|local or pin on|off.\n",
+            option, value);
+        return;
+    }
+
+    setMemoryConfig(&config);
+    cmdMemConfig(dbl, currentDB, NULL);
+}
+
+static ShardedTable** findShardedTable(const char* name) {
+
+    for (size_t i = 0; i < MAX_SHARDED_TABLES; i++) {
+        if (shardedTables[i] && strcmp(shardedTables[i]->name, name) == 0)
+            return &shardedTables[i];
+    }
+
+    return NULL;
+}
+
+// "-shard <key column> <shards>" moves the current table into a sharded table of the same name
+void cmdShardDB(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    if (!*currentDB) {
+        printf("No database selected.\n");
+        return;
+    }
+
+    Database* db = *currentDB;
+    char colName[STRING_LEN];
+
+    readArg(&args, "Enter the key column > ", colName, sizeof(colName));
+
+    int col = findColumn(db, colName);
+
+    if (col < 0) {
+        printf("Column: '%s' not found.\n", colName);
+        return;
+    }
+
+    size_t numShards = safeReadSize(&args, "Enter the number of shards > ");
+
+    if (numShards == 0 || numShards > MAX_SHARDS) {
+        printf("The number of shards must be between 1 and %d.\n", MAX_SHARDS);
+        return;
+    }
+
+    if (findShardedTable(db->dbName)) {
+        printf("A sharded table named %s already exists.\n", db->dbName);
+        return;
+    }
+
+    ShardedTable** slot = NULL;
+
+    for (size_t i = 0; !slot && i < MAX_SHARDED_TABLES; i++) {
+        if (!shardedTables[i])
+            slot = &shardedTables[i];
+    }
+
+    if (!slot) {
+        printf("At most %d tables can be sharded at once. Use -unshard first.\n", MAX_SHARDED_TABLES);
+        return;
+    }
+
+    *slot = shardDatabase(db, col, numShards);
+
+    printf("Sharded %s over %zu workers on %s.\n", db->dbName, numShards, colName);
+
+    selectDatabase(dbl, currentDB, NULL);
+    deleteDatabaseFromList(dbl, (*slot)->name);
+}
+
+// Reads an inline value for column col of a sharded table, returns -1 after printing what's wrong
+static int readShardValue(Database* schema, size_t col, char** args, DataValues* out) {
+
+    char value[STRING_LEN];
+    Predicate pred;
+
+    if (!hasArg(*args) || readArg(args, NULL, value, sizeof(value)) < 0) {
+        printf("Expected a value for column %s.\n", schema->cols[col].colName);
+        return -1;
+    }
+
+    if (parsePredicate(schema, schema->cols[col].colName, "=", value, &pred) < 0) {
+        printf("Invalid %s value '%s' for column %s.\n", data_types[schema->cols[col].type], value,
+            schema->cols[col].colName);
+        return -1;
+    }
+
+    *out = pred.value;
+
+    return 0;
+}
+
+/* -sharded <table> insert <values...>
+                    update <key> <column> <value>
+                    delete <key>
+                    agg <count|sum|avg|min|max> <column> [where ...]
+                    info */
+void cmdShardedOp(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char name[STRING_LEN];
+    char op[STRING_LEN];
+
+    readArg(&args, "Enter the sharded table > ", name, sizeof(name));
+
+    ShardedTable** slot = findShardedTable(name);
+
+    if (!slot) {
+        printf("No sharded table named %s. Use -shard to create one.\n", name);
+        return;
+    }
+
+    ShardedTable* table = *slot;
+    // Every shard has the same columns, and the workers never change them
+    Database* schema = table->shards[0].db;
+
+    readArg(&args, "Enter the operation (insert, update, delete, agg, info) > ", op, sizeof(op));
+
+    if (strcmp(op, "insert") == 0) {
+
+        DataValues values[table->numCols ? table->numCols : 1];
+
+        for (size_t c = 0; c < table->numCols; c++) {
+            if (readShardValue(schema, c, &args, &values[c]) < 0)
+                return;
+        }
+
+        shardInsertRow(table, values);
+        shardFlush(table);
+
+    } else if (strcmp(op, "update") == 0) {
+
+        DataValues key, value;
+        char colName[STRING_LEN];
+
+        if (readShardValue(schema, table->keyCol, &args, &key) < 0)
+            return;
+
+        readArg(&args, "Enter the column > ", colName, sizeof(colName));
+
+        int col = findColumn(schema, colName);
+
+        if (col < 0) {
+            printf("Column: '%s' not found.\n", colName);
+            return;
+        }
+
+        if (readShardValue(schema, col, &args, &value) < 0)
+            return;
+
+        printf("Updated %zu rows.\n", shardUpdateKey(table, key, col, value));
+
+    } else if (strcmp(op, "delete") == 0) {
+
+        DataValues key;
+
+        if (readShardValue(schema, table->keyCol, &args, &key) < 0)
+            return;
+
+        printf("Deleted %zu rows.\n", shardDeleteKey(table, key));
+
+    } else if (strcmp(op, "agg") == 0) {
+
+        char opName[STRING_LEN];
+        char colName[STRING_LEN];
+        Predicate preds[MAX_PREDICATES];
+        size_t numPreds = 0;
+        int aggOp = -1;
+
+        readArg(&args, "Enter the aggregate (count, sum, avg, min, max) > ", opName, sizeof(opName));
+
+        for (int a = 0; a < AGG_OP_COUNT; a++) {
+            if (strcmp(opName, aggregate_ops[a]) == 0)
+                aggOp = a;
+        }
+
+        if (aggOp < 0) {
+            printf("Unknown aggregate '%s'. Use count, sum, avg, min or max.\n", opName);
+            return;
+        }
+
+        readArg(&args, "Enter the column > ", colName, sizeof(colName));
+
+        int col = findColumn(schema, colName);
+
+        if (col < 0) {
+            printf("Column: '%s' not found.\n", colName);
+            return;
+        }
+
+        while (hasArg(args)) {
+
+            char word[STRING_LEN];
+
+            readArg(&args, NULL, word, sizeof(word));
+
+            if (strcmp(word, "where") != 0 && strcmp(word, "and") != 0) {
+                printf("Unexpected '%s'. Use where and and.\n", word);
+                return;
+            }
+
+            if (readPredicateArgs(schema, &args, word, preds, &numPreds) < 0)
+                return;
+        }
+
+        AggregateResult result;
+
+        shardAggregate(table, aggOp, col, preds, numPreds, &result);
+        printf("%s(%s) = %g over %zu rows\n", aggregate_ops[aggOp], colName, result.value, result.rows);
+
+    } else if (strcmp(op, "info") == 0) {
+        printShardedTable(table);
+    } else {
+        printf("Unknown operation '%s'. Use insert, update, delete, agg or info.\n", op);
+    }
+}
+
+void cmdUnshardDB(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char name[STRING_LEN];
+
+    readArg(&args, "Enter the sharded table > ", name, sizeof(name));
+
+    ShardedTable** slot = findShardedTable(name);
+
+    if (!slot) {
+        printf("No sharded table named %s.\n", name);
+        return;
+    }
+
+    if (findDatabaseInList(dbl, name)) {
+        printf("Database with name %s already exists. Delete it first.\n", name);
+        return;
+    }
+
+    if (databaseListFull(dbl)) {
+        printf("Unable to unshard. Delete a database and try again.\n");
+        return;
+    }
+
+    Database* db = unshardTable(*slot);
+    *slot = NULL;
+
+    addDatabaseToList(db, dbl);
+    selectDatabase(dbl, currentDB, db);
+    printf("Merged %zu rows back into %s, grouped by shard.\n", db->numRows, name);
+}
+
+/* -replicate listen <address>    accept replicas and stream every change to them
+   -replicate from <address>      become a read replica of the primary at address
+   -replicate status              show LSNs and lag
+   -replicate wait [seconds]      wait until this replica has caught up */
+void cmdReplicate(DatabaseList* dbl, Database** currentDB, char* args) {
+
+    char mode[STRING_LEN];
+    char address[FILE_NAME_LEN];
+
+    readArg(&args, "Enter listen, from, status or wait > ", mode, sizeof(mode));
+
+    if (strcmp(mode, "listen") == 0) {
+
+        readArg(&args, "Enter the port or unix:/path to listen on > ", address, sizeof(address));
+
+        if (startReplicationServer(dbl, address) == 0)
+            printf("Accepting replicas on %s.\n", address);
+
+    } else if (strcmp(mode, "from") == 0) {
+
+        readArg(&args, "Enter the primary's host:port or unix:/path > ", address, sizeof(address));
+
+        if (dbl->dbCount)
+            printf("The primary's tables replace the ones here, tables it doesn't have are dropped.\n");
+
+        if (startReplica(dbl, address) == 0)
+            printf("Following %s.\n", address);
+
+    } else if (strcmp(mode, "status") == 0) {
+
+        if (!isReplica() && !isPrimary())
+            printf("Replication is not running. Use -replicate listen or -replicate from.\n");
+
+        printReplicaStatus();
+        printPrimaryStatus();
+
+    } else if (strcmp(mode, "wait") == 0) {
+
+        double seconds = 10.0;
+
+        if (hasArg(args)) {
+            readArg(&args, NULL, address, sizeof(address));
+            seconds = strtod(address, NULL);
+        }
+
+        // The stream is applied under the catalog lock, let it in while we wait
+        unlockCatalog();
+        int caughtUp = waitForReplica(seconds);
+        lockCatalog();
+
+        if (caughtUp == 0)
+            printf("Replica is caught up.\n");
+        else
+            printf("Replica did not catch up within %gs.\n", seconds);
+
+    } else {
+        printf("Unknown option '%s'. Use listen, from, status or wait.\n", mode);
+    }
+}
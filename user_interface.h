@@ -3,36 +3,75 @@
 
 #include "database_list.h"
 
+#define LINE_LEN 1024
+
+// Rows shown by a bare -print, and by the reprint after a change unless -autoprint says otherwise
+#define PRINT_PAGE_ROWS 100
+#define AUTO_PRINT_ROWS 20
+#define MAX_SHARDED_TABLES 16
+// Percentiles one -sketch query can ask for
+#define MAX_PERCENTILES 16
+
 typedef struct {
     char* command;
-    void (*cmdFunction)(DatabaseList* dbl, Database** currentDB, char* name);
+    void (*cmdFunction)(DatabaseList* dbl, Database** currentDB, char* args);
 } uiCmd;
 
 extern uiCmd uiCommands[];
 extern size_t commandCount;
 
-void userMenu();
-
-void cmdQuit(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdPrintDB(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdPrintDBList(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdHelp(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdCreateDB(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdDeleteDB(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdSwitchDB(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdNewCol(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdNewRow(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdWriteCell(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdDeleteRow(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdDeleteCol(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdSaveDbToFile(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdLoadDbFromFile(DatabaseList* dbl, Database** currentDB, char* name);
-void cmdChangeColName(DatabaseList* dbl, Database** currentDB, char* name);
-
-int safeReadInt(Database* currentDB, size_t rowValue, size_t colValue);
-int safeReadFloat(Database* currentDB, size_t rowValue, size_t colValue);
-int safeReadDouble(Database* currentDB, size_t rowValue, size_t colValue);
-
-size_t safeReadSize();
+void userMenu(int interactive);
+
+void cmdQuit(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdPrintDB(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdPrintDBList(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdHelp(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdCreateDB(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdDeleteDB(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdSwitchDB(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdNewCol(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdNewRow(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdWriteCell(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdDeleteRow(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdDeleteCol(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdSaveDbToFile(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdLoadDbFromFile(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdChangeColName(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdBgSaveDbToFile(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdBgSaveStatus(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdInsertRow(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdAutoPrint(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdBulkLoad(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdAttachDbFile(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdMemoryBudget(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdMemoryStats(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdStats(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdMetricsServer(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdSaveDbToBinary(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdLoadDbFromBinary(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdCompressInfo(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdExport(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdSaveDbToStore(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdLoadDbFromStore(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdAggregate(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdUpdate(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdComputed(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdMaterialize(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdBloom(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdSketch(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdView(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdIo(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdMemConfig(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdSaveDbToArrow(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdLoadDbFromArrow(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdCacheStats(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdShardDB(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdShardedOp(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdUnshardDB(DatabaseList* dbl, Database** currentDB, char* args);
+void cmdReplicate(DatabaseList* dbl, Database** currentDB, char* args);
+
+int safeReadValue(Database* currentDB, size_t rowValue, size_t colValue, char** args, const char* prompt);
+
+size_t safeReadSize(char** args, const char* prompt);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,488 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "view.h"
+
+static MaterializedView* views[MAX_VIEWS];
+static size_t numViews = 0;
+static int observing = 0;
+
+// Set while a view writes its own table, so the observer doesn't take that for someone else's change
+static int applying = 0;
+
+static const char* aggregateNames[] = {"count", "count", "sum", "avg"};
+
+// Reads a cell of the source as it was before the write in before (if any), returns 0 for NULL
+static int readSource(const Database* db, size_t row, size_t col, const Mutation* before, DataValues* out) {
+
+    if (before && before->col == col) {
+        *out = before->oldValue;
+        return !before->oldNull;
+    }
+
+    if (isCellNull(db, row, col))
+        return 0;
+
+    *out = db->rows[row].cells[col].value;
+
+    return 1;
+}
+
+static void growViewBuckets(MaterializedView* view) {
+
+    size_t numBuckets = view->numBuckets ? view->numBuckets * 2 : VIEW_INITIAL_BUCKETS;
+    ViewGroup** buckets = calloc(numBuckets, sizeof(ViewGroup*));
+
+    if (!buckets) {
+        fprintf(stderr, "calloc returned NULL pointer for view buckets\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < view->numGroups; i++) {
+        ViewGroup* group = view->groups[i];
+        size_t b = mixBits(group->keyBits) & (numBuckets - 1);
+        group->nextInBucket = buckets[b];
+        buckets[b] = group;
+    }
+
+    free(view->buckets);
+    view->buckets = buckets;
+    view->numBuckets = numBuckets;
+}
+
+static ViewGroup* findGroup(const MaterializedView* view, int keyNull, uint64_t keyBits) {
+
+    ViewGroup* group = view->buckets[mixBits(keyBits) & (view->numBuckets - 1)];
+
+    while (group && (group->keyNull != keyNull || group->keyBits != keyBits))
+        group = group->nextInBucket;
+
+    return group;
+}
+
+// A new group gets the next row of the view table, holding just its key until it's written
+static ViewGroup* addGroup(MaterializedView* view, int keyNull, uint64_t keyBits, DataValues key) {
+
+    if (view->numGroups >= view->numBuckets)
+        growViewBuckets(view);
+
+    if (view->numGroups == view->groupCapacity) {
+
+        size_t capacity = view->groupCapacity ? view->groupCapacity * 2 : VIEW_INITIAL_BUCKETS;
+        ViewGroup** groups = realloc(view->groups, capacity * sizeof(ViewGroup*));
+
+        if (!groups) {
+            fprintf(stderr, "realloc returned NULL pointer for view groups\n");
+            exit(1);
+        }
+
+        view->groups = groups;
+        view->groupCapacity = capacity;
+    }
+
+    ViewGroup* group = calloc(1, sizeof(ViewGroup) + view->numAggs * sizeof(ViewAccumulator));
+
+    if (!group) {
+        fprintf(stderr, "calloc returned NULL pointer for ViewGroup\n");
+        exit(1);
+    }
+
+    Database* table = view->table ? view->table->db : NULL;
+
+    group->keyBits = keyBits;
+    group->keyNull = keyNull;
+    group->key = key;
+    group->row = view->numGroups;
+
+    size_t b = mixBits(keyBits) & (view->numBuckets - 1);
+    group->nextInBucket = view->buckets[b];
+    view->buckets[b] = group;
+    view->groups[view->numGroups++] = group;
+
+    // While the view is being built the table is still its own, see createView
+    if (!table)
+        return group;
+
+    createRow(table);
+
+    if (!keyNull)
+        writeCell(table, group->row, 0, table->cols[0].type, key);
+
+    return group;
+}
+
+// Takes an emptied group and its view row out, the groups after it move up a row
+static void removeGroup(MaterializedView* view, ViewGroup* group) {
+
+    ViewGroup** link = &view->buckets[mixBits(group->keyBits) & (view->numBuckets - 1)];
+
+    while (*link != group)
+        link = &(*link)->nextInBucket;
+
+    *link = group->nextInBucket;
+
+    removeRow(view->table->db, group->row);
+
+    for (size_t i = group->row + 1; i < view->numGroups; i++) {
+        view->groups[i]->row--;
+        view->groups[i - 1] = view->groups[i];
+    }
+
+    view->numGroups--;
+    free(group);
+}
+
+static void writeGroup(Database* table, const MaterializedView* view, const ViewGroup* group) {
+
+    for (size_t i = 0; i < view->numAggs; i++) {
+
+        const ViewAccumulator* acc = &group->acc[i];
+        size_t col = i + 1;
+
+        switch (view->aggs[i].op) {
+
+            case VIEW_COUNT_ROWS :
+                writeCell(table, group->row, col, INT_TYPE, (DataValues){.i = (int)group->rows});
+                break;
+
+            case VIEW_COUNT :
+                writeCell(table, group->row, col, INT_TYPE, (DataValues){.i = (int)acc->count});
+                break;
+
+            case VIEW_SUM :
+            case VIEW_AVG :
+                // Like SQL, the sum and average of a group with no values are NULL
+                if (!acc->count)
+                    setCellNull(table, group->row, col);
+                else
+                    writeCell(table, group->row, col, DOUBLE_TYPE, (DataValues){.d = view->aggs[i].op == VIEW_SUM
+                        ? acc->sum : acc->sum / acc->count});
+                break;
+        }
+    }
+}
+
+/* Adds (sign 1) or takes out (sign -1) one source row, reading the cell before
+   overwrote as it was. Returns the group it changed, NULL if that emptied it */
+static ViewGroup* applyRow(MaterializedView* view, const Database* db, size_t row, int sign,
+    const Mutation* before) {
+
+    DataValues key = {0};
+    int keyNull = !readSource(db, row, view->groupCol, before, &key);
+    uint64_t keyBits = keyNull ? 0 : typeOps(db->cols[view->groupCol].type)->hashBits(key);
+    ViewGroup* group = findGroup(view, keyNull, keyBits);
+
+    if (!group) {
+        // Can't take out a row that was never added
+        if (sign < 0)
+            return NULL;
+        group = addGroup(view, keyNull, keyBits, key);
+    }
+
+    group->rows += sign;
+
+    for (size_t i = 0; i < view->numAggs; i++) {
+
+        DataValues value;
+
+        if (view->aggs[i].op == VIEW_COUNT_ROWS || !readSource(db, row, view->aggs[i].col, before, &value))
+            continue;
+
+        group->acc[i].sum += sign * typeOps(db->cols[view->aggs[i].col].type)->toDouble(value);
+        group->acc[i].count += sign;
+    }
+
+    view->deltas++;
+
+    if (!group->rows && view->table) {
+        removeGroup(view, group);
+        return NULL;
+    }
+
+    return group;
+}
+
+static void applyAndWrite(MaterializedView* view, const Database* db, size_t row, int sign, const Mutation* before) {
+
+    ViewGroup* group = applyRow(view, db, row, sign, before);
+
+    if (group)
+        writeGroup(view->table->db, view, group);
+}
+
+static int viewReadsColumn(const MaterializedView* view, size_t col) {
+
+    if (col == view->groupCol)
+        return 1;
+
+    for (size_t i = 0; i < view->numAggs; i++) {
+        if (view->aggs[i].op != VIEW_COUNT_ROWS && view->aggs[i].col == col)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Adds a column named base, cut to fit and numbered (_2, _3, ...) when that would repeat a name already in the view
+static void createViewColumn(Database* table, const char* base, DataTypes type) {
+
+    char name[STRING_LEN];
+    char suffix[16] = "";
+    size_t baseLength = strlen(base);
+
+    for (int n = 2; ; n++) {
+
+        size_t keep = STRING_LEN - 1 - strlen(suffix);
+
+        if (keep > baseLength)
+            keep = baseLength;
+
+        memcpy(name, base, keep);
+        strcpy(name + keep, suffix);
+
+        size_t col = 0;
+
+        while (col < table->numCols && strcmp(table->cols[col].colName, name) != 0)
+            col++;
+
+        if (col == table->numCols)
+            break;
+
+        snprintf(suffix, sizeof(suffix), "_%d", n);
+    }
+
+    createColumn(table, name, type);
+}
+
+static void freeView(MaterializedView* view) {
+
+    for (size_t i = 0; i < view->numGroups; i++)
+        free(view->groups[i]);
+
+    free(view->groups);
+    free(view->buckets);
+    free(view);
+}
+
+// Stops keeping views[index], its table stays in the list as it is
+static void stopView(size_t index, const char* reason) {
+
+    MaterializedView* view = views[index];
+
+    if (reason)
+        fprintf(stderr, "View %s is no longer kept up to date: %s.\n", view->name, reason);
+
+    unpinDatabaseEntry(view->source);
+    unpinDatabaseEntry(view->table);
+
+    views[index] = views[--numViews];
+    freeView(view);
+}
+
+// Applies a change to a source table, returns 0 or -1 if the view has to stop
+static int applyMutation(MaterializedView* view, const Mutation* m) {
+
+    Database* db = m->db;
+
+    switch (m->type) {
+
+        case MUTATION_APPEND_ROWS :
+            for (size_t r = m->row; r < m->row + m->numRows; r++)
+                applyAndWrite(view, db, r, 1, NULL);
+            break;
+
+        // Reported while the row is still there
+        case MUTATION_DELETE_ROW :
+            for (size_t r = m->row; r < m->row + m->numRows; r++)
+                applyAndWrite(view, db, r, -1, NULL);
+            break;
+
+        // The row goes out as it was and back in as it is, into another group if the key changed
+        case MUTATION_WRITE_CELL :
+            if (viewReadsColumn(view, m->col)) {
+                applyAndWrite(view, db, m->row, -1, m);
+                applyAndWrite(view, db, m->row, 1, NULL);
+            }
+            break;
+
+        case MUTATION_DELETE_COLUMN :
+            if (viewReadsColumn(view, m->col))
+                return -1;
+
+            if (view->groupCol > m->col)
+                view->groupCol--;
+
+            for (size_t i = 0; i < view->numAggs; i++) {
+                if (view->aggs[i].op != VIEW_COUNT_ROWS && view->aggs[i].col > m->col)
+                    view->aggs[i].col--;
+            }
+            break;
+
+        case MUTATION_DROP_TABLE :
+            return -1;
+
+        default :
+            break;
+    }
+
+    return 0;
+}
+
+static void viewObserver(const Mutation* mutation, void* ctx) {
+
+    if (applying)
+        return;
+
+    for (size_t i = 0; i < numViews;) {
+
+        MaterializedView* view = views[i];
+        int isTable = mutation->db ? mutation->db == view->table->db : strcmp(mutation->table, view->table->dbName) == 0;
+        int isSource = mutation->db ? mutation->db == view->source->db
+            : strcmp(mutation->table, view->source->dbName) == 0;
+
+        // Renaming a column of the view table is harmless, anything else would get out of step with the groups
+        if (isTable && mutation->type != MUTATION_RENAME_COLUMN) {
+            stopView(i, mutation->type == MUTATION_DROP_TABLE ? NULL : "its table was changed directly");
+            continue;
+        }
+
+        if (isSource) {
+
+            applying = 1;
+            int result = applyMutation(view, mutation);
+            applying = 0;
+
+            if (result < 0) {
+                stopView(i, mutation->type == MUTATION_DROP_TABLE ? "its source table was dropped"
+                    : "a column it reads was deleted");
+                continue;
+            }
+        }
+
+        i++;
+    }
+}
+
+/* Creates the view table name over source, grouped on groupCol, and adds it to the list.
+   Returns 0, -1 if there's already a table called name, -2 if there's no room for
+   another view or table and -3 if source is itself a view */
+int createView(DatabaseList* dbl, Database* source, const char* name, size_t groupCol,
+    const ViewAggregate* aggs, size_t numAggs) {
+
+    if (findDatabaseInList(dbl, name))
+        return -1;
+
+    DatabaseEntry* sourceEntry = findDatabaseInList(dbl, source->dbName);
+
+    if (numViews == MAX_VIEWS || databaseListFull(dbl) || !sourceEntry || numAggs > MAX_VIEW_AGGREGATES)
+        return -2;
+
+    // A view's own writes aren't passed on to other views
+    for (size_t i = 0; i < numViews; i++) {
+        if (views[i]->table == sourceEntry)
+            return -3;
+    }
+
+    if (!observing && addMutationObserver(viewObserver, NULL) < 0)
+        return -2;
+
+    observing = 1;
+
+    MaterializedView* view = calloc(1, sizeof(MaterializedView));
+
+    if (!view) {
+        fprintf(stderr, "calloc returned NULL pointer for MaterializedView\n");
+        exit(1);
+    }
+
+    snprintf(view->name, sizeof(view->name), "%s", name);
+    view->source = sourceEntry;
+    view->groupCol = groupCol;
+    view->numAggs = numAggs;
+    memcpy(view->aggs, aggs, numAggs * sizeof(ViewAggregate));
+    growViewBuckets(view);
+
+    // One pass over the source, the table is written once per group at the end
+    for (size_t r = 0; r < source->numRows; r++)
+        applyRow(view, source, r, 1, NULL);
+
+    Database* table = createDatabase(name);
+
+    createColumn(table, source->cols[groupCol].colName, source->cols[groupCol].type);
+
+    for (size_t i = 0; i < numAggs; i++) {
+
+        // Room for the whole name, createViewColumn cuts it down
+        char colName[STRING_LEN + 8];
+
+        if (aggs[i].op == VIEW_COUNT_ROWS)
+            snprintf(colName, sizeof(colName), "count");
+        else
+            snprintf(colName, sizeof(colName), "%s_%s", aggregateNames[aggs[i].op], source->cols[aggs[i].col].colName);
+
+        createViewColumn(table, colName,
+            aggs[i].op == VIEW_COUNT_ROWS || aggs[i].op == VIEW_COUNT ? INT_TYPE : DOUBLE_TYPE);
+    }
+
+    for (size_t i = 0; i < view->numGroups; i++) {
+
+        ViewGroup* group = view->groups[i];
+
+        createRow(table);
+
+        if (!group->keyNull)
+            writeCell(table, group->row, 0, table->cols[0].type, group->key);
+
+        writeGroup(table, view, group);
+    }
+
+    view->table = addDatabaseToList(table, dbl);
+
+    if (!view->table) {
+        deleteDatabase(table);
+        freeView(view);
+        return -2;
+    }
+
+    pinDatabaseEntry(view->source);
+    pinDatabaseEntry(view->table);
+
+    views[numViews++] = view;
+
+    return 0;
+}
+
+MaterializedView* findView(const char* name) {
+
+    for (size_t i = 0; i < numViews; i++) {
+        if (strcmp(views[i]->name, name) == 0)
+            return views[i];
+    }
+
+    return NULL;
+}
+
+void printViews() {
+
+    if (!numViews) {
+        printf("No materialized views.\n");
+        return;
+    }
+
+    for (size_t i = 0; i < numViews; i++) {
+
+        const MaterializedView* view = views[i];
+        const Database* source = view->source->db;
+
+        printf("%s: ", view->name);
+
+        for (size_t a = 0; a < view->numAggs; a++) {
+            printf("%s%s", a ? ", " : "", aggregateNames[view->aggs[a].op]);
+            if (view->aggs[a].op != VIEW_COUNT_ROWS)
+                printf(" %s", source->cols[view->aggs[a].col].colName);
+        }
+
+        printf(" by %s from %s, %zu groups, %llu deltas applied\n", source->cols[view->groupCol].colName,
+            view->source->dbName, view->numGroups, (unsigned long long)view->deltas);
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "database.h"
+#include "database_list.h"
+
+/* Materialized aggregate views: a GROUP BY over one column of a table, kept as a
+   table of its own in the DatabaseList with one row per group, so reading the
+   rollup is reading a small table however big the source gets.
+
+   The view listens to the source's mutations and applies each one as a delta:
+   an appended row is added to its group, a deleted row (reported while it's
+   still there) is taken out, and a cell write takes the row out with the old
+   value and adds it back with the new one. That's O(number of aggregates) per
+   changed row. Only aggregates that can take a value back out are offered,
+   count, sum and avg, min and max would need the whole group on a delete.
+
+   The view row of a group goes away with the group's last row. Both tables are
+   pinned while the view is kept. Changing the view table directly, or dropping
+   a column the view reads, stops the view and leaves its table as it was */
+
+#define MAX_VIEWS 16
+#define MAX_VIEW_AGGREGATES 16
+#define VIEW_INITIAL_BUCKETS 64
+
+typedef enum {
+
+    VIEW_COUNT_ROWS,
+    VIEW_COUNT,
+    VIEW_SUM,
+    VIEW_AVG
+
+} ViewAggregateOp;
+
+typedef struct {
+
+    ViewAggregateOp op;
+    // Source column, unused for VIEW_COUNT_ROWS
+    size_t col;
+
+} ViewAggregate;
+
+// Running state of one aggregate in one group
+typedef struct {
+
+    double sum;
+    uint64_t count;
+
+} ViewAccumulator;
+
+typedef struct ViewGroup {
+
+    // hashBits of the group value, so -0.0 and 0.0 are one group
+    uint64_t keyBits;
+    int keyNull;
+    DataValues key;
+
+    // Row of the view table holding this group, and source rows in it
+    size_t row;
+    uint64_t rows;
+
+    struct ViewGroup* nextInBucket;
+
+    ViewAccumulator acc[];
+
+} ViewGroup;
+
+typedef struct MaterializedView {
+
+    char name[STRING_LEN];
+    DatabaseEntry* source;
+    DatabaseEntry* table;
+
+    size_t groupCol;
+    ViewAggregate aggs[MAX_VIEW_AGGREGATES];
+    size_t numAggs;
+
+    // Groups hashed on keyBits, and in view row order
+    ViewGroup** buckets;
+    size_t numBuckets;
+    ViewGroup** groups;
+    size_t numGroups;
+    size_t groupCapacity;
+
+    // Deltas applied since the view was created
+    uint64_t deltas;
+
+} MaterializedView;
+
+int createView(DatabaseList* dbl, Database* source, const char* name, size_t groupCol,
+    const ViewAggregate* aggs, size_t numAggs);
+MaterializedView* findView(const char* name);
+void printViews();
+
+#endif